@@ -0,0 +1,3351 @@
+/**
+ * Shared helpers of the Vulkan demos, header-only.
+ *
+ * Every demo is still a single translation unit: the header is included once
+ * from the demo's .cpp file with a relative path, so the compile commands
+ * in the demo headers do not change.
+ *
+ * The demo specific steps (Instance, Device, Render Pass, Pipeline creation, ...)
+ * stay in the demos. Only the helpers which were copied into multiple demos live here:
+ *  * Move only owners of the scope local Vulkan handles (shader modules of a pipeline build).
+ *  * Physical device ranking (optionally with the vkmininfo device profile) and queue family selection.
+ *  * Cached memory properties, memory type lookup and the memory arena.
+ *  * Shader loading (SPIR-V or shaderc with the compiled SPIR-V cache) and the pipeline cache file.
+ *  * PPM writer (SIMD RGBA to RGB pack).
+ *  * Staging uploader and the readback ring.
+ *  * Streaming frame writer (DEMO_CAPTURE_FRAMES) and the tracer (DEMO_TRACE).
+ *  * Benchmark timer (DEMO_BENCH) and vertex layouts (DEMO_VERTEX_LAYOUT).
+ *  * Present mode selection, frame pacing and Swapchain creation.
+ *  * Command Buffer strategies of the draw loop (DEMO_COMMAND_STRATEGY) with the per frame Command Pools.
+ *
+ * Configuration macros (define before the include):
+ *  * HAVE_SHADERC: compile the GLSL sources with shaderc (1) or load the pre-compiled SPIR-V (0). Default: 0
+ *
+ * MIT License
+ * Copyright (c) 2024 elecro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef VKDEMO_H
+#define VKDEMO_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.h>
+
+#ifndef HAVE_SHADERC
+#define HAVE_SHADERC 0
+#endif
+
+#if HAVE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_SSSE3_PACK 1
+#include <tmmintrin.h>
+#else
+#define HAVE_SSSE3_PACK 0
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// RH. Owner of a device child handle, the handle is destroyed with the owner (or by Reset).
+// Used for the handles which only live in one scope, so an exception between two create calls does not leak them.
+template<typename HANDLE>
+struct DeviceHandle {
+    typedef void (VKAPI_PTR *DestroyFunction)(VkDevice, HANDLE, const VkAllocationCallbacks*);
+
+    DeviceHandle() : device(VK_NULL_HANDLE), handle(VK_NULL_HANDLE), destroy(NULL) {}
+    DeviceHandle(const VkDevice owner, HANDLE value, DestroyFunction destroyFunction)
+        : device(owner), handle(value), destroy(destroyFunction) {}
+    DeviceHandle(DeviceHandle&& other) : device(other.device), handle(other.Release()), destroy(other.destroy) {}
+    ~DeviceHandle() { Reset(); }
+
+    DeviceHandle& operator=(DeviceHandle&& other) {
+        if (this != &other) {
+            Reset();
+            device = other.device;
+            destroy = other.destroy;
+            handle = other.Release();
+        }
+        return *this;
+    }
+
+    DeviceHandle(const DeviceHandle&) = delete;
+    DeviceHandle& operator=(const DeviceHandle&) = delete;
+
+    HANDLE Get() const { return handle; }
+
+    // Gives up the ownership, the caller destroys the handle.
+    HANDLE Release() {
+        HANDLE value = handle;
+        handle = VK_NULL_HANDLE;
+        return value;
+    }
+
+    void Reset() {
+        if (handle != VK_NULL_HANDLE) {
+            destroy(device, handle, NULL);
+            handle = VK_NULL_HANDLE;
+        }
+    }
+
+    VkDevice        device;
+    HANDLE          handle;
+    DestroyFunction destroy;
+};
+
+typedef DeviceHandle<VkShaderModule> ShaderModuleHandle;
+
+// Returns the first queue family which has every "requiredFlags" and none of the "excludedFlags" bits.
+// If a surface is given, the family must also support presentation to it.
+inline uint32_t FindQueueFamily(const VkPhysicalDevice device,
+                                VkQueueFlags requiredFlags,
+                                VkQueueFlags excludedFlags,
+                                const VkSurfaceKHR surface,
+                                bool *hasIdx);
+
+// DV. Physical device ranking (type, device local memory, queue families), DEMO_DEVICE overrides it.
+inline uint64_t ScorePhysicalDevice(const VkPhysicalDevice device);
+inline bool MatchPhysicalDevice(const VkPhysicalDevice device, uint32_t deviceIdx, const char *selector);
+
+// DP. Measured device profile written by vkmininfo (DEMO_PROFILE with DEMO_PROBE=1), loaded from DEMO_DEVICE_PROFILE.
+struct DeviceProfileEntry {
+    uint32_t    vendorID;
+    uint32_t    deviceID;
+    std::string pipelineCacheUUID;  // Lower case hex, as vkmininfo writes it.
+    bool        probed;             // True if the profile has the probe results of the device.
+    double      uploadMiBps;        // Best host->device copy bandwidth over the memory types.
+    double      downloadMiBps;      // Best device->host copy bandwidth over the memory types.
+    double      dispatchMedianUs;
+};
+
+inline std::vector<DeviceProfileEntry> LoadDeviceProfile(const char *fileName);
+inline const DeviceProfileEntry *FindDeviceProfile(const VkPhysicalDevice device);
+
+inline const VkPhysicalDeviceMemoryProperties& GetMemoryProperties(const VkPhysicalDevice physicalDevice);
+inline uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+inline uint32_t FindPreferredMemoryType(const VkPhysicalDevice physicalDevice,
+                                        uint32_t typeFilter,
+                                        VkMemoryPropertyFlags preferred,
+                                        VkMemoryPropertyFlags required);
+
+#if HAVE_SHADERC
+inline std::vector<char> LoadGLSL(const std::string name);
+inline std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
+#else
+inline std::vector<uint32_t> LoadSPIRV(const std::string name);
+#endif
+
+// ST. Load (or compile) a shader on a worker thread, the stage is selected by the file extension.
+inline std::future<std::vector<uint32_t> > LoadShaderAsync(const std::string& name);
+
+inline VkPipelineCache LoadPipelineCache(const VkPhysicalDevice physicalDevice,
+                                         const VkDevice device,
+                                         const std::string& fileName,
+                                         bool *outHit);
+inline void SavePipelineCache(const VkPhysicalDevice physicalDevice,
+                              const VkDevice device,
+                              const VkPipelineCache pipelineCache,
+                              const std::string& fileName);
+// Write "header" and "data" into a unique temporary file next to "fileName", then rename it over "fileName".
+// A concurrently running process never reads a partially written file. On failure the temporary file is removed.
+inline bool WriteFileAtomic(const std::string& fileName, const void *header, size_t headerSize, const void *data, size_t dataSize);
+
+inline void PackRGBAToRGB(const uint8_t *src, uint8_t *dst, uint32_t pixelCount, bool swapRB);
+inline void WritePPM(const std::string& fileName,
+                     const uint8_t *data,
+                     uint32_t width,
+                     uint32_t height,
+                     VkDeviceSize rowPitch,
+                     bool swapRB,
+                     bool useMmap);
+
+// Size of the device memory blocks which are sub-allocated by the memory arena.
+// Resources which are larger than half of a block get a dedicated allocation.
+const VkDeviceSize g_arenaBlockSize = 64 * 1024 * 1024;
+
+struct ArenaRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Buffers and linear images must not share a bufferImageGranularity page with optimal images.
+    bool linear;
+};
+
+struct ArenaBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryTypeIndex;
+    bool dedicated;
+    // Host visible blocks are mapped once at creation.
+    uint8_t *mapped;
+    // Allocated ranges sorted by offset.
+    std::vector<ArenaRange> ranges;
+};
+
+struct MemoryArena {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memProperties;
+    VkDeviceSize bufferImageGranularity;
+    VkDeviceSize nonCoherentAtomSize;
+    uint32_t maxAllocationCount;
+    uint32_t allocationCount;
+    // Released blocks keep their slot (with VK_NULL_HANDLE memory) so block indices stay valid.
+    std::vector<ArenaBlock> blocks;
+};
+
+struct ArenaAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Host address of the allocation, NULL if the memory type is not host visible.
+    uint8_t *mapped;
+    uint32_t blockIdx;
+};
+
+struct ArenaStats {
+    uint32_t blockCount;
+    uint32_t allocationCount;
+    VkDeviceSize reservedBytes;
+    VkDeviceSize usedBytes;
+    VkDeviceSize largestFreeRange;
+    // 1 - (largest free range of the blocks / all free bytes): 0 means that no block is fragmented.
+    float fragmentation;
+};
+
+inline void CreateMemoryArena(const VkPhysicalDevice physicalDevice, const VkDevice device, MemoryArena *outArena);
+inline void DestroyMemoryArena(MemoryArena *arena);
+inline ArenaAllocation ArenaAllocate(MemoryArena *arena,
+                                     const VkMemoryRequirements& memRequirements,
+                                     uint32_t memoryTypeIndex,
+                                     bool linear);
+inline ArenaAllocation ArenaAllocateBuffer(MemoryArena *arena, const VkBuffer buffer, VkMemoryPropertyFlags properties);
+inline ArenaAllocation ArenaAllocateImage(MemoryArena *arena,
+                                          const VkImage image,
+                                          VkImageTiling tiling,
+                                          VkMemoryPropertyFlags properties);
+inline void ArenaFree(MemoryArena *arena, const ArenaAllocation& allocation);
+inline ArenaStats GetArenaStats(const MemoryArena& arena);
+inline void PrintArenaStats(const MemoryArena& arena);
+
+// Transient host visible buffer of the staging uploader.
+struct StagingBuffer {
+    VkBuffer buffer;
+    ArenaAllocation memory;
+};
+
+// Batches the uploads into device local buffers into a single Command Buffer.
+// The staging buffers are released after the fence of the batch has signaled.
+// Device local and host visible memory (ReBAR/UMA) is written directly without a staging copy.
+struct StagingUploader {
+    MemoryArena *arena;
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmdBuffer;
+    VkFence fence;
+    bool forceStaging;
+    bool recording;
+    bool submitted;
+    uint32_t directCount;
+    uint32_t stagedCount;
+    std::vector<StagingBuffer> stagingBuffers;
+};
+
+inline void CreateStagingUploader(const VkDevice device,
+                                  MemoryArena *arena,
+                                  uint32_t queueFamilyIdx,
+                                  bool forceStaging,
+                                  StagingUploader *outUploader);
+inline void DestroyStagingUploader(const VkDevice device, StagingUploader *uploader);
+inline ArenaAllocation UploadDeviceLocalBuffer(const VkDevice device,
+                                               StagingUploader *uploader,
+                                               const VkBuffer buffer,
+                                               const void *data,
+                                               VkDeviceSize size,
+                                               VkAccessFlags dstAccessMask,
+                                               VkPipelineStageFlags dstStageMask);
+inline void SubmitStagingUploads(const VkDevice device, StagingUploader *uploader, const VkQueue queue);
+inline void ReleaseStagingBuffers(const VkDevice device, StagingUploader *uploader, bool wait);
+
+enum ReadbackSlotState {
+    READBACK_SLOT_FREE,
+    READBACK_SLOT_IN_FLIGHT,
+    READBACK_SLOT_READY,
+    // Returned by PollReadback, the consumer owns the data until ReleaseReadback.
+    READBACK_SLOT_ACQUIRED,
+};
+
+// One persistently mapped staging buffer of the readback ring.
+struct ReadbackSlot {
+    VkBuffer buffer;
+    ArenaAllocation memory;
+    const uint8_t *data;
+    VkCommandBuffer cmdBuffer;
+    // Fence of the submission which contains the copy into this slot.
+    VkFence fence;
+    ReadbackSlotState state;
+    uint64_t frameIdx;
+    // Offset of the pixels in the buffer, imported host memory can start with a file header.
+    VkDeviceSize bufferOffset;
+    // The memory is an imported host allocation (VK_EXT_external_memory_host) and it is not mapped.
+    bool imported;
+};
+
+// Page aligned host memory which is imported as the destination of a readback slot.
+struct ReadbackHostMemory {
+    void *pointer;
+    // Must be a multiple of minImportedHostPointerAlignment.
+    VkDeviceSize size;
+    // Offset of the pixels inside the host memory.
+    VkDeviceSize offset;
+};
+
+// Ring of staging buffers which are filled by copy commands recorded next to the frame's draw commands.
+// The CPU only polls the slots, so it never waits on the GPU for a capture.
+struct ReadbackRing {
+    MemoryArena *arena;
+    VkCommandPool cmdPool;
+    uint32_t width;
+    uint32_t height;
+    // Size of one tightly packed 4 byte per pixel image.
+    VkDeviceSize size;
+    bool coherent;
+    uint32_t nextSlot;
+    std::vector<ReadbackSlot> slots;
+};
+
+inline void CreateReadbackRing(const VkPhysicalDevice physicalDevice,
+                               const VkDevice device,
+                               MemoryArena *arena,
+                               uint32_t queueFamilyIdx,
+                               uint32_t width,
+                               uint32_t height,
+                               uint32_t slotCount,
+                               const ReadbackHostMemory *hostMemories,
+                               ReadbackRing *outRing);
+// H. The Instance version reported by the loader, 1.0 loaders do not export vkEnumerateInstanceVersion.
+inline uint32_t QueryInstanceVersion();
+// H. Zero if the host pointers can not be imported, "instanceVersion" is the apiVersion of the Instance.
+inline VkDeviceSize QueryHostImportAlignment(const VkInstance instance, uint32_t instanceVersion, const VkPhysicalDevice physicalDevice);
+inline bool ImportReadbackHostMemory(const VkPhysicalDevice physicalDevice,
+                                     const VkDevice device,
+                                     const ReadbackHostMemory& hostMemory,
+                                     ReadbackSlot *slot);
+inline void DestroyReadbackRing(const VkDevice device, ReadbackRing *ring);
+inline VkCommandBuffer RecordReadback(const VkDevice device,
+                                      ReadbackRing *ring,
+                                      const VkImage image,
+                                      VkImageLayout imageLayout,
+                                      const VkFence fence,
+                                      uint64_t frameIdx);
+inline ReadbackSlot *PollReadback(const VkDevice device, ReadbackRing *ring);
+inline void ReleaseReadback(ReadbackSlot *slot);
+// Keep only the newest capture in "kept" without copying it, the previously kept slot goes back to the ring.
+inline void KeepNewestReadback(ReadbackSlot *slot, ReadbackSlot **kept);
+
+// DEMO_TRACE: scoped CPU zones and GPU timestamp zones, exported as a Chrome trace (JSON) at exit.
+// Every thread writes its zones into its own fixed size ring. A ring has a single writer and it is only
+// read after the traced threads are stopped, so recording a zone takes no lock and does no output.
+// The oldest zones are overwritten when a ring is full.
+struct TraceEvent {
+    // Zone names must be string literals, only the pointer is stored and the name is written without escaping.
+    const char *name;
+    // Nanoseconds since the start of the trace.
+    uint64_t startNs;
+    uint64_t durationNs;
+    // The zone is a GPU timestamp pair, it is shown on the GPU track of the recording thread.
+    bool gpu;
+};
+
+struct TraceRing {
+    const char *threadName;
+    uint32_t threadIdx;
+    std::vector<TraceEvent> events;
+    // Number of zones written so far, the next zone goes to "writeCount % g_traceRingSize".
+    std::atomic<uint64_t> writeCount;
+};
+
+struct Tracer {
+    bool enabled;
+    std::chrono::steady_clock::time_point origin;
+    // Only taken to register a thread and to export the trace.
+    std::mutex registerMutex;
+    // The deque keeps the rings in place while other threads are registered.
+    std::deque<TraceRing> rings;
+};
+
+// Maps the timestamps of a queue onto the trace clock.
+struct TraceGpuClock {
+    uint64_t baseTicks;
+    uint64_t baseNs;
+    // Nanoseconds per timestamp tick.
+    double timestampPeriod;
+    // Mask of the valid timestamp bits, the counter can wrap around.
+    uint64_t timestampMask;
+};
+
+// Scoped CPU zone, records the time between its construction and destruction on the current thread.
+struct TraceZone {
+    explicit TraceZone(const char *zoneName);
+    ~TraceZone();
+
+    const char *name;
+    uint64_t startNs;
+};
+
+static const uint32_t g_traceRingSize = 65536;
+static Tracer g_tracer;
+
+// Ring of the current thread, NULL if the thread is not traced.
+static thread_local TraceRing *t_traceRing = NULL;
+
+inline void InitTracer(bool enabled);
+inline void TraceRegisterThread(const char *threadName);
+inline uint64_t TraceNow();
+inline void TraceRecord(const char *name, uint64_t startNs, uint64_t endNs, bool gpu);
+
+// Calibrate the timestamps of "queue" against the trace clock with a single timestamp write.
+inline void CalibrateTraceGpuClock(const VkPhysicalDevice physicalDevice,
+                                   const VkDevice device,
+                                   const VkQueue queue,
+                                   uint32_t queueFamilyIdx,
+                                   TraceGpuClock *outClock);
+inline void TraceGpuZone(const TraceGpuClock& clock, const char *name, uint64_t beginTicks, uint64_t endTicks);
+inline void WriteTrace(const char *fileName);
+
+enum CaptureFormat {
+    CAPTURE_FORMAT_PPM,
+    CAPTURE_FORMAT_Y4M,
+    CAPTURE_FORMAT_RGBA,
+};
+
+// Maximum number of captured frames waiting for the writer thread.
+// The readback ring of a streaming capture needs this many extra slots.
+static const uint32_t g_captureQueueSize = 8;
+
+// Background writer of the streaming capture.
+// The render loop hands the readback slots over without copying, every conversion and I/O is done on the writer thread.
+// The written slots are released back to the ring on the render thread (ReclaimFrames), the ring is not thread safe.
+struct FrameWriter {
+    CaptureFormat format;
+    std::string outputPattern;
+    // Output for the Y4M and RGBA streams.
+    FILE *stream;
+    uint32_t width;
+    uint32_t height;
+    // The captured image is in BGRA order.
+    bool swapRB;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Signaled after each written frame, FlushFrameWriter waits on it.
+    std::condition_variable writtenCond;
+    std::deque<ReadbackSlot*> queue;
+    // Written slots which are not yet released to the readback ring.
+    std::vector<ReadbackSlot*> writtenSlots;
+    // Queued frames and the frame which is being written.
+    uint32_t pending;
+    bool done;
+    uint64_t written;
+    uint64_t dropped;
+};
+
+inline void StartFrameWriter(CaptureFormat format,
+                             const std::string& outputPattern,
+                             FILE *stream,
+                             uint32_t width,
+                             uint32_t height,
+                             bool swapRB,
+                             FrameWriter *writer);
+// Takes over the slot, a dropped frame is released immediately.
+inline bool QueueFrame(FrameWriter *writer, ReadbackSlot *slot);
+// Release the written slots to their readback ring, called on the render thread.
+inline void ReclaimFrames(FrameWriter *writer);
+// Wait until every queued frame is written and reclaim the slots, e.g. before the ring is destroyed.
+inline void FlushFrameWriter(FrameWriter *writer);
+inline void StopFrameWriter(FrameWriter *writer);
+inline void FrameWriterMain(FrameWriter *writer);
+
+// GPU and CPU timing of the DEMO_BENCH mode.
+// Each frame in flight owns a begin and an end timestamp query. They are written by two small
+// pre-recorded Command Buffers which are submitted around the frame's draw Command Buffer.
+struct BenchTimer {
+    VkQueryPool queryPool;
+    VkCommandPool cmdPool;
+    std::vector<VkCommandBuffer> beginCmdBuffers;
+    std::vector<VkCommandBuffer> endCmdBuffers;
+    // The queries of the slot were submitted and their results are not yet collected.
+    std::vector<bool> pending;
+    // Nanoseconds per timestamp tick.
+    double timestampPeriod;
+    // Mask of the valid timestamp bits, the counter can wrap around.
+    uint64_t timestampMask;
+    // Per frame times in milliseconds.
+    std::vector<double> gpuTimes;
+    std::vector<double> cpuTimes;
+    // TC. The collected timestamps are also recorded as trace zones with this clock.
+    TraceGpuClock traceClock;
+};
+
+inline void CreateBenchTimer(const VkPhysicalDevice physicalDevice,
+                             const VkDevice device,
+                             uint32_t queueFamilyIdx,
+                             uint32_t slotCount,
+                             BenchTimer *outTimer);
+inline void DestroyBenchTimer(const VkDevice device, BenchTimer *timer);
+inline void CollectBenchTimestamps(const VkDevice device, BenchTimer *timer, uint32_t slot);
+inline void PrintBenchResults(const VkPhysicalDevice physicalDevice, const BenchTimer& timer, double totalSeconds);
+
+// Vertex layouts of the DEMO_VERTEX_LAYOUT mode.
+// Except "position" every layout stores the same position, color, UV and normal attributes.
+enum VertexLayout {
+    // Only the vec2 position (R32G32_SFLOAT), see the V.4. and V.5. descriptions.
+    VERTEX_LAYOUT_POSITION,
+    // Interleaved (AoS) 32 bit float attributes in a single binding.
+    VERTEX_LAYOUT_AOS,
+    // Split streams (SoA): one binding per attribute, each stream is a range of the same buffer.
+    VERTEX_LAYOUT_SOA,
+    // Interleaved packed attributes: R16G16_SFLOAT position and UV, R8G8B8A8_UNORM color
+    // and A2B10G10R10_UNORM_PACK32 normal.
+    VERTEX_LAYOUT_PACKED,
+};
+
+// Vertex input state and buffer content of a vertex layout.
+struct VertexLayoutData {
+    VertexLayout layout;
+    uint32_t vertexCount;
+    // Bytes of all attributes of a single vertex.
+    uint32_t vertexSize;
+    // Empty for the position layout, it uses the descriptions of main.
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    // Start of each binding in the vertex buffer.
+    std::vector<VkDeviceSize> bindingOffsets;
+    std::vector<uint8_t> data;
+};
+
+inline VertexLayout ParseVertexLayout(const char *name);
+inline const char *VertexLayoutName(VertexLayout layout);
+inline void BuildVertexLayout(const VkPhysicalDevice physicalDevice,
+                              VertexLayout layout,
+                              const std::vector<float>& positions,
+                              VertexLayoutData *outData);
+inline void PrintVertexFetchReport(const VertexLayoutData& layoutData, uint64_t verticesPerFrame, const BenchTimer& timer);
+
+// Frame pacing and acquire->present latency tracking of the draw loop.
+struct FramePacer {
+    // Minimum time between the start of two frames, zero disables the limiter.
+    std::chrono::steady_clock::duration frameInterval;
+    std::chrono::steady_clock::time_point nextFrame;
+    // Log the latency of every frame, not only the summary.
+    bool logFrames;
+    uint64_t frameCount;
+    // Acquire->present latencies in milliseconds.
+    double latencySum;
+    double latencyMax;
+};
+
+inline VkPresentModeKHR ParsePresentMode(const char *name);
+inline const char *PresentModeName(VkPresentModeKHR mode);
+inline VkPresentModeKHR SelectPresentMode(const VkPhysicalDevice physicalDevice, const VkSurfaceKHR surface, VkPresentModeKHR requested);
+inline void InitFramePacer(double maxFps, bool logFrames, FramePacer *outPacer);
+inline void PaceFrame(FramePacer *pacer);
+inline void RecordFrameLatency(FramePacer *pacer, uint32_t imageIndex, double latency);
+inline void PrintFrameLatency(const FramePacer& pacer);
+
+// CB. How the draw Command Buffers are produced.
+enum CommandStrategy {
+    // One Command Buffer per Swapchain image, recorded at start (and after a resize) and submitted many times.
+    COMMAND_STRATEGY_PRERECORDED,
+    // Every frame records a new Command Buffer, as a dynamic scene would.
+    COMMAND_STRATEGY_PER_FRAME,
+};
+
+// CB. Command Pool of one frame in flight for the per frame recording.
+// The whole pool is reset once the fence of its frame has signaled, which is cheaper than
+// resetting each Command Buffer (and does not need VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT).
+struct FrameCommandPool {
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmdBuffer;
+};
+
+inline CommandStrategy ParseCommandStrategy(const char *name);
+inline void CreateFrameCommandPools(const VkDevice device,
+                                    uint32_t queueFamilyIdx,
+                                    uint32_t count,
+                                    std::vector<FrameCommandPool> *outPools);
+inline void DestroyFrameCommandPools(const VkDevice device, std::vector<FrameCommandPool> *pools);
+// CB. Report the CPU cost of the Command Buffer strategy, "recordTimes" are in milliseconds.
+inline void PrintCommandStrategyResults(CommandStrategy strategy, const std::vector<double>& recordTimes);
+
+// SC. Swapchain parameters which are kept when the Swapchain is re-created after a resize.
+// Only the size dependent resources are rebuilt, the Render Pass and the Pipeline
+// (with dynamic viewport and scissor) are kept.
+struct SwapchainConfig {
+    VkSurfaceFormatKHR surfaceFormat;
+    VkPresentModeKHR requestedPresentMode;
+    // Zero selects "minImageCount + 1".
+    uint32_t requestedImageCount;
+    VkImageUsageFlags imageUsage;
+};
+
+inline VkSwapchainKHR CreateSwapchain(const VkPhysicalDevice physicalDevice,
+                                      const VkDevice device,
+                                      const VkSurfaceKHR surface,
+                                      const SwapchainConfig& config,
+                                      const VkSwapchainKHR oldSwapchain,
+                                      VkExtent2D *extent,
+                                      VkPresentModeKHR *outPresentMode);
+inline std::vector<VkImage> GetSwapchainImages(const VkDevice device, const VkSwapchainKHR swapchain);
+
+// The resize callback is only available if GLFW is included before this header.
+#if defined(GLFW_VERSION_MAJOR)
+inline void FramebufferResizeCallback(GLFWwindow *window, int width, int height);
+#endif
+
+inline uint32_t FindQueueFamily(const VkPhysicalDevice device,
+                                VkQueueFlags requiredFlags,
+                                VkQueueFlags excludedFlags,
+                                const VkSurfaceKHR surface,
+                                bool *hasIdx) {
+    if (hasIdx != nullptr) {
+        *hasIdx = false;
+    }
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t queueFamilyIdx = 0;
+    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
+        // A transfer only family is found by excluding the graphics and compute capable ones.
+        if (((queueFamily.queueFlags & requiredFlags) == requiredFlags) && !(queueFamily.queueFlags & excludedFlags)) {
+            if (surface == VK_NULL_HANDLE) {
+                if (hasIdx != NULL) {
+                    *hasIdx = true;
+                }
+
+                return queueFamilyIdx;
+            }
+
+            // G.XX. Check if the selected queue family supports presentation.
+            // At the moment the examples expect that the graphics and presentation queue is the same.
+            // This is not always the case.
+            // TODO: add support for different graphics and presentation family indices.
+            VkBool32 presentSupport;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, queueFamilyIdx, surface, &presentSupport);
+            if (presentSupport) {
+                if (hasIdx != NULL) {
+                    *hasIdx = true;
+                }
+
+                return queueFamilyIdx;
+            }
+        }
+
+        queueFamilyIdx++;
+    }
+
+    return UINT32_MAX;
+}
+
+inline uint64_t ScorePhysicalDevice(const VkPhysicalDevice device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    // DV.1. The device type is the most important: discrete > integrated > virtual > CPU.
+    uint64_t typeRank = 0;
+    switch (properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeRank = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeRank = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeRank = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: typeRank = 1; break;
+        default: break;
+    }
+
+    // DV.2. Then the size of the largest device local heap (in MiB).
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+
+    uint64_t heapMiB = 0;
+    for (uint32_t idx = 0; idx < memProperties.memoryHeapCount; idx++) {
+        if (memProperties.memoryHeaps[idx].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            heapMiB = std::max<uint64_t>(heapMiB, memProperties.memoryHeaps[idx].size >> 20);
+        }
+    }
+
+    // DV.2.1. A device with measured copy bandwidth in DEMO_DEVICE_PROFILE ranks above the unmeasured ones
+    // of the same type, and the measured devices are ordered by their upload + download bandwidth.
+    uint64_t measuredRank = 0;
+    uint64_t sizeRank = heapMiB;
+    const DeviceProfileEntry *profile = FindDeviceProfile(device);
+    if ((profile != NULL) && profile->probed) {
+        measuredRank = 1;
+        sizeRank = (uint64_t)(profile->uploadMiBps + profile->downloadMiBps);
+    }
+
+    // DV.3. Finally the dedicated compute and transfer queue families (async compute and copies).
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    uint64_t queueRank = 0;
+    for (uint32_t idx = 0; idx < queueFamilyCount; idx++) {
+        const VkQueueFlags flags = queueFamilies[idx].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            queueRank |= 2;
+        }
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            queueRank |= 1;
+        }
+    }
+
+    // DV.4. The ranks are packed so a plain integer compare orders the devices.
+    return (typeRank << 56) | (measuredRank << 55) | (std::min<uint64_t>(sizeRank, 0xFFFFFFFFFFull) << 8) | queueRank;
+}
+
+inline bool MatchPhysicalDevice(const VkPhysicalDevice device, uint32_t deviceIdx, const char *selector) {
+    // DV.5. Without a selector every device matches,
+    // a number selects the device by enumeration index, anything else by a part of its name.
+    if ((selector == NULL) || (selector[0] == '\0')) {
+        return true;
+    }
+
+    if ((selector[0] >= '0') && (selector[0] <= '9')) {
+        return (uint32_t)atoi(selector) == deviceIdx;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    return strstr(properties.deviceName, selector) != NULL;
+}
+
+// Returns every number which follows a "key": in the text.
+inline std::vector<double> ProfileNumbers(const std::string& text, const char *key) {
+    const std::string quotedKey = std::string("\"") + key + "\":";
+
+    std::vector<double> values;
+    for (size_t pos = text.find(quotedKey); pos != std::string::npos; pos = text.find(quotedKey, pos)) {
+        pos += quotedKey.size();
+        values.push_back(strtod(text.c_str() + pos, NULL));
+    }
+
+    return values;
+}
+
+inline std::vector<DeviceProfileEntry> LoadDeviceProfile(const char *fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open()) {
+        printf("Device profile: failed to open %s, the devices are ranked without it\n", fileName);
+        return {};
+    }
+
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // DP.1. No JSON library is used: vkmininfo writes one object per device, each starting with its "vendorID",
+    // so the text is split at those keys and only the needed values are picked out of each part.
+    static const char vendorKey[] = "\"vendorID\":";
+    static const char uuidKey[] = "\"pipelineCacheUUID\": \"";
+
+    std::vector<DeviceProfileEntry> entries;
+    for (size_t start = text.find(vendorKey); start != std::string::npos; ) {
+        const size_t end = text.find(vendorKey, start + 1);
+        const std::string part = text.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+        start = end;
+
+        const std::vector<double> vendorIDs = ProfileNumbers(part, "vendorID");
+        const std::vector<double> deviceIDs = ProfileNumbers(part, "deviceID");
+        const size_t uuidStart = part.find(uuidKey);
+        if (deviceIDs.empty() || (uuidStart == std::string::npos)) {
+            continue;
+        }
+
+        DeviceProfileEntry entry = {};
+        entry.vendorID = (uint32_t)vendorIDs[0];
+        entry.deviceID = (uint32_t)deviceIDs[0];
+        entry.pipelineCacheUUID = part.substr(uuidStart + sizeof(uuidKey) - 1, VK_UUID_SIZE * 2);
+
+        // DP.2. The probe results are only there if vkmininfo ran with DEMO_PROBE=1.
+        const std::vector<double> uploads = ProfileNumbers(part, "uploadMiBps");
+        const std::vector<double> downloads = ProfileNumbers(part, "downloadMiBps");
+        const std::vector<double> dispatches = ProfileNumbers(part, "dispatchMedianUs");
+        if (!uploads.empty() && !downloads.empty()) {
+            entry.probed = true;
+            entry.uploadMiBps = *std::max_element(uploads.begin(), uploads.end());
+            entry.downloadMiBps = *std::max_element(downloads.begin(), downloads.end());
+            entry.dispatchMedianUs = dispatches.empty() ? 0.0 : dispatches[0];
+        }
+
+        entries.push_back(entry);
+    }
+
+    printf("Device profile: %u device(s) loaded from %s\n", (uint32_t)entries.size(), fileName);
+
+    return entries;
+}
+
+inline const DeviceProfileEntry *FindDeviceProfile(const VkPhysicalDevice device) {
+    // DP.3. The profile is loaded once, on the first device ranking.
+    static bool loaded = false;
+    static std::vector<DeviceProfileEntry> entries;
+    if (!loaded) {
+        const char *envDeviceProfile = getenv("DEMO_DEVICE_PROFILE");
+        if ((envDeviceProfile != NULL) && (envDeviceProfile[0] != '\0')) {
+            entries = LoadDeviceProfile(envDeviceProfile);
+        }
+        loaded = true;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    char uuid[VK_UUID_SIZE * 2 + 1];
+    for (uint32_t idx = 0; idx < VK_UUID_SIZE; idx++) {
+        snprintf(uuid + idx * 2, 3, "%02x", properties.pipelineCacheUUID[idx]);
+    }
+
+    // DP.4. A driver update changes the pipelineCacheUUID, so the old measurements are not used for it.
+    for (const DeviceProfileEntry& entry : entries) {
+        if ((entry.vendorID == properties.vendorID) && (entry.deviceID == properties.deviceID)
+            && (entry.pipelineCacheUUID == uuid)) {
+            return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+inline const VkPhysicalDeviceMemoryProperties& GetMemoryProperties(const VkPhysicalDevice physicalDevice) {
+    // The memory properties of a Physical Device do not change, so they are only queried once.
+    // The cache is per thread, so it is used without locking.
+    static thread_local VkPhysicalDevice cachedDevice = VK_NULL_HANDLE;
+    static thread_local VkPhysicalDeviceMemoryProperties cachedProperties;
+
+    if (cachedDevice != physicalDevice) {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &cachedProperties);
+        cachedDevice = physicalDevice;
+    }
+
+    return cachedProperties;
+}
+
+inline uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
+                               uint32_t typeFilter,
+                               VkMemoryPropertyFlags properties) {
+    const VkPhysicalDeviceMemoryProperties& memProperties = GetMemoryProperties(physicalDevice);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+inline uint32_t FindPreferredMemoryType(const VkPhysicalDevice physicalDevice,
+                                        uint32_t typeFilter,
+                                        VkMemoryPropertyFlags preferred,
+                                        VkMemoryPropertyFlags required) {
+    const VkPhysicalDeviceMemoryProperties& memProperties = GetMemoryProperties(physicalDevice);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & preferred) == preferred) {
+            return i;
+        }
+    }
+
+    return FindMemoryType(physicalDevice, typeFilter, required);
+}
+
+inline VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+inline void CreateMemoryArena(const VkPhysicalDevice physicalDevice, const VkDevice device, MemoryArena *outArena) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    outArena->physicalDevice = physicalDevice;
+    outArena->device = device;
+    outArena->bufferImageGranularity = properties.limits.bufferImageGranularity;
+    outArena->nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+    outArena->maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+    outArena->allocationCount = 0;
+    outArena->blocks.clear();
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &outArena->memProperties);
+}
+
+inline void DestroyMemoryArena(MemoryArena *arena) {
+    for (ArenaBlock& block : arena->blocks) {
+        if (block.memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        if (!block.ranges.empty()) {
+            printf("Memory arena: %u allocation(s) leaked in block of memory type %u\n",
+                   (uint32_t)block.ranges.size(), block.memoryTypeIndex);
+        }
+
+        if (block.mapped != NULL) {
+            vkUnmapMemory(arena->device, block.memory);
+        }
+        vkFreeMemory(arena->device, block.memory, NULL);
+    }
+
+    arena->blocks.clear();
+    arena->allocationCount = 0;
+}
+
+inline uint32_t ArenaCreateBlock(MemoryArena *arena, uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated) {
+    // A.1. Every block is a real device allocation, they are limited by maxMemoryAllocationCount.
+    if (arena->allocationCount >= arena->maxAllocationCount) {
+        throw std::runtime_error("failed to allocate arena block: maxMemoryAllocationCount reached!");
+    }
+
+    ArenaBlock block;
+    {
+        block.memory = VK_NULL_HANDLE;
+        block.size = size;
+        block.memoryTypeIndex = memoryTypeIndex;
+        block.dedicated = dedicated;
+        block.mapped = NULL;
+    }
+
+    // A.2. Allocate the block memory.
+    VkMemoryAllocateInfo allocInfo;
+    {
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = NULL;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+    }
+
+    if (vkAllocateMemory(arena->device, &allocInfo, NULL, &block.memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate arena block memory!");
+    }
+
+    // A.3. Persistently map host visible blocks, a memory object can only be mapped once.
+    const VkMemoryPropertyFlags propertyFlags = arena->memProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if (propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *mapped;
+        if (vkMapMemory(arena->device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+            vkFreeMemory(arena->device, block.memory, NULL);
+            throw std::runtime_error("failed to map arena block memory!");
+        }
+        block.mapped = (uint8_t*)mapped;
+    }
+
+    arena->allocationCount++;
+
+    // A.4. Reuse the slot of a released block.
+    for (uint32_t blockIdx = 0; blockIdx < arena->blocks.size(); blockIdx++) {
+        if (arena->blocks[blockIdx].memory == VK_NULL_HANDLE) {
+            arena->blocks[blockIdx] = block;
+            return blockIdx;
+        }
+    }
+
+    arena->blocks.push_back(block);
+    return (uint32_t)arena->blocks.size() - 1;
+}
+
+inline bool ArenaFindRange(const MemoryArena& arena,
+                           const ArenaBlock& block,
+                           VkDeviceSize size,
+                           VkDeviceSize alignment,
+                           bool linear,
+                           VkDeviceSize *outOffset,
+                           size_t *outRangeIdx) {
+    const VkDeviceSize granularity = arena.bufferImageGranularity;
+
+    // First fit: check the gap before each allocated range and the gap at the end of the block.
+    VkDeviceSize gapStart = 0;
+    for (size_t rangeIdx = 0; rangeIdx <= block.ranges.size(); rangeIdx++) {
+        const bool hasNext = (rangeIdx < block.ranges.size());
+        const VkDeviceSize gapEnd = hasNext ? block.ranges[rangeIdx].offset : block.size;
+
+        VkDeviceSize offset = AlignUp(gapStart, alignment);
+        // A linear and an optimal resource must not be on the same bufferImageGranularity "page".
+        if ((rangeIdx > 0) && (block.ranges[rangeIdx - 1].linear != linear)) {
+            offset = AlignUp(offset, granularity);
+        }
+
+        VkDeviceSize end = offset + size;
+        if (hasNext && (block.ranges[rangeIdx].linear != linear)) {
+            end = AlignUp(end, granularity);
+        }
+
+        if (end <= gapEnd) {
+            *outOffset = offset;
+            *outRangeIdx = rangeIdx;
+            return true;
+        }
+
+        if (hasNext) {
+            gapStart = block.ranges[rangeIdx].offset + block.ranges[rangeIdx].size;
+        }
+    }
+
+    return false;
+}
+
+inline ArenaAllocation ArenaAllocate(MemoryArena *arena,
+                                     const VkMemoryRequirements& memRequirements,
+                                     uint32_t memoryTypeIndex,
+                                     bool linear) {
+    // A.5. Mapped ranges are flushed/invalidated in nonCoherentAtomSize units,
+    // so host visible allocations are aligned (and padded) to it to not touch the neighbours.
+    VkDeviceSize alignment = (memRequirements.alignment > 0) ? memRequirements.alignment : 1;
+    VkDeviceSize size = memRequirements.size;
+
+    const VkMemoryPropertyFlags propertyFlags = arena->memProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if (propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        alignment = AlignUp(alignment, arena->nonCoherentAtomSize);
+        size = AlignUp(size, arena->nonCoherentAtomSize);
+    }
+
+    // A.6. Small heaps get smaller blocks to not reserve a big part of them at once.
+    const uint32_t heapIndex = arena->memProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    VkDeviceSize blockSize = g_arenaBlockSize;
+    if (arena->memProperties.memoryHeaps[heapIndex].size / 8 < blockSize) {
+        blockSize = AlignUp(arena->memProperties.memoryHeaps[heapIndex].size / 8, arena->nonCoherentAtomSize);
+    }
+
+    uint32_t blockIdx = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    size_t rangeIdx = 0;
+
+    if ((size > blockSize / 2) || (propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+        // A.7. Large resources get their own block.
+        // Lazily allocated memory is committed per memory object, so it is never shared.
+        blockIdx = ArenaCreateBlock(arena, memoryTypeIndex, size, true);
+    } else {
+        // A.8. Find a free range in the existing blocks of the memory type.
+        for (uint32_t idx = 0; idx < arena->blocks.size(); idx++) {
+            const ArenaBlock& block = arena->blocks[idx];
+            if ((block.memory == VK_NULL_HANDLE) || block.dedicated || (block.memoryTypeIndex != memoryTypeIndex)) {
+                continue;
+            }
+
+            if (ArenaFindRange(*arena, block, size, alignment, linear, &offset, &rangeIdx)) {
+                blockIdx = idx;
+                break;
+            }
+        }
+
+        // A.9. Otherwise start a new block.
+        if (blockIdx == UINT32_MAX) {
+            blockIdx = ArenaCreateBlock(arena, memoryTypeIndex, blockSize, false);
+            offset = 0;
+            rangeIdx = 0;
+        }
+    }
+
+    ArenaBlock& block = arena->blocks[blockIdx];
+    block.ranges.insert(block.ranges.begin() + rangeIdx, ArenaRange{ offset, size, linear });
+
+    ArenaAllocation allocation;
+    {
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.mapped = (block.mapped != NULL) ? (block.mapped + offset) : NULL;
+        allocation.blockIdx = blockIdx;
+    }
+
+    return allocation;
+}
+
+inline ArenaAllocation ArenaAllocateBuffer(MemoryArena *arena, const VkBuffer buffer, VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(arena->device, buffer, &memRequirements);
+
+    uint32_t memoryTypeIndex = FindMemoryType(arena->physicalDevice, memRequirements.memoryTypeBits, properties);
+
+    ArenaAllocation allocation = ArenaAllocate(arena, memRequirements, memoryTypeIndex, true);
+    if (vkBindBufferMemory(arena->device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+
+    return allocation;
+}
+
+inline ArenaAllocation ArenaAllocateImage(MemoryArena *arena,
+                                          const VkImage image,
+                                          VkImageTiling tiling,
+                                          VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(arena->device, image, &memRequirements);
+
+    uint32_t memoryTypeIndex = FindMemoryType(arena->physicalDevice, memRequirements.memoryTypeBits, properties);
+
+    ArenaAllocation allocation = ArenaAllocate(arena, memRequirements, memoryTypeIndex, (tiling == VK_IMAGE_TILING_LINEAR));
+    if (vkBindImageMemory(arena->device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind image memory!");
+    }
+
+    return allocation;
+}
+
+inline void ArenaFree(MemoryArena *arena, const ArenaAllocation& allocation) {
+    ArenaBlock& block = arena->blocks[allocation.blockIdx];
+
+    for (size_t rangeIdx = 0; rangeIdx < block.ranges.size(); rangeIdx++) {
+        if (block.ranges[rangeIdx].offset == allocation.offset) {
+            block.ranges.erase(block.ranges.begin() + rangeIdx);
+            break;
+        }
+    }
+
+    // Dedicated blocks are released right away, shared blocks are kept for the next allocations.
+    if (block.dedicated && block.ranges.empty()) {
+        if (block.mapped != NULL) {
+            vkUnmapMemory(arena->device, block.memory);
+        }
+        vkFreeMemory(arena->device, block.memory, NULL);
+
+        block.memory = VK_NULL_HANDLE;
+        block.mapped = NULL;
+        arena->allocationCount--;
+    }
+}
+
+inline ArenaStats GetArenaStats(const MemoryArena& arena) {
+    ArenaStats stats = {};
+    // Sum of the largest free range of each block, an allocation can't span blocks anyway.
+    VkDeviceSize largestFreeBytes = 0;
+
+    for (const ArenaBlock& block : arena.blocks) {
+        if (block.memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        stats.blockCount++;
+        stats.reservedBytes += block.size;
+
+        VkDeviceSize gapStart = 0;
+        VkDeviceSize largestGap = 0;
+        for (const ArenaRange& range : block.ranges) {
+            stats.allocationCount++;
+            stats.usedBytes += range.size;
+            largestGap = std::max(largestGap, range.offset - gapStart);
+            gapStart = range.offset + range.size;
+        }
+        largestGap = std::max(largestGap, block.size - gapStart);
+
+        stats.largestFreeRange = std::max(stats.largestFreeRange, largestGap);
+        largestFreeBytes += largestGap;
+    }
+
+    // Alignment padding is counted as free space.
+    const VkDeviceSize freeBytes = stats.reservedBytes - stats.usedBytes;
+    if (freeBytes > 0) {
+        stats.fragmentation = 1.0f - (float)largestFreeBytes / (float)freeBytes;
+    }
+
+    return stats;
+}
+
+inline void PrintArenaStats(const MemoryArena& arena) {
+    const ArenaStats stats = GetArenaStats(arena);
+
+    printf("Memory arena: %u allocation(s) in %u block(s), %.1f KiB used of %.1f KiB, "
+           "largest free range: %.1f KiB, fragmentation: %.1f%%\n",
+           stats.allocationCount, stats.blockCount,
+           stats.usedBytes / 1024.0, stats.reservedBytes / 1024.0,
+           stats.largestFreeRange / 1024.0, stats.fragmentation * 100.0f);
+}
+
+inline void CreateStagingUploader(const VkDevice device,
+                                  MemoryArena *arena,
+                                  uint32_t queueFamilyIdx,
+                                  bool forceStaging,
+                                  StagingUploader *outUploader) {
+    outUploader->arena = arena;
+    outUploader->forceStaging = forceStaging;
+    outUploader->recording = false;
+    outUploader->submitted = false;
+    outUploader->directCount = 0;
+    outUploader->stagedCount = 0;
+    outUploader->stagingBuffers.clear();
+
+    // SU.1. Create a Command Pool for the upload Command Buffer.
+    // The Command Buffer is re-recorded for each batch so the pool must allow individual resets.
+    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &outUploader->cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    // SU.2. Allocate the upload Command Buffer.
+    {
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = outUploader->cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+        }
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &outUploader->cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    // SU.3. Create the Fence which signals when the staging buffers can be released.
+    {
+        VkFenceCreateInfo fenceInfo;
+        {
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = NULL;
+            fenceInfo.flags = 0;
+        }
+
+        if (vkCreateFence(device, &fenceInfo, NULL, &outUploader->fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+    }
+}
+
+inline void DestroyStagingUploader(const VkDevice device, StagingUploader *uploader) {
+    ReleaseStagingBuffers(device, uploader, true);
+
+    vkDestroyFence(device, uploader->fence, NULL);
+    vkFreeCommandBuffers(device, uploader->cmdPool, 1, &uploader->cmdBuffer);
+    vkDestroyCommandPool(device, uploader->cmdPool, NULL);
+}
+
+inline ArenaAllocation UploadDeviceLocalBuffer(const VkDevice device,
+                                               StagingUploader *uploader,
+                                               const VkBuffer buffer,
+                                               const void *data,
+                                               VkDeviceSize size,
+                                               VkAccessFlags dstAccessMask,
+                                               VkPipelineStageFlags dstStageMask) {
+    MemoryArena *arena = uploader->arena;
+
+    // SU.4. Select the memory of the destination buffer.
+    // Device local memory which is also host visible is preferred as it can be written without a copy.
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    const uint32_t memoryTypeIndex = FindPreferredMemoryType(arena->physicalDevice,
+                                                             memRequirements.memoryTypeBits,
+                                                             directFlags,
+                                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    const bool direct = !uploader->forceStaging
+        && ((arena->memProperties.memoryTypes[memoryTypeIndex].propertyFlags & directFlags) == directFlags);
+
+    ArenaAllocation allocation = ArenaAllocate(arena, memRequirements, memoryTypeIndex, true);
+    if (vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+
+    // SU.5. Write the data directly if possible (the arena keeps the memory mapped).
+    if (direct) {
+        ::memcpy(allocation.mapped, data, size);
+
+        VkMappedMemoryRange memoryRange = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, allocation.memory, allocation.offset, allocation.size };
+        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
+
+        uploader->directCount++;
+        return allocation;
+    }
+
+    // SU.6. Otherwise fill a transient staging buffer.
+    StagingBuffer staging;
+    {
+        VkBufferCreateInfo bufferInfo;
+        {
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = NULL;
+            bufferInfo.flags = 0;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = NULL;
+        }
+
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &staging.buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create staging buffer!");
+        }
+
+        staging.memory = ArenaAllocateBuffer(arena, staging.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+        ::memcpy(staging.memory.mapped, data, size);
+
+        VkMappedMemoryRange memoryRange = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, staging.memory.memory, staging.memory.offset, staging.memory.size };
+        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
+    }
+
+    // SU.7. Start the batch if this is its first copy.
+    if (!uploader->recording) {
+        // The previous batch must be finished before its Command Buffer is re-recorded.
+        ReleaseStagingBuffers(device, uploader, true);
+
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = NULL;
+        }
+
+        if (vkBeginCommandBuffer(uploader->cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+        uploader->recording = true;
+    }
+
+    // SU.8. Record the copy and make the result visible for the consumer stage.
+    // The barrier also covers the later submissions on the same queue, no extra wait is needed.
+    {
+        VkBufferCopy copyRegion = { 0, 0, size };
+        vkCmdCopyBuffer(uploader->cmdBuffer, staging.buffer, buffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier bufferMemoryBarrier;
+        {
+            bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            bufferMemoryBarrier.pNext = NULL;
+            bufferMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            bufferMemoryBarrier.dstAccessMask = dstAccessMask;
+            bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferMemoryBarrier.buffer = buffer;
+            bufferMemoryBarrier.offset = 0;
+            bufferMemoryBarrier.size = size;
+        }
+
+        vkCmdPipelineBarrier(uploader->cmdBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask,
+                             0,
+                             0, NULL,
+                             1, &bufferMemoryBarrier,
+                             0, NULL);
+    }
+
+    uploader->stagingBuffers.push_back(staging);
+    uploader->stagedCount++;
+
+    return allocation;
+}
+
+inline void SubmitStagingUploads(const VkDevice device, StagingUploader *uploader, const VkQueue queue) {
+    (void)device;
+
+    if (!uploader->recording) {
+        return;
+    }
+
+    // SU.9. Submit all recorded copies at once.
+    if (vkEndCommandBuffer(uploader->cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    VkSubmitInfo submitInfo;
+    {
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = NULL;
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = NULL;
+        submitInfo.pWaitDstStageMask = NULL;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &uploader->cmdBuffer;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = NULL;
+    }
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, uploader->fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+
+    uploader->recording = false;
+    uploader->submitted = true;
+}
+
+inline void ReleaseStagingBuffers(const VkDevice device, StagingUploader *uploader, bool wait) {
+    if (!uploader->submitted) {
+        return;
+    }
+
+    // SU.10. Release the staging buffers once the copies are done.
+    // Without "wait" this only polls the fence, so it can be called every frame.
+    if (wait) {
+        vkWaitForFences(device, 1, &uploader->fence, VK_TRUE, UINT64_MAX);
+    } else if (vkGetFenceStatus(device, uploader->fence) != VK_SUCCESS) {
+        return;
+    }
+
+    for (const StagingBuffer& staging : uploader->stagingBuffers) {
+        vkDestroyBuffer(device, staging.buffer, NULL);
+        ArenaFree(uploader->arena, staging.memory);
+    }
+    uploader->stagingBuffers.clear();
+
+    vkResetFences(device, 1, &uploader->fence);
+    uploader->submitted = false;
+}
+
+#if HAVE_SHADERC
+
+inline std::vector<char> LoadGLSL(const std::string name) {
+    std::ifstream input(name, std::ios::binary);
+
+    if (!input.is_open()) {
+        throw std::runtime_error("failed to open file:" + name);
+    }
+
+    return std::vector<char>(std::istreambuf_iterator<char>(input),
+                             std::istreambuf_iterator<char>());
+}
+
+// Key for the compile options used in CompileGLSL. It is part of the SPIR-V cache hash (together with
+// the shaderc version), update it whenever the shaderc::CompileOptions change.
+static const char g_shaderCompileOptionsKey[] = "shaderc-default-options";
+
+// First word of every SPIR-V module.
+static const uint32_t g_spirvMagic = 0x07230203;
+
+// 64-bit FNV-1a hash.
+inline uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    for (size_t idx = 0; idx < size; idx++) {
+        hash ^= bytes[idx];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Returns the content-addressed file name of a compiled shader or an empty string if the cache is disabled.
+inline std::string SpirvCacheFileName(shaderc_shader_kind shaderType, const std::vector<char> &src) {
+    const char *envShaderCache = getenv("DEMO_SHADER_CACHE");
+    const std::string cacheDir = (envShaderCache != NULL) ? envShaderCache : "shader_cache";
+
+    if (cacheDir.empty()) {
+        return "";
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = HashBytes(hash, src.data(), src.size());
+    hash = HashBytes(hash, &shaderType, sizeof(shaderType));
+    hash = HashBytes(hash, g_shaderCompileOptionsKey, sizeof(g_shaderCompileOptionsKey));
+
+    // A shaderc update can change the generated code, so its version is also part of the key.
+    unsigned int spvVersion = 0;
+    unsigned int spvRevision = 0;
+    shaderc_get_spv_version(&spvVersion, &spvRevision);
+    hash = HashBytes(hash, &spvVersion, sizeof(spvVersion));
+    hash = HashBytes(hash, &spvRevision, sizeof(spvRevision));
+
+    // The directory might already exist, any real error will show up on file open.
+    mkdir(cacheDir.c_str(), 0755);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)hash);
+
+    return cacheDir + "/" + name;
+}
+
+inline std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
+    const std::string cacheFileName = SpirvCacheFileName(shaderType, vertSrc);
+
+    if (!cacheFileName.empty()) {
+        std::ifstream input(cacheFileName, std::ios::ate | std::ios::binary);
+
+        if (input.is_open()) {
+            size_t fileSize = (size_t) input.tellg();
+
+            // A truncated or foreign file is not used, the shader is compiled again and the entry is rewritten.
+            if ((fileSize > 0) && ((fileSize % sizeof(uint32_t)) == 0)) {
+                std::vector<uint32_t> code(fileSize / sizeof(uint32_t));
+
+                input.seekg(0);
+                if (input.read((char*)code.data(), fileSize) && (code[0] == g_spirvMagic)) {
+                    return code;
+                }
+            }
+
+            printf("Shader cache: ignoring invalid entry '%s'\n", cacheFileName.c_str());
+        }
+    }
+
+    shaderc::Compiler compiler;
+    shaderc::CompileOptions options;
+    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+
+    if (module.GetNumErrors() > 0) {
+        fprintf(stderr, "-> Faild to comple:\n%s\n", module.GetErrorMessage().c_str());
+    }
+
+    std::vector<uint32_t> code(module.begin(), module.end());
+
+    if (!cacheFileName.empty() && (module.GetCompilationStatus() == shaderc_compilation_status_success)) {
+        // Write into a temporary file and rename it so other processes never read a partial shader.
+        // A failed write only costs a compilation on the next start.
+        if (!WriteFileAtomic(cacheFileName, NULL, 0, code.data(), code.size() * sizeof(uint32_t))) {
+            printf("Shader cache: failed to write file: %s (%s)\n", cacheFileName.c_str(), strerror(errno));
+        }
+    }
+
+    return code;
+}
+
+#else
+
+inline std::vector<uint32_t> LoadSPIRV(const std::string name) {
+    std::ifstream file(name, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file: " + name);
+    }
+
+    size_t fileSize = (size_t) file.tellg();
+
+    if ((fileSize % sizeof(uint32_t)) != 0) {
+        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+    }
+
+    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+
+    file.seekg(0);
+    file.read((char*)buffer.data(), fileSize);
+
+    file.close();
+
+    return buffer;
+}
+
+#endif
+
+inline std::future<std::vector<uint32_t> > LoadShaderAsync(const std::string& name) {
+    return std::async(std::launch::async, [name]() -> std::vector<uint32_t> {
+        #if HAVE_SHADERC
+        shaderc_shader_kind kind = shaderc_vertex_shader;
+        if ((name.size() > 5) && (name.compare(name.size() - 5, 5, ".frag") == 0)) {
+            kind = shaderc_fragment_shader;
+        } else if ((name.size() > 5) && (name.compare(name.size() - 5, 5, ".comp") == 0)) {
+            kind = shaderc_compute_shader;
+        }
+
+        std::vector<char> src = LoadGLSL(name);
+        return CompileGLSL(kind, src);
+        #else
+        return LoadSPIRV(name + ".spv");
+        #endif
+    });
+}
+
+// Header written in front of the VkPipelineCache data blob.
+// The driver validates the vendorID/deviceID/pipelineCacheUUID of the blob itself,
+// but a cache is only reused if the driverVersion also matches.
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+};
+
+static const uint32_t g_pipelineCacheMagic = 0x43505644; // "DVPC"
+
+inline VkPipelineCache LoadPipelineCache(const VkPhysicalDevice physicalDevice,
+                                         const VkDevice device,
+                                         const std::string& fileName,
+                                         bool *outHit) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<char> initialData;
+    if (!fileName.empty()) {
+        std::ifstream file(fileName, std::ios::binary);
+
+        PipelineCacheFileHeader header;
+        if (file.is_open()
+            && file.read((char*)&header, sizeof(header))
+            && (header.magic == g_pipelineCacheMagic)
+            && (header.vendorID == properties.vendorID)
+            && (header.deviceID == properties.deviceID)
+            && (header.driverVersion == properties.driverVersion)
+            && (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0)) {
+            std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                                   std::istreambuf_iterator<char>());
+
+            // A truncated file is treated as a miss.
+            if (data.size() == header.dataSize) {
+                initialData.swap(data);
+            }
+        }
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo;
+    {
+        pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        pipelineCacheCreateInfo.pNext = NULL;
+        pipelineCacheCreateInfo.flags = 0;
+        pipelineCacheCreateInfo.initialDataSize = initialData.size();
+        pipelineCacheCreateInfo.pInitialData = initialData.data();
+    }
+
+    VkPipelineCache pipelineCache;
+    if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, NULL, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    printf("Pipeline cache: %s (%zu bytes from '%s')\n",
+           (initialData.empty() ? "miss" : "hit"), initialData.size(), fileName.c_str());
+
+    if (outHit != NULL) {
+        *outHit = !initialData.empty();
+    }
+
+    return pipelineCache;
+}
+
+inline void SavePipelineCache(const VkPhysicalDevice physicalDevice,
+                              const VkDevice device,
+                              const VkPipelineCache pipelineCache,
+                              const std::string& fileName) {
+    if (fileName.empty()) {
+        return;
+    }
+
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, NULL) != VK_SUCCESS) {
+        throw std::runtime_error("failed to query pipeline cache size!");
+    }
+
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to get pipeline cache data!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    PipelineCacheFileHeader header;
+    {
+        header.magic = g_pipelineCacheMagic;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = dataSize;
+    }
+
+    // Write into a temporary file and rename it so a concurrently starting
+    // process never reads a partially written cache.
+    if (!WriteFileAtomic(fileName, &header, sizeof(header), data.data(), dataSize)) {
+        printf("Pipeline cache: failed to write file: %s (%s)\n", fileName.c_str(), strerror(errno));
+        return;
+    }
+
+    printf("Pipeline cache: saved %zu bytes to '%s'\n", dataSize, fileName.c_str());
+}
+
+inline bool WriteFileAtomic(const std::string& fileName, const void *header, size_t headerSize, const void *data, size_t dataSize) {
+    // The temporary file is in the same directory, so the rename does not cross file systems.
+    // mkstemp gives each process (and thread) its own file, the last rename wins.
+    std::string tmpFileName = fileName + ".XXXXXX";
+    int fd = mkstemp(&tmpFileName[0]);
+    if (fd < 0) {
+        return false;
+    }
+
+    // mkstemp creates the file with 0600, use the usual permissions of a cache file.
+    bool success = (fchmod(fd, 0644) == 0);
+
+    const void *chunks[] = { header, data };
+    const size_t chunkSizes[] = { headerSize, dataSize };
+    for (uint32_t idx = 0; success && (idx < 2); idx++) {
+        const char *ptr = (const char*)chunks[idx];
+        size_t remaining = chunkSizes[idx];
+        while (remaining > 0) {
+            ssize_t written = write(fd, ptr, remaining);
+            if ((written < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (written <= 0) {
+                success = false;
+                break;
+            }
+            ptr += written;
+            remaining -= (size_t)written;
+        }
+    }
+
+    // A failed close can also mean lost data (e.g. a full disk on a network file system).
+    if (close(fd) != 0) {
+        success = false;
+    }
+
+    if (success && (std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)) {
+        success = false;
+    }
+
+    if (!success) {
+        const int savedErrno = errno;
+        unlink(tmpFileName.c_str());
+        errno = savedErrno;
+    }
+
+    return success;
+}
+
+#if HAVE_SSSE3_PACK
+// Packs 16 pixels per iteration: 4 shuffled 12 byte groups are merged into 3 full 16 byte stores.
+// Returns the number of packed pixels, the rest is left for the scalar loop.
+__attribute__((target("ssse3")))
+inline uint32_t PackRGBAToRGBSSSE3(const uint8_t *src, uint8_t *dst, uint32_t pixelCount, bool swapRB) {
+    const __m128i mask = swapRB ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    uint32_t idx = 0;
+    for (; idx + 16 <= pixelCount; idx += 16) {
+        const __m128i *in = (const __m128i*)(src + idx * 4);
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), mask);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+        const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+        const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+
+        __m128i *out = (__m128i*)(dst + idx * 3);
+        _mm_storeu_si128(out + 0, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+
+    return idx;
+}
+#endif
+
+inline void PackRGBAToRGB(const uint8_t *src, uint8_t *dst, uint32_t pixelCount, bool swapRB) {
+    uint32_t idx = 0;
+
+#if HAVE_SSSE3_PACK
+    // The demos are built without -mssse3, so the CPU support is checked at runtime.
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3) {
+        idx = PackRGBAToRGBSSSE3(src, dst, pixelCount, swapRB);
+    }
+#elif defined(__ARM_NEON)
+    for (; idx + 16 <= pixelCount; idx += 16) {
+        const uint8x16x4_t rgba = vld4q_u8(src + idx * 4);
+        uint8x16x3_t rgb;
+        rgb.val[0] = swapRB ? rgba.val[2] : rgba.val[0];
+        rgb.val[1] = rgba.val[1];
+        rgb.val[2] = swapRB ? rgba.val[0] : rgba.val[2];
+        vst3q_u8(dst + idx * 3, rgb);
+    }
+#endif
+
+    const uint32_t rIdx = swapRB ? 2 : 0;
+    const uint32_t bIdx = swapRB ? 0 : 2;
+    for (; idx < pixelCount; idx++) {
+        dst[idx * 3 + 0] = src[idx * 4 + rIdx];
+        dst[idx * 3 + 1] = src[idx * 4 + 1];
+        dst[idx * 3 + 2] = src[idx * 4 + bIdx];
+    }
+}
+
+inline void WritePPM(const std::string& fileName,
+                     const uint8_t *data,
+                     uint32_t width,
+                     uint32_t height,
+                     VkDeviceSize rowPitch,
+                     bool swapRB,
+                     bool useMmap) {
+    // ppm header
+    char header[64];
+    const int headerSize = snprintf(header, sizeof(header), "P6\n%u\n%u\n255\n", width, height);
+    const size_t rowSize = (size_t)width * 3;
+    const size_t fileSize = headerSize + rowSize * height;
+
+    int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", fileName.c_str());
+        return;
+    }
+
+    // The rows are packed directly into the file mapping or into a single buffer written with one call.
+    uint8_t *output = NULL;
+    std::vector<uint8_t> buffer;
+    if (useMmap) {
+        if (ftruncate(fd, fileSize) == 0) {
+            void *mapped = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) {
+                output = (uint8_t*)mapped;
+            }
+        }
+
+        if (output == NULL) {
+            fprintf(stderr, "Failed to map '%s', falling back to write\n", fileName.c_str());
+            useMmap = false;
+        }
+    }
+
+    if (!useMmap) {
+        buffer.resize(fileSize);
+        output = buffer.data();
+    }
+
+    // ppm binary pixel data
+    // As the image format is R8G8B8A8 one "pixel" size is 4 bytes, only the RGB values are kept.
+    memcpy(output, header, headerSize);
+    for (uint32_t y = 0; y < height; y++) {
+        PackRGBAToRGB(data + y * rowPitch, output + headerSize + y * rowSize, width, swapRB);
+    }
+
+    if (useMmap) {
+        munmap(output, fileSize);
+    } else {
+        size_t offset = 0;
+        while (offset < fileSize) {
+            ssize_t written = write(fd, output + offset, fileSize - offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+                break;
+            }
+            offset += written;
+        }
+    }
+
+    close(fd);
+}
+
+inline void CreateReadbackRing(const VkPhysicalDevice physicalDevice,
+                               const VkDevice device,
+                               MemoryArena *arena,
+                               uint32_t queueFamilyIdx,
+                               uint32_t width,
+                               uint32_t height,
+                               uint32_t slotCount,
+                               const ReadbackHostMemory *hostMemories,
+                               ReadbackRing *outRing) {
+    outRing->arena = arena;
+    outRing->width = width;
+    outRing->height = height;
+    outRing->size = (VkDeviceSize)width * height * 4;
+    outRing->coherent = true;
+    outRing->nextSlot = 0;
+    outRing->slots.resize(slotCount);
+
+    // B.1. Create a Command Pool for the readback Command Buffers.
+    // Each slot re-records its Command Buffer so the pool must allow individual resets.
+    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &outRing->cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    // B.2. Select the memory type for the staging buffers.
+    // Host cached memory is preferred as the CPU reads from it, coherency is optional.
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t idx = 0; idx < slotCount; idx++) {
+        ReadbackSlot& slot = outRing->slots[idx];
+
+        slot.bufferOffset = 0;
+        slot.imported = false;
+
+        // B.3. Use the imported host memory if it was provided and the driver accepts it.
+        if (hostMemories != NULL) {
+            slot.imported = ImportReadbackHostMemory(physicalDevice, device, hostMemories[idx], &slot);
+        }
+
+        if (!slot.imported) {
+            // B.3.1. Create the staging buffer.
+            {
+                VkBufferCreateInfo bufferInfo;
+                {
+                    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                    bufferInfo.pNext = NULL;
+                    bufferInfo.flags = 0;
+                    bufferInfo.size = outRing->size;
+                    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+                    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+                    bufferInfo.queueFamilyIndexCount = 0;
+                    bufferInfo.pQueueFamilyIndices = NULL;
+                }
+
+                if (vkCreateBuffer(device, &bufferInfo, NULL, &slot.buffer) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create readback buffer!");
+                }
+            }
+
+            // B.4. Sub-allocate and bind the buffer memory, the arena keeps it persistently mapped.
+            {
+                VkMemoryRequirements memRequirements;
+                vkGetBufferMemoryRequirements(device, slot.buffer, &memRequirements);
+
+                uint32_t memoryTypeIndex = UINT32_MAX;
+                for (uint32_t typeIdx = 0; typeIdx < memProperties.memoryTypeCount; typeIdx++) {
+                    const VkMemoryPropertyFlags cachedFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+                    if ((memRequirements.memoryTypeBits & (1 << typeIdx))
+                        && ((memProperties.memoryTypes[typeIdx].propertyFlags & cachedFlags) == cachedFlags)) {
+                        memoryTypeIndex = typeIdx;
+                        break;
+                    }
+                }
+
+                if (memoryTypeIndex == UINT32_MAX) {
+                    memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+                }
+
+                outRing->coherent = (memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+                slot.memory = ArenaAllocate(outRing->arena, memRequirements, memoryTypeIndex, true);
+                vkBindBufferMemory(device, slot.buffer, slot.memory.memory, slot.memory.offset);
+                slot.data = slot.memory.mapped;
+            }
+
+        }
+
+        // B.5. Allocate the Command Buffer of the slot.
+        {
+            VkCommandBufferAllocateInfo allocInfo;
+            {
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.pNext = NULL;
+                allocInfo.commandPool = outRing->cmdPool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandBufferCount = 1;
+            }
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, &slot.cmdBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+        }
+
+        slot.fence = VK_NULL_HANDLE;
+        slot.state = READBACK_SLOT_FREE;
+        slot.frameIdx = 0;
+    }
+}
+
+inline uint32_t QueryInstanceVersion() {
+    const PFN_vkEnumerateInstanceVersion enumerateVersion =
+        (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+
+    uint32_t version = VK_API_VERSION_1_0;
+    if ((enumerateVersion != NULL) && (enumerateVersion(&version) != VK_SUCCESS)) {
+        version = VK_API_VERSION_1_0;
+    }
+
+    return version;
+}
+
+inline VkDeviceSize QueryHostImportAlignment(const VkInstance instance, uint32_t instanceVersion, const VkPhysicalDevice physicalDevice) {
+    // H.0.1. Check the device extension.
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, NULL);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensions.data());
+
+    bool hasExtension = false;
+    for (const VkExtensionProperties& extension : extensions) {
+        if (strcmp(extension.extensionName, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) == 0) {
+            hasExtension = true;
+            break;
+        }
+    }
+
+    // vkGetPhysicalDeviceProperties2 is a Vulkan 1.1 entry point, both the Instance and the device must support it.
+    // It is looked up at runtime, so the demo still links against a 1.0 loader.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    if (!hasExtension || (instanceVersion < VK_API_VERSION_1_1) || (properties.apiVersion < VK_API_VERSION_1_1)) {
+        return 0;
+    }
+
+    const PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 =
+        (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2");
+    if (getProperties2 == NULL) {
+        return 0;
+    }
+
+    // H.0.2. Query the required alignment of the imported host pointers (and sizes).
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties;
+    {
+        hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        hostProperties.pNext = NULL;
+        hostProperties.minImportedHostPointerAlignment = 0;
+    }
+
+    VkPhysicalDeviceProperties2 properties2;
+    {
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &hostProperties;
+    }
+    getProperties2(physicalDevice, &properties2);
+
+    return hostProperties.minImportedHostPointerAlignment;
+}
+
+inline bool ImportReadbackHostMemory(const VkPhysicalDevice physicalDevice,
+                                     const VkDevice device,
+                                     const ReadbackHostMemory& hostMemory,
+                                     ReadbackSlot *slot) {
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties =
+        (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+    if (getMemoryHostPointerProperties == NULL) {
+        return false;
+    }
+
+    // H.3. Query the memory types which can import the host pointer.
+    VkMemoryHostPointerPropertiesEXT pointerProperties;
+    {
+        pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+        pointerProperties.pNext = NULL;
+        pointerProperties.memoryTypeBits = 0;
+    }
+
+    if (getMemoryHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                       hostMemory.pointer, &pointerProperties) != VK_SUCCESS) {
+        return false;
+    }
+
+    // H.4. Create a buffer over the whole host memory, the copy writes the pixels at "offset".
+    VkExternalMemoryBufferCreateInfo externalInfo;
+    {
+        externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+        externalInfo.pNext = NULL;
+        externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    }
+
+    VkBufferCreateInfo bufferInfo;
+    {
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = &externalInfo;
+        bufferInfo.flags = 0;
+        bufferInfo.size = hostMemory.size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferInfo.queueFamilyIndexCount = 0;
+        bufferInfo.pQueueFamilyIndices = NULL;
+    }
+
+    if (vkCreateBuffer(device, &bufferInfo, NULL, &slot->buffer) != VK_SUCCESS) {
+        return false;
+    }
+
+    // H.5. Select a host coherent memory type.
+    // The imported memory is not mapped, so the CPU must be able to read it without an invalidate.
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, slot->buffer, &memRequirements);
+
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    const uint32_t typeBits = memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    for (uint32_t typeIdx = 0; typeIdx < memProperties.memoryTypeCount; typeIdx++) {
+        if ((typeBits & (1 << typeIdx))
+            && (memProperties.memoryTypes[typeIdx].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            memoryTypeIndex = typeIdx;
+            break;
+        }
+    }
+
+    if ((memoryTypeIndex == UINT32_MAX) || (memRequirements.size > hostMemory.size)) {
+        vkDestroyBuffer(device, slot->buffer, NULL);
+        return false;
+    }
+
+    // H.6. Import the host memory and bind it to the buffer.
+    VkImportMemoryHostPointerInfoEXT importInfo;
+    {
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+        importInfo.pNext = NULL;
+        importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        importInfo.pHostPointer = hostMemory.pointer;
+    }
+
+    VkMemoryAllocateInfo allocInfo;
+    {
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = &importInfo;
+        allocInfo.allocationSize = hostMemory.size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+    }
+
+    // The imported memory is owned by the slot and not by the memory arena.
+    VkDeviceMemory importedMemory;
+    if (vkAllocateMemory(device, &allocInfo, NULL, &importedMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(device, slot->buffer, NULL);
+        return false;
+    }
+
+    vkBindBufferMemory(device, slot->buffer, importedMemory, 0);
+
+    slot->memory = { importedMemory, 0, hostMemory.size, NULL, UINT32_MAX };
+    slot->data = (const uint8_t*)hostMemory.pointer + hostMemory.offset;
+    slot->bufferOffset = hostMemory.offset;
+
+    return true;
+}
+
+inline void DestroyReadbackRing(const VkDevice device, ReadbackRing *ring) {
+    // The caller must make sure that no copy is in flight.
+    for (size_t idx = 0; idx < ring->slots.size(); idx++) {
+        ReadbackSlot& slot = ring->slots[idx];
+
+        if (slot.imported) {
+            vkFreeMemory(device, slot.memory.memory, NULL);
+        } else {
+            ArenaFree(ring->arena, slot.memory);
+        }
+        vkDestroyBuffer(device, slot.buffer, NULL);
+        vkFreeCommandBuffers(device, ring->cmdPool, 1, &slot.cmdBuffer);
+    }
+
+    vkDestroyCommandPool(device, ring->cmdPool, NULL);
+    ring->slots.clear();
+}
+
+inline VkCommandBuffer RecordReadback(const VkDevice device,
+                                      ReadbackRing *ring,
+                                      const VkImage image,
+                                      VkImageLayout imageLayout,
+                                      const VkFence fence,
+                                      uint64_t frameIdx) {
+    (void)device;
+
+    // B.6. Find the next free slot.
+    // If every slot is still in flight or not yet consumed, the frame is not captured instead of waiting.
+    ReadbackSlot *slot = NULL;
+    for (size_t count = 0; count < ring->slots.size(); count++) {
+        ReadbackSlot& candidate = ring->slots[ring->nextSlot];
+        ring->nextSlot = (ring->nextSlot + 1) % ring->slots.size();
+
+        if (candidate.state == READBACK_SLOT_FREE) {
+            slot = &candidate;
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        return VK_NULL_HANDLE;
+    }
+
+    // B.7. Record the copy commands.
+    {
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = NULL;
+        }
+
+        if (vkBeginCommandBuffer(slot->cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+    }
+
+    // B.7.1. Transition the source image to transfer source layout.
+    // The copy must wait for the color attachment (or blit) writes of the same submission.
+    VkImageMemoryBarrier imageMemoryBarrier;
+    {
+        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageMemoryBarrier.pNext = NULL;
+        imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageMemoryBarrier.oldLayout = imageLayout;
+        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.image = image;
+        imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    vkCmdPipelineBarrier(slot->cmdBuffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+
+    // B.7.2. Copy the image into the tightly packed staging buffer.
+    {
+        VkBufferImageCopy copyRegion;
+        {
+            copyRegion.bufferOffset = slot->bufferOffset;
+            copyRegion.bufferRowLength = 0;
+            copyRegion.bufferImageHeight = 0;
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.mipLevel = 0;
+            copyRegion.imageSubresource.baseArrayLayer = 0;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageOffset = { 0, 0, 0 };
+            copyRegion.imageExtent = { ring->width, ring->height, 1 };
+        }
+
+        vkCmdCopyImageToBuffer(slot->cmdBuffer,
+                               image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               slot->buffer,
+                               1, &copyRegion);
+    }
+
+    // B.7.3. Transition the source image back to its original layout (ex.: for presentation).
+    {
+        imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageMemoryBarrier.dstAccessMask = 0;
+        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageMemoryBarrier.newLayout = imageLayout;
+    }
+
+    // B.7.4. Make the buffer writes available for the host.
+    VkBufferMemoryBarrier bufferMemoryBarrier;
+    {
+        bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferMemoryBarrier.pNext = NULL;
+        bufferMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferMemoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferMemoryBarrier.buffer = slot->buffer;
+        bufferMemoryBarrier.offset = slot->bufferOffset;
+        bufferMemoryBarrier.size = ring->size;
+    }
+
+    vkCmdPipelineBarrier(slot->cmdBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, NULL, 1, &bufferMemoryBarrier, 1, &imageMemoryBarrier);
+
+    if (vkEndCommandBuffer(slot->cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    slot->fence = fence;
+    slot->state = READBACK_SLOT_IN_FLIGHT;
+    slot->frameIdx = frameIdx;
+
+    return slot->cmdBuffer;
+}
+
+inline ReadbackSlot *PollReadback(const VkDevice device, ReadbackRing *ring) {
+    ReadbackSlot *oldest = NULL;
+
+    for (size_t idx = 0; idx < ring->slots.size(); idx++) {
+        ReadbackSlot& slot = ring->slots[idx];
+
+        // B.8. Check if the submission containing the copy has finished.
+        // This does not block, if the fence is still pending the slot is checked again on the next poll.
+        if ((slot.state == READBACK_SLOT_IN_FLIGHT) && (vkGetFenceStatus(device, slot.fence) == VK_SUCCESS)) {
+            if (!ring->coherent && !slot.imported) {
+                VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, slot.memory.memory, slot.memory.offset, slot.memory.size };
+                vkInvalidateMappedMemoryRanges(device, 1, &range);
+            }
+
+            slot.fence = VK_NULL_HANDLE;
+            slot.state = READBACK_SLOT_READY;
+        }
+
+        if ((slot.state == READBACK_SLOT_READY) && ((oldest == NULL) || (slot.frameIdx < oldest->frameIdx))) {
+            oldest = &slot;
+        }
+    }
+
+    if (oldest != NULL) {
+        oldest->state = READBACK_SLOT_ACQUIRED;
+    }
+
+    return oldest;
+}
+
+inline void ReleaseReadback(ReadbackSlot *slot) {
+    slot->state = READBACK_SLOT_FREE;
+}
+
+inline void KeepNewestReadback(ReadbackSlot *slot, ReadbackSlot **kept) {
+    // PollReadback returns the oldest capture first, so a later slot is always newer.
+    if (*kept != NULL) {
+        ReleaseReadback(*kept);
+    }
+    *kept = slot;
+}
+
+inline void InitTracer(bool enabled) {
+    g_tracer.enabled = enabled;
+    g_tracer.origin = std::chrono::steady_clock::now();
+}
+
+inline void TraceRegisterThread(const char *threadName) {
+    if (!g_tracer.enabled) {
+        return;
+    }
+
+    // TC.1. The ring is allocated up front, recording a zone never allocates.
+    std::lock_guard<std::mutex> lock(g_tracer.registerMutex);
+    g_tracer.rings.emplace_back();
+
+    TraceRing& ring = g_tracer.rings.back();
+    ring.threadName = threadName;
+    ring.threadIdx = (uint32_t)(g_tracer.rings.size() - 1);
+    ring.events.resize(g_traceRingSize);
+    ring.writeCount.store(0);
+
+    t_traceRing = &ring;
+}
+
+inline uint64_t TraceNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_tracer.origin).count();
+}
+
+inline void TraceRecord(const char *name, uint64_t startNs, uint64_t endNs, bool gpu) {
+    TraceRing *ring = t_traceRing;
+    if (ring == NULL) {
+        return;
+    }
+
+    // TC.2. Only the owner thread writes the ring, the release store publishes the zone for the export.
+    const uint64_t writeIdx = ring->writeCount.load(std::memory_order_relaxed);
+    TraceEvent& event = ring->events[writeIdx % g_traceRingSize];
+    event.name = name;
+    event.startNs = startNs;
+    event.durationNs = (endNs > startNs) ? (endNs - startNs) : 0;
+    event.gpu = gpu;
+    ring->writeCount.store(writeIdx + 1, std::memory_order_release);
+}
+
+inline TraceZone::TraceZone(const char *zoneName)
+           : name((t_traceRing != NULL) ? zoneName : NULL)
+           , startNs((t_traceRing != NULL) ? TraceNow() : 0) {
+}
+
+inline TraceZone::~TraceZone() {
+    if (name != NULL) {
+        TraceRecord(name, startNs, TraceNow(), false);
+    }
+}
+
+inline void CalibrateTraceGpuClock(const VkPhysicalDevice physicalDevice,
+                                   const VkDevice device,
+                                   const VkQueue queue,
+                                   uint32_t queueFamilyIdx,
+                                   TraceGpuClock *outClock) {
+    // TC.3. Query the timestamp properties of the queue.
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t validBits = queueFamilies[queueFamilyIdx].timestampValidBits;
+    if (validBits == 0) {
+        throw std::runtime_error("failed to find timestamp support on the queue!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    outClock->timestampPeriod = properties.limits.timestampPeriod;
+    outClock->timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+
+    // TC.4. Create a single timestamp query, a Command Buffer which writes it and a Fence to wait for it.
+    VkQueryPool queryPool;
+    {
+        VkQueryPoolCreateInfo queryPoolInfo;
+        {
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.pNext = NULL;
+            queryPoolInfo.flags = 0;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 1;
+            queryPoolInfo.pipelineStatistics = 0;
+        }
+
+        if (vkCreateQueryPool(device, &queryPoolInfo, NULL, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+    }
+
+    VkCommandPool cmdPool;
+    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    VkCommandBuffer cmdBuffer;
+    {
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+        }
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    VkFence fence;
+    {
+        VkFenceCreateInfo fenceInfo;
+        {
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = NULL;
+            fenceInfo.flags = 0;
+        }
+
+        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create fence!");
+        }
+    }
+
+    {
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = NULL;
+        }
+
+        vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+        vkCmdResetQueryPool(cmdBuffer, queryPool, 0, 1);
+        vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+
+    // TC.5. The timestamp is written between the submit and the end of the fence wait,
+    // the middle of the two CPU times is used as its trace time, the error is at most half of the span.
+    VkSubmitInfo submitInfo;
+    {
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = NULL;
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = NULL;
+        submitInfo.pWaitDstStageMask = NULL;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuffer;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = NULL;
+    }
+
+    const uint64_t submitNs = TraceNow();
+    if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
+    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    const uint64_t waitNs = TraceNow();
+
+    uint64_t ticks;
+    VkResult result = vkGetQueryPoolResults(device, queryPool, 0, 1, sizeof(ticks), &ticks,
+                                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to get timestamp query results!");
+    }
+
+    outClock->baseTicks = ticks & outClock->timestampMask;
+    outClock->baseNs = submitNs + (waitNs - submitNs) / 2;
+    printf("Trace: GPU clock calibrated, error within %.3f ms\n", (waitNs - submitNs) / 2000000.0);
+
+    vkDestroyFence(device, fence, NULL);
+    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+    vkDestroyCommandPool(device, cmdPool, NULL);
+    vkDestroyQueryPool(device, queryPool, NULL);
+}
+
+inline void TraceGpuZone(const TraceGpuClock& clock, const char *name, uint64_t beginTicks, uint64_t endTicks) {
+    // TC.6. The ticks are counted from the calibration point, the mask handles a wrapped counter.
+    const uint64_t beginNs = clock.baseNs + (uint64_t)(((beginTicks - clock.baseTicks) & clock.timestampMask) * clock.timestampPeriod);
+    const uint64_t endNs = clock.baseNs + (uint64_t)(((endTicks - clock.baseTicks) & clock.timestampMask) * clock.timestampPeriod);
+    TraceRecord(name, beginNs, endNs, true);
+}
+
+inline void WriteTrace(const char *fileName) {
+    // TC.7. The traced threads are stopped, the rings are no longer written.
+    std::lock_guard<std::mutex> lock(g_tracer.registerMutex);
+
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", fileName);
+        return;
+    }
+
+    // Chrome trace event format, it can also be opened with Perfetto (ui.perfetto.dev).
+    // The times are in microseconds, every thread has a CPU and a GPU track.
+    uint64_t zoneCount = 0;
+    uint64_t overwrittenCount = 0;
+    const char *separator = "";
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (const TraceRing& ring : g_tracer.rings) {
+        const uint32_t cpuTrack = ring.threadIdx * 2;
+        const uint32_t gpuTrack = cpuTrack + 1;
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                separator, cpuTrack, ring.threadName);
+        separator = ",\n";
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s GPU\"}}",
+                separator, gpuTrack, ring.threadName);
+
+        const uint64_t writeCount = ring.writeCount.load(std::memory_order_acquire);
+        const uint64_t firstIdx = (writeCount > g_traceRingSize) ? (writeCount - g_traceRingSize) : 0;
+        for (uint64_t idx = firstIdx; idx < writeCount; idx++) {
+            const TraceEvent& event = ring.events[idx % g_traceRingSize];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    separator, event.name, event.gpu ? gpuTrack : cpuTrack, event.startNs / 1000.0, event.durationNs / 1000.0);
+        }
+
+        zoneCount += writeCount - firstIdx;
+        overwrittenCount += firstIdx;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Trace: %llu zones written to %s, %llu overwritten\n",
+           (unsigned long long)zoneCount, fileName, (unsigned long long)overwrittenCount);
+}
+
+inline void StartFrameWriter(CaptureFormat format,
+                             const std::string& outputPattern,
+                             FILE *stream,
+                             uint32_t width,
+                             uint32_t height,
+                             bool swapRB,
+                             FrameWriter *writer) {
+    writer->format = format;
+    writer->outputPattern = outputPattern;
+    writer->stream = stream;
+    writer->width = width;
+    writer->height = height;
+    writer->swapRB = swapRB;
+    writer->pending = 0;
+    writer->done = false;
+    writer->written = 0;
+    writer->dropped = 0;
+
+    // C.1. The frames stay in the readback slots, the writer has no pixel storage of its own.
+    writer->writtenSlots.reserve(g_captureQueueSize);
+
+    // C.2. The Y4M stream starts with a single header.
+    // The frame rate is only nominal, it can be overridden on the ffmpeg side with "-r".
+    if (format == CAPTURE_FORMAT_Y4M) {
+        fprintf(stream, "YUV4MPEG2 W%u H%u F30:1 Ip A1:1 C444\n", width, height);
+    }
+
+    writer->thread = std::thread(FrameWriterMain, writer);
+}
+
+inline bool QueueFrame(FrameWriter *writer, ReadbackSlot *slot) {
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        // Drop the frame instead of waiting for the writer thread.
+        if (writer->pending >= g_captureQueueSize) {
+            writer->dropped++;
+            ReleaseReadback(slot);
+            return false;
+        }
+
+        writer->queue.push_back(slot);
+        writer->pending++;
+    }
+    writer->cond.notify_one();
+
+    return true;
+}
+
+inline void ReclaimFrames(FrameWriter *writer) {
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    for (ReadbackSlot *slot : writer->writtenSlots) {
+        ReleaseReadback(slot);
+    }
+    writer->writtenSlots.clear();
+}
+
+inline void FlushFrameWriter(FrameWriter *writer) {
+    {
+        std::unique_lock<std::mutex> lock(writer->mutex);
+        writer->writtenCond.wait(lock, [writer] { return writer->pending == 0; });
+    }
+    ReclaimFrames(writer);
+}
+
+inline void StopFrameWriter(FrameWriter *writer) {
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->done = true;
+    }
+    writer->cond.notify_one();
+    writer->thread.join();
+
+    if (writer->stream != NULL) {
+        fclose(writer->stream);
+        writer->stream = NULL;
+    }
+
+    fprintf(stderr, "Capture: %llu frames written, %llu dropped\n",
+            (unsigned long long)writer->written, (unsigned long long)writer->dropped);
+}
+
+inline void FrameWriterMain(FrameWriter *writer) {
+    TraceRegisterThread("frame writer");
+
+    const size_t pixelCount = (size_t)writer->width * writer->height;
+    // Index of the R and B bytes in the captured pixels.
+    const size_t rIdx = writer->swapRB ? 2 : 0;
+    const size_t bIdx = writer->swapRB ? 0 : 2;
+
+    // Conversion buffer: three planes for Y4M, a swizzled copy for RGBA.
+    std::vector<uint8_t> output;
+    if (writer->format == CAPTURE_FORMAT_RGBA) {
+        output.resize(pixelCount * 4);
+    } else if (writer->format == CAPTURE_FORMAT_Y4M) {
+        output.resize(pixelCount * 3);
+    }
+
+    while (true) {
+        ReadbackSlot *slot;
+        {
+            std::unique_lock<std::mutex> lock(writer->mutex);
+            writer->cond.wait(lock, [writer] { return !writer->queue.empty() || writer->done; });
+
+            // Every queued frame is written before the thread exits.
+            if (writer->queue.empty()) {
+                break;
+            }
+
+            slot = writer->queue.front();
+            writer->queue.pop_front();
+        }
+
+        // The slot was invalidated by PollReadback, it is not touched by the render thread until it is reclaimed.
+        const uint8_t *pixels = slot->data;
+        TraceZone zone("write frame");
+
+        switch (writer->format) {
+        case CAPTURE_FORMAT_PPM: {
+            char fileName[512];
+            snprintf(fileName, sizeof(fileName), writer->outputPattern.c_str(), (unsigned int)writer->written);
+
+            WritePPM(fileName, pixels, writer->width, writer->height, (VkDeviceSize)writer->width * 4, writer->swapRB, false);
+            break;
+        }
+        case CAPTURE_FORMAT_Y4M: {
+            // BT.601 limited range RGB to YUV 4:4:4 conversion.
+            uint8_t *planeY = output.data();
+            uint8_t *planeU = planeY + pixelCount;
+            uint8_t *planeV = planeU + pixelCount;
+            for (size_t idx = 0; idx < pixelCount; idx++) {
+                const int r = pixels[idx * 4 + rIdx];
+                const int g = pixels[idx * 4 + 1];
+                const int b = pixels[idx * 4 + bIdx];
+
+                planeY[idx] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                planeU[idx] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                planeV[idx] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+
+            fputs("FRAME\n", writer->stream);
+            fwrite(output.data(), 1, output.size(), writer->stream);
+            break;
+        }
+        case CAPTURE_FORMAT_RGBA: {
+            const uint8_t *data = pixels;
+            if (writer->swapRB) {
+                for (size_t idx = 0; idx < pixelCount; idx++) {
+                    output[idx * 4 + 0] = pixels[idx * 4 + 2];
+                    output[idx * 4 + 1] = pixels[idx * 4 + 1];
+                    output[idx * 4 + 2] = pixels[idx * 4 + 0];
+                    output[idx * 4 + 3] = pixels[idx * 4 + 3];
+                }
+                data = output.data();
+            }
+
+            fwrite(data, 1, pixelCount * 4, writer->stream);
+            break;
+        }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(writer->mutex);
+            writer->writtenSlots.push_back(slot);
+            writer->pending--;
+            writer->written++;
+        }
+        writer->writtenCond.notify_all();
+    }
+
+    if (writer->stream != NULL) {
+        fflush(writer->stream);
+    }
+}
+
+inline void CreateBenchTimer(const VkPhysicalDevice physicalDevice,
+                             const VkDevice device,
+                             uint32_t queueFamilyIdx,
+                             uint32_t slotCount,
+                             BenchTimer *outTimer) {
+    // BT.1. Check the timestamp support of the queue.
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t validBits = queueFamilies[queueFamilyIdx].timestampValidBits;
+    if (validBits == 0) {
+        throw std::runtime_error("failed to find timestamp support on the queue!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    outTimer->timestampPeriod = properties.limits.timestampPeriod;
+    outTimer->timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+    outTimer->pending.assign(slotCount, false);
+
+    // BT.2. Create the query pool with a begin and an end query for each slot.
+    VkQueryPoolCreateInfo queryPoolInfo;
+    {
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.pNext = NULL;
+        queryPoolInfo.flags = 0;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = slotCount * 2;
+        queryPoolInfo.pipelineStatistics = 0;
+    }
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, NULL, &outTimer->queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    // BT.3. Create the Command Pool and the begin/end Command Buffers.
+    VkCommandPoolCreateInfo poolInfo;
+    {
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.pNext = NULL;
+        poolInfo.flags = 0;
+        poolInfo.queueFamilyIndex = queueFamilyIdx;
+    }
+
+    if (vkCreateCommandPool(device, &poolInfo, NULL, &outTimer->cmdPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create benchmark command pool!");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo;
+    {
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.pNext = NULL;
+        allocInfo.commandPool = outTimer->cmdPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = slotCount;
+    }
+
+    outTimer->beginCmdBuffers.resize(slotCount);
+    outTimer->endCmdBuffers.resize(slotCount);
+    if (vkAllocateCommandBuffers(device, &allocInfo, outTimer->beginCmdBuffers.data()) != VK_SUCCESS ||
+        vkAllocateCommandBuffers(device, &allocInfo, outTimer->endCmdBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate benchmark command buffers!");
+    }
+
+    // BT.4. Record the timestamp writes once, they are re-submitted for every frame of the slot.
+    // The begin query is written when the previous commands reach the top of the pipe,
+    // the end query when the draw commands of the same submission are fully done.
+    VkCommandBufferBeginInfo beginInfo;
+    {
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = NULL;
+        beginInfo.flags = 0;
+        beginInfo.pInheritanceInfo = NULL;
+    }
+
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        vkBeginCommandBuffer(outTimer->beginCmdBuffers[slot], &beginInfo);
+        vkCmdResetQueryPool(outTimer->beginCmdBuffers[slot], outTimer->queryPool, slot * 2, 2);
+        vkCmdWriteTimestamp(outTimer->beginCmdBuffers[slot], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, outTimer->queryPool, slot * 2);
+
+        vkBeginCommandBuffer(outTimer->endCmdBuffers[slot], &beginInfo);
+        vkCmdWriteTimestamp(outTimer->endCmdBuffers[slot], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, outTimer->queryPool, slot * 2 + 1);
+
+        if (vkEndCommandBuffer(outTimer->beginCmdBuffers[slot]) != VK_SUCCESS ||
+            vkEndCommandBuffer(outTimer->endCmdBuffers[slot]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record benchmark command buffer!");
+        }
+    }
+}
+
+inline void DestroyBenchTimer(const VkDevice device, BenchTimer *timer) {
+    // The caller must make sure that no query is in flight.
+    vkFreeCommandBuffers(device, timer->cmdPool, (uint32_t)timer->beginCmdBuffers.size(), timer->beginCmdBuffers.data());
+    vkFreeCommandBuffers(device, timer->cmdPool, (uint32_t)timer->endCmdBuffers.size(), timer->endCmdBuffers.data());
+    vkDestroyCommandPool(device, timer->cmdPool, NULL);
+    vkDestroyQueryPool(device, timer->queryPool, NULL);
+}
+
+inline void CollectBenchTimestamps(const VkDevice device, BenchTimer *timer, uint32_t slot) {
+    if (!timer->pending[slot]) {
+        return;
+    }
+
+    // BT.5. Read back the two timestamps of the slot.
+    // The fence of the frame already signaled, so the wait returns immediately.
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(device, timer->queryPool, slot * 2, 2, sizeof(timestamps), timestamps,
+                                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to get timestamp query results!");
+    }
+
+    const uint64_t ticks = (timestamps[1] - timestamps[0]) & timer->timestampMask;
+    timer->gpuTimes.push_back(ticks * timer->timestampPeriod / 1000000.0);
+    timer->pending[slot] = false;
+
+    // TC. The GPU zone of the frame is recorded on the main thread, which collects the timestamps.
+    if (g_tracer.enabled) {
+        TraceGpuZone(timer->traceClock, "gpu frame", timestamps[0], timestamps[1]);
+    }
+}
+
+// Value at the given percentile of the sorted samples (nearest rank).
+inline double Percentile(const std::vector<double>& sorted, double percentile) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+
+    size_t rank = (size_t)(percentile / 100.0 * sorted.size() + 0.999999);
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+inline void PrintBenchResults(const VkPhysicalDevice physicalDevice, const BenchTimer& timer, double totalSeconds) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<double> gpuTimes = timer.gpuTimes;
+    std::vector<double> cpuTimes = timer.cpuTimes;
+    std::sort(gpuTimes.begin(), gpuTimes.end());
+    std::sort(cpuTimes.begin(), cpuTimes.end());
+
+    // BT.6. Print one block which can be compared across drivers and commits.
+    printf("Bench: %s (driver 0x%x, api %u.%u.%u)\n", properties.deviceName, properties.driverVersion,
+           VK_VERSION_MAJOR(properties.apiVersion), VK_VERSION_MINOR(properties.apiVersion), VK_VERSION_PATCH(properties.apiVersion));
+    printf("Bench: %zu frames in %.3f s, %.1f FPS\n", cpuTimes.size(), totalSeconds,
+           (totalSeconds > 0.0) ? cpuTimes.size() / totalSeconds : 0.0);
+    printf("Bench: GPU time (ms): min %.4f median %.4f p99 %.4f\n",
+           Percentile(gpuTimes, 0.0), Percentile(gpuTimes, 50.0), Percentile(gpuTimes, 99.0));
+    printf("Bench: CPU record+submit time (ms): min %.4f median %.4f p99 %.4f\n",
+           Percentile(cpuTimes, 0.0), Percentile(cpuTimes, 50.0), Percentile(cpuTimes, 99.0));
+}
+
+inline VertexLayout ParseVertexLayout(const char *name) {
+    if (strcmp(name, "position") == 0) {
+        return VERTEX_LAYOUT_POSITION;
+    } else if (strcmp(name, "aos") == 0) {
+        return VERTEX_LAYOUT_AOS;
+    } else if (strcmp(name, "soa") == 0) {
+        return VERTEX_LAYOUT_SOA;
+    } else if (strcmp(name, "packed") == 0) {
+        return VERTEX_LAYOUT_PACKED;
+    }
+
+    throw std::runtime_error("unknown vertex layout!");
+}
+
+inline const char *VertexLayoutName(VertexLayout layout) {
+    switch (layout) {
+        case VERTEX_LAYOUT_POSITION: return "position";
+        case VERTEX_LAYOUT_AOS: return "aos";
+        case VERTEX_LAYOUT_SOA: return "soa";
+        case VERTEX_LAYOUT_PACKED: return "packed";
+    }
+
+    return "unknown";
+}
+
+// Half float conversion with round to nearest, values below the normal half range are flushed to zero.
+inline uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    ::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    const uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0) {
+        return (uint16_t)sign;
+    } else if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+
+    // The rounding carry can move into the exponent, so the parts are added.
+    return (uint16_t)(sign | (((uint32_t)exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+inline void AppendVertexData(std::vector<uint8_t> *data, const void *value, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(value);
+    data->insert(data->end(), bytes, bytes + size);
+}
+
+// Appends one attribute (location 0: position, 1: color, 2: UV, 3: normal) in the float or packed format.
+inline void AppendVertexAttribute(std::vector<uint8_t> *data, uint32_t location, bool packed, const float *value) {
+    static const uint32_t componentCounts[4] = { 2, 4, 2, 3 };
+
+    if (!packed) {
+        AppendVertexData(data, value, sizeof(float) * componentCounts[location]);
+    } else if (location == 1) {
+        uint8_t color[4];
+        for (uint32_t idx = 0; idx < 4; idx++) {
+            color[idx] = (uint8_t)(std::min(std::max(value[idx], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+        AppendVertexData(data, color, sizeof(color));
+    } else if (location == 3) {
+        // The [-1, 1] normal is mapped to [0, 1023], the shader reverts it (see "packedNormal").
+        uint32_t normal = 0;
+        for (uint32_t idx = 0; idx < 3; idx++) {
+            const float unorm = std::min(std::max(value[idx] * 0.5f + 0.5f, 0.0f), 1.0f);
+            normal |= (uint32_t)(unorm * 1023.0f + 0.5f) << (idx * 10);
+        }
+        AppendVertexData(data, &normal, sizeof(normal));
+    } else {
+        const uint16_t half[2] = { FloatToHalf(value[0]), FloatToHalf(value[1]) };
+        AppendVertexData(data, half, sizeof(half));
+    }
+}
+
+inline void BuildVertexLayout(const VkPhysicalDevice physicalDevice,
+                              VertexLayout layout,
+                              const std::vector<float>& positions,
+                              VertexLayoutData *outData) {
+    const uint32_t vertexCount = (uint32_t)(positions.size() / 2);
+
+    outData->layout = layout;
+    outData->vertexCount = vertexCount;
+    outData->bindings.clear();
+    outData->attributes.clear();
+    outData->bindingOffsets.clear();
+    outData->data.clear();
+
+    if (layout == VERTEX_LAYOUT_POSITION) {
+        outData->vertexSize = sizeof(float) * 2;
+        outData->bindingOffsets.push_back(0);
+        AppendVertexData(&outData->data, positions.data(), sizeof(float) * positions.size());
+        return;
+    }
+
+    // VL.6. Select the attribute formats, the locations match the "attributes.vert" shader.
+    const bool packed = (layout == VERTEX_LAYOUT_PACKED);
+    const VkFormat formats[4] = {
+        packed ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT,
+        packed ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32A32_SFLOAT,
+        packed ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT,
+        packed ? VK_FORMAT_A2B10G10R10_UNORM_PACK32 : VK_FORMAT_R32G32B32_SFLOAT,
+    };
+    const uint32_t sizes[4] = {
+        packed ? 4u : 8u,
+        packed ? 4u : 16u,
+        packed ? 4u : 8u,
+        packed ? 4u : 12u,
+    };
+    outData->vertexSize = sizes[0] + sizes[1] + sizes[2] + sizes[3];
+
+    // Not every packed format is required to be usable as a vertex attribute.
+    for (uint32_t location = 0; location < 4; location++) {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, formats[location], &formatProperties);
+
+        if ((formatProperties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) == 0) {
+            throw std::runtime_error("failed to find vertex buffer support for the vertex layout formats!");
+        }
+    }
+
+    // VL.7. Describe the bindings and attributes.
+    // The interleaved layouts use a single binding, the SoA layout a binding for each attribute.
+    const bool interleaved = (layout != VERTEX_LAYOUT_SOA);
+    uint32_t attributeOffset = 0;
+    for (uint32_t location = 0; location < 4; location++) {
+        VkVertexInputAttributeDescription attribute;
+        {
+            attribute.location = location;
+            attribute.binding = interleaved ? 0 : location;
+            attribute.format = formats[location];
+            attribute.offset = interleaved ? attributeOffset : 0;
+        }
+        outData->attributes.push_back(attribute);
+        attributeOffset += sizes[location];
+
+        if (!interleaved || (location == 0)) {
+            VkVertexInputBindingDescription binding;
+            {
+                binding.binding = location;
+                binding.stride = interleaved ? outData->vertexSize : sizes[location];
+                binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            }
+            outData->bindings.push_back(binding);
+        }
+    }
+
+    // VL.8. Fill the buffer, the SoA streams follow each other aligned to 16 bytes.
+    // Each triangle corner has its own color and UV, the normal faces the viewer.
+    static const float cornerColors[3][4] = {
+        { 1.0f, 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f, 1.0f },
+        { 0.0f, 0.0f, 1.0f, 1.0f },
+    };
+    static const float cornerUVs[3][2] = { { 0.5f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+    static const float normal[3] = { 0.0f, 0.0f, 1.0f };
+
+    const uint32_t streamCount = interleaved ? 1 : 4;
+    for (uint32_t stream = 0; stream < streamCount; stream++) {
+        outData->data.resize((outData->data.size() + 15) & ~(size_t)15, 0);
+        outData->bindingOffsets.push_back(outData->data.size());
+
+        for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+            const float *values[4] = { &positions[vertex * 2], cornerColors[vertex % 3], cornerUVs[vertex % 3], normal };
+
+            for (uint32_t location = 0; location < 4; location++) {
+                if (interleaved || (location == stream)) {
+                    AppendVertexAttribute(&outData->data, location, packed, values[location]);
+                }
+            }
+        }
+    }
+}
+
+inline void PrintVertexFetchReport(const VertexLayoutData& layoutData, uint64_t verticesPerFrame, const BenchTimer& timer) {
+    std::vector<double> gpuTimes = timer.gpuTimes;
+    std::sort(gpuTimes.begin(), gpuTimes.end());
+
+    // VL.9. The fetched bytes are an upper bound, the post-transform cache can skip repeated vertices.
+    const double gpuMedian = Percentile(gpuTimes, 50.0);
+    const double frameBytes = (double)layoutData.vertexSize * verticesPerFrame;
+    printf("Bench: vertex layout %s, %u bytes/vertex, %zu binding(s), %.1f KiB/frame, %.3f GB/s at the median GPU time\n",
+           VertexLayoutName(layoutData.layout), layoutData.vertexSize, layoutData.bindingOffsets.size(),
+           frameBytes / 1024.0, (gpuMedian > 0.0) ? frameBytes / (gpuMedian * 1000000.0) : 0.0);
+}
+
+inline VkPresentModeKHR ParsePresentMode(const char *name) {
+    if (strcmp(name, "fifo") == 0) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    } else if (strcmp(name, "fifo_relaxed") == 0) {
+        return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    } else if (strcmp(name, "mailbox") == 0) {
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if (strcmp(name, "immediate") == 0) {
+        return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    }
+
+    throw std::runtime_error("unknown present mode!");
+}
+
+inline const char *PresentModeName(VkPresentModeKHR mode) {
+    switch (mode) {
+        case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+        default: return "unknown";
+    }
+}
+
+inline VkPresentModeKHR SelectPresentMode(const VkPhysicalDevice physicalDevice, const VkSurfaceKHR surface, VkPresentModeKHR requested) {
+    // FP.1. Query the presentation modes of the surface.
+    uint32_t presentModeCount;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, NULL);
+
+    std::vector<VkPresentModeKHR> presentModes;
+    presentModes.resize(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
+
+    // FP.2. By standard the FIFO presentation mode is always available, it is the fallback.
+    if (std::find(presentModes.begin(), presentModes.end(), requested) != presentModes.end()) {
+        return requested;
+    }
+
+    printf("Present mode: %s is not supported by the surface, using fifo\n", PresentModeName(requested));
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+inline void InitFramePacer(double maxFps, bool logFrames, FramePacer *outPacer) {
+    outPacer->frameInterval = std::chrono::steady_clock::duration::zero();
+    if (maxFps > 0.0) {
+        outPacer->frameInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / maxFps));
+    }
+    outPacer->nextFrame = std::chrono::steady_clock::now();
+    outPacer->logFrames = logFrames;
+    outPacer->frameCount = 0;
+    outPacer->latencySum = 0.0;
+    outPacer->latencyMax = 0.0;
+}
+
+inline void PaceFrame(FramePacer *pacer) {
+    if (pacer->frameInterval == std::chrono::steady_clock::duration::zero()) {
+        return;
+    }
+
+    // FP.3. Sleep until the start of the next frame.
+    // A late frame moves the schedule instead of rendering the missed frames in a burst.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < pacer->nextFrame) {
+        std::this_thread::sleep_until(pacer->nextFrame);
+        now = pacer->nextFrame;
+    }
+    pacer->nextFrame = now + pacer->frameInterval;
+}
+
+inline void RecordFrameLatency(FramePacer *pacer, uint32_t imageIndex, double latency) {
+    if (pacer->logFrames) {
+        printf("Frame %llu: image %u, acquire->present %.3f ms\n", (unsigned long long)pacer->frameCount, imageIndex, latency);
+    }
+
+    pacer->frameCount++;
+    pacer->latencySum += latency;
+    pacer->latencyMax = std::max(pacer->latencyMax, latency);
+}
+
+inline void PrintFrameLatency(const FramePacer& pacer) {
+    if (pacer.frameCount == 0) {
+        return;
+    }
+
+    printf("Latency: %llu frames, acquire->present avg %.3f ms, max %.3f ms\n",
+           (unsigned long long)pacer.frameCount, pacer.latencySum / pacer.frameCount, pacer.latencyMax);
+}
+
+inline CommandStrategy ParseCommandStrategy(const char *name) {
+    if (strcmp(name, "prerecorded") == 0) {
+        return COMMAND_STRATEGY_PRERECORDED;
+    } else if (strcmp(name, "per_frame") == 0) {
+        return COMMAND_STRATEGY_PER_FRAME;
+    }
+
+    throw std::runtime_error("unknown command strategy!");
+}
+
+inline void CreateFrameCommandPools(const VkDevice device,
+                                    uint32_t queueFamilyIdx,
+                                    uint32_t count,
+                                    std::vector<FrameCommandPool> *outPools) {
+    outPools->resize(count);
+    for (FrameCommandPool& pool : *outPools) {
+        // CB.1.1. The Command Buffers only live for one frame: the pool is transient and
+        // it is reset as a whole, so the individual reset flag is not needed.
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &pool.cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+
+        // CB.1.2. The Command Buffer is allocated once and re-recorded after each pool reset.
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = pool.cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+        }
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &pool.cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+}
+
+inline void DestroyFrameCommandPools(const VkDevice device, std::vector<FrameCommandPool> *pools) {
+    for (FrameCommandPool& pool : *pools) {
+        vkDestroyCommandPool(device, pool.cmdPool, NULL);
+    }
+    pools->clear();
+}
+
+inline void PrintCommandStrategyResults(CommandStrategy strategy, const std::vector<double>& recordTimes) {
+    std::vector<double> sorted = recordTimes;
+    std::sort(sorted.begin(), sorted.end());
+
+    // CB.3. The pre-recorded Command Buffers cost nothing per frame, their recording is a one time cost
+    // (repeated after each resize). The per frame recording is also part of the CPU record+submit time.
+    if (strategy == COMMAND_STRATEGY_PRERECORDED) {
+        double total = 0.0;
+        for (double time : recordTimes) {
+            total += time;
+        }
+        printf("Bench: command strategy prerecorded, %zu recordings, %.4f ms in total, 0 ms per frame\n", sorted.size(), total);
+    } else {
+        printf("Bench: command strategy per_frame, pool reset+record time (ms): min %.4f median %.4f p99 %.4f\n",
+               Percentile(sorted, 0.0), Percentile(sorted, 50.0), Percentile(sorted, 99.0));
+    }
+}
+
+inline VkSwapchainKHR CreateSwapchain(const VkPhysicalDevice physicalDevice,
+                                      const VkDevice device,
+                                      const VkSurfaceKHR surface,
+                                      const SwapchainConfig& config,
+                                      const VkSwapchainKHR oldSwapchain,
+                                      VkExtent2D *extent,
+                                      VkPresentModeKHR *outPresentMode) {
+    // G.5.1. Query the surface capabilities and select the swapchain's extent (width, height).
+    // If the surface does not dictate the extent the requested (window framebuffer) size is used within the limits.
+    VkSurfaceCapabilitiesKHR surfaceCapabilities;
+    {
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+
+        if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
+            *extent = surfaceCapabilities.currentExtent;
+        } else {
+            extent->width = std::max(surfaceCapabilities.minImageExtent.width, std::min(surfaceCapabilities.maxImageExtent.width, extent->width));
+            extent->height = std::max(surfaceCapabilities.minImageExtent.height, std::min(surfaceCapabilities.maxImageExtent.height, extent->height));
+        }
+    }
+
+    if ((surfaceCapabilities.supportedUsageFlags & config.imageUsage) != config.imageUsage) {
+        throw std::runtime_error("failed to find the required swapchain image usage!");
+    }
+
+    // G.5.3. Select the requested presentation mode if the surface supports it.
+    *outPresentMode = SelectPresentMode(physicalDevice, surface, config.requestedPresentMode);
+
+    // G.5.4. Specify the number of images in the swap chain.
+    // For better performance using "min + 1", unless a count is requested.
+    // A zero maxImageCount means that there is no upper limit.
+    uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
+    if (config.requestedImageCount > 0) {
+        imageCount = std::max(config.requestedImageCount, surfaceCapabilities.minImageCount);
+    }
+    if ((surfaceCapabilities.maxImageCount > 0) && (imageCount > surfaceCapabilities.maxImageCount)) {
+        imageCount = surfaceCapabilities.maxImageCount;
+    }
+
+    VkSwapchainCreateInfoKHR createInfo;
+    {
+        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        createInfo.pNext = NULL;
+        createInfo.flags = 0;
+        createInfo.surface = surface;
+        createInfo.minImageCount = imageCount;
+        createInfo.imageFormat = config.surfaceFormat.format;
+        createInfo.imageColorSpace = config.surfaceFormat.colorSpace;
+        createInfo.imageExtent = *extent;
+        createInfo.imageArrayLayers = 1;
+        createInfo.imageUsage = config.imageUsage;
+        // If the graphics and presentation queue is different this should not be exclusive.
+        createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        createInfo.queueFamilyIndexCount = 0;
+        createInfo.pQueueFamilyIndices = NULL;
+        createInfo.preTransform = surfaceCapabilities.currentTransform;
+        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        createInfo.presentMode = *outPresentMode;
+        createInfo.clipped = VK_TRUE;
+        // SC. The old Swapchain (if any) lets the presentation engine hand over its resources.
+        // It is retired by this call, but must still be destroyed by the caller.
+        createInfo.oldSwapchain = oldSwapchain;
+    }
+
+    VkSwapchainKHR swapchain;
+    if (vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create swap chain!");
+    }
+
+    return swapchain;
+}
+
+inline std::vector<VkImage> GetSwapchainImages(const VkDevice device, const VkSwapchainKHR swapchain) {
+    uint32_t imageCount;
+    vkGetSwapchainImagesKHR(device, swapchain, &imageCount, NULL);
+
+    std::vector<VkImage> swapImages(imageCount);
+    vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapImages.data());
+
+    return swapImages;
+}
+
+#if defined(GLFW_VERSION_MAJOR)
+inline void FramebufferResizeCallback(GLFWwindow *window, int width, int height) {
+    (void)width;
+    (void)height;
+
+    // SC. Only flag the resize, the Swapchain is re-created at the start of the next frame.
+    bool *resized = static_cast<bool*>(glfwGetWindowUserPointer(window));
+    *resized = true;
+}
+#endif
+
+#endif // VKDEMO_H
@@ -0,0 +1,423 @@
+/**
+ * Single file micro-benchmark of the PPM writers used by the demos.
+ *
+ * Compares the old per-pixel "ofstream::write(row, 3)" loop with the packed
+ * RGBA to RGB writer (scalar and SIMD pack, single write call or mmap).
+ * No Vulkan is required, the input is a random RGBA image in memory.
+ *
+ * Before the measurements every pack mode and writer is checked against a scalar
+ * reference (odd widths, SIMD block edges and padded rows). Any mismatch is
+ * reported and the benchmark exits with 1.
+ *
+ * Compile:
+ * $ g++ -O2 ppmbench.cpp -o ppmbench -std=c++11
+ *
+ * Run:
+ * $ ./ppmbench
+ *
+ * Env variables:
+ * DEMO_OUTPUT: Output PPM file name, overwritten by every run. Default: ppmbench.ppm
+ * DEMO_IMAGE_WIDTH: Width of the test image. Default: 3840
+ * DEMO_IMAGE_HEIGHT: Height of the test image. Default: 2160
+ * DEMO_ROW_PADDING: Extra bytes at the end of each input row (rowPitch test). Default: 0
+ * DEMO_ITERATIONS: Number of runs of each variant, the median is reported. Default: 5
+ *
+ * Dependencies:
+ *  * C++11
+ *  * POSIX (open, write, mmap)
+ *
+ * MIT License
+ * Copyright (c) 2024 elecro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_SSSE3_PACK 1
+#include <tmmintrin.h>
+#else
+#define HAVE_SSSE3_PACK 0
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum PackMode {
+    PACK_SCALAR,
+    PACK_SIMD,
+};
+
+static void PackRGBAToRGB(const uint8_t *src, uint8_t *dst, uint32_t pixelCount, PackMode mode);
+static void WriteLegacyPPM(const std::string& fileName, const uint8_t *data, uint32_t width, uint32_t height, size_t rowPitch);
+static void WritePPM(const std::string& fileName,
+                     const uint8_t *data,
+                     uint32_t width,
+                     uint32_t height,
+                     size_t rowPitch,
+                     PackMode mode,
+                     bool useMmap);
+static uint32_t VerifyWriters(const std::string& fileName);
+
+static void FillRandom(std::vector<uint8_t> *data, uint32_t seed) {
+    uint32_t state = seed;
+    for (size_t idx = 0; idx < data->size(); idx++) {
+        state = state * 1664525u + 1013904223u;
+        (*data)[idx] = (uint8_t)(state >> 24);
+    }
+}
+
+static std::vector<uint8_t> ReadFile(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static uint32_t EnvValue(const char *name, uint32_t defaultValue) {
+    const char *value = getenv(name);
+    if ((value == NULL) || (atoi(value) <= 0)) {
+        return defaultValue;
+    }
+    return atoi(value);
+}
+
+// Runs the given function "iterations" times and returns the median time in milliseconds.
+template<typename FUNC>
+static double MeasureMedian(uint32_t iterations, const FUNC& func) {
+    std::vector<double> times;
+    for (uint32_t idx = 0; idx < iterations; idx++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    const char *envOutputName = getenv("DEMO_OUTPUT");
+    const std::string outputFileName = (envOutputName != NULL) ? envOutputName : "ppmbench.ppm";
+    const uint32_t width = EnvValue("DEMO_IMAGE_WIDTH", 3840);
+    const uint32_t height = EnvValue("DEMO_IMAGE_HEIGHT", 2160);
+    const uint32_t rowPadding = getenv("DEMO_ROW_PADDING") != NULL ? atoi(getenv("DEMO_ROW_PADDING")) : 0;
+    const uint32_t iterations = EnvValue("DEMO_ITERATIONS", 5);
+    const size_t rowPitch = (size_t)width * 4 + rowPadding;
+
+    printf("Image: %ux%u rowPitch = %zu, iterations: %u\n", width, height, rowPitch, iterations);
+    printf("Output: %s\n", outputFileName.c_str());
+    printf("SIMD pack: %s\n", HAVE_SSSE3_PACK ? "SSSE3 (runtime check)" : "NEON or none");
+
+    // 0. Check every variant against the scalar reference before measuring anything.
+    const uint32_t verifyFailures = VerifyWriters(outputFileName);
+    if (verifyFailures > 0) {
+        fprintf(stderr, "Verify: %u mismatch(es), the benchmark is not run\n", verifyFailures);
+        unlink(outputFileName.c_str());
+        return 1;
+    }
+
+    // 1. Create a random RGBA input image.
+    std::vector<uint8_t> image(rowPitch * height);
+    FillRandom(&image, 0x12345678);
+
+    // 2. Measure the pack kernels without any I/O.
+    std::vector<uint8_t> packed((size_t)width * height * 3);
+    const double megaBytes = (double)width * height * 4 / (1024.0 * 1024.0);
+    const PackMode packModes[] = { PACK_SCALAR, PACK_SIMD };
+    const char *packNames[] = { "scalar", "simd" };
+    for (uint32_t modeIdx = 0; modeIdx < 2; modeIdx++) {
+        const PackMode mode = packModes[modeIdx];
+        double ms = MeasureMedian(iterations, [&]() {
+            for (uint32_t y = 0; y < height; y++) {
+                PackRGBAToRGB(image.data() + y * rowPitch, packed.data() + (size_t)y * width * 3, width, mode);
+            }
+        });
+        printf("pack %-6s          : %8.3f ms (%7.1f MiB/s input)\n", packNames[modeIdx], ms, megaBytes / (ms / 1000.0));
+    }
+
+    // 3. Measure the complete PPM writers.
+    double legacyMs = MeasureMedian(iterations, [&]() {
+        WriteLegacyPPM(outputFileName, image.data(), width, height, rowPitch);
+    });
+    printf("ofstream per pixel   : %8.3f ms\n", legacyMs);
+    const std::vector<uint8_t> reference = ReadFile(outputFileName);
+
+    struct Variant {
+        const char *name;
+        PackMode mode;
+        bool useMmap;
+    };
+    const Variant variants[] = {
+        { "scalar + write      ", PACK_SCALAR, false },
+        { "simd + write        ", PACK_SIMD, false },
+        { "simd + mmap         ", PACK_SIMD, true },
+    };
+    uint32_t mismatchCount = 0;
+    for (const Variant& variant : variants) {
+        double ms = MeasureMedian(iterations, [&]() {
+            WritePPM(outputFileName, image.data(), width, height, rowPitch, variant.mode, variant.useMmap);
+        });
+
+        // The output must match the old writer byte by byte.
+        const std::vector<uint8_t> result = ReadFile(outputFileName);
+        printf("%s : %8.3f ms (%5.1fx)\n", variant.name, ms, legacyMs / ms);
+        if (result != reference) {
+            fprintf(stderr, "MISMATCH: %s output differs from the ofstream writer\n", variant.name);
+            mismatchCount++;
+        }
+    }
+
+    unlink(outputFileName.c_str());
+
+    return (mismatchCount > 0) ? 1 : 0;
+}
+
+uint32_t VerifyWriters(const std::string& fileName) {
+    // V.1. Odd widths, widths around the 16 pixel SIMD blocks and padded rows (also not a multiple of 4 bytes).
+    const uint32_t widths[] = { 1, 3, 15, 16, 17, 31, 32, 33, 47, 63, 65, 257 };
+    const uint32_t paddings[] = { 0, 3, 4, 12, 64 };
+    const uint32_t height = 3;
+    // Guard bytes after each packed row catch SIMD stores past the end of the row.
+    const size_t guardSize = 64;
+    const uint8_t guardValue = 0xCD;
+
+    const PackMode packModes[] = { PACK_SCALAR, PACK_SIMD };
+    const char *packNames[] = { "scalar", "simd" };
+
+    uint32_t failures = 0;
+    uint32_t caseCount = 0;
+    for (uint32_t width : widths) {
+        for (uint32_t padding : paddings) {
+            const size_t rowPitch = (size_t)width * 4 + padding;
+            const size_t rowSize = (size_t)width * 3;
+
+            std::vector<uint8_t> image(rowPitch * height);
+            FillRandom(&image, width * 131 + padding);
+
+            // V.2. The reference does not use any of the pack kernels.
+            std::vector<uint8_t> expected(rowSize * height);
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) {
+                    memcpy(&expected[y * rowSize + x * 3], &image[y * rowPitch + x * 4], 3);
+                }
+            }
+
+            // V.3. The pack kernels, one row at a time like the writers.
+            for (uint32_t modeIdx = 0; modeIdx < 2; modeIdx++) {
+                bool match = true;
+                for (uint32_t y = 0; y < height; y++) {
+                    std::vector<uint8_t> packed(rowSize + guardSize, guardValue);
+                    PackRGBAToRGB(image.data() + y * rowPitch, packed.data(), width, packModes[modeIdx]);
+
+                    match = match && (memcmp(packed.data(), &expected[y * rowSize], rowSize) == 0);
+                    match = match && (std::count(packed.begin() + rowSize, packed.end(), guardValue) == (ptrdiff_t)guardSize);
+                }
+
+                caseCount++;
+                if (!match) {
+                    fprintf(stderr, "MISMATCH: pack %s width = %u padding = %u\n", packNames[modeIdx], width, padding);
+                    failures++;
+                }
+            }
+
+            // V.4. The complete files of every writer: header and the packed pixels.
+            char header[64];
+            const int headerSize = snprintf(header, sizeof(header), "P6\n%u\n%u\n255\n", width, height);
+            std::vector<uint8_t> expectedFile(header, header + headerSize);
+            expectedFile.insert(expectedFile.end(), expected.begin(), expected.end());
+
+            for (uint32_t writerIdx = 0; writerIdx < 4; writerIdx++) {
+                static const char *writerNames[] = { "ofstream", "scalar + write", "simd + write", "simd + mmap" };
+                if (writerIdx == 0) {
+                    WriteLegacyPPM(fileName, image.data(), width, height, rowPitch);
+                } else {
+                    WritePPM(fileName, image.data(), width, height, rowPitch,
+                             (writerIdx == 1) ? PACK_SCALAR : PACK_SIMD, (writerIdx == 3));
+                }
+
+                const std::vector<uint8_t> result = ReadFile(fileName);
+
+                caseCount++;
+                if ((result.size() != expectedFile.size())
+                    || (memcmp(result.data(), expectedFile.data(), expectedFile.size()) != 0)) {
+                    fprintf(stderr, "MISMATCH: %s width = %u padding = %u\n", writerNames[writerIdx], width, padding);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    printf("Verify: %u case(s), %u mismatch(es)\n", caseCount, failures);
+
+    return failures;
+}
+
+// The current loop of the demos before the packed writer.
+void WriteLegacyPPM(const std::string& fileName, const uint8_t *data, uint32_t width, uint32_t height, size_t rowPitch) {
+    std::ofstream file(fileName, std::ios::out | std::ios::binary);
+    // ppm header
+    file << "P6\n" << width << "\n" << height << "\n" << 255 << "\n";
+
+    // ppm binary pixel data
+    // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t*)data;
+        for (uint32_t x = 0; x < width; x++) {
+            // Only copy the RGB values (3)
+            file.write((const char*)row, 3);
+            row++;
+        }
+
+        data += rowPitch;
+    }
+    file.close();
+}
+
+#if HAVE_SSSE3_PACK
+// Same kernel as in the demos.
+__attribute__((target("ssse3")))
+static uint32_t PackRGBAToRGBSSSE3(const uint8_t *src, uint8_t *dst, uint32_t pixelCount) {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    uint32_t idx = 0;
+    for (; idx + 16 <= pixelCount; idx += 16) {
+        const __m128i *in = (const __m128i*)(src + idx * 4);
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), mask);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+        const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+        const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+
+        __m128i *out = (__m128i*)(dst + idx * 3);
+        _mm_storeu_si128(out + 0, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+
+    return idx;
+}
+#endif
+
+void PackRGBAToRGB(const uint8_t *src, uint8_t *dst, uint32_t pixelCount, PackMode mode) {
+    uint32_t idx = 0;
+
+    if (mode == PACK_SIMD) {
+#if HAVE_SSSE3_PACK
+        static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+        if (hasSSSE3) {
+            idx = PackRGBAToRGBSSSE3(src, dst, pixelCount);
+        }
+#elif defined(__ARM_NEON)
+        for (; idx + 16 <= pixelCount; idx += 16) {
+            const uint8x16x4_t rgba = vld4q_u8(src + idx * 4);
+            uint8x16x3_t rgb;
+            rgb.val[0] = rgba.val[0];
+            rgb.val[1] = rgba.val[1];
+            rgb.val[2] = rgba.val[2];
+            vst3q_u8(dst + idx * 3, rgb);
+        }
+#endif
+    }
+
+    for (; idx < pixelCount; idx++) {
+        dst[idx * 3 + 0] = src[idx * 4 + 0];
+        dst[idx * 3 + 1] = src[idx * 4 + 1];
+        dst[idx * 3 + 2] = src[idx * 4 + 2];
+    }
+}
+
+void WritePPM(const std::string& fileName,
+              const uint8_t *data,
+              uint32_t width,
+              uint32_t height,
+              size_t rowPitch,
+              PackMode mode,
+              bool useMmap) {
+    char header[64];
+    const int headerSize = snprintf(header, sizeof(header), "P6\n%u\n%u\n255\n", width, height);
+    const size_t rowSize = (size_t)width * 3;
+    const size_t fileSize = headerSize + rowSize * height;
+
+    int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", fileName.c_str());
+        return;
+    }
+
+    uint8_t *output = NULL;
+    std::vector<uint8_t> buffer;
+    if (useMmap) {
+        if (ftruncate(fd, fileSize) == 0) {
+            void *mapped = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) {
+                output = (uint8_t*)mapped;
+            }
+        }
+
+        if (output == NULL) {
+            fprintf(stderr, "Failed to map '%s', falling back to write\n", fileName.c_str());
+            useMmap = false;
+        }
+    }
+
+    if (!useMmap) {
+        buffer.resize(fileSize);
+        output = buffer.data();
+    }
+
+    memcpy(output, header, headerSize);
+    for (uint32_t y = 0; y < height; y++) {
+        PackRGBAToRGB(data + y * rowPitch, output + headerSize + y * rowSize, width, mode);
+    }
+
+    if (useMmap) {
+        munmap(output, fileSize);
+    } else {
+        size_t offset = 0;
+        while (offset < fileSize) {
+            ssize_t written = write(fd, output + offset, fileSize - offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+                break;
+            }
+            offset += written;
+        }
+    }
+
+    close(fd);
+}
@@ -1,51 +1,278 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <cerrno>
 #include <cstring>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
-
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
-
 struct Vulkan2DImage {
     VkImage vkImage;
-    VkDeviceMemory vkMemory;
+    ArenaAllocation vkMemory;
     VkImageView vkImageView;
     uint32_t width;
     uint32_t height;
 };
 
-void DestroyVulkanImage(VkDevice device, struct Vulkan2DImage* img);
+void DestroyVulkanImage(VkDevice device, MemoryArena *arena, struct Vulkan2DImage* img);
 
 static bool CreateVulkan2DImage(
     VkDevice device,
-    VkPhysicalDevice physicalDevice,
+    MemoryArena *arena,
     VkFormat renderImageFormat,
     uint32_t renderImageWidth,
     uint32_t renderImageHeight,
+    const std::vector<uint32_t>& queueFamilies,
     Vulkan2DImage& out);
 
-void DumpImage(VkDevice device, Vulkan2DImage& img, std::string outputFileName);
+void DumpImage(VkDevice device,
+               const ArenaAllocation& memory,
+               uint32_t width,
+               uint32_t height,
+               std::string outputFileName,
+               bool useMmap);
+
+enum FilterKernel {
+    FILTER_KERNEL_INVERT,
+    FILTER_KERNEL_BLUR,
+    FILTER_KERNEL_BLUR_TILED,
+    FILTER_KERNEL_COUNT,
+};
+
+// GLSL source of each filter kernel, without shaderc the "<name>.spv" file is loaded.
+const char *g_filterKernelShaders[FILTER_KERNEL_COUNT] = { "compute.comp", "blur.comp", "blur_tiled.comp" };
+
+// Work group size of the filter kernels, specialized at pipeline creation.
+struct WorkGroupSize {
+    uint32_t x;
+    uint32_t y;
+};
+
+const WorkGroupSize g_defaultWorkGroupSize = { 16, 16 };
+
+// Work group shapes tried by the autotuner, the ones over the device limits are skipped.
+const WorkGroupSize g_workGroupCandidates[] = {
+    { 8, 8 }, { 16, 8 }, { 8, 16 }, { 16, 16 }, { 32, 8 }, { 8, 32 },
+    { 32, 16 }, { 32, 32 }, { 64, 1 }, { 128, 1 }, { 256, 1 }, { 64, 4 },
+};
+// The tiled blur kernel loads this many extra texels on both sides of a tile line.
+const int32_t g_maxBlurRadius = 8;
+
+struct FilterPass {
+    FilterKernel kernel;
+    int32_t direction[2];
+};
+
+// Push constant block of the filter kernels.
+struct FilterPushConstants {
+    int32_t direction[2];
+    int32_t radius;
+};
+
+static std::vector<FilterPass> ParseFilterPasses(const char *passList, bool tiledBlur);
+static std::vector<uint32_t> LoadComputeShaderCode(const std::string& name);
+static VkShaderModule CreateComputeShader(const VkDevice device, const std::vector<uint32_t>& shaderCode);
+static VkBuffer CreateHostBuffer(MemoryArena *arena,
+                                 VkDeviceSize size,
+                                 VkBufferUsageFlags usage,
+                                 ArenaAllocation *outMemory);
+static void RecordImageBarrier(VkCommandBuffer cmdBuffer,
+                               VkImage image,
+                               VkPipelineStageFlags srcStage,
+                               VkAccessFlags srcAccess,
+                               VkImageLayout oldLayout,
+                               VkPipelineStageFlags dstStage,
+                               VkAccessFlags dstAccess,
+                               VkImageLayout newLayout);
+
+// Descriptor sets of a filter target: the input and output image (index into FilterTarget::images) of each.
+// The first pass reads the source image, the others read the output of the previous pass.
+const uint32_t g_filterSetCount = 3;
+const uint32_t g_filterSetImages[g_filterSetCount][2] = { { 0, 1 }, { 1, 2 }, { 2, 1 } };
+
+// Images of a single filter chain: [0] is the source, the passes write [1] and [2] in turns.
+struct FilterTarget {
+    Vulkan2DImage images[3];
+    VkDescriptorSet sets[g_filterSetCount];
+};
+
+// Objects shared by all filter targets.
+struct FilterContext {
+    VkDevice device;
+    MemoryArena *arena;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipelines[FILTER_KERNEL_COUNT];
+    // Queue families accessing the images, with more than one the images are shared concurrently.
+    std::vector<uint32_t> queueFamilies;
+    std::vector<FilterPass> passes;
+    int32_t blurRadius;
+    WorkGroupSize groupSize;
+};
+
+static bool WorkGroupSizeSupported(const VkPhysicalDeviceProperties& properties, const WorkGroupSize& size);
+static void CreateFilterPipelines(const VkDevice device,
+                                  const VkPipelineCache pipelineCache,
+                                  const VkPipelineLayout pipelineLayout,
+                                  const VkShaderModule shaders[FILTER_KERNEL_COUNT],
+                                  const bool kernelUsed[FILTER_KERNEL_COUNT],
+                                  const WorkGroupSize& groupSize,
+                                  VkPipeline outPipelines[FILTER_KERNEL_COUNT]);
+static void DestroyFilterPipelines(const VkDevice device, VkPipeline pipelines[FILTER_KERNEL_COUNT]);
+static WorkGroupSize AutotuneWorkGroupSize(const VkPhysicalDevice physicalDevice,
+                                           VkQueue queue,
+                                           uint32_t queueFamilyIdx,
+                                           const VkPipelineCache pipelineCache,
+                                           const VkShaderModule shaders[FILTER_KERNEL_COUNT],
+                                           const bool kernelUsed[FILTER_KERNEL_COUNT],
+                                           FilterContext context,
+                                           uint32_t width,
+                                           uint32_t height);
+static bool LoadWorkGroupSize(const std::string& fileName, const VkPhysicalDeviceProperties& properties, WorkGroupSize *outSize);
+static void SaveWorkGroupSize(const std::string& fileName, const VkPhysicalDeviceProperties& properties, const WorkGroupSize& size);
+static void CreateFilterTarget(const FilterContext& context, uint32_t width, uint32_t height, FilterTarget *outTarget);
+static void DestroyFilterTarget(const FilterContext& context, FilterTarget *target);
+static void RecordUpload(VkCommandBuffer cmdBuffer,
+                         VkBuffer buffer,
+                         const Vulkan2DImage& image,
+                         VkPipelineStageFlags dstStage,
+                         VkAccessFlags dstAccess);
+static VkImage RecordFilterPasses(VkCommandBuffer cmdBuffer,
+                                  const FilterContext& context,
+                                  const FilterTarget& target,
+                                  VkPipelineStageFlags dstStage,
+                                  VkAccessFlags dstAccess);
+static void RecordDownload(VkCommandBuffer cmdBuffer, VkImage image, uint32_t width, uint32_t height, VkBuffer buffer);
+static void RunSingleImage(const FilterContext& context,
+                           VkQueue queue,
+                           uint32_t queueFamilyIdx,
+                           uint32_t imageWidth,
+                           uint32_t imageHeight,
+                           const std::string& outputFileName,
+                           bool useMmap);
+
+struct DecodedImage {
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    // Tightly packed RGBA pixels.
+    std::vector<uint8_t> pixels;
+};
+
+// Images decoded by the loader thread ahead of the GPU.
+struct BatchLoader {
+    std::vector<std::string> files;
+    size_t capacity;
+    std::deque<DecodedImage> decoded;
+    bool finished;
+    bool stopRequested;
+    // Only written by the loader thread.
+    uint32_t failedCount;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+struct BatchSlot {
+    // Size of the slot resources, 0 if they are not created yet.
+    uint32_t width;
+    uint32_t height;
+    FilterTarget target;
+    VkBuffer uploadBuffer;
+    ArenaAllocation uploadMemory;
+    VkBuffer readbackBuffer;
+    ArenaAllocation readbackMemory;
+    // Upload, filter and download command buffers.
+    VkCommandBuffer cmdBuffers[3];
+    // Image written by the last filter pass.
+    VkImage outputImage;
+    // Signaled by the upload and the filter stages, waited by the next stage.
+    VkSemaphore stageSemaphores[2];
+    // Signaled by the download stage.
+    VkFence fence;
+    bool busy;
+    std::string outputName;
+};
+
+static std::vector<std::string> ListBatchInputs(const std::string& path);
+// Largest decoded batch image, 256 Mpixels are 1 GiB of RGBA.
+static const uint64_t g_maxPPMPixels = 256ull << 20;
+
+static bool ReadPPM(const std::string& fileName, DecodedImage *out);
+static void BatchLoaderThread(BatchLoader *loader);
+static bool BatchLoaderPop(BatchLoader *loader, DecodedImage *out);
+static uint32_t RunBatch(const FilterContext& context,
+                         VkQueue computeQueue,
+                         VkQueue transferQueue,
+                         uint32_t computeQueueFamilyIdx,
+                         uint32_t transferQueueFamilyIdx,
+                         BatchLoader *loader,
+                         const std::string& outputDir,
+                         uint32_t slotCount,
+                         bool useMmap);
+
+// Settings of a filter run, each device of a multi-GPU batch gets a copy.
+struct FilterSettings {
+    bool enableValidationLayers;
+    std::string pipelineCacheFileName;
+    std::string autotuneCacheFileName;
+    std::string outputFileName;
+    bool ppmMmap;
+    uint32_t imageWidth;
+    uint32_t imageHeight;
+    int32_t blurRadius;
+    std::vector<FilterPass> passes;
+    // SPIR-V of the kernels used by the passes, loaded once for all devices on worker threads.
+    std::shared_future<std::vector<uint32_t> > kernelCode[FILTER_KERNEL_COUNT];
+    // ST. Start of the process, the devices report the time until their first dispatch.
+    std::chrono::steady_clock::time_point startupStart;
+    // Zero if there is no explicit work group size.
+    WorkGroupSize requestedGroupSize;
+    bool autotune;
+    // Shared by all devices, without a loader the single synthetic image is filtered.
+    BatchLoader *batchLoader;
+    std::string batchOutputDir;
+    uint32_t batchSlots;
+};
+
+// A selected physical device with the queue families used by the filter.
+struct FilterDevice {
+    VkPhysicalDevice physicalDevice;
+    // Index in the vkEnumeratePhysicalDevices order.
+    uint32_t deviceIdx;
+    uint32_t computeQueueFamilyIdx;
+    uint32_t transferQueueFamilyIdx;
+};
+
+static uint32_t RunFilterDevice(const FilterSettings& settings, const FilterDevice& filterDevice);
+static void FilterDeviceWorker(const FilterSettings *settings,
+                               const FilterDevice *filterDevice,
+                               uint32_t *outProcessedCount,
+                               std::exception_ptr *outError);
 
 
 
@@ -53,19 +280,117 @@ int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first dispatch.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
+    const char *envMultiGpu = getenv("DEMO_MULTI_GPU");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envWidth = getenv("DEMO_WIDTH");
+    const char *envHeight = getenv("DEMO_HEIGHT");
+    const char *envFilter = getenv("DEMO_FILTER");
+    const char *envBlurRadius = getenv("DEMO_BLUR_RADIUS");
+    const char *envTiledBlur = getenv("DEMO_TILED_BLUR");
+    const char *envBatchInput = getenv("DEMO_BATCH_INPUT");
+    const char *envBatchOutput = getenv("DEMO_BATCH_OUTPUT");
+    const char *envBatchSlots = getenv("DEMO_BATCH_SLOTS");
+    const char *envWorkGroupSize = getenv("DEMO_WORKGROUP_SIZE");
+    const char *envAutotune = getenv("DEMO_AUTOTUNE");
+    const char *envAutotuneCache = getenv("DEMO_AUTOTUNE_CACHE");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    bool tiledBlur = ((envTiledBlur != NULL) && (strncmp("1", envTiledBlur, 2) == 0));
+    bool autotune = ((envAutotune != NULL) && (strncmp("1", envAutotune, 2) == 0));
+    bool multiGpu = ((envMultiGpu != NULL) && (strncmp("1", envMultiGpu, 2) == 0));
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
+    // F. Configure the image size and the filter passes.
+    // The passes are executed in order, each one reads the output of the previous pass.
+    uint32_t imageWidth = 256;
+    if ((envWidth != NULL) && (atoi(envWidth) > 0)) {
+        imageWidth = atoi(envWidth);
+    }
+
+    uint32_t imageHeight = 256;
+    if ((envHeight != NULL) && (atoi(envHeight) > 0)) {
+        imageHeight = atoi(envHeight);
+    }
+
+    int32_t blurRadius = 4;
+    if ((envBlurRadius != NULL) && (atoi(envBlurRadius) > 0)) {
+        blurRadius = std::min(atoi(envBlurRadius), g_maxBlurRadius);
+    }
+
+    const std::vector<FilterPass> filterPasses = ParseFilterPasses((envFilter != NULL) ? envFilter : "invert", tiledBlur);
+
+    // ST.1. Start loading (or compiling) the kernels used by the passes on worker threads.
+    // This runs in parallel with the Instance/Device creation, each device only waits
+    // for the results at its Shader Module creation.
+    std::shared_future<std::vector<uint32_t> > kernelLoads[FILTER_KERNEL_COUNT];
+    for (size_t passIdx = 0; passIdx < filterPasses.size(); passIdx++) {
+        const FilterKernel kernel = filterPasses[passIdx].kernel;
+        if (!kernelLoads[kernel].valid()) {
+            kernelLoads[kernel] = std::async(std::launch::async, LoadComputeShaderCode,
+                                             std::string(g_filterKernelShaders[kernel])).share();
+        }
+    }
+
+    // BA. In batch mode the images of the input directory (or list file) are filtered
+    // with "slots" images in flight instead of the single synthetic image.
+    const char *batchInput = envBatchInput;
+    const char *batchOutputDir = "batch_out";
+    if (envBatchOutput != NULL) {
+        batchOutputDir = envBatchOutput;
+    }
+
+    uint32_t batchSlots = 3;
+    if ((envBatchSlots != NULL) && (atoi(envBatchSlots) > 0)) {
+        batchSlots = std::min(atoi(envBatchSlots), 8);
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Image size: %ux%u\n", imageWidth, imageHeight);
+    printf("Filter: %s (%u pass(es), blur radius %d%s)\n",
+           ((envFilter != NULL) ? envFilter : "invert"), (uint32_t)filterPasses.size(), blurRadius,
+           (tiledBlur ? ", tiled" : ""));
+    // WG. An explicit work group size ("<x>x<y>") overrides the autotuner and its cache.
+    WorkGroupSize requestedGroupSize = { 0, 0 };
+    if ((envWorkGroupSize != NULL)
+        && ((sscanf(envWorkGroupSize, "%ux%u", &requestedGroupSize.x, &requestedGroupSize.y) != 2)
+            || (requestedGroupSize.x == 0) || (requestedGroupSize.y == 0))) {
+        throw std::runtime_error("invalid work group size!");
+    }
+
+    const char *autotuneCacheFileName = "autotune.cache";
+    if (envAutotuneCache != NULL) {
+        autotuneCacheFileName = envAutotuneCache;
+    }
+
+    if (batchInput != NULL) {
+        printf("Batch: %s -> %s (%u slot(s))\n", batchInput, batchOutputDir, batchSlots);
+    }
+
+    // MG. Only the batch is spread over the devices, the single image is filtered on the highest ranked one.
+    if (multiGpu && (batchInput == NULL)) {
+        printf("Multi-GPU: requires DEMO_BATCH_INPUT, using a single device\n");
+        multiGpu = false;
+    }
 
     // 1. Create Vulkan Instance.
     // A Vulkan instance is the base for all other Vulkan API calls.
@@ -118,8 +443,8 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
-    uint32_t graphicsQueueFamilyIdx;
+    // MG. With DEMO_MULTI_GPU every matching device filters a part of the batch, otherwise only the highest ranked one.
+    std::vector<FilterDevice> filterDevices;
     {
         // 2.1 Query the number of physical devices.
         uint32_t deviceCount = 0;
@@ -134,40 +459,202 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The physical devices which support Compute Queue (and match DEMO_DEVICE) are ordered by their rank.
+        std::vector<std::pair<uint64_t, FilterDevice> > candidates;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, &hasIdx);
-            if (hasIdx) {
-                physicalDevice = device;
-                break;
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_COMPUTE_BIT, 0, VK_NULL_HANDLE, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            FilterDevice filterDevice;
+            {
+                filterDevice.physicalDevice = device;
+                filterDevice.deviceIdx = deviceIdx;
+                filterDevice.computeQueueFamilyIdx = queueFamilyIdx;
+                filterDevice.transferQueueFamilyIdx = queueFamilyIdx;
             }
+
+            candidates.push_back(std::make_pair(ScorePhysicalDevice(device), filterDevice));
         }
 
-        if (physicalDevice == VK_NULL_HANDLE) {
+        if (candidates.empty()) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        // The stable sort keeps the enumeration order of the equally ranked devices.
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const std::pair<uint64_t, FilterDevice>& lhs, const std::pair<uint64_t, FilterDevice>& rhs) {
+                             return lhs.first > rhs.first;
+                         });
+
+        const size_t selectedCount = (multiGpu ? candidates.size() : 1);
+        for (size_t idx = 0; idx < selectedCount; idx++) {
+            FilterDevice& filterDevice = candidates[idx].second;
+
+            // BA. The batch uploads and downloads on a transfer only queue family if there is one.
+            if (batchInput != NULL) {
+                bool hasTransferIdx;
+                uint32_t transferIdx = FindQueueFamily(filterDevice.physicalDevice,
+                                                       VK_QUEUE_TRANSFER_BIT,
+                                                       VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT,
+                                                       VK_NULL_HANDLE,
+                                                       &hasTransferIdx);
+                if (hasTransferIdx) {
+                    filterDevice.transferQueueFamilyIdx = transferIdx;
+                }
+            }
+
+            // F.1. The image must fit into the device limits.
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(filterDevice.physicalDevice, &properties);
+
+            if ((imageWidth > properties.limits.maxImageDimension2D)
+                || (imageHeight > properties.limits.maxImageDimension2D)) {
+                throw std::runtime_error("image size is over the device limits!");
+            }
+
+            printf("Device: [%u] %s (score 0x%llx)\n", filterDevice.deviceIdx, properties.deviceName,
+                   (unsigned long long)candidates[idx].first);
+            filterDevices.push_back(filterDevice);
+        }
+    }
+
+    // MG. Collect the settings of the filter run.
+    FilterSettings settings;
+    {
+        settings.enableValidationLayers = enableValidationLayers;
+        settings.pipelineCacheFileName = pipelineCacheFileName;
+        settings.autotuneCacheFileName = autotuneCacheFileName;
+        settings.outputFileName = outputFileName;
+        settings.ppmMmap = ppmMmap;
+        settings.imageWidth = imageWidth;
+        settings.imageHeight = imageHeight;
+        settings.blurRadius = blurRadius;
+        settings.passes = filterPasses;
+        settings.requestedGroupSize = requestedGroupSize;
+        settings.autotune = autotune;
+        settings.batchLoader = NULL;
+        settings.batchOutputDir = batchOutputDir;
+        settings.batchSlots = batchSlots;
+    }
+
+    // F.3. The kernels are loaded (or compiled) once (ST.1), the shader modules are created on each device.
+    for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+        settings.kernelCode[kernel] = kernelLoads[kernel];
+    }
+    settings.startupStart = startupStart;
+
+    // BA.5. Start decoding the images on the loader thread, the devices take the images in turns.
+    BatchLoader loader;
+    std::thread loaderThread;
+    if (batchInput != NULL) {
+        {
+            loader.files = ListBatchInputs(batchInput);
+            loader.capacity = 2 * batchSlots * filterDevices.size();
+            loader.finished = false;
+            loader.stopRequested = false;
+            loader.failedCount = 0;
+        }
+
+        loaderThread = std::thread(BatchLoaderThread, &loader);
+        settings.batchLoader = &loader;
+    }
+
+    std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
+    std::vector<uint32_t> processedCounts(filterDevices.size(), 0);
+    std::vector<std::exception_ptr> workerErrors(filterDevices.size());
+
+    if (filterDevices.size() == 1) {
+        processedCounts[0] = RunFilterDevice(settings, filterDevices[0]);
+    } else {
+        // MG.1. One worker thread (with its own logical device) for each physical device of the instance.
+        // The pipeline and autotune caches get a ".<device index>" suffix so the workers never write the same file.
+        std::vector<FilterSettings> deviceSettings(filterDevices.size(), settings);
+        std::vector<std::thread> workers;
+        for (size_t idx = 0; idx < filterDevices.size(); idx++) {
+            const std::string suffix = "." + std::to_string(filterDevices[idx].deviceIdx);
+            if (!deviceSettings[idx].pipelineCacheFileName.empty()) {
+                deviceSettings[idx].pipelineCacheFileName += suffix;
+            }
+            deviceSettings[idx].autotuneCacheFileName += suffix;
+
+            workers.push_back(std::thread(FilterDeviceWorker, &deviceSettings[idx], &filterDevices[idx],
+                                          &processedCounts[idx], &workerErrors[idx]));
+        }
+
+        for (size_t idx = 0; idx < workers.size(); idx++) {
+            workers[idx].join();
+        }
+    }
+
+    double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+    if (batchInput != NULL) {
+        loaderThread.join();
+        printf("Batch: %u file(s) failed to decode\n", loader.failedCount);
+    }
+
+    for (size_t idx = 0; idx < workerErrors.size(); idx++) {
+        if (workerErrors[idx]) {
+            std::rethrow_exception(workerErrors[idx]);
+        }
     }
 
+    // MG.2. Report the aggregate throughput and the share of each device.
+    if (filterDevices.size() > 1) {
+        uint32_t totalCount = 0;
+        for (size_t idx = 0; idx < processedCounts.size(); idx++) {
+            totalCount += processedCounts[idx];
+        }
+
+        printf("Multi-GPU: %u image(s) on %u device(s) in %.3f s (%.2f images/sec)\n",
+               totalCount, (uint32_t)filterDevices.size(), runTime, ((runTime > 0.0) ? totalCount / runTime : 0.0));
+        for (size_t idx = 0; idx < filterDevices.size(); idx++) {
+            printf("  [%u]: %u image(s)\n", filterDevices[idx].deviceIdx, processedCounts[idx]);
+        }
+    }
+
+    // XY. Destroy instance
+    vkDestroyInstance(instance, NULL);
+
+    return 0;
+}
+
+uint32_t RunFilterDevice(const FilterSettings& settings, const FilterDevice& filterDevice) {
+    const VkPhysicalDevice physicalDevice = filterDevice.physicalDevice;
+    const uint32_t computeQueueFamilyIdx = filterDevice.computeQueueFamilyIdx;
+    const uint32_t transferQueueFamilyIdx = filterDevice.transferQueueFamilyIdx;
+
     // 3. Create a logical Vulkan Device.
     // Most Vulkan API calls require a logical device.
     // To use device level layer, they should be provided here.
     VkDevice device;
     {
-        // 3.1. Build the device queue create info data (use only a singe queue).
+        // 3.1. Build the device queue create info data (use a singe queue from each family).
         float queuePriority = 1.0f;
-        VkDeviceQueueCreateInfo queueCreateInfo;
-        {
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.pNext = NULL;
-            queueCreateInfo.flags = 0;
-            queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
-        }
 
         // 3.2. The queue family/families must be provided to allow the device to use them.
-        std::vector<uint32_t> uniqueQueueFamilies = { graphicsQueueFamilyIdx };
+        std::vector<uint32_t> uniqueQueueFamilies = { computeQueueFamilyIdx };
+        if (transferQueueFamilyIdx != computeQueueFamilyIdx) {
+            uniqueQueueFamilies.push_back(transferQueueFamilyIdx);
+        }
+
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos(uniqueQueueFamilies.size());
+        for (size_t idx = 0; idx < uniqueQueueFamilies.size(); idx++) {
+            VkDeviceQueueCreateInfo& queueCreateInfo = queueCreateInfos[idx];
+            {
+                queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+                queueCreateInfo.pNext = NULL;
+                queueCreateInfo.flags = 0;
+                queueCreateInfo.queueFamilyIndex = uniqueQueueFamilies[idx];
+                queueCreateInfo.queueCount = 1;
+                queueCreateInfo.pQueuePriorities = &queuePriority;
+            }
+        }
 
         // 3.3. Specify the device creation information.
         VkDeviceCreateInfo createInfo;
@@ -175,14 +662,14 @@ int main(int argc, char **argv) {
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             createInfo.pNext = NULL;
             createInfo.flags = 0;
-            createInfo.queueCreateInfoCount = 1;
-            createInfo.pQueueCreateInfos = &queueCreateInfo;
+            createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+            createInfo.pQueueCreateInfos = queueCreateInfos.data();
             createInfo.pEnabledFeatures = NULL;
             createInfo.enabledExtensionCount = 0;
             createInfo.ppEnabledExtensionNames = NULL;
             createInfo.enabledLayerCount = 0;
 
-            if (enableValidationLayers) {
+            if (settings.enableValidationLayers) {
                 // To have device level validation information, the layers are added here.
                 createInfo.enabledLayerCount = static_cast<uint32_t>(g_validationLayers.size());
                 createInfo.ppEnabledLayerNames = g_validationLayers.data();
@@ -198,68 +685,28 @@ int main(int argc, char **argv) {
     // 4. Get the selected Queue family's first queue.
     // A Queue is used to issue recorded command buffers to the GPU for execution.
     VkQueue queue;
+    VkQueue transferQueue;
     {
-        vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
+        vkGetDeviceQueue(device, computeQueueFamilyIdx, 0, &queue);
+        vkGetDeviceQueue(device, transferQueueFamilyIdx, 0, &transferQueue);
     }
 
-    // Input & output Images
-    Vulkan2DImage sourceImage;
-    Vulkan2DImage destinationImage;
-
-    CreateVulkan2DImage(device, physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, 256, 256, sourceImage);
-    sourceImage.width = sourceImage.height = 256;
-    CreateVulkan2DImage(device, physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, 256, 256, destinationImage);
-    destinationImage.width = destinationImage.height = 256;
-
-    uint32_t* dataPtr;
-    vkMapMemory(device, sourceImage.vkMemory, 0, VK_WHOLE_SIZE, 0, (void**)&dataPtr);
-
-    uint8_t red, green, blue, alpha;
-    red = green = blue = 255;
-    alpha = 255;
-    for (int x = 0; x < 256; x++) {
-        for (int y = 0; y < 256; y++) {
-            /*if (x % 16 == 0 || y % 16 == 0) {
-                red = 255;
-            } else {
-                red = 0;
-            }*/
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
 
-            red = (((x & 0x8) == 0) ^ ((y & 0x8) == 0)) * 255;
-            dataPtr[x * 256 + y] = red | (x << 8u) | (y << 16u) | (alpha << 24u);
-        }
+    // F.3. Create the shader modules of the kernels used by the passes.
+    VkShaderModule filterShaders[FILTER_KERNEL_COUNT];
+    bool kernelUsed[FILTER_KERNEL_COUNT] = {};
+    for (size_t passIdx = 0; passIdx < settings.passes.size(); passIdx++) {
+        kernelUsed[settings.passes[passIdx].kernel] = true;
     }
 
-    VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, sourceImage.vkMemory, 0, VK_WHOLE_SIZE };
-    vkFlushMappedMemoryRanges(device, 1, &range);
-    vkUnmapMemory(device, sourceImage.vkMemory);
-
-    // compute shader
-    VkShaderModule computeShader;
-    {
-        #if HAVE_SHADERC
-        std::vector<char> shaderSrc = LoadGLSL("compute.comp");
-        std::vector<uint32_t> shaderode = CompileGLSL(shaderc_compute_shader, shaderSrc);
-        #else
-        std::vector<uint32_t> shaderCode = LoadSPIRV("compute.comp.spv");
-        #endif
-
-        if (shaderCode.size() == 0) {
-            throw std::runtime_error("failed to load compute shader!");
-        }
-
-        VkShaderModuleCreateInfo shaderCreateInfo;
-        {
-            shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            shaderCreateInfo.pNext = NULL;
-            shaderCreateInfo.flags = 0;
-            shaderCreateInfo.codeSize = shaderCode.size() * sizeof(uint32_t);
-            shaderCreateInfo.pCode = reinterpret_cast<uint32_t*>(shaderCode.data());
-        }
-
-        VkResult shaderCreateResult = vkCreateShaderModule(device, &shaderCreateInfo, NULL, &computeShader);
-        if (shaderCreateResult != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create compute shader");
+    for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+        filterShaders[kernel] = VK_NULL_HANDLE;
+        if (kernelUsed[kernel]) {
+            filterShaders[kernel] = CreateComputeShader(device, settings.kernelCode[kernel].get());
         }
     }
 
@@ -287,7 +734,7 @@ int main(int argc, char **argv) {
         {
             pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
             pushConstantRange.offset     = 0;
-            pushConstantRange.size       = sizeof(int32_t) * 2; // ivec2
+            pushConstantRange.size       = sizeof(FilterPushConstants); // ivec2 + int
         }
 
         VkPipelineLayoutCreateInfo pipelineLayoutInfo;
@@ -306,50 +753,27 @@ int main(int argc, char **argv) {
         }
     }
 
-    // compute pipeline
-    VkPipeline computePipeline;
-    {
-
-        VkPipelineShaderStageCreateInfo computeStageInfo;
-        {
-            computeStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            computeStageInfo.pNext = NULL;
-            computeStageInfo.flags = 0;
-            computeStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-            computeStageInfo.module = computeShader;
-            computeStageInfo.pName = "main";
-            computeStageInfo.pSpecializationInfo = NULL;
-        }
-
-        VkComputePipelineCreateInfo pPipelineInfo;
-        {
-            pPipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-            pPipelineInfo.pNext = NULL;
-            pPipelineInfo.flags = 0;
-            pPipelineInfo.stage = computeStageInfo;
-            pPipelineInfo.layout = computePipelineLayout;
-            pPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-            pPipelineInfo.basePipelineIndex = 0;
-        }
-
-        VkResult pipelineCreation = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pPipelineInfo, nullptr, &computePipeline);
-        if (pipelineCreation != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create compute pipeline");
-        }
-    }
-
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, settings.pipelineCacheFileName, &pipelineCacheHit);
 
     // Descriptors
+    // F.5. Each filter target (one or one for each batch slot) has its own descriptor sets.
+    // The autotuner uses an extra target. A batch slot re-creates its target for a new image size,
+    // so the sets are freed individually (they all have the same layout, the pool does not fragment).
+    const uint32_t targetCount = ((settings.batchLoader != NULL) ? settings.batchSlots : 1) + (settings.autotune ? 1 : 0);
     VkDescriptorPool descriptorPool;
     {
         VkDescriptorPoolSize descriptorPoolSizes[] = {
-            { /* type*/ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 }
+            { /* type*/ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 * g_filterSetCount * targetCount }
         };
 
         VkDescriptorPoolCreateInfo poolCreateInfo = {};
         {
             poolCreateInfo.sType            = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolCreateInfo.maxSets          = 1;
+            poolCreateInfo.flags            = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+            poolCreateInfo.maxSets          = g_filterSetCount * targetCount;
             poolCreateInfo.poolSizeCount    = sizeof(descriptorPoolSizes) / sizeof(descriptorPoolSizes[0]);
             poolCreateInfo.pPoolSizes       = descriptorPoolSizes;
         }
@@ -360,456 +784,1477 @@ int main(int argc, char **argv) {
         }
     }
 
-    VkDescriptorSet descriporSet;
+    // F.6. Collect the objects shared by all filter targets.
+    FilterContext filterContext;
     {
-        VkDescriptorSetAllocateInfo setAllocateInfo = {};
-        setAllocateInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        setAllocateInfo.descriptorPool     = descriptorPool;
-        setAllocateInfo.descriptorSetCount = 1;
-        setAllocateInfo.pSetLayouts        = &descriptorSetLayout;
-
-        VkResult allocateResult = vkAllocateDescriptorSets(device, &setAllocateInfo, &descriporSet);
-        // TODO: handle result
+        filterContext.device = device;
+        filterContext.arena = &memoryArena;
+        filterContext.descriptorPool = descriptorPool;
+        filterContext.setLayout = descriptorSetLayout;
+        filterContext.pipelineLayout = computePipelineLayout;
+        for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+            filterContext.pipelines[kernel] = VK_NULL_HANDLE;
+        }
+        filterContext.queueFamilies = { computeQueueFamilyIdx };
+        if (transferQueueFamilyIdx != computeQueueFamilyIdx) {
+            filterContext.queueFamilies.push_back(transferQueueFamilyIdx);
+        }
+        filterContext.passes = settings.passes;
+        filterContext.blurRadius = settings.blurRadius;
+        filterContext.groupSize = g_defaultWorkGroupSize;
     }
 
+    // WG. Select the work group size: explicit, autotuned (and cached) or the cached one for the device.
+    // The autotuner runs on the synthetic image size (DEMO_WIDTH x DEMO_HEIGHT) also in batch mode.
     {
-        VkDescriptorImageInfo srcInfo = { /* sampler */ VK_NULL_HANDLE, sourceImage.vkImageView, VK_IMAGE_LAYOUT_GENERAL };
-        VkDescriptorImageInfo dstInfo = { /* sampler */ VK_NULL_HANDLE, destinationImage.vkImageView, VK_IMAGE_LAYOUT_GENERAL };
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        const char *groupSizeSource = "default";
+        if (settings.requestedGroupSize.x > 0) {
+            filterContext.groupSize = settings.requestedGroupSize;
+            groupSizeSource = "DEMO_WORKGROUP_SIZE";
+        } else if (settings.autotune) {
+            filterContext.groupSize = AutotuneWorkGroupSize(physicalDevice, queue, computeQueueFamilyIdx, pipelineCache,
+                                                            filterShaders, kernelUsed, filterContext,
+                                                            settings.imageWidth, settings.imageHeight);
+            SaveWorkGroupSize(settings.autotuneCacheFileName, properties, filterContext.groupSize);
+            groupSizeSource = "autotuned";
+        } else if (LoadWorkGroupSize(settings.autotuneCacheFileName, properties, &filterContext.groupSize)) {
+            groupSizeSource = settings.autotuneCacheFileName.c_str();
+        }
 
-        VkWriteDescriptorSet writeDescriptorSet[] =
-        {
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,         // sType
-                nullptr,                                        // pNext
-                descriporSet,                                   // dstSet (destination descriptor set)
-                0,                                              // dstBinding (binding point idx in the set)
-                0,                                              // dstArrayElement
-                1,                                              // descriptorCount
-                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,               // descriptorType
-                &srcInfo,                                       // pImageInfo
-                nullptr,                                        // pBufferInfo
-                nullptr,                                        // pTexelBufferView
-            },
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,         // sType
-                nullptr,                                        // pNext
-                descriporSet,                                   // dstSet (destination descriptor set)
-                1,                                              // dstBinding (binding point idx in the set)
-                0,                                              // dstArrayElement
-                1,                                              // descriptorCount
-                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,               // descriptorType
-                &dstInfo,                                       // pImageInfo
-                nullptr,                                        // pBufferInfo
-                nullptr,                                        // pTexelBufferView
-            },
-        };
-        vkUpdateDescriptorSets(device, 2, writeDescriptorSet, 0, nullptr);
+        if (!WorkGroupSizeSupported(properties, filterContext.groupSize)) {
+            throw std::runtime_error("work group size is over the device limits!");
+        }
+
+        printf("Work group size: %ux%u (%s)\n", filterContext.groupSize.x, filterContext.groupSize.y, groupSizeSource);
     }
 
-    // 14. Create Command Pool.
-    // Required to create Command buffers.
-    VkCommandPool cmdPool;
+    // compute pipeline
+    // F.4. One pipeline is created for each kernel used by the passes.
     {
-        VkCommandPoolCreateInfo poolInfo;
-        {
-            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-            poolInfo.pNext = NULL;
-            poolInfo.flags = 0;
-            poolInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-        }
+        std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
 
-        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create command pool!");
-        }
+        CreateFilterPipelines(device, pipelineCache, computePipelineLayout, filterShaders, kernelUsed,
+                              filterContext.groupSize, filterContext.pipelines);
+
+        double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+        printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
     }
 
-    // 15. Create Command Buffer to record draw commands.
-    VkCommandBuffer cmdBuffer;
-    {
-        VkCommandBufferAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
-        }
+    // ST.2. Report the time to the first dispatch.
+    printf("Startup: %.3f ms until the first dispatch\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - settings.startupStart).count());
+
+    uint32_t processedCount = 1;
+    if (settings.batchLoader != NULL) {
+        processedCount = RunBatch(filterContext, queue, transferQueue, computeQueueFamilyIdx, transferQueueFamilyIdx,
+                                  settings.batchLoader, settings.batchOutputDir, settings.batchSlots, settings.ppmMmap);
+    } else {
+        RunSingleImage(filterContext, queue, computeQueueFamilyIdx, settings.imageWidth, settings.imageHeight,
+                       settings.outputFileName, settings.ppmMmap);
+    }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+    DestroyFilterPipelines(device, filterContext.pipelines);
+    for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+        if (kernelUsed[kernel]) {
+            vkDestroyShaderModule(device, filterShaders[kernel], NULL);
         }
     }
 
-    // Start recording draw commands.
+    vkDestroyPipelineLayout(device, computePipelineLayout, NULL);
 
-    // 16. Start Command Buffer
-    {
-        VkCommandBufferBeginInfo beginInfo;
-        {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            beginInfo.pInheritanceInfo = NULL;
-        }
+    vkDestroyDescriptorPool(device, descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
 
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-    }
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, settings.pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
 
-    {
-        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-        //&dynamicUniformOffset
-        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &descriporSet, 0, NULL);
-        int32_t Hdirection[2] = { 1, 0 };
-        vkCmdPushConstants(cmdBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t) * 2, Hdirection);
-        vkCmdDispatch(cmdBuffer, 256 / 16, 256/16, 1);
-        /*int32_t Vdirection[2] = { 0, 1 };
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
 
-        vkCmdPushConstants(cmdBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t) * 2, Vdirection);
-        vkCmdDispatch(cmdBuffer, 256 / 16, 256/16, 1);*/
-    }
+    // XX. Destroy Device
+    vkDestroyDevice(device, NULL);
 
+    return processedCount;
+}
 
-    // 18. End the Command Buffer recording.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+void FilterDeviceWorker(const FilterSettings *settings,
+                        const FilterDevice *filterDevice,
+                        uint32_t *outProcessedCount,
+                        std::exception_ptr *outError) {
+    // MG.3. An error stops the loader, so the other workers finish early, and it is rethrown by main.
+    try {
+        *outProcessedCount = RunFilterDevice(*settings, *filterDevice);
+    } catch (...) {
+        *outError = std::current_exception();
+
+        std::lock_guard<std::mutex> lock(settings->batchLoader->mutex);
+        settings->batchLoader->stopRequested = true;
+        settings->batchLoader->cond.notify_all();
     }
+}
 
-    // 19. Create a Fence.
-    // This Fence will be used to synchronize between CPU and GPU.
-    // The Fence is created in an unsignaled state, thus no need to reset it.
-    VkFence fence;
-    {
-        VkFenceCreateInfo fenceInfo;
+bool CreateVulkan2DImage(
+    VkDevice device,
+    MemoryArena *arena,
+    VkFormat renderImageFormat,
+    uint32_t renderImageWidth,
+    uint32_t renderImageHeight,
+    const std::vector<uint32_t>& queueFamilies,
+    Vulkan2DImage& out)
+{
+    //VkImage renderImage;
+    {
+        // 5.1. Specify the image creation information.
+        VkImageCreateInfo imageInfo;
+        {
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = NULL;
+            imageInfo.flags = 0;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = renderImageFormat;
+            imageInfo.extent = { renderImageWidth, renderImageHeight,  1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            // Tiling optimal means that the image is in a GPU optimal mode.
+            // Usually this means that it should not be accessed from the CPU side directly as
+            // the image color channels can be in any order.
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            // Specifying the usage is important:
+            // * VK_IMAGE_USAGE_TRANSFER_SRC_BIT: the image can be used as a source for a transfer/copy operation.
+            // * VK_IMAGE_USAGE_TRANSFER_DST_BIT: the image can be used as a destination of a transfer/copy operation.
+            // * VK_IMAGE_USAGE_STORAGE_BIT: the image can be read and written by the compute kernels.
+            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+            // With more than one queue family (ex.: a dedicated transfer queue) the image is shared concurrently,
+            // so there is no need for queue family ownership transfers.
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.queueFamilyIndexCount = 0;
+            imageInfo.pQueueFamilyIndices = NULL;
+            if (queueFamilies.size() > 1) {
+                imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+                imageInfo.pQueueFamilyIndices = queueFamilies.data();
+            }
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        // 5.2. Create the image.
+        if (vkCreateImage(device, &imageInfo, NULL, &out.vkImage) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create 2D image!");
+        }
+    }
+
+    // 6. Allocate and bind the memory for the render target image.
+    // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
+    // The memory is sub-allocated from the memory arena and bound to the image.
+    // The CPU never accesses the image directly (the pixels are copied through buffers), so it is device local.
+    out.vkMemory = ArenaAllocateImage(arena, out.vkImage, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    out.width = renderImageWidth;
+    out.height = renderImageHeight;
+
+    // 7. Create an Image View for the Render Target Image.
+    // Will be used by the Framebuffer as Color Attachment.
+    {
+        // 7.1. Specify the view information.
+        VkImageViewCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            createInfo.image = out.vkImage;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = renderImageFormat;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
+        }
+
+        // 7.2. Create the Image View.
+        if (vkCreateImageView(device, &createInfo, NULL, &out.vkImageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image views!");
+        }
+    }
+
+    return true;
+}
+
+void DestroyVulkanImage(VkDevice device, MemoryArena *arena, struct Vulkan2DImage* img) {
+    vkDestroyImage(device, img->vkImage, NULL);
+    vkDestroyImageView(device, img->vkImageView, NULL);
+    ArenaFree(arena, img->vkMemory);
+}
+
+
+void DumpImage(VkDevice device,
+               const ArenaAllocation& memory,
+               uint32_t width,
+               uint32_t height,
+               std::string outputFileName,
+               bool useMmap) {
+    // 23. Make the device writes of the buffer visible for the host (no-op on coherent memory).
+    VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, memory.memory, memory.offset, memory.size };
+    vkInvalidateMappedMemoryRanges(device, 1, &range);
+
+    // 24. The arena keeps the buffer memory mapped, the pixels are tightly packed.
+    const uint8_t* data = memory.mapped;
+
+    // 25. Write out the image to a ppm file.
+    // The pixels are packed to RGB and written with a single call (or through mmap).
+    WritePPM(outputFileName, data, width, height, (VkDeviceSize)width * sizeof(uint32_t), false, useMmap);
+}
+
+std::vector<FilterPass> ParseFilterPasses(const char *passList, bool tiledBlur) {
+    const FilterKernel blurKernel = tiledBlur ? FILTER_KERNEL_BLUR_TILED : FILTER_KERNEL_BLUR;
+    const FilterPass invertPass = { FILTER_KERNEL_INVERT, { 0, 0 } };
+    const FilterPass hblurPass = { blurKernel, { 1, 0 } };
+    const FilterPass vblurPass = { blurKernel, { 0, 1 } };
+
+    // The list is comma separated, ex.: "blur,invert".
+    // "blur" is the separable blur: a horizontal ("hblur") and a vertical ("vblur") pass.
+    std::vector<FilterPass> passes;
+    std::string list(passList);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        const std::string name = list.substr(start, end - start);
+        if (name == "invert") {
+            passes.push_back(invertPass);
+        } else if (name == "blur") {
+            passes.push_back(hblurPass);
+            passes.push_back(vblurPass);
+        } else if (name == "hblur") {
+            passes.push_back(hblurPass);
+        } else if (name == "vblur") {
+            passes.push_back(vblurPass);
+        } else {
+            throw std::runtime_error("unknown filter pass!");
+        }
+
+        start = end + 1;
+    }
+
+    return passes;
+}
+
+std::vector<uint32_t> LoadComputeShaderCode(const std::string& name) {
+    #if HAVE_SHADERC
+    std::vector<char> shaderSrc = LoadGLSL(name);
+    std::vector<uint32_t> shaderCode = CompileGLSL(shaderc_compute_shader, shaderSrc);
+    #else
+    std::vector<uint32_t> shaderCode = LoadSPIRV(name + ".spv");
+    #endif
+
+    if (shaderCode.size() == 0) {
+        throw std::runtime_error("failed to load compute shader!");
+    }
+
+    return shaderCode;
+}
+
+VkShaderModule CreateComputeShader(const VkDevice device, const std::vector<uint32_t>& shaderCode) {
+    VkShaderModuleCreateInfo shaderCreateInfo;
+    {
+        shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderCreateInfo.pNext = NULL;
+        shaderCreateInfo.flags = 0;
+        shaderCreateInfo.codeSize = shaderCode.size() * sizeof(uint32_t);
+        shaderCreateInfo.pCode = shaderCode.data();
+    }
+
+    VkShaderModule shaderModule;
+    VkResult shaderCreateResult = vkCreateShaderModule(device, &shaderCreateInfo, NULL, &shaderModule);
+    if (shaderCreateResult != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute shader");
+    }
+
+    return shaderModule;
+}
+
+VkBuffer CreateHostBuffer(MemoryArena *arena,
+                          VkDeviceSize size,
+                          VkBufferUsageFlags usage,
+                          ArenaAllocation *outMemory) {
+    VkBufferCreateInfo bufferInfo;
+    {
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = NULL;
+        bufferInfo.flags = 0;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferInfo.queueFamilyIndexCount = 0;
+        bufferInfo.pQueueFamilyIndices = NULL;
+    }
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(arena->device, &bufferInfo, NULL, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create buffer!");
+    }
+
+    *outMemory = ArenaAllocateBuffer(arena, buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+    return buffer;
+}
+
+void RecordImageBarrier(VkCommandBuffer cmdBuffer,
+                        VkImage image,
+                        VkPipelineStageFlags srcStage,
+                        VkAccessFlags srcAccess,
+                        VkImageLayout oldLayout,
+                        VkPipelineStageFlags dstStage,
+                        VkAccessFlags dstAccess,
+                        VkImageLayout newLayout) {
+    VkImageMemoryBarrier imageMemoryBarrier;
+    {
+        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageMemoryBarrier.pNext = NULL;
+        imageMemoryBarrier.srcAccessMask = srcAccess;
+        imageMemoryBarrier.dstAccessMask = dstAccess;
+        imageMemoryBarrier.oldLayout = oldLayout;
+        imageMemoryBarrier.newLayout = newLayout;
+        imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.image = image;
+        imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    vkCmdPipelineBarrier(cmdBuffer, srcStage, dstStage, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+}
+
+void CreateFilterTarget(const FilterContext& context, uint32_t width, uint32_t height, FilterTarget *outTarget) {
+    // The images are device local with optimal tiling, the pixels are moved through host visible buffers.
+    for (uint32_t imageIdx = 0; imageIdx < 3; imageIdx++) {
+        CreateVulkan2DImage(context.device, context.arena, VK_FORMAT_R8G8B8A8_UNORM, width, height,
+                            context.queueFamilies, outTarget->images[imageIdx]);
+    }
+
+    {
+        VkDescriptorSetLayout setLayouts[g_filterSetCount] = { context.setLayout, context.setLayout, context.setLayout };
+
+        VkDescriptorSetAllocateInfo setAllocateInfo = {};
+        setAllocateInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocateInfo.descriptorPool     = context.descriptorPool;
+        setAllocateInfo.descriptorSetCount = g_filterSetCount;
+        setAllocateInfo.pSetLayouts        = setLayouts;
+
+        VkResult allocateResult = vkAllocateDescriptorSets(context.device, &setAllocateInfo, outTarget->sets);
+        if (allocateResult != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+    }
+
+    for (uint32_t setIdx = 0; setIdx < g_filterSetCount; setIdx++) {
+        const Vulkan2DImage& input = outTarget->images[g_filterSetImages[setIdx][0]];
+        const Vulkan2DImage& output = outTarget->images[g_filterSetImages[setIdx][1]];
+
+        VkDescriptorImageInfo srcInfo = { /* sampler */ VK_NULL_HANDLE, input.vkImageView, VK_IMAGE_LAYOUT_GENERAL };
+        VkDescriptorImageInfo dstInfo = { /* sampler */ VK_NULL_HANDLE, output.vkImageView, VK_IMAGE_LAYOUT_GENERAL };
+
+        VkWriteDescriptorSet writeDescriptorSet[] =
+        {
+            {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,         // sType
+                nullptr,                                        // pNext
+                outTarget->sets[setIdx],                        // dstSet (destination descriptor set)
+                0,                                              // dstBinding (binding point idx in the set)
+                0,                                              // dstArrayElement
+                1,                                              // descriptorCount
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,               // descriptorType
+                &srcInfo,                                       // pImageInfo
+                nullptr,                                        // pBufferInfo
+                nullptr,                                        // pTexelBufferView
+            },
+            {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,         // sType
+                nullptr,                                        // pNext
+                outTarget->sets[setIdx],                        // dstSet (destination descriptor set)
+                1,                                              // dstBinding (binding point idx in the set)
+                0,                                              // dstArrayElement
+                1,                                              // descriptorCount
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,               // descriptorType
+                &dstInfo,                                       // pImageInfo
+                nullptr,                                        // pBufferInfo
+                nullptr,                                        // pTexelBufferView
+            },
+        };
+        vkUpdateDescriptorSets(context.device, 2, writeDescriptorSet, 0, nullptr);
+    }
+}
+
+void DestroyFilterTarget(const FilterContext& context, FilterTarget *target) {
+    vkFreeDescriptorSets(context.device, context.descriptorPool, g_filterSetCount, target->sets);
+    for (uint32_t imageIdx = 0; imageIdx < 3; imageIdx++) {
+        DestroyVulkanImage(context.device, context.arena, &target->images[imageIdx]);
+    }
+}
+
+void RecordUpload(VkCommandBuffer cmdBuffer,
+                  VkBuffer buffer,
+                  const Vulkan2DImage& image,
+                  VkPipelineStageFlags dstStage,
+                  VkAccessFlags dstAccess) {
+    // F.7.1. Copy the tightly packed pixels into the source image and move it into the general layout.
+    RecordImageBarrier(cmdBuffer, image.vkImage,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkBufferImageCopy copyRegion;
+    {
+        copyRegion.bufferOffset = 0;
+        copyRegion.bufferRowLength = 0;
+        copyRegion.bufferImageHeight = 0;
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.mipLevel = 0;
+        copyRegion.imageSubresource.baseArrayLayer = 0;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageOffset = { 0, 0, 0 };
+        copyRegion.imageExtent = { image.width, image.height, 1 };
+    }
+
+    vkCmdCopyBufferToImage(cmdBuffer, buffer, image.vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+    RecordImageBarrier(cmdBuffer, image.vkImage,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       dstStage, dstAccess, VK_IMAGE_LAYOUT_GENERAL);
+}
+
+VkImage RecordFilterPasses(VkCommandBuffer cmdBuffer,
+                           const FilterContext& context,
+                           const FilterTarget& target,
+                           VkPipelineStageFlags dstStage,
+                           VkAccessFlags dstAccess) {
+    // F.7.2. Move the intermediate images into the general layout used by the kernels.
+    for (uint32_t imageIdx = 1; imageIdx < 3; imageIdx++) {
+        RecordImageBarrier(cmdBuffer, target.images[imageIdx].vkImage,
+                           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    // F.7.3. Record the filter passes.
+    // The dispatch covers the whole image (rounded up), the kernels skip the invocations outside of it.
+    const uint32_t groupCountX = (target.images[0].width + context.groupSize.x - 1) / context.groupSize.x;
+    const uint32_t groupCountY = (target.images[0].height + context.groupSize.y - 1) / context.groupSize.y;
+    uint32_t outputIdx = 0;
+
+    for (size_t passIdx = 0; passIdx < context.passes.size(); passIdx++) {
+        const FilterPass& pass = context.passes[passIdx];
+        const uint32_t setIdx = (passIdx == 0) ? 0 : (1 + (passIdx - 1) % 2);
+
+        // F.7.4. The pass reads the image written by the previous dispatch.
+        // The barrier also orders the write after the reads of the pass before (same image two passes ago).
+        if (passIdx > 0) {
+            RecordImageBarrier(cmdBuffer, target.images[outputIdx].vkImage,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        }
+
+        FilterPushConstants constants;
+        {
+            constants.direction[0] = pass.direction[0];
+            constants.direction[1] = pass.direction[1];
+            constants.radius = context.blurRadius;
+        }
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, context.pipelines[pass.kernel]);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, context.pipelineLayout, 0, 1, &target.sets[setIdx], 0, NULL);
+        vkCmdPushConstants(cmdBuffer, context.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vkCmdDispatch(cmdBuffer, groupCountX, groupCountY, 1);
+
+        outputIdx = g_filterSetImages[setIdx][1];
+    }
+
+    // F.7.5. Move the result of the last pass into the transfer source layout for the readback.
+    RecordImageBarrier(cmdBuffer, target.images[outputIdx].vkImage,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                       dstStage, dstAccess, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    return target.images[outputIdx].vkImage;
+}
+
+void RecordDownload(VkCommandBuffer cmdBuffer, VkImage image, uint32_t width, uint32_t height, VkBuffer buffer) {
+    // F.7.6. Copy the image (in transfer source layout) into the readback buffer.
+    VkBufferImageCopy copyRegion;
+    {
+        copyRegion.bufferOffset = 0;
+        copyRegion.bufferRowLength = 0;
+        copyRegion.bufferImageHeight = 0;
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.mipLevel = 0;
+        copyRegion.imageSubresource.baseArrayLayer = 0;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageOffset = { 0, 0, 0 };
+        copyRegion.imageExtent = { width, height, 1 };
+    }
+
+    vkCmdCopyImageToBuffer(cmdBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &copyRegion);
+
+    // Make the buffer writes available for the host.
+    VkBufferMemoryBarrier bufferMemoryBarrier;
+    {
+        bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferMemoryBarrier.pNext = NULL;
+        bufferMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferMemoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferMemoryBarrier.buffer = buffer;
+        bufferMemoryBarrier.offset = 0;
+        bufferMemoryBarrier.size = VK_WHOLE_SIZE;
+    }
+
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, NULL, 1, &bufferMemoryBarrier, 0, NULL);
+}
+
+void RunSingleImage(const FilterContext& context,
+                    VkQueue queue,
+                    uint32_t queueFamilyIdx,
+                    uint32_t imageWidth,
+                    uint32_t imageHeight,
+                    const std::string& outputFileName,
+                    bool useMmap) {
+    const VkDevice device = context.device;
+
+    // Input & output Images
+    FilterTarget target;
+    CreateFilterTarget(context, imageWidth, imageHeight, &target);
+
+    // F.2. Create the upload and readback buffers (tightly packed RGBA pixels).
+    const VkDeviceSize imageBytes = (VkDeviceSize)imageWidth * imageHeight * sizeof(uint32_t);
+
+    ArenaAllocation uploadMemory;
+    VkBuffer uploadBuffer = CreateHostBuffer(context.arena, imageBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &uploadMemory);
+
+    ArenaAllocation readbackMemory;
+    VkBuffer readbackBuffer = CreateHostBuffer(context.arena, imageBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &readbackMemory);
+
+    // The arena keeps the host visible memory mapped.
+    uint32_t* dataPtr = (uint32_t*)uploadMemory.mapped;
+
+    uint8_t red, green, blue, alpha;
+    red = green = blue = 255;
+    alpha = 255;
+    for (uint32_t y = 0; y < imageHeight; y++) {
+        for (uint32_t x = 0; x < imageWidth; x++) {
+            red = (((x & 0x8) == 0) ^ ((y & 0x8) == 0)) * 255;
+            green = y & 0xFF;
+            blue = x & 0xFF;
+            dataPtr[y * imageWidth + x] = red | (green << 8u) | (blue << 16u) | (alpha << 24u);
+        }
+    }
+
+    VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, uploadMemory.memory, uploadMemory.offset, uploadMemory.size };
+    vkFlushMappedMemoryRanges(device, 1, &range);
+
+    // 14. Create Command Pool.
+    // Required to create Command buffers.
+    VkCommandPool cmdPool;
+    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    // 15. Create Command Buffer to record draw commands.
+    VkCommandBuffer cmdBuffer;
+    {
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+        }
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    // Start recording draw commands.
+
+    // 16. Start Command Buffer
+    {
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = NULL;
+        }
+
+        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+    }
+
+    // F.7. Record the upload, the filter passes and the readback into a single command buffer.
+    {
+        RecordUpload(cmdBuffer, uploadBuffer, target.images[0], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        VkImage outputImage = RecordFilterPasses(cmdBuffer, context, target, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        RecordDownload(cmdBuffer, outputImage, imageWidth, imageHeight, readbackBuffer);
+    }
+
+
+    // 18. End the Command Buffer recording.
+    {
+        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+
+    // 19. Create a Fence.
+    // This Fence will be used to synchronize between CPU and GPU.
+    // The Fence is created in an unsignaled state, thus no need to reset it.
+    VkFence fence;
+    {
+        VkFenceCreateInfo fenceInfo;
+        {
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = 0;
+            //fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            fenceInfo.flags = 0;
+        }
+
+        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create synchronization objects for a frame!");
+        }
+
+        //vkResetFences(device, 1, &fence);
+    }
+
+    // 20. Submit the recorded Command Buffer to the Queue.
+    {
+        VkSubmitInfo submitInfo;
+        {
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = NULL;
+            submitInfo.waitSemaphoreCount = 0;
+            submitInfo.pWaitSemaphores = NULL;
+            submitInfo.pWaitDstStageMask = NULL;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &cmdBuffer;
+            submitInfo.signalSemaphoreCount = 0;
+            submitInfo.pSignalSemaphores = NULL;
+        }
+
+        // A fence is provided to have a CPU side sync point.
+        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit command buffer!");
+        }
+    }
+
+    // 21. Wait the submitted Command Buffer to finish.
+    {
+        // -1 means to wait for ever to finish.
+        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for fence!");
+        }
+    }
+
+
+    // XX. Destroy Fence.
+    vkDestroyFence(device, fence, NULL);
+
+    // XX. Free Command Buffer.
+    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+
+    // XX. Destroy Command Pool
+    vkDestroyCommandPool(device, cmdPool, NULL);
+
+
+    // The upload buffer still has the source pixels.
+    DumpImage(device, uploadMemory, imageWidth, imageHeight, "src.ppm", useMmap);
+    DumpImage(device, readbackMemory, imageWidth, imageHeight, outputFileName, useMmap);
+
+    // A.1. Report the memory arena usage.
+    PrintArenaStats(*context.arena);
+
+    vkDestroyBuffer(device, uploadBuffer, NULL);
+    ArenaFree(context.arena, uploadMemory);
+    vkDestroyBuffer(device, readbackBuffer, NULL);
+    ArenaFree(context.arena, readbackMemory);
+
+    DestroyFilterTarget(context, &target);
+}
+
+std::vector<std::string> ListBatchInputs(const std::string& path) {
+    std::vector<std::string> files;
+
+    // BA.1. A directory is scanned for ".ppm" files (in name order),
+    // any other file is a list with one image path on each line.
+    DIR *dir = opendir(path.c_str());
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const std::string name(entry->d_name);
+            if ((name.size() > 4) && (name.compare(name.size() - 4, 4, ".ppm") == 0)) {
+                files.push_back(path + "/" + name);
+            }
+        }
+        closedir(dir);
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    std::ifstream list(path);
+    if (!list.is_open()) {
+        throw std::runtime_error("failed to open the batch input!");
+    }
+
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty()) {
+            files.push_back(line);
+        }
+    }
+
+    return files;
+}
+
+static bool ReadPPMValue(std::ifstream& input, uint32_t *outValue) {
+    // Skip the whitespaces and the comment lines before the value.
+    int chr = input.get();
+    while (input.good() && (isspace(chr) || (chr == '#'))) {
+        if (chr == '#') {
+            input.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        chr = input.get();
+    }
+
+    if (!input.good() || !isdigit(chr)) {
+        return false;
+    }
+
+    // The single whitespace after the value is consumed too (required before the pixel data).
+    uint32_t value = 0;
+    while (input.good() && isdigit(chr)) {
+        if (value > (UINT32_MAX - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + (chr - '0');
+        chr = input.get();
+    }
+
+    *outValue = value;
+    return true;
+}
+
+bool ReadPPM(const std::string& fileName, DecodedImage *out) {
+    std::ifstream input(fileName, std::ios::binary);
+
+    // BA.2. Only binary (P6) images with 8 bit channels are supported.
+    char magic[2];
+    if (!input.read(magic, 2) || (magic[0] != 'P') || (magic[1] != '6')) {
+        return false;
+    }
+
+    uint32_t maxValue = 0;
+    if (!ReadPPMValue(input, &out->width) || !ReadPPMValue(input, &out->height) || !ReadPPMValue(input, &maxValue)
+        || (out->width == 0) || (out->height == 0) || (maxValue != 255)) {
+        return false;
+    }
+
+    // BA.2.1. The header is not trusted: the pixel data must fit into the rest of the file
+    // and into the pixel limit, before anything is allocated for it.
+    const std::streamoff dataStart = input.tellg();
+    input.seekg(0, std::ios::end);
+    const std::streamoff dataSize = input.tellg() - dataStart;
+    input.seekg(dataStart);
+
+    const uint64_t pixelCount64 = (uint64_t)out->width * out->height;
+    if ((pixelCount64 > g_maxPPMPixels) || (dataStart < 0) || ((uint64_t)dataSize < pixelCount64 * 3)) {
+        return false;
+    }
+
+    const size_t pixelCount = (size_t)pixelCount64;
+    std::vector<uint8_t> rgb(pixelCount * 3);
+    if (!input.read(reinterpret_cast<char*>(rgb.data()), rgb.size())) {
+        return false;
+    }
+
+    // BA.3. Expand to the RGBA layout of the images.
+    out->name = fileName;
+    out->pixels.resize(pixelCount * 4);
+    for (size_t idx = 0; idx < pixelCount; idx++) {
+        out->pixels[idx * 4 + 0] = rgb[idx * 3 + 0];
+        out->pixels[idx * 4 + 1] = rgb[idx * 3 + 1];
+        out->pixels[idx * 4 + 2] = rgb[idx * 3 + 2];
+        out->pixels[idx * 4 + 3] = 255;
+    }
+
+    return true;
+}
+
+void BatchLoaderThread(BatchLoader *loader) {
+    for (size_t fileIdx = 0; fileIdx < loader->files.size(); fileIdx++) {
+        DecodedImage image;
+        if (!ReadPPM(loader->files[fileIdx], &image)) {
+            printf("Batch: failed to decode %s\n", loader->files[fileIdx].c_str());
+            loader->failedCount++;
+            continue;
+        }
+
+        // BA.4. Wait for a free entry, the loader stays at most "capacity" images ahead of the GPU.
+        std::unique_lock<std::mutex> lock(loader->mutex);
+        loader->cond.wait(lock, [loader]() { return (loader->decoded.size() < loader->capacity) || loader->stopRequested; });
+        if (loader->stopRequested) {
+            break;
+        }
+
+        loader->decoded.push_back(std::move(image));
+        loader->cond.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->finished = true;
+    loader->cond.notify_all();
+}
+
+bool BatchLoaderPop(BatchLoader *loader, DecodedImage *out) {
+    std::unique_lock<std::mutex> lock(loader->mutex);
+    loader->cond.wait(lock, [loader]() { return !loader->decoded.empty() || loader->finished; });
+
+    if (loader->decoded.empty()) {
+        return false;
+    }
+
+    *out = std::move(loader->decoded.front());
+    loader->decoded.pop_front();
+    loader->cond.notify_all();
+
+    return true;
+}
+
+static void SubmitBatchStage(VkQueue queue,
+                             VkCommandBuffer cmdBuffer,
+                             VkSemaphore waitSemaphore,
+                             VkPipelineStageFlags waitStage,
+                             VkSemaphore signalSemaphore,
+                             VkFence fence) {
+    VkSubmitInfo submitInfo;
+    {
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = NULL;
+        submitInfo.waitSemaphoreCount = (waitSemaphore != VK_NULL_HANDLE) ? 1 : 0;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuffer;
+        submitInfo.signalSemaphoreCount = (signalSemaphore != VK_NULL_HANDLE) ? 1 : 0;
+        submitInfo.pSignalSemaphores = &signalSemaphore;
+    }
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
+}
+
+static void RetireBatchSlot(VkDevice device, BatchSlot *slot, bool useMmap) {
+    if (vkWaitForFences(device, 1, &slot->fence, VK_TRUE, -1) != VK_SUCCESS) {
+        throw std::runtime_error("failed to wait for fence!");
+    }
+    vkResetFences(device, 1, &slot->fence);
+
+    DumpImage(device, slot->readbackMemory, slot->width, slot->height, slot->outputName, useMmap);
+    slot->busy = false;
+}
+
+static void CreateBatchSlot(const FilterContext& context,
+                            const VkCommandPool cmdPools[2],
+                            uint32_t width,
+                            uint32_t height,
+                            BatchSlot *outSlot) {
+    const VkDevice device = context.device;
+    const VkDeviceSize imageBytes = (VkDeviceSize)width * height * sizeof(uint32_t);
+    BatchSlot& slot = *outSlot;
+
+    // BA.8.2. The upload, filter and download command buffers only depend on the slot resources,
+    // so they are recorded once and resubmitted for every image of this size.
+    slot.width = width;
+    slot.height = height;
+    CreateFilterTarget(context, width, height, &slot.target);
+    slot.uploadBuffer = CreateHostBuffer(context.arena, imageBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &slot.uploadMemory);
+    slot.readbackBuffer = CreateHostBuffer(context.arena, imageBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &slot.readbackMemory);
+    slot.busy = false;
+
+    for (uint32_t stageIdx = 0; stageIdx < 3; stageIdx++) {
+        VkCommandBufferAllocateInfo allocInfo;
         {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            //fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-            fenceInfo.flags = 0;
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = cmdPools[(stageIdx == 1) ? 0 : 1];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
         }
 
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization objects for a frame!");
+        if (vkAllocateCommandBuffers(device, &allocInfo, &slot.cmdBuffers[stageIdx]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
         }
 
-        //vkResetFences(device, 1, &fence);
-    }
-
-    // 20. Submit the recorded Command Buffer to the Queue.
-    {
-        VkSubmitInfo submitInfo;
+        VkCommandBufferBeginInfo beginInfo;
         {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = 0;
+            beginInfo.pInheritanceInfo = NULL;
         }
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        if (vkBeginCommandBuffer(slot.cmdBuffers[stageIdx], &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
         }
-    }
 
-    // 21. Wait the submitted Command Buffer to finish.
-    {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
+        // BA.8.1. The stages are ordered by semaphores (which also make the writes visible),
+        // so the last barrier of the upload and filter stages does not wait for anything on its own queue.
+        // The images are shared concurrently between the queue families, no ownership transfer is needed.
+        if (stageIdx == 0) {
+            RecordUpload(slot.cmdBuffers[0], slot.uploadBuffer, slot.target.images[0], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+        } else if (stageIdx == 1) {
+            slot.outputImage = RecordFilterPasses(slot.cmdBuffers[1], context, slot.target, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+        } else {
+            RecordDownload(slot.cmdBuffers[2], slot.outputImage, width, height, slot.readbackBuffer);
+        }
+
+        if (vkEndCommandBuffer(slot.cmdBuffers[stageIdx]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
         }
     }
 
+    VkSemaphoreCreateInfo semaphoreInfo;
+    {
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = NULL;
+        semaphoreInfo.flags = 0;
+    }
 
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
+    VkFenceCreateInfo fenceInfo;
+    {
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.pNext = 0;
+        fenceInfo.flags = 0;
+    }
 
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+    if ((vkCreateSemaphore(device, &semaphoreInfo, NULL, &slot.stageSemaphores[0]) != VK_SUCCESS)
+        || (vkCreateSemaphore(device, &semaphoreInfo, NULL, &slot.stageSemaphores[1]) != VK_SUCCESS)
+        || (vkCreateFence(device, &fenceInfo, NULL, &slot.fence) != VK_SUCCESS)) {
+        throw std::runtime_error("failed to create synchronization objects for a slot!");
+    }
+}
 
-    // XX. Destroy Command Pool
-    vkDestroyCommandPool(device, cmdPool, NULL);
+static void DestroyBatchSlot(const FilterContext& context, const VkCommandPool cmdPools[2], BatchSlot *slot) {
+    const VkDevice device = context.device;
 
+    vkDestroySemaphore(device, slot->stageSemaphores[0], NULL);
+    vkDestroySemaphore(device, slot->stageSemaphores[1], NULL);
+    vkDestroyFence(device, slot->fence, NULL);
 
-    DumpImage(device, sourceImage, "src.ppm");
-    DumpImage(device, destinationImage, outputFileName);
+    // The filter stage is allocated from the compute pool, the upload and download stages from the transfer pool.
+    vkFreeCommandBuffers(device, cmdPools[0], 1, &slot->cmdBuffers[1]);
+    vkFreeCommandBuffers(device, cmdPools[1], 1, &slot->cmdBuffers[0]);
+    vkFreeCommandBuffers(device, cmdPools[1], 1, &slot->cmdBuffers[2]);
 
-    DestroyVulkanImage(device, &sourceImage);
-    DestroyVulkanImage(device, &destinationImage);
+    vkDestroyBuffer(device, slot->uploadBuffer, NULL);
+    ArenaFree(context.arena, slot->uploadMemory);
+    vkDestroyBuffer(device, slot->readbackBuffer, NULL);
+    ArenaFree(context.arena, slot->readbackMemory);
 
-    vkDestroyPipeline(device, computePipeline, NULL);
+    DestroyFilterTarget(context, &slot->target);
 
-    vkDestroyPipelineLayout(device, computePipelineLayout, NULL);
+    slot->width = 0;
+    slot->height = 0;
+}
 
-    vkDestroyDescriptorPool(device, descriptorPool, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
+uint32_t RunBatch(const FilterContext& context,
+                  VkQueue computeQueue,
+                  VkQueue transferQueue,
+                  uint32_t computeQueueFamilyIdx,
+                  uint32_t transferQueueFamilyIdx,
+                  BatchLoader *loader,
+                  const std::string& outputDir,
+                  uint32_t slotCount,
+                  bool useMmap) {
+    const VkDevice device = context.device;
+
+    if ((mkdir(outputDir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        throw std::runtime_error("failed to create the batch output directory!");
+    }
 
-    vkDestroyShaderModule(device, computeShader, NULL);
+    DecodedImage image;
+    if (!BatchLoaderPop(loader, &image)) {
+        printf("Batch: no images to process\n");
+        return 0;
+    }
 
-    // XX. Destroy Device
-    vkDestroyDevice(device, NULL);
+    // BA.6. The images can have different sizes, only the ones over the device limits are skipped.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.arena->physicalDevice, &properties);
+    const uint32_t maxDimension = properties.limits.maxImageDimension2D;
 
-    // XY. Destroy instance
-    vkDestroyInstance(instance, NULL);
+    // BA.7. One command pool for each stage's queue family.
+    const uint32_t poolQueueFamilies[2] = { computeQueueFamilyIdx, transferQueueFamilyIdx };
+    VkCommandPool cmdPools[2];
+    for (uint32_t poolIdx = 0; poolIdx < 2; poolIdx++) {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.queueFamilyIndex = poolQueueFamilies[poolIdx];
+        }
 
-    return 0;
-}
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPools[poolIdx]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
+    // BA.8. The slots are created on first use, each one processes a single image at a time.
+    std::vector<BatchSlot> slots(slotCount);
+    for (uint32_t slotIdx = 0; slotIdx < slotCount; slotIdx++) {
+        slots[slotIdx].width = 0;
+        slots[slotIdx].height = 0;
+        slots[slotIdx].busy = false;
     }
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+    printf("Batch: %u file(s), %u slot(s), %s transfer queue\n",
+           (uint32_t)loader->files.size(), slotCount,
+           ((transferQueueFamilyIdx != computeQueueFamilyIdx) ? "dedicated" : "shared"));
 
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    // BA.9. Feed the slots in turns.
+    // Before a slot is reused its previous image is written out, meanwhile the other slots keep the GPU busy.
+    std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+    uint32_t processedCount = 0;
+    uint32_t skippedCount = 0;
+    uint32_t slotIdx = 0;
+    bool hasImage = true;
 
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
+    while (hasImage) {
+        BatchSlot& slot = slots[slotIdx];
 
-            return queueFamilyIdx;
+        if (slot.busy) {
+            RetireBatchSlot(device, &slot, useMmap);
+            processedCount++;
         }
 
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
-    }
+        if ((image.width > maxDimension) || (image.height > maxDimension)) {
+            printf("Batch: skipping %s (%ux%u is over the device limit of %u)\n",
+                   image.name.c_str(), image.width, image.height, maxDimension);
+            skippedCount++;
+        } else {
+            // BA.9.1. The slot is idle, so its resources can be re-created for an image of another size.
+            if ((slot.width != image.width) || (slot.height != image.height)) {
+                if (slot.width != 0) {
+                    printf("Batch: slot %u re-created for %ux%u (was %ux%u)\n",
+                           slotIdx, image.width, image.height, slot.width, slot.height);
+                    DestroyBatchSlot(context, cmdPools, &slot);
+                }
+                CreateBatchSlot(context, cmdPools, image.width, image.height, &slot);
+            }
 
-    return UINT32_MAX;
-}
+            // BA.9.2. Upload -> filter -> download, the transfer stages run on the transfer queue.
+            memcpy(slot.uploadMemory.mapped, image.pixels.data(), image.pixels.size());
+
+            VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL, slot.uploadMemory.memory, slot.uploadMemory.offset, slot.uploadMemory.size };
+            vkFlushMappedMemoryRanges(device, 1, &range);
 
+            slot.outputName = outputDir + "/" + image.name.substr(image.name.find_last_of('/') + 1);
 
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+            SubmitBatchStage(transferQueue, slot.cmdBuffers[0],
+                             VK_NULL_HANDLE, 0, slot.stageSemaphores[0], VK_NULL_HANDLE);
+            SubmitBatchStage(computeQueue, slot.cmdBuffers[1],
+                             slot.stageSemaphores[0], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, slot.stageSemaphores[1], VK_NULL_HANDLE);
+            SubmitBatchStage(transferQueue, slot.cmdBuffers[2],
+                             slot.stageSemaphores[1], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_NULL_HANDLE, slot.fence);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+            slot.busy = true;
+            slotIdx = (slotIdx + 1) % slotCount;
         }
+
+        hasImage = BatchLoaderPop(loader, &image);
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
-}
+    // BA.10. Retire the remaining slots in submission order.
+    for (uint32_t idx = 0; idx < slotCount; idx++) {
+        BatchSlot& slot = slots[(slotIdx + idx) % slotCount];
+        if (slot.busy) {
+            RetireBatchSlot(device, &slot, useMmap);
+            processedCount++;
+        }
+    }
 
-#if HAVE_SHADERC
+    double batchTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
 
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+    printf("Batch: %u image(s) in %.3f s (%.2f images/sec), %u skipped\n",
+           processedCount, batchTime, ((batchTime > 0.0) ? processedCount / batchTime : 0.0), skippedCount);
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+    // A.1. Report the memory arena usage.
+    PrintArenaStats(*context.arena);
+
+    for (uint32_t idx = 0; idx < slotCount; idx++) {
+        if (slots[idx].width != 0) {
+            DestroyBatchSlot(context, cmdPools, &slots[idx]);
+        }
     }
 
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
+    vkDestroyCommandPool(device, cmdPools[0], NULL);
+    vkDestroyCommandPool(device, cmdPools[1], NULL);
+
+    return processedCount;
 }
 
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+bool WorkGroupSizeSupported(const VkPhysicalDeviceProperties& properties, const WorkGroupSize& size) {
+    // WG.1. The tiled blur kernel keeps the tile lines (with the apron) in shared memory as packed RGBA8.
+    const uint32_t sharedBytes = (size.x * size.y + 2 * g_maxBlurRadius * (size.x + size.y)) * sizeof(uint32_t);
 
-    return { module.begin(), module.end() };
+    return (size.x > 0) && (size.y > 0)
+        && (size.x <= properties.limits.maxComputeWorkGroupSize[0])
+        && (size.y <= properties.limits.maxComputeWorkGroupSize[1])
+        && (size.x * size.y <= properties.limits.maxComputeWorkGroupInvocations)
+        && (sharedBytes <= properties.limits.maxComputeSharedMemorySize);
 }
 
-#else
+void CreateFilterPipelines(const VkDevice device,
+                           const VkPipelineCache pipelineCache,
+                           const VkPipelineLayout pipelineLayout,
+                           const VkShaderModule shaders[FILTER_KERNEL_COUNT],
+                           const bool kernelUsed[FILTER_KERNEL_COUNT],
+                           const WorkGroupSize& groupSize,
+                           VkPipeline outPipelines[FILTER_KERNEL_COUNT]) {
+    // WG.2. The work group size is specialized at pipeline creation (constant_id 0 and 1 of the kernels).
+    const uint32_t specData[2] = { groupSize.x, groupSize.y };
+    const VkSpecializationMapEntry specEntries[2] = {
+        { /* constantID */ 0, /* offset */ 0, /* size */ sizeof(uint32_t) },
+        { /* constantID */ 1, /* offset */ sizeof(uint32_t), /* size */ sizeof(uint32_t) },
+    };
+
+    VkSpecializationInfo specInfo;
+    {
+        specInfo.mapEntryCount = 2;
+        specInfo.pMapEntries = specEntries;
+        specInfo.dataSize = sizeof(specData);
+        specInfo.pData = specData;
+    }
 
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
+    for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+        outPipelines[kernel] = VK_NULL_HANDLE;
+        if (!kernelUsed[kernel]) {
+            continue;
+        }
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
-    }
+        VkPipelineShaderStageCreateInfo computeStageInfo;
+        {
+            computeStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            computeStageInfo.pNext = NULL;
+            computeStageInfo.flags = 0;
+            computeStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            computeStageInfo.module = shaders[kernel];
+            computeStageInfo.pName = "main";
+            computeStageInfo.pSpecializationInfo = &specInfo;
+        }
 
-    size_t fileSize = (size_t) file.tellg();
+        VkComputePipelineCreateInfo pPipelineInfo;
+        {
+            pPipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pPipelineInfo.pNext = NULL;
+            pPipelineInfo.flags = 0;
+            pPipelineInfo.stage = computeStageInfo;
+            pPipelineInfo.layout = pipelineLayout;
+            pPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+            pPipelineInfo.basePipelineIndex = 0;
+        }
 
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+        VkResult pipelineCreation = vkCreateComputePipelines(device, pipelineCache, 1, &pPipelineInfo, nullptr, &outPipelines[kernel]);
+        if (pipelineCreation != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create compute pipeline");
+        }
     }
+}
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+void DestroyFilterPipelines(const VkDevice device, VkPipeline pipelines[FILTER_KERNEL_COUNT]) {
+    for (uint32_t kernel = 0; kernel < FILTER_KERNEL_COUNT; kernel++) {
+        if (pipelines[kernel] != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipelines[kernel], NULL);
+            pipelines[kernel] = VK_NULL_HANDLE;
+        }
+    }
+}
 
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
+WorkGroupSize AutotuneWorkGroupSize(const VkPhysicalDevice physicalDevice,
+                                    VkQueue queue,
+                                    uint32_t queueFamilyIdx,
+                                    const VkPipelineCache pipelineCache,
+                                    const VkShaderModule shaders[FILTER_KERNEL_COUNT],
+                                    const bool kernelUsed[FILTER_KERNEL_COUNT],
+                                    FilterContext context,
+                                    uint32_t width,
+                                    uint32_t height) {
+    const VkDevice device = context.device;
 
-    file.close();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    return buffer;
-}
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
 
-#endif
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
 
+    // WG.3. The candidates are timed with GPU timestamps around the filter passes,
+    // if the queue has no timestamp support the submission is timed on the CPU.
+    const uint32_t validBits = queueFamilies[queueFamilyIdx].timestampValidBits;
+    const uint64_t timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
 
-bool CreateVulkan2DImage(
-    VkDevice device,
-    VkPhysicalDevice physicalDevice,
-    VkFormat renderImageFormat,
-    uint32_t renderImageWidth,
-    uint32_t renderImageHeight,
-    Vulkan2DImage& out)
-{
-    //VkImage renderImage;
-    {
-        // 5.1. Specify the image creation information.
-        VkImageCreateInfo imageInfo;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (validBits > 0) {
+        VkQueryPoolCreateInfo queryPoolInfo;
         {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = renderImageFormat;
-            imageInfo.extent = { renderImageWidth, renderImageHeight,  1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            // Tiling optimal means that the image is in a GPU optimal mode.
-            // Usually this means that it should not be accessed from the CPU side directly as
-            // the image color channels can be in any order.
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            // Specifying the usage is important:
-            // * VK_IMAGE_USAGE_TRANSFER_SRC_BIT: the image can be used as a source for a transfer/copy operation.
-            // * VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT: the image can be used as a color attachment (aka can render on it).
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT; //VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // | VK_IMAGE_USAGE_SAMPLED_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.pNext = NULL;
+            queryPoolInfo.flags = 0;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2;
+            queryPoolInfo.pipelineStatistics = 0;
         }
 
-        // 5.2. Create the image.
-        if (vkCreateImage(device, &imageInfo, NULL, &out.vkImage) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
+        if (vkCreateQueryPool(device, &queryPoolInfo, NULL, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
         }
     }
 
-    // 6. Allocate and bind the memory for the render target image.
-    // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
+    VkCommandPool cmdPool;
     {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, out.vkImage, &memRequirements);
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
 
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
 
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
+    VkCommandBuffer cmdBuffer;
+    {
+        VkCommandBufferAllocateInfo allocInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            allocInfo.commandPool = cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
         }
 
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &out.vkMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
         }
-
-        // 6.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, out.vkImage, out.vkMemory, 0);
     }
 
-    // 7. Create an Image View for the Render Target Image.
-    // Will be used by the Framebuffer as Color Attachment.
+    VkFence fence;
     {
-        // 7.1. Specify the view information.
-        VkImageViewCreateInfo createInfo;
+        VkFenceCreateInfo fenceInfo;
         {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.image = out.vkImage;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = renderImageFormat;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = 0;
+            fenceInfo.flags = 0;
         }
 
-        // 7.2. Create the Image View.
-        if (vkCreateImageView(device, &createInfo, NULL, &out.vkImageView) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create image views!");
+        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create synchronization objects for the autotuner!");
         }
     }
 
-    return true;
-}
+    VkCommandBufferBeginInfo beginInfo;
+    {
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = NULL;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = NULL;
+    }
 
-void DestroyVulkanImage(VkDevice device, struct Vulkan2DImage* img) {
-    vkDestroyImage(device, img->vkImage, NULL);
-    vkDestroyImageView(device, img->vkImageView, NULL);
-    vkFreeMemory(device, img->vkMemory, NULL);
-}
+    VkSubmitInfo submitInfo;
+    {
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = NULL;
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.pWaitSemaphores = NULL;
+        submitInfo.pWaitDstStageMask = NULL;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuffer;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = NULL;
+    }
 
+    // WG.4. The kernels run on the real image size. The image contents do not change the timing,
+    // so the source image is only moved into the general layout.
+    FilterTarget target;
+    CreateFilterTarget(context, width, height, &target);
 
-void DumpImage(VkDevice device, Vulkan2DImage& img, std::string outputFileName) {
-    // Start readback process of the rendered image.
-    // 22. Copy the rendered image into a buffer which can be mapped and read.
-    // Note: this is the most basic process to the the image into a readeable memory.
-    //VkImage readableImage;
-    //VkDeviceMemory readableImageMemory;
-    //CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, renderImage, renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
+    vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+    RecordImageBarrier(cmdBuffer, target.images[0].vkImage,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+    vkEndCommandBuffer(cmdBuffer);
 
-    // 23. Get layout of the readable image (including row pitch).
-    VkImageSubresource subResource;
-    {
-        subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subResource.mipLevel = 0;
-        subResource.arrayLayer = 0;
+    if ((vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS)
+        || (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS)) {
+        throw std::runtime_error("failed to prepare the autotuner image!");
     }
-    VkSubresourceLayout subResourceLayout;
-    vkGetImageSubresourceLayout(device, img.vkImage, &subResource, &subResourceLayout);
+    vkResetFences(device, 1, &fence);
+
+    // WG.5. Each candidate is run once to warm up, the best of the following runs is its time.
+    const uint32_t runCount = 5;
+    WorkGroupSize best = g_defaultWorkGroupSize;
+    double bestTime = std::numeric_limits<double>::max();
+
+    for (size_t candidateIdx = 0; candidateIdx < sizeof(g_workGroupCandidates) / sizeof(g_workGroupCandidates[0]); candidateIdx++) {
+        const WorkGroupSize& candidate = g_workGroupCandidates[candidateIdx];
+        if (!WorkGroupSizeSupported(properties, candidate)) {
+            printf("Autotune: %3ux%-3u skipped (over the device limits)\n", candidate.x, candidate.y);
+            continue;
+        }
 
-    // 24. Map image memory so we can start copying from it.
-    const uint8_t* data;
-    {
-        vkMapMemory(device, img.vkMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-        data += subResourceLayout.offset;
+        context.groupSize = candidate;
+        CreateFilterPipelines(device, pipelineCache, context.pipelineLayout, shaders, kernelUsed, candidate, context.pipelines);
+
+        double candidateTime = std::numeric_limits<double>::max();
+        for (uint32_t run = 0; run <= runCount; run++) {
+            vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+            if (queryPool != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(cmdBuffer, queryPool, 0, 2);
+                vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+            }
+
+            RecordFilterPasses(cmdBuffer, context, target, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+            if (queryPool != VK_NULL_HANDLE) {
+                vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+            }
+
+            if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record command buffer!");
+            }
+
+            std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+            if ((vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS)
+                || (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS)) {
+                throw std::runtime_error("failed to run the autotuner candidate!");
+            }
+            double runTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+            vkResetFences(device, 1, &fence);
+
+            if (queryPool != VK_NULL_HANDLE) {
+                uint64_t timestamps[2];
+                VkResult result = vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                                        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("failed to get timestamp query results!");
+                }
+
+                const uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+                runTime = ticks * properties.limits.timestampPeriod / 1000000.0;
+            }
+
+            if (run > 0) {
+                candidateTime = std::min(candidateTime, runTime);
+            }
+        }
+
+        printf("Autotune: %3ux%-3u %.3f ms\n", candidate.x, candidate.y, candidateTime);
+        if (candidateTime < bestTime) {
+            bestTime = candidateTime;
+            best = candidate;
+        }
+
+        DestroyFilterPipelines(device, context.pipelines);
     }
 
-    // 25. Write out the image to a ppm file.
+    printf("Autotune: best work group size %ux%u (%.3f ms, %s)\n",
+           best.x, best.y, bestTime, ((queryPool != VK_NULL_HANDLE) ? "GPU timestamps" : "CPU time"));
+
+    DestroyFilterTarget(context, &target);
+    vkDestroyFence(device, fence, NULL);
+    vkDestroyCommandPool(device, cmdPool, NULL);
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, NULL);
+    }
+
+    return best;
+}
+
+bool LoadWorkGroupSize(const std::string& fileName, const VkPhysicalDeviceProperties& properties, WorkGroupSize *outSize) {
+    // WG.6. Each line of the cache is "<vendorID> <deviceID> <x> <y>", the IDs are hexadecimal.
+    std::ifstream file(fileName);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        uint32_t vendorID = 0;
+        uint32_t deviceID = 0;
+        WorkGroupSize size;
+        if ((sscanf(line.c_str(), "%x %x %u %u", &vendorID, &deviceID, &size.x, &size.y) == 4)
+            && (vendorID == properties.vendorID) && (deviceID == properties.deviceID)) {
+            *outSize = size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SaveWorkGroupSize(const std::string& fileName, const VkPhysicalDeviceProperties& properties, const WorkGroupSize& size) {
+    // WG.7. Keep the entries of the other devices and replace the current one.
+    std::vector<std::string> lines;
     {
-        std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-        // ppm header
-        file << "P6\n" << img.width << "\n" << img.height << "\n" << 255 << "\n";
-
-        // ppm binary pixel data
-        // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-        for (uint32_t y = 0; y < img.height; y++) {
-            uint32_t *row = (uint32_t*)data;
-            for (uint32_t x = 0; x < img.width; x++) {
-                // Only copy the RGB values (3)
-                file.write((const char*)row, 3);
-                row++;
+        std::ifstream file(fileName);
+
+        std::string line;
+        while (std::getline(file, line)) {
+            uint32_t vendorID = 0;
+            uint32_t deviceID = 0;
+            if ((sscanf(line.c_str(), "%x %x", &vendorID, &deviceID) == 2)
+                && ((vendorID != properties.vendorID) || (deviceID != properties.deviceID))) {
+                lines.push_back(line);
             }
-
-            data += subResourceLayout.rowPitch;
         }
-        file.close();
+    }
+
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%04x %04x %u %u", properties.vendorID, properties.deviceID, size.x, size.y);
+    lines.push_back(entry);
+
+    std::ofstream file(fileName, std::ios::trunc);
+    if (!file.is_open()) {
+        printf("Autotune: failed to write '%s'\n", fileName.c_str());
+        return;
+    }
+
+    for (size_t idx = 0; idx < lines.size(); idx++) {
+        file << lines[idx] << '\n';
     }
 }
@@ -11,7 +11,11 @@
  * $ ./vkmininfo
  *
  * Env variables:
- *  * None
+ *  * DEMO_PROFILE: Write the device profile (JSON) into this file, "-" writes it to the standard output
+ *    instead of the text dump. The demos rank the devices by the probe results of this file
+ *    with DEMO_DEVICE_PROFILE=<file>. Default: unset
+ *  * DEMO_PROBE: Run the copy bandwidth and dispatch latency probes (1) on each device. Default: 0
+ *  * DEMO_PROBE_SIZE: Size of the bandwidth probe buffers in MiB. Default: 64
  *
  * Dependencies:
  *  * C++11
@@ -41,7 +45,9 @@
  */
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <algorithm>
+#include <chrono>
 #include <numeric>
 #include <string>
 #include <vector>
@@ -131,14 +137,20 @@ void DumpLayers(const std::string& header, const std::vector<VkLayerProperties>&
     }
 }
 
-VkInstance CreateInstance() {
+bool HasExtension(const std::vector<VkExtensionProperties>& exts, const char *name) {
+    return std::any_of(exts.begin(), exts.end(),
+        [name](const VkExtensionProperties& ext) {
+            return 0 == strcmp(ext.extensionName, name);
+        });
+}
+
+VkInstance CreateInstance(uint32_t apiVersion, const std::vector<const char*>& extensions) {
 #ifndef VK_MAKE_API_VERSION
 #define VK_MAKE_API_VERSION(variant, major, minor, patch) \
     ((((uint32_t)(variant)) << 29) | (((uint32_t)(major)) << 22) | (((uint32_t)(minor)) << 12) | ((uint32_t)(patch)))
 #endif
 
     std::vector<const char*> layers     = {};
-    std::vector<const char*> extensions = {};
 
     const VkApplicationInfo appInfo = {
         VK_STRUCTURE_TYPE_APPLICATION_INFO,                 // sType
@@ -147,7 +159,7 @@ VkInstance CreateInstance() {
         1,                                                  // applicationVersion
         "Raw",                                              // pEngineName
         1,                                                  // engineVersion
-        VK_MAKE_API_VERSION(0, 1, 0, 0),                    // apiVersion
+        apiVersion,                                         // apiVersion
     };
 
     const VkInstanceCreateInfo createInfo = {
@@ -170,17 +182,61 @@ VkInstance CreateInstance() {
     return instance;
 }
 
+uint32_t QueryInstanceVersion() {
+    // vkEnumerateInstanceVersion is only exported by Vulkan 1.1 (and newer) loaders.
+    const PFN_vkEnumerateInstanceVersion enumerateVersion =
+        (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+
+    uint32_t version = VK_MAKE_API_VERSION(0, 1, 0, 0);
+    if ((nullptr != enumerateVersion) && (VK_SUCCESS != enumerateVersion(&version))) {
+        version = VK_MAKE_API_VERSION(0, 1, 0, 0);
+    }
+
+    return version;
+}
+
+VkSurfaceKHR CreateHeadlessSurface(VkInstance instance) {
+    const PFN_vkCreateHeadlessSurfaceEXT createSurface =
+        (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+
+    const VkHeadlessSurfaceCreateInfoEXT createInfo = {
+        VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT, // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+    };
+
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    if ((nullptr == createSurface) || (VK_SUCCESS != createSurface(instance, &createInfo, nullptr, &surface))) {
+        printf("Failed to create headless surface, present modes are not reported\n");
+        return VK_NULL_HANDLE;
+    }
+
+    return surface;
+}
+
 struct PhysicalDeviceInfo {
     VkPhysicalDevice                    phyDevice;
     VkPhysicalDeviceProperties          properties;
     std::vector<VkExtensionProperties>  extensions;
     VkPhysicalDeviceMemoryProperties    memory;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    // Zero if the instance or the device is below Vulkan 1.1.
+    uint32_t                            subgroupSize;
+    // Zero without VK_EXT_external_memory_host.
+    VkDeviceSize                        minImportedHostPointerAlignment;
+    // Present modes of a headless surface, empty without VK_EXT_headless_surface.
+    std::vector<VkPresentModeKHR>       presentModes;
 };
 
-std::vector<PhysicalDeviceInfo> QueryPhysicalDevices(VkInstance instance) {
+std::vector<PhysicalDeviceInfo> QueryPhysicalDevices(VkInstance instance, uint32_t instanceVersion, VkSurfaceKHR surface) {
     const std::vector<VkPhysicalDevice> devices =
         QueryWithMethod<VkPhysicalDevice>(vkEnumeratePhysicalDevices, instance);
 
+    // The extended properties are queried with the core 1.1 or the VK_KHR_get_physical_device_properties2 entry point.
+    const bool instance11 = (instanceVersion >= VK_MAKE_API_VERSION(0, 1, 1, 0));
+    const PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)
+        vkGetInstanceProcAddr(instance, instance11 ? "vkGetPhysicalDeviceProperties2" : "vkGetPhysicalDeviceProperties2KHR");
+
     std::vector<PhysicalDeviceInfo> infos(devices.size());
     for (size_t idx = 0; idx < infos.size(); idx++) {
         const VkPhysicalDevice phyDevice = devices[idx];
@@ -191,11 +247,68 @@ std::vector<PhysicalDeviceInfo> QueryPhysicalDevices(VkInstance instance) {
 
         vkGetPhysicalDeviceProperties(phyDevice, &infos[idx].properties);
         vkGetPhysicalDeviceMemoryProperties(phyDevice, &infos[idx].memory);
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &queueFamilyCount, nullptr);
+        infos[idx].queueFamilies.resize(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &queueFamilyCount, infos[idx].queueFamilies.data());
+
+        VkPhysicalDeviceSubgroupProperties subgroupProps = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,                  // sType
+            nullptr,                                                                // pNext
+            0,                                                                      // subgroupSize
+            0,                                                                      // supportedStages
+            0,                                                                      // supportedOperations
+            VK_FALSE,                                                               // quadOperationsInAllStages
+        };
+
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProps = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,  // sType
+            nullptr,                                                                // pNext
+            0,                                                                      // minImportedHostPointerAlignment
+        };
+
+        VkPhysicalDeviceProperties2 props2 = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,                         // sType
+            nullptr,                                                                // pNext
+            {},                                                                     // properties
+        };
+
+        // The subgroup properties are core 1.1 structures, both the instance and the device must support it.
+        if (instance11 && (infos[idx].properties.apiVersion >= VK_MAKE_API_VERSION(0, 1, 1, 0))) {
+            subgroupProps.pNext = props2.pNext;
+            props2.pNext = &subgroupProps;
+        }
+
+        if (HasExtension(infos[idx].extensions, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+            hostProps.pNext = props2.pNext;
+            props2.pNext = &hostProps;
+        }
+
+        if ((nullptr != getProperties2) && (nullptr != props2.pNext)) {
+            getProperties2(phyDevice, &props2);
+        }
+
+        infos[idx].subgroupSize = subgroupProps.subgroupSize;
+        infos[idx].minImportedHostPointerAlignment = hostProps.minImportedHostPointerAlignment;
+
+        if (VK_NULL_HANDLE != surface) {
+            infos[idx].presentModes =
+                QueryWithMethod<VkPresentModeKHR>(vkGetPhysicalDeviceSurfacePresentModesKHR, phyDevice, surface);
+        }
     }
 
     return infos;
 }
 
+bool IsComputeOnlyFamily(const VkQueueFamilyProperties& family) {
+    return (family.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+}
+
+bool IsTransferOnlyFamily(const VkQueueFamilyProperties& family) {
+    return (family.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+}
+
 void DumpPhysicalDeviceInfos(const std::string& header, const std::vector<PhysicalDeviceInfo>& phyDevices) {
 
     printf("%s (count = %ld)\n", header.c_str(), phyDevices.size());
@@ -211,6 +324,8 @@ void DumpPhysicalDeviceInfos(const std::string& header, const std::vector<Physic
                string_VkPhysicalDeviceType(props.deviceType),
                apiVersion.major, apiVersion.minor, apiVersion.patch,
                drvVersion.major, drvVersion.minor, drvVersion.patch);
+        printf("     timestampPeriod = %.3f ns subgroupSize = %u minImportedHostPointerAlignment = %lu\n",
+               props.limits.timestampPeriod, info.subgroupSize, info.minImportedHostPointerAlignment);
         printf("\n");
 
         DumpExtensions("    Device Extensions", info.extensions);
@@ -246,24 +361,745 @@ void DumpPhysicalDeviceInfos(const std::string& header, const std::vector<Physic
                 }
             }
         }
+        printf("\n");
+
+        printf("    Queue Families (count = %ld)\n", info.queueFamilies.size());
+        for (uint32_t ndx = 0; ndx < info.queueFamilies.size(); ndx++) {
+            const VkQueueFamilyProperties& family = info.queueFamilies[ndx];
+
+            printf("     %u: queueCount = %u queueFlags = 0x%x timestampValidBits = %u%s\n",
+                   ndx, family.queueCount, family.queueFlags, family.timestampValidBits,
+                   IsComputeOnlyFamily(family) ? " (compute only)" : (IsTransferOnlyFamily(family) ? " (transfer only)" : ""));
+        }
+
+        if (!info.presentModes.empty()) {
+            printf("\n");
+            printf("    Present Modes (headless surface, count = %ld)\n", info.presentModes.size());
+            for (const VkPresentModeKHR mode : info.presentModes) {
+                printf("     %s\n", string_VkPresentModeKHR(mode));
+            }
+        }
+    }
+}
+
+// Compute shader with an empty "main" and a 1x1x1 work group for the dispatch latency probe:
+//   OpCapability Shader
+//   OpMemoryModel Logical GLSL450
+//   OpEntryPoint GLCompute %1 "main"
+//   OpExecutionMode %1 LocalSize 1 1 1
+//   %2 = OpTypeVoid
+//   %3 = OpTypeFunction %2
+//   %1 = OpFunction %2 None %3
+//   %4 = OpLabel
+//   OpReturn
+//   OpFunctionEnd
+const uint32_t g_emptyComputeSpirv[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x00000005, 0x00000000,
+    0x00020011, 0x00000001,
+    0x0003000e, 0x00000000, 0x00000001,
+    0x0005000f, 0x00000005, 0x00000001, 0x6e69616d, 0x00000000,
+    0x00060010, 0x00000001, 0x00000011, 0x00000001, 0x00000001, 0x00000001,
+    0x00020013, 0x00000002,
+    0x00030021, 0x00000003, 0x00000002,
+    0x00050036, 0x00000002, 0x00000001, 0x00000000, 0x00000003,
+    0x000200f8, 0x00000004,
+    0x000100fd,
+    0x00010038,
+};
+
+// Each bandwidth probe runs this many times, the fastest run is reported.
+const uint32_t g_probeRepeatCount = 4;
+// Number of timed dispatches (after the same number of warm-up ones).
+const uint32_t g_dispatchProbeCount = 100;
+
+struct MemoryTypeProbe {
+    uint32_t    memoryTypeIndex;
+    // Mapped memcpy into/from the memory, zero if the type is not host visible.
+    double      hostWriteMiBps;
+    double      hostReadMiBps;
+    // vkCmdCopyBuffer from/to a host visible (coherent) staging buffer.
+    double      uploadMiBps;
+    double      downloadMiBps;
+};
+
+struct ProbeResults {
+    bool                            valid;
+    uint32_t                        queueFamilyIndex;
+    VkDeviceSize                    bufferSize;
+    // Only the memory types which could hold the probe buffers.
+    std::vector<MemoryTypeProbe>    memoryTypes;
+    // CPU round trip of a 1x1x1 dispatch (submit until the fence is signaled).
+    double                          dispatchMinUs;
+    double                          dispatchMedianUs;
+    // GPU time between the timestamps around the dispatch, negative if the queue has no timestamps.
+    double                          dispatchGpuUs;
+};
+
+struct ProbeBuffer {
+    VkBuffer                        buffer;
+    VkDeviceMemory                  memory;
+    // NULL if the memory type is not host visible.
+    uint8_t                        *mapped;
+};
+
+bool CreateProbeBuffer(VkDevice device, VkDeviceSize size, uint32_t memoryTypeIndex, const PhysicalDeviceInfo& info, ProbeBuffer *out) {
+    *out = { VK_NULL_HANDLE, VK_NULL_HANDLE, nullptr };
+
+    const VkBufferCreateInfo bufferInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,               // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        size,                                               // size
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, // usage
+        VK_SHARING_MODE_EXCLUSIVE,                          // sharingMode
+        0,                                                  // queueFamilyIndexCount
+        nullptr,                                            // pQueueFamilyIndices
+    };
+
+    if (VK_SUCCESS != vkCreateBuffer(device, &bufferInfo, nullptr, &out->buffer)) {
+        return false;
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, out->buffer, &requirements);
+
+    const VkMemoryAllocateInfo allocInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,             // sType
+        nullptr,                                            // pNext
+        requirements.size,                                  // allocationSize
+        memoryTypeIndex,                                    // memoryTypeIndex
+    };
+
+    // The type may not support buffers at all or the heap may be exhausted, the type is skipped then.
+    if (!(requirements.memoryTypeBits & (1U << memoryTypeIndex))
+        || (VK_SUCCESS != vkAllocateMemory(device, &allocInfo, nullptr, &out->memory))
+        || (VK_SUCCESS != vkBindBufferMemory(device, out->buffer, out->memory, 0))) {
+        if (VK_NULL_HANDLE != out->memory) {
+            vkFreeMemory(device, out->memory, nullptr);
+        }
+        vkDestroyBuffer(device, out->buffer, nullptr);
+        return false;
+    }
+
+    if (info.memory.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *mapped = nullptr;
+        if (VK_SUCCESS == vkMapMemory(device, out->memory, 0, VK_WHOLE_SIZE, 0, &mapped)) {
+            out->mapped = (uint8_t*)mapped;
+        }
+    }
+
+    return true;
+}
+
+void DestroyProbeBuffer(VkDevice device, ProbeBuffer *buffer) {
+    // Freeing the memory also unmaps it.
+    vkDestroyBuffer(device, buffer->buffer, nullptr);
+    vkFreeMemory(device, buffer->memory, nullptr);
+}
+
+double ElapsedSeconds(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns the CPU time of the submit and the wait in seconds, negative on error.
+double SubmitAndWait(VkDevice device, VkQueue queue, VkCommandBuffer cmdBuffer, VkFence fence) {
+    const VkSubmitInfo submitInfo = {
+        VK_STRUCTURE_TYPE_SUBMIT_INFO,                      // sType
+        nullptr,                                            // pNext
+        0,                                                  // waitSemaphoreCount
+        nullptr,                                            // pWaitSemaphores
+        nullptr,                                            // pWaitDstStageMask
+        1,                                                  // commandBufferCount
+        &cmdBuffer,                                         // pCommandBuffers
+        0,                                                  // signalSemaphoreCount
+        nullptr,                                            // pSignalSemaphores
+    };
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if ((VK_SUCCESS != vkQueueSubmit(queue, 1, &submitInfo, fence))
+        || (VK_SUCCESS != vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX))) {
+        return -1.0;
+    }
+    const double seconds = ElapsedSeconds(start);
+
+    vkResetFences(device, 1, &fence);
+    return seconds;
+}
+
+double ProbeCopy(VkDevice device, VkQueue queue, VkCommandBuffer cmdBuffer, VkFence fence,
+                 VkBuffer src, VkBuffer dst, VkDeviceSize size) {
+    const VkCommandBufferBeginInfo beginInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        // sType
+        nullptr,                                            // pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,        // flags
+        nullptr,                                            // pInheritanceInfo
+    };
+
+    const VkBufferCopy region = { 0, 0, size };
+
+    double bestSeconds = -1.0;
+    for (uint32_t run = 0; run < g_probeRepeatCount; run++) {
+        vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+        vkCmdCopyBuffer(cmdBuffer, src, dst, 1, &region);
+        vkEndCommandBuffer(cmdBuffer);
+
+        const double seconds = SubmitAndWait(device, queue, cmdBuffer, fence);
+        if ((seconds > 0.0) && ((bestSeconds < 0.0) || (seconds < bestSeconds))) {
+            bestSeconds = seconds;
+        }
+    }
+
+    return (bestSeconds > 0.0) ? ((double)size / (1 << 20)) / bestSeconds : 0.0;
+}
+
+void ProbeHostAccess(VkDevice device, const ProbeBuffer& buffer, VkDeviceSize size, bool coherent,
+                     std::vector<uint8_t>& hostData, MemoryTypeProbe *out) {
+    const VkMappedMemoryRange range = {
+        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,              // sType
+        nullptr,                                            // pNext
+        buffer.memory,                                      // memory
+        0,                                                  // offset
+        VK_WHOLE_SIZE,                                      // size
+    };
+
+    double bestWrite = -1.0;
+    double bestRead = -1.0;
+    for (uint32_t run = 0; run < g_probeRepeatCount; run++) {
+        // Non coherent memory is flushed after the write and invalidated before the read, as a real upload would do.
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        memcpy(buffer.mapped, hostData.data(), size);
+        if (!coherent) {
+            vkFlushMappedMemoryRanges(device, 1, &range);
+        }
+        const double writeSeconds = ElapsedSeconds(start);
+
+        start = std::chrono::steady_clock::now();
+        if (!coherent) {
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+        memcpy(hostData.data(), buffer.mapped, size);
+        const double readSeconds = ElapsedSeconds(start);
+
+        bestWrite = ((bestWrite < 0.0) || (writeSeconds < bestWrite)) ? writeSeconds : bestWrite;
+        bestRead = ((bestRead < 0.0) || (readSeconds < bestRead)) ? readSeconds : bestRead;
+    }
+
+    const double sizeInMiB = (double)size / (1 << 20);
+    out->hostWriteMiBps = (bestWrite > 0.0) ? sizeInMiB / bestWrite : 0.0;
+    out->hostReadMiBps = (bestRead > 0.0) ? sizeInMiB / bestRead : 0.0;
+}
+
+void ProbeDispatch(VkDevice device, VkQueue queue, VkCommandBuffer cmdBuffer, VkFence fence,
+                   const PhysicalDeviceInfo& info, ProbeResults *results) {
+    const VkShaderModuleCreateInfo shaderInfo = {
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,        // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        sizeof(g_emptyComputeSpirv),                        // codeSize
+        g_emptyComputeSpirv,                                // pCode
+    };
+
+    const VkPipelineLayoutCreateInfo layoutInfo = {
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,      // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        0,                                                  // setLayoutCount
+        nullptr,                                            // pSetLayouts
+        0,                                                  // pushConstantRangeCount
+        nullptr,                                            // pPushConstantRanges
+    };
+
+    VkShaderModule   shader     = VK_NULL_HANDLE;
+    VkPipelineLayout layout     = VK_NULL_HANDLE;
+    VkPipeline       pipeline   = VK_NULL_HANDLE;
+    if ((VK_SUCCESS != vkCreateShaderModule(device, &shaderInfo, nullptr, &shader))
+        || (VK_SUCCESS != vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout))) {
+        printf("Failed to create the dispatch probe shader\n");
+        vkDestroyShaderModule(device, shader, nullptr);
+        return;
+    }
+
+    const VkComputePipelineCreateInfo pipelineInfo = {
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,     // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        {                                                   // stage
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, // sType
+            nullptr,                                        // pNext
+            0,                                              // flags
+            VK_SHADER_STAGE_COMPUTE_BIT,                    // stage
+            shader,                                         // module
+            "main",                                         // pName
+            nullptr,                                        // pSpecializationInfo
+        },
+        layout,                                             // layout
+        VK_NULL_HANDLE,                                     // basePipelineHandle
+        -1,                                                 // basePipelineIndex
+    };
+
+    if (VK_SUCCESS != vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline)) {
+        printf("Failed to create the dispatch probe pipeline\n");
+        vkDestroyPipelineLayout(device, layout, nullptr);
+        vkDestroyShaderModule(device, shader, nullptr);
+        return;
+    }
+
+    // The GPU time is measured with two timestamps if the queue family supports them.
+    const uint32_t timestampBits = info.queueFamilies[results->queueFamilyIndex].timestampValidBits;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (timestampBits > 0) {
+        const VkQueryPoolCreateInfo queryInfo = {
+            VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,       // sType
+            nullptr,                                        // pNext
+            0,                                              // flags
+            VK_QUERY_TYPE_TIMESTAMP,                        // queryType
+            2,                                              // queryCount
+            0,                                              // pipelineStatistics
+        };
+
+        if (VK_SUCCESS != vkCreateQueryPool(device, &queryInfo, nullptr, &queryPool)) {
+            queryPool = VK_NULL_HANDLE;
+        }
+    }
+
+    // The same command buffer is resubmitted, so only the submission and the dispatch are timed.
+    const VkCommandBufferBeginInfo beginInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        nullptr,                                            // pInheritanceInfo
+    };
+
+    vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+    if (VK_NULL_HANDLE != queryPool) {
+        vkCmdResetQueryPool(cmdBuffer, queryPool, 0, 2);
+        vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+    }
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatch(cmdBuffer, 1, 1, 1);
+    if (VK_NULL_HANDLE != queryPool) {
+        vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+    }
+    vkEndCommandBuffer(cmdBuffer);
+
+    std::vector<double> roundTrips;
+    for (uint32_t run = 0; run < 2 * g_dispatchProbeCount; run++) {
+        const double seconds = SubmitAndWait(device, queue, cmdBuffer, fence);
+        if ((run >= g_dispatchProbeCount) && (seconds >= 0.0)) {
+            roundTrips.push_back(seconds * 1e6);
+        }
+    }
+
+    if (!roundTrips.empty()) {
+        std::sort(roundTrips.begin(), roundTrips.end());
+        results->dispatchMinUs = roundTrips.front();
+        results->dispatchMedianUs = roundTrips[roundTrips.size() / 2];
+    }
+
+    if (VK_NULL_HANDLE != queryPool) {
+        uint64_t timestamps[2] = { 0, 0 };
+        if (VK_SUCCESS == vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT)) {
+            const uint64_t mask = (timestampBits >= 64) ? UINT64_MAX : ((1ULL << timestampBits) - 1);
+            const uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+            results->dispatchGpuUs = ticks * info.properties.limits.timestampPeriod / 1000.0;
+        }
+
+        vkDestroyQueryPool(device, queryPool, nullptr);
+    }
+
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, layout, nullptr);
+    vkDestroyShaderModule(device, shader, nullptr);
+}
+
+ProbeResults RunProbes(const PhysicalDeviceInfo& info, VkDeviceSize bufferSize) {
+    ProbeResults results = {};
+    results.bufferSize = bufferSize;
+    results.dispatchGpuUs = -1.0;
+
+    // The probes run on the first queue family with compute support (which implies transfer support).
+    results.queueFamilyIndex = UINT32_MAX;
+    for (uint32_t idx = 0; idx < info.queueFamilies.size(); idx++) {
+        if (info.queueFamilies[idx].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            results.queueFamilyIndex = idx;
+            break;
+        }
+    }
+
+    if (UINT32_MAX == results.queueFamilyIndex) {
+        printf("Probes skipped on %s: no compute queue family\n", info.properties.deviceName);
+        return results;
+    }
+
+    const float queuePriority = 1.0f;
+    const VkDeviceQueueCreateInfo queueInfo = {
+        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,         // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        results.queueFamilyIndex,                           // queueFamilyIndex
+        1,                                                  // queueCount
+        &queuePriority,                                     // pQueuePriorities
+    };
+
+    const VkDeviceCreateInfo deviceInfo = {
+        VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,               // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+        1,                                                  // queueCreateInfoCount
+        &queueInfo,                                         // pQueueCreateInfos
+        0,                                                  // enabledLayerCount
+        nullptr,                                            // ppEnabledLayerNames
+        0,                                                  // enabledExtensionCount
+        nullptr,                                            // ppEnabledExtensionNames
+        nullptr,                                            // pEnabledFeatures
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    if (VK_SUCCESS != vkCreateDevice(info.phyDevice, &deviceInfo, nullptr, &device)) {
+        printf("Probes skipped on %s: failed to create device\n", info.properties.deviceName);
+        return results;
+    }
+
+    VkQueue queue;
+    vkGetDeviceQueue(device, results.queueFamilyIndex, 0, &queue);
+
+    const VkCommandPoolCreateInfo poolInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,         // sType
+        nullptr,                                            // pNext
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,    // flags
+        results.queueFamilyIndex,                           // queueFamilyIndex
+    };
+
+    const VkFenceCreateInfo fenceInfo = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,                // sType
+        nullptr,                                            // pNext
+        0,                                                  // flags
+    };
+
+    VkCommandPool   cmdPool     = VK_NULL_HANDLE;
+    VkCommandBuffer cmdBuffer   = VK_NULL_HANDLE;
+    VkFence         fence       = VK_NULL_HANDLE;
+    vkCreateCommandPool(device, &poolInfo, nullptr, &cmdPool);
+    vkCreateFence(device, &fenceInfo, nullptr, &fence);
+
+    const VkCommandBufferAllocateInfo allocInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,     // sType
+        nullptr,                                            // pNext
+        cmdPool,                                            // commandPool
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,                    // level
+        1,                                                  // commandBufferCount
+    };
+    vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer);
+
+    // The staging buffer of the copies is the first host visible and coherent type which can hold it.
+    const VkMemoryPropertyFlags stagingFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    ProbeBuffer staging = { VK_NULL_HANDLE, VK_NULL_HANDLE, nullptr };
+    bool hasStaging = false;
+    for (uint32_t idx = 0; (idx < info.memory.memoryTypeCount) && !hasStaging; idx++) {
+        if ((info.memory.memoryTypes[idx].propertyFlags & stagingFlags) == stagingFlags) {
+            hasStaging = CreateProbeBuffer(device, bufferSize, idx, info, &staging);
+        }
+    }
+
+    std::vector<uint8_t> hostData(bufferSize, 0x5a);
+    for (uint32_t idx = 0; idx < info.memory.memoryTypeCount && hasStaging; idx++) {
+        const VkMemoryType& memType = info.memory.memoryTypes[idx];
+
+        // Protected and lazily allocated memory can't back a transfer buffer.
+        if (memType.propertyFlags & (VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+            continue;
+        }
+
+        ProbeBuffer buffer;
+        if (!CreateProbeBuffer(device, bufferSize, idx, info, &buffer)) {
+            continue;
+        }
+
+        MemoryTypeProbe probe = {};
+        probe.memoryTypeIndex = idx;
+        probe.uploadMiBps = ProbeCopy(device, queue, cmdBuffer, fence, staging.buffer, buffer.buffer, bufferSize);
+        probe.downloadMiBps = ProbeCopy(device, queue, cmdBuffer, fence, buffer.buffer, staging.buffer, bufferSize);
+
+        if (nullptr != buffer.mapped) {
+            ProbeHostAccess(device, buffer, bufferSize, (memType.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0,
+                            hostData, &probe);
+        }
+
+        results.memoryTypes.push_back(probe);
+        DestroyProbeBuffer(device, &buffer);
+    }
+
+    if (hasStaging) {
+        DestroyProbeBuffer(device, &staging);
+    } else {
+        printf("Bandwidth probes skipped on %s: no host visible staging memory\n", info.properties.deviceName);
+    }
+
+    ProbeDispatch(device, queue, cmdBuffer, fence, info, &results);
+    results.valid = true;
+
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroyCommandPool(device, cmdPool, nullptr);
+    vkDestroyDevice(device, nullptr);
+
+    return results;
+}
+
+void DumpProbeResults(const PhysicalDeviceInfo& info, const ProbeResults& results) {
+    printf("  %s: probes on queue family %u (buffer size = %lu)\n",
+           info.properties.deviceName, results.queueFamilyIndex, results.bufferSize);
+
+    printf("    Memory Type Bandwidth (MiB/s)\n");
+    for (const MemoryTypeProbe& probe : results.memoryTypes) {
+        printf("     %u: upload = %.1f download = %.1f hostWrite = %.1f hostRead = %.1f\n",
+               probe.memoryTypeIndex, probe.uploadMiBps, probe.downloadMiBps, probe.hostWriteMiBps, probe.hostReadMiBps);
+    }
+
+    printf("    Dispatch Latency: min = %.1f us median = %.1f us gpu = %.1f us\n",
+           results.dispatchMinUs, results.dispatchMedianUs, results.dispatchGpuUs);
+}
+
+void WriteJSONString(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const char *chr = str; *chr != '\0'; chr++) {
+        if ((*chr == '"') || (*chr == '\\')) {
+            fputc('\\', out);
+            fputc(*chr, out);
+        } else if ((unsigned char)*chr < 0x20) {
+            fprintf(out, "\\u%04x", *chr);
+        } else {
+            fputc(*chr, out);
+        }
+    }
+    fputc('"', out);
+}
+
+const char *JSONBool(bool value) {
+    return value ? "true" : "false";
+}
+
+void WriteProfile(FILE *out,
+                  uint32_t loaderVersion,
+                  const std::vector<PhysicalDeviceInfo>& phyDevices,
+                  const std::vector<ProbeResults>& probes) {
+    // The devices are identified by vendorID, deviceID and pipelineCacheUUID, like the caches of the other demos.
+    const VersionInfo loader = GetVersionInfo(loaderVersion);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"profileVersion\": 1,\n");
+    fprintf(out, "  \"loaderVersion\": \"%u.%u.%u\",\n", loader.major, loader.minor, loader.patch);
+    fprintf(out, "  \"devices\": [\n");
+
+    for (size_t idx = 0; idx < phyDevices.size(); idx++) {
+        const PhysicalDeviceInfo&           info        = phyDevices[idx];
+        const VkPhysicalDeviceProperties&   props       = info.properties;
+        const VkPhysicalDeviceLimits&       limits      = props.limits;
+        const VersionInfo                   apiVersion  = GetVersionInfo(props.apiVersion);
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"index\": %u,\n", (uint32_t)idx);
+        fprintf(out, "      \"deviceName\": ");
+        WriteJSONString(out, props.deviceName);
+        fprintf(out, ",\n");
+        fprintf(out, "      \"vendorID\": %u,\n", props.vendorID);
+        fprintf(out, "      \"deviceID\": %u,\n", props.deviceID);
+        fprintf(out, "      \"deviceType\": \"%s\",\n", string_VkPhysicalDeviceType(props.deviceType));
+        fprintf(out, "      \"apiVersion\": \"%u.%u.%u\",\n", apiVersion.major, apiVersion.minor, apiVersion.patch);
+        fprintf(out, "      \"driverVersion\": %u,\n", props.driverVersion);
+        fprintf(out, "      \"pipelineCacheUUID\": \"");
+        for (uint32_t ndx = 0; ndx < VK_UUID_SIZE; ndx++) {
+            fprintf(out, "%02x", props.pipelineCacheUUID[ndx]);
+        }
+        fprintf(out, "\",\n");
+
+        fprintf(out, "      \"limits\": {\n");
+        fprintf(out, "        \"timestampPeriod\": %g,\n", limits.timestampPeriod);
+        fprintf(out, "        \"timestampComputeAndGraphics\": %s,\n", JSONBool(limits.timestampComputeAndGraphics));
+        fprintf(out, "        \"maxComputeWorkGroupSize\": [%u, %u, %u],\n",
+                limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupSize[1], limits.maxComputeWorkGroupSize[2]);
+        fprintf(out, "        \"maxComputeWorkGroupInvocations\": %u,\n", limits.maxComputeWorkGroupInvocations);
+        fprintf(out, "        \"maxComputeSharedMemorySize\": %u,\n", limits.maxComputeSharedMemorySize);
+        fprintf(out, "        \"maxImageDimension2D\": %u,\n", limits.maxImageDimension2D);
+        fprintf(out, "        \"maxMemoryAllocationCount\": %u,\n", limits.maxMemoryAllocationCount);
+        fprintf(out, "        \"bufferImageGranularity\": %llu,\n", (unsigned long long)limits.bufferImageGranularity);
+        fprintf(out, "        \"nonCoherentAtomSize\": %llu,\n", (unsigned long long)limits.nonCoherentAtomSize);
+        fprintf(out, "        \"minMemoryMapAlignment\": %llu,\n", (unsigned long long)limits.minMemoryMapAlignment);
+        fprintf(out, "        \"optimalBufferCopyOffsetAlignment\": %llu,\n",
+                (unsigned long long)limits.optimalBufferCopyOffsetAlignment);
+        fprintf(out, "        \"minUniformBufferOffsetAlignment\": %llu\n",
+                (unsigned long long)limits.minUniformBufferOffsetAlignment);
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"subgroupSize\": %u,\n", info.subgroupSize);
+        fprintf(out, "      \"minImportedHostPointerAlignment\": %llu,\n",
+                (unsigned long long)info.minImportedHostPointerAlignment);
+
+        fprintf(out, "      \"presentModes\": [");
+        for (size_t ndx = 0; ndx < info.presentModes.size(); ndx++) {
+            fprintf(out, "%s\"%s\"", (ndx > 0) ? ", " : "", string_VkPresentModeKHR(info.presentModes[ndx]));
+        }
+        fprintf(out, "],\n");
+
+        fprintf(out, "      \"queueFamilies\": [\n");
+        for (uint32_t ndx = 0; ndx < info.queueFamilies.size(); ndx++) {
+            const VkQueueFamilyProperties& family = info.queueFamilies[ndx];
+
+            fprintf(out, "        { \"index\": %u, \"queueCount\": %u, \"queueFlags\": %u, \"graphics\": %s, \"compute\": %s, "
+                         "\"transfer\": %s, \"computeOnly\": %s, \"transferOnly\": %s, \"timestampValidBits\": %u }%s\n",
+                    ndx, family.queueCount, family.queueFlags,
+                    JSONBool(family.queueFlags & VK_QUEUE_GRAPHICS_BIT),
+                    JSONBool(family.queueFlags & VK_QUEUE_COMPUTE_BIT),
+                    JSONBool(family.queueFlags & VK_QUEUE_TRANSFER_BIT),
+                    JSONBool(IsComputeOnlyFamily(family)), JSONBool(IsTransferOnlyFamily(family)),
+                    family.timestampValidBits, (ndx + 1 < info.queueFamilies.size()) ? "," : "");
+        }
+        fprintf(out, "      ],\n");
+
+        fprintf(out, "      \"memoryHeaps\": [\n");
+        for (uint32_t ndx = 0; ndx < info.memory.memoryHeapCount; ndx++) {
+            const VkMemoryHeap& heap = info.memory.memoryHeaps[ndx];
+
+            fprintf(out, "        { \"index\": %u, \"size\": %llu, \"flags\": %u }%s\n",
+                    ndx, (unsigned long long)heap.size, heap.flags, (ndx + 1 < info.memory.memoryHeapCount) ? "," : "");
+        }
+        fprintf(out, "      ],\n");
+
+        fprintf(out, "      \"memoryTypes\": [\n");
+        for (uint32_t ndx = 0; ndx < info.memory.memoryTypeCount; ndx++) {
+            const VkMemoryType& memType = info.memory.memoryTypes[ndx];
+
+            fprintf(out, "        { \"index\": %u, \"heapIndex\": %u, \"propertyFlags\": %u }%s\n",
+                    ndx, memType.heapIndex, memType.propertyFlags, (ndx + 1 < info.memory.memoryTypeCount) ? "," : "");
+        }
+        fprintf(out, "      ],\n");
+
+        fprintf(out, "      \"extensions\": [");
+        for (size_t ndx = 0; ndx < info.extensions.size(); ndx++) {
+            fprintf(out, "%s\"%s\"", (ndx > 0) ? ", " : "", info.extensions[ndx].extensionName);
+        }
+        fprintf(out, "]");
+
+        // The probe results are only present if DEMO_PROBE was enabled and the probes could run.
+        if ((idx < probes.size()) && probes[idx].valid) {
+            const ProbeResults& results = probes[idx];
+
+            fprintf(out, ",\n");
+            fprintf(out, "      \"probes\": {\n");
+            fprintf(out, "        \"queueFamilyIndex\": %u,\n", results.queueFamilyIndex);
+            fprintf(out, "        \"bufferSize\": %llu,\n", (unsigned long long)results.bufferSize);
+            fprintf(out, "        \"memoryTypes\": [\n");
+            for (size_t ndx = 0; ndx < results.memoryTypes.size(); ndx++) {
+                const MemoryTypeProbe& probe = results.memoryTypes[ndx];
+
+                fprintf(out, "          { \"index\": %u, \"uploadMiBps\": %.1f, \"downloadMiBps\": %.1f, "
+                             "\"hostWriteMiBps\": %.1f, \"hostReadMiBps\": %.1f }%s\n",
+                        probe.memoryTypeIndex, probe.uploadMiBps, probe.downloadMiBps,
+                        probe.hostWriteMiBps, probe.hostReadMiBps, (ndx + 1 < results.memoryTypes.size()) ? "," : "");
+            }
+            fprintf(out, "        ],\n");
+            fprintf(out, "        \"dispatchMinUs\": %.2f,\n", results.dispatchMinUs);
+            fprintf(out, "        \"dispatchMedianUs\": %.2f,\n", results.dispatchMedianUs);
+            fprintf(out, "        \"dispatchGpuUs\": %.3f\n", results.dispatchGpuUs);
+            fprintf(out, "      }");
+        }
+
+        fprintf(out, "\n    }%s\n", (idx + 1 < phyDevices.size()) ? "," : "");
     }
+
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
 }
 
 int main() {
+    const char *envProfile      = getenv("DEMO_PROFILE");
+    const char *envProbe        = getenv("DEMO_PROBE");
+    const char *envProbeSize    = getenv("DEMO_PROBE_SIZE");
+
+    const bool  runProbes       = ((envProbe != NULL) && (strncmp("1", envProbe, 2) == 0));
+    // With "-" the standard output only has the profile, so it can be piped into a JSON tool.
+    const bool  textOutput      = ((envProfile == NULL) || (strcmp("-", envProfile) != 0));
+
+    VkDeviceSize probeSize = 64 << 20;
+    if ((envProbeSize != NULL) && (atoi(envProbeSize) > 0)) {
+        probeSize = (VkDeviceSize)atoi(envProbeSize) << 20;
+    }
+
     std::vector<VkExtensionProperties>  instanceExts    = QueryInstanceExtensions();
-    DumpExtensions("Instance Extensions", instanceExts);
-    printf("\n");
+    if (textOutput) {
+        DumpExtensions("Instance Extensions", instanceExts);
+        printf("\n");
+    }
 
     std::vector<VkLayerProperties>      layers          = QueryInstanceLayers();
-    DumpLayers("Instance Layers", layers);
-    printf("\n");
+    if (textOutput) {
+        DumpLayers("Instance Layers", layers);
+        printf("\n");
+    }
+
+    // The subgroup properties need a 1.1 instance, a 1.0 loader uses VK_KHR_get_physical_device_properties2.
+    // The present modes are queried on a headless surface, so no window system is needed.
+    const uint32_t                      loaderVersion   = QueryInstanceVersion();
+    const uint32_t                      apiVersion      = std::min(loaderVersion, VK_MAKE_API_VERSION(0, 1, 1, 0));
+    const bool                          headless        = HasExtension(instanceExts, VK_KHR_SURFACE_EXTENSION_NAME)
+                                                          && HasExtension(instanceExts, VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+    std::vector<const char*>            extensions      = {};
+    if (headless) {
+        extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+    }
+    if ((apiVersion < VK_MAKE_API_VERSION(0, 1, 1, 0))
+        && HasExtension(instanceExts, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+        extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+
+    VkInstance                          instance        = CreateInstance(apiVersion, extensions);
+    if (VK_NULL_HANDLE == instance) {
+        return 1;
+    }
 
-    VkInstance                          instance        = CreateInstance();
-    std::vector<PhysicalDeviceInfo>     phyDevices      = QueryPhysicalDevices(instance);
+    VkSurfaceKHR                        surface         = headless ? CreateHeadlessSurface(instance) : VK_NULL_HANDLE;
+    std::vector<PhysicalDeviceInfo>     phyDevices      = QueryPhysicalDevices(instance, apiVersion, surface);
 
-    DumpPhysicalDeviceInfos("Physical Devices", phyDevices);
-    printf("\n");
+    if (textOutput) {
+        DumpPhysicalDeviceInfos("Physical Devices", phyDevices);
+        printf("\n");
+    }
+
+    std::vector<ProbeResults>           probes          = {};
+    if (runProbes) {
+        if (textOutput) {
+            printf("Probes (count = %ld)\n", phyDevices.size());
+        }
+
+        for (const PhysicalDeviceInfo& info : phyDevices) {
+            probes.push_back(RunProbes(info, probeSize));
+            if (textOutput && probes.back().valid) {
+                DumpProbeResults(info, probes.back());
+            }
+        }
+
+        if (textOutput) {
+            printf("\n");
+        }
+    }
+
+    if (envProfile != NULL) {
+        FILE *out = textOutput ? fopen(envProfile, "w") : stdout;
+        if (out == NULL) {
+            printf("Failed to open profile file: %s\n", envProfile);
+        } else {
+            WriteProfile(out, loaderVersion, phyDevices, probes);
+
+            if (textOutput) {
+                fclose(out);
+                printf("Profile written: %s\n", envProfile);
+            }
+        }
+    }
 
+    if (VK_NULL_HANDLE != surface) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
 
     vkDestroyInstance(instance, nullptr);
 
@@ -21,11 +21,37 @@
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_HOST_IMPORT: The GPU copies the image directly into the mmap'ed output file (1), which is then a
+ *   PAM (P7, RGB_ALPHA) image. Requires VK_EXT_external_memory_host and Vulkan 1.1, otherwise the PPM path is used.
+ *   Default: 0
+ * DEMO_BENCH: Render N frames with GPU timestamp and CPU timing before the output image, unset or 0
+ *   disables it. Default: 0
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_FARM_WORKERS: Comma separated worker thread counts of the headless render farm, each count is a separate
+ *   run (ex.: 1,2,4). Unset or 0 disables the farm. Default: 0
+ * DEMO_FARM_RENDERS: Number of renders in each farm run. Default: 1000
+ * DEMO_FARM_SIZE: Comma separated farm render target sizes, each size is run with every worker count
+ *   (ex.: 256x256,1024x1024). Default: 256x256
+ * DEMO_FARM_FORMAT: Format of the farm render targets and of the output image: rgba8, bgra8 or srgb. Default: rgba8
+ * DEMO_FARM_TARGETS: Render targets (and readback slots) of each farm worker. Default: 8
+ * DEMO_FARM_BATCH: Renders of a farm worker submitted with a single vkQueueSubmit. Default: 4
+ * DEMO_FARM_SHARED_QUEUE: The farm workers hand their batches to a single submission thread (1) instead of
+ *   submitting to their own queues (0). If the queue family has fewer queues than workers the shared queue
+ *   is used anyway. Default: 0
+ * DEMO_MULTI_GPU: The farm workers are spread over every matching device (1), one device per worker, instead of
+ *   only using the highest ranked one (0). The Instance is shared, each extra device gets its own logical device,
+ *   Render Pass and Pipeline. Default: 0
  *
  * Dependencies:
  *  * C++11
- *  * Vulkan 1.0
+ *  * Vulkan 1.0 (1.1 for DEMO_HOST_IMPORT, it is only requested if the loader supports it)
  *  * Vulkan loader
  *  * One of the following:
  *    * glslangValidator (HAVE_SHADERC=0)
@@ -59,67 +85,261 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * OFTWARE.
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <mutex>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
+#include <thread>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
-
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
-
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
-                                   const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
+// HF. Headless render farm (DEMO_FARM_WORKERS).
+// One render target of a farm worker, created the same way as the output image.
+struct FarmTarget {
+    VkImage image;
+    ArenaAllocation memory;
+    VkImageView imageView;
+    VkFramebuffer framebuffer;
+};
+
+// A group of render targets which is submitted with a single vkQueueSubmit, one VkSubmitInfo for each render.
+// The batch owns a transient Command Pool which is reset after the fence of the previous submission.
+struct FarmBatch {
+    VkCommandPool cmdPool;
+    std::vector<VkCommandBuffer> drawCmdBuffers;
+    // Draw and readback Command Buffers of each render, referenced by the submit infos.
+    std::vector<VkCommandBuffer> frameCmdBuffers;
+    std::vector<VkSubmitInfo> submitInfos;
+    VkFence fence;
+    uint32_t firstTarget;
+    // Number of renders in the current submission.
+    uint32_t renderCount;
+    // The batch was submitted and its fence is not yet waited for.
+    bool inFlight;
+    // The batch waits in the submission thread, guarded by the mutex of the submitter.
+    bool queued;
+    // The submission thread did submit the batch (it skips the batches after a failure), guarded by the same mutex.
+    bool submitted;
+};
+
+// FF. First failure of the farm threads. An exception must not leave a std::thread (std::terminate),
+// so it is stored here, the other threads stop and main rethrows it after the join.
+struct FarmFailure {
+    std::atomic<bool> failed;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+// Shared queue of the farm: the workers hand over their batches and a single thread submits them.
+struct FarmSubmitter {
+    VkQueue queue;
+    std::thread thread;
+    std::mutex mutex;
+    // Signaled both for new batches and for finished submits.
+    std::condition_variable cond;
+    std::deque<FarmBatch*> pending;
+    bool done;
+    uint64_t submits;
+    FarmFailure *failure;
+};
+
+// MG. Device of the farm workers. The first one is the device of main, with DEMO_MULTI_GPU every other
+// matching device gets its own logical device, Render Pass and Pipeline on the shared Instance.
+struct FarmDevice {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIdx;
+    // The workers of the device own a queue each, or share the first one if there are not enough queues.
+    std::vector<VkQueue> queues;
+    MemoryArena *arena;
+    VkRenderPass renderPass;
+    VkPipeline pipeline;
+    std::string name;
+    // Resources of an extra device, the ones of the first device are owned (and destroyed) by main.
+    bool owned;
+    MemoryArena ownedArena;
+    VkShaderModule vertShaderModule;
+    VkShaderModule fragShaderModule;
+    VkPipelineLayout pipelineLayout;
+};
+
+// Settings and state of one farm run on one device.
+struct FarmRun {
+    VkDevice device;
+    VkRenderPass renderPass;
+    VkPipeline pipeline;
+    VkExtent2D extent;
+    uint32_t batchSize;
+    uint32_t renderCount;
+    // Renders claimed by the workers so far, the counter can overshoot the render count.
+    // MG. The counter is shared by the runs of every device, so the faster devices take more renders.
+    std::atomic<uint32_t> *claimedRenders;
+    // NULL if every worker submits to its own queue.
+    FarmSubmitter *submitter;
+    // FF. Shared by the runs of every device, like the render counter.
+    FarmFailure *failure;
+};
+
+struct FarmWorker {
+    FarmRun *run;
+    // Index of the worker's device in the farm device list.
+    uint32_t deviceIdx;
+    // Own queue of the worker, VK_NULL_HANDLE with the shared queue.
+    VkQueue queue;
+    std::vector<FarmTarget> targets;
+    std::vector<FarmBatch> batches;
+    ReadbackRing readbackRing;
+    // Copy of the most recent capture, stands in for the encoding or sending of a real farm.
+    std::vector<uint8_t> lastCapture;
+    uint64_t renders;
+    uint64_t captures;
+    std::thread thread;
+};
+
+static VkRenderPass CreateTriangleRenderPass(const VkDevice device, VkFormat format);
+static VkPipeline CreateTrianglePipeline(const VkDevice device,
+                                         const VkRenderPass renderPass,
+                                         const VkPipelineLayout pipelineLayout,
+                                         const VkShaderModule vertShaderModule,
+                                         const VkShaderModule fragShaderModule,
+                                         const VkPipelineCache pipelineCache);
+
+static void ParseFarmWorkerCounts(const char *list, std::vector<uint32_t> *outCounts);
+static void ParseFarmSizes(const char *list, std::vector<VkExtent2D> *outSizes);
+static VkFormat ParseFarmFormat(const char *name);
+static void CreateFarmDevice(const VkPhysicalDevice physicalDevice,
+                             uint32_t queueFamilyIdx,
+                             uint32_t queueCount,
+                             VkFormat format,
+                             const std::vector<uint32_t>& vertCode,
+                             const std::vector<uint32_t>& fragCode,
+                             bool enableValidationLayers,
+                             FarmDevice *outDevice);
+static void DestroyFarmDevice(FarmDevice *farmDevice);
+static void CreateFarmWorker(const VkPhysicalDevice physicalDevice,
+                             const VkDevice device,
+                             MemoryArena *arena,
+                             uint32_t queueFamilyIdx,
+                             VkFormat format,
+                             uint32_t targetCount,
+                             FarmRun *run,
+                             const VkQueue queue,
+                             FarmWorker *outWorker);
+static void DestroyFarmWorker(const VkDevice device, MemoryArena *arena, FarmWorker *worker);
+static void FarmWorkerMain(FarmWorker *worker);
+static void RunFarmWorker(FarmWorker *worker);
+static void RecordFarmFailure(FarmFailure *failure);
+static void RecordFarmDraw(const VkCommandBuffer cmdBuffer, const FarmRun& run, const VkFramebuffer framebuffer);
+static void WaitFarmBatch(FarmWorker *worker, FarmBatch *batch);
+static void StartFarmSubmitter(const VkQueue queue, FarmFailure *failure, FarmSubmitter *submitter);
+static void QueueFarmBatch(FarmSubmitter *submitter, FarmBatch *batch);
+static void StopFarmSubmitter(FarmSubmitter *submitter);
+static void FarmSubmitterMain(FarmSubmitter *submitter);
+static void PrintFarmResults(const std::vector<FarmRun>& runs,
+                             const std::vector<FarmDevice>& farmDevices,
+                             const std::vector<FarmWorker>& workers,
+                             double totalSeconds);
 
 int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envBench = getenv("DEMO_BENCH");
+    const char *envHostImport = getenv("DEMO_HOST_IMPORT");
+    const char *envFarmWorkers = getenv("DEMO_FARM_WORKERS");
+    const char *envFarmRenders = getenv("DEMO_FARM_RENDERS");
+    const char *envFarmSize = getenv("DEMO_FARM_SIZE");
+    const char *envFarmFormat = getenv("DEMO_FARM_FORMAT");
+    const char *envFarmTargets = getenv("DEMO_FARM_TARGETS");
+    const char *envFarmBatch = getenv("DEMO_FARM_BATCH");
+    const char *envFarmSharedQueue = getenv("DEMO_FARM_SHARED_QUEUE");
+    const char *envMultiGpu = getenv("DEMO_MULTI_GPU");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    uint32_t benchFrames = (envBench != NULL) ? (uint32_t)strtoul(envBench, NULL, 10) : 0;
+    bool hostImport = ((envHostImport != NULL) && (strncmp("1", envHostImport, 2) == 0));
     const char *outputFileName = "out.ppm";
 
+    // HF. Every farm worker count is run with every render target size.
+    std::vector<uint32_t> farmWorkerCounts;
+    ParseFarmWorkerCounts(envFarmWorkers, &farmWorkerCounts);
+    std::vector<VkExtent2D> farmSizes;
+    ParseFarmSizes((envFarmSize != NULL) ? envFarmSize : "256x256", &farmSizes);
+    const VkFormat farmFormat = ParseFarmFormat(envFarmFormat);
+    const uint32_t farmRenders = (envFarmRenders != NULL) ? (uint32_t)strtoul(envFarmRenders, NULL, 10) : 1000;
+    const uint32_t farmTargets = std::max(1u, (envFarmTargets != NULL) ? (uint32_t)strtoul(envFarmTargets, NULL, 10) : 8u);
+    const uint32_t farmBatch = std::min(farmTargets, std::max(1u, (envFarmBatch != NULL) ? (uint32_t)strtoul(envFarmBatch, NULL, 10) : 4u));
+    const bool farmSharedQueue = ((envFarmSharedQueue != NULL) && (strncmp("1", envFarmSharedQueue, 2) == 0));
+    const bool farmMultiGpu = !farmWorkerCounts.empty() && (envMultiGpu != NULL) && (strncmp("1", envMultiGpu, 2) == 0);
+
+    // The PAM output of the host import is written as it is, so it requires RGBA ordered pixels.
+    if (hostImport && (farmFormat == VK_FORMAT_B8G8R8A8_UNORM)) {
+        printf("Host import: the bgra8 format is not supported, using the staging buffer\n");
+        hostImport = false;
+    }
+
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    if (benchFrames > 0) {
+        printf("Bench: %u frames\n", benchFrames);
+    }
+    if (!farmWorkerCounts.empty()) {
+        printf("Farm: %u renders per run, %u render targets per worker, %u renders per submit%s%s\n",
+               farmRenders, farmTargets / farmBatch * farmBatch, farmBatch, (farmSharedQueue ? ", shared queue" : ""),
+               (farmMultiGpu ? ", multi GPU" : ""));
+    }
+
+    // ST.1. Start loading (or compiling) the shaders on worker threads.
+    // This runs in parallel with the Instance/Device creation, the results are only
+    // waited for at the Shader Module creation.
+    std::future<std::vector<uint32_t> > vertShaderLoad = LoadShaderAsync("triangle.vert");
+    std::future<std::vector<uint32_t> > fragShaderLoad = LoadShaderAsync("passthrough.frag");
 
     // 1. Create Vulkan Instance.
     // A Vulkan instance is the base for all other Vulkan API calls.
     // This is similar an the OpenGL context.
     VkInstance instance;
+    // H. The host import alignment query needs a Vulkan 1.1 Instance, a 1.0 loader would reject it.
+    const uint32_t instanceVersion = (QueryInstanceVersion() >= VK_API_VERSION_1_1) ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
     {
         std::vector<const char*> extensions{};
 
@@ -142,7 +362,7 @@ int main(int argc, char **argv) {
             appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
             appInfo.pEngineName = "RAW";
             appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.apiVersion = VK_API_VERSION_1_1;
+            appInfo.apiVersion = instanceVersion;
         }
 
         // 1.2. Specify the Instance creation information.
@@ -196,8 +416,10 @@ int main(int argc, char **argv) {
       In this case the first device is selected which has a "Graphics" queue.
       The Queue index is also used later do submit rendering jobs.
     */
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
+    // MG. The other matching devices in rank order, they are only used by the farm with DEMO_MULTI_GPU.
+    std::vector<std::pair<VkPhysicalDevice, uint32_t> > farmExtraDevices;
     {
         // 2.1 Query the number of physical devices.
         /*
@@ -220,41 +442,100 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The physical devices which support Graphics Queue (and match DEMO_DEVICE) are ordered by their rank,
+        // the highest ranked one is selected.
+        std::vector<std::pair<uint64_t, std::pair<VkPhysicalDevice, uint32_t> > > candidates;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, &hasIdx);
-            if (hasIdx) {
-                physicalDevice = device;
-                break;
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, VK_NULL_HANDLE, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
             }
+
+            candidates.push_back(std::make_pair(ScorePhysicalDevice(device), std::make_pair(device, queueFamilyIdx)));
         }
 
-        if (physicalDevice == VK_NULL_HANDLE) {
+        if (candidates.empty()) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        // The stable sort keeps the enumeration order of the equally ranked devices.
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const std::pair<uint64_t, std::pair<VkPhysicalDevice, uint32_t> >& lhs,
+                            const std::pair<uint64_t, std::pair<VkPhysicalDevice, uint32_t> >& rhs) {
+                             return lhs.first > rhs.first;
+                         });
+
+        physicalDevice = candidates[0].second.first;
+        graphicsQueueFamilyIdx = candidates[0].second.second;
+
+        const size_t selectedCount = (farmMultiGpu ? candidates.size() : 1);
+        for (size_t idx = 0; idx < selectedCount; idx++) {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(candidates[idx].second.first, &properties);
+            printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)candidates[idx].first);
+
+            if (idx > 0) {
+                farmExtraDevices.push_back(candidates[idx].second);
+            }
+        }
+    }
+
+    // H.0. Check if the output file can be imported as the readback destination.
+    // A zero alignment means that VK_EXT_external_memory_host (or Vulkan 1.1) is not available.
+    VkDeviceSize hostImportAlignment = 0;
+    if (hostImport) {
+        hostImportAlignment = QueryHostImportAlignment(instance, instanceVersion, physicalDevice);
+
+        if (hostImportAlignment != 0) {
+            printf("Host import: ON (minImportedHostPointerAlignment = %llu)\n", (unsigned long long)hostImportAlignment);
+        } else {
+            printf("Host import: VK_EXT_external_memory_host with Vulkan 1.1 is not supported, using the staging buffer\n");
+        }
     }
 
     // 3. Create a logical Vulkan Device.
     // Most Vulkan API calls require a logical device.
     // To use device level layer, they should be provided here.
     VkDevice device;
+    uint32_t farmQueueCount = 1;
+    const uint32_t farmMaxWorkers = farmWorkerCounts.empty() ? 1 : *std::max_element(farmWorkerCounts.begin(), farmWorkerCounts.end());
     {
+        // HF.1. The farm workers can own a queue each, so as many queues are created as the largest
+        // worker count (limited by the queue family). Everything else only uses the first queue.
+        if (!farmWorkerCounts.empty() && !farmSharedQueue) {
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+            farmQueueCount = std::min(farmMaxWorkers, queueFamilies[graphicsQueueFamilyIdx].queueCount);
+        }
+
         // 3.1. Build the device queue create info data (use only a singe queue).
-        float queuePriority = 1.0f;
+        std::vector<float> queuePriorities(farmQueueCount, 1.0f);
         VkDeviceQueueCreateInfo queueCreateInfo;
         {
             queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
             queueCreateInfo.pNext = NULL;
             queueCreateInfo.flags = 0;
             queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfo.queueCount = farmQueueCount;
+            queueCreateInfo.pQueuePriorities = queuePriorities.data();
         }
 
         // 3.2. The queue family/families must be provided to allow the device to use them.
         std::vector<uint32_t> uniqueQueueFamilies = { graphicsQueueFamilyIdx };
 
+        // H.1. Enable the host memory import extension if it is used.
+        std::vector<const char*> deviceExtensions;
+        if (hostImportAlignment != 0) {
+            deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        }
+
         // 3.3. Specify the device creation information.
         VkDeviceCreateInfo createInfo;
         {
@@ -264,8 +545,8 @@ int main(int argc, char **argv) {
             createInfo.queueCreateInfoCount = 1;
             createInfo.pQueueCreateInfos = &queueCreateInfo;
             createInfo.pEnabledFeatures = NULL;
-            createInfo.enabledExtensionCount = 0;
-            createInfo.ppEnabledExtensionNames = NULL;
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
             createInfo.enabledLayerCount = 0;
 
             if (enableValidationLayers) {
@@ -288,12 +569,24 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // HF.2. Get the queues of the farm workers, the first one is the same as the queue above.
+    std::vector<VkQueue> farmQueues(farmQueueCount);
+    for (uint32_t queueIdx = 0; queueIdx < farmQueueCount; queueIdx++) {
+        vkGetDeviceQueue(device, graphicsQueueFamilyIdx, queueIdx, &farmQueues[queueIdx]);
+    }
+
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // 5. Create a 256x256 2D Image to draw onto.
     // This will be the render target image.
     // Note: An Image by itself does not allocate memory on the GPU.
     uint32_t renderImageWidth = 256;
     uint32_t renderImageHeight = 256;
-    VkFormat renderImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    // HF. The output image uses the farm format, as the farm render targets share its Render Pass and Pipeline.
+    VkFormat renderImageFormat = farmFormat;
     VkImage renderImage;
     {
         // 5.1. Specify the image creation information.
@@ -330,35 +623,8 @@ int main(int argc, char **argv) {
 
     // 6. Allocate and bind the memory for the render target image.
     // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory renderImageMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, renderImage, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &renderImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, renderImage, renderImageMemory, 0);
-    }
+    // The memory is sub-allocated from the memory arena and bound to the image.
+    ArenaAllocation renderImageMemory = ArenaAllocateImage(&memoryArena, renderImage, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     // 7. Create an Image View for the Render Target Image.
     // Will be used by the Framebuffer as Color Attachment.
@@ -392,70 +658,15 @@ int main(int argc, char **argv) {
 
     // 8. Create a Render Pass.
     // A Render Pass is required to use vkCmdDraw* commands.
-    VkRenderPass renderPass;
-    {
-        VkAttachmentDescription colorAttachment;
-        {
-            colorAttachment.flags = 0;
-            colorAttachment.format = renderImageFormat;
-            colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        }
-
-        VkAttachmentReference colorAttachmentRef;
-        {
-            colorAttachmentRef.attachment = 0;
-            colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        }
-
-        VkSubpassDescription subpass;
-        {
-            subpass.flags = 0;
-            subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-            subpass.inputAttachmentCount = 0;
-            subpass.pInputAttachments = NULL;
-            subpass.colorAttachmentCount = 1;
-            subpass.pColorAttachments = &colorAttachmentRef;
-            subpass.pResolveAttachments = NULL;
-            subpass.pDepthStencilAttachment = NULL;
-            subpass.preserveAttachmentCount = 0;
-            subpass.pPreserveAttachments = NULL;
-        }
-
-        VkRenderPassCreateInfo renderPassInfo;
-        {
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-            renderPassInfo.pNext = NULL;
-            renderPassInfo.flags = 0;
-            renderPassInfo.attachmentCount = 1;
-            renderPassInfo.pAttachments = &colorAttachment;
-            renderPassInfo.subpassCount = 1;
-            renderPassInfo.pSubpasses = &subpass;
-            renderPassInfo.dependencyCount = 0;
-            renderPassInfo.pDependencies = NULL;
-        }
-
-        if (vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create render pass!");
-        }
-    }
+    // MG. The Render Pass (and the Pipeline) is also created on the extra devices of the farm.
+    VkRenderPass renderPass = CreateTriangleRenderPass(device, renderImageFormat);
 
     // 9. Create Vertex shader.
+    // 9.1. Wait for the vertex shader loaded (or compiled) by the worker thread (ST.1).
+    // MG. The code is kept for the shader modules of the extra farm devices.
+    const std::vector<uint32_t> vertCode = vertShaderLoad.get();
     VkShaderModule vertShaderModule;
     {
-        // 9.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> vertSrc = LoadGLSL("triangle.vert");
-        std::vector<uint32_t> vertCode = CompileGLSL(shaderc_vertex_shader, vertSrc);
-        #else
-        std::vector<uint32_t> vertCode = LoadSPIRV("triangle.vert.spv");
-        #endif
-
         if (vertCode.size() == 0) {
             throw std::runtime_error("failed to load vertex shader!");
         }
@@ -470,7 +681,7 @@ int main(int argc, char **argv) {
             vertInfo.pNext = NULL;
             vertInfo.flags = 0;
             vertInfo.codeSize = vertCode.size() * sizeof(uint32_t);
-            vertInfo.pCode = reinterpret_cast<uint32_t*>(vertCode.data());
+            vertInfo.pCode = vertCode.data();
         }
 
         // 9.3. Create the Vertex Shader Module.
@@ -480,16 +691,10 @@ int main(int argc, char **argv) {
     }
 
     // 10. Create Fragment shader.
+    // 10.1. Wait for the fragment shader loaded (or compiled) by the worker thread (ST.1).
+    const std::vector<uint32_t> fragCode = fragShaderLoad.get();
     VkShaderModule fragShaderModule;
     {
-        // 10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> fragSrc = LoadGLSL("passthrough.frag");
-        std::vector<uint32_t> fragCode = CompileGLSL(shaderc_fragment_shader, fragSrc);
-        #else
-        std::vector<uint32_t> fragCode = LoadSPIRV("passthrough.frag.spv");
-        #endif
-
         if (fragCode.size() == 0) {
             throw std::runtime_error("failed to load fragment shader!");
         }
@@ -501,7 +706,7 @@ int main(int argc, char **argv) {
             fragInfo.pNext = NULL;
             fragInfo.flags = 0;
             fragInfo.codeSize = fragCode.size() * sizeof(uint32_t);
-            fragInfo.pCode = reinterpret_cast<uint32_t*>(fragCode.data());
+            fragInfo.pCode = fragCode.data();
         }
 
         // 10.3. Create the Fragment Shader Module.
@@ -529,164 +734,19 @@ int main(int argc, char **argv) {
         }
     }
 
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, pipelineCacheFileName, &pipelineCacheHit);
+
     // 12. Create the Rendering Pipeline
     VkPipeline pipeline;
     {
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo;
-        {
-            vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vertShaderStageInfo.pNext = NULL;
-            vertShaderStageInfo.flags = 0;
-            vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vertShaderStageInfo.module = vertShaderModule;
-            vertShaderStageInfo.pName = "main";
-            vertShaderStageInfo.pSpecializationInfo = NULL;
-        }
-
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo;
-        {
-            fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            fragShaderStageInfo.pNext = NULL;
-            fragShaderStageInfo.flags = 0;
-            fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-            fragShaderStageInfo.module = fragShaderModule;
-            fragShaderStageInfo.pName = "main";
-            fragShaderStageInfo.pSpecializationInfo = NULL;
-        }
+        std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+        pipeline = CreateTrianglePipeline(device, renderPass, pipelineLayout, vertShaderModule, fragShaderModule, pipelineCache);
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
-
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo;
-        {
-            vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-            vertexInputInfo.pNext = NULL;
-            vertexInputInfo.flags = 0;
-            vertexInputInfo.vertexBindingDescriptionCount = 0;
-            vertexInputInfo.pVertexBindingDescriptions = NULL;
-            vertexInputInfo.vertexAttributeDescriptionCount = 0;
-            vertexInputInfo.pVertexAttributeDescriptions = NULL;
-        }
-
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly;
-        {
-            inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-            inputAssembly.pNext = NULL;
-            inputAssembly.flags = 0;
-            inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-            inputAssembly.primitiveRestartEnable = VK_FALSE;
-        }
-
-        VkViewport viewport;
-        {
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) renderImageWidth;
-            viewport.height = (float) renderImageHeight;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-        }
-
-        VkRect2D scissor;
-        {
-            scissor.offset = { 0, 0 };
-            scissor.extent = { (uint32_t)viewport.width, (uint32_t)viewport.height };
-        }
-
-        VkPipelineViewportStateCreateInfo viewportState{};
-        {
-            viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-            viewportState.viewportCount = 1;
-            viewportState.pViewports = &viewport;
-            viewportState.scissorCount = 1;
-            viewportState.pScissors = &scissor;
-        }
-
-        VkPipelineRasterizationStateCreateInfo rasterizer;
-        {
-            rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-            rasterizer.pNext = NULL;
-            rasterizer.flags = 0;
-            rasterizer.depthClampEnable = VK_FALSE;
-            rasterizer.rasterizerDiscardEnable = VK_FALSE;
-            rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-            rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-            rasterizer.depthBiasEnable = VK_FALSE;
-            rasterizer.depthBiasConstantFactor = 0.0;
-            rasterizer.depthBiasClamp = 0.0;
-            rasterizer.depthBiasSlopeFactor = 0.0;
-            rasterizer.lineWidth = 1.0f;
-        }
-
-        VkPipelineMultisampleStateCreateInfo multisampling;
-        {
-            multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-            multisampling.pNext = NULL;
-            multisampling.flags = 0;
-            multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-            multisampling.sampleShadingEnable = VK_FALSE;
-            multisampling.minSampleShading = 0.0;
-            multisampling.pSampleMask = NULL;
-            multisampling.alphaToCoverageEnable = VK_FALSE;
-            multisampling.alphaToOneEnable = VK_FALSE;
-        }
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment;
-        {
-            colorBlendAttachment.blendEnable = VK_FALSE;
-            colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-                                                  | VK_COLOR_COMPONENT_G_BIT
-                                                  | VK_COLOR_COMPONENT_B_BIT
-                                                  | VK_COLOR_COMPONENT_A_BIT;
-        }
-
-        VkPipelineColorBlendStateCreateInfo colorBlending;
-        {
-            colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-            colorBlending.pNext = NULL;
-            colorBlending.flags = 0;
-            colorBlending.logicOpEnable = VK_FALSE;
-            colorBlending.logicOp = VK_LOGIC_OP_COPY;
-            colorBlending.attachmentCount = 1;
-            colorBlending.pAttachments = &colorBlendAttachment;
-            colorBlending.blendConstants[0] = 0.0f;
-            colorBlending.blendConstants[1] = 0.0f;
-            colorBlending.blendConstants[2] = 0.0f;
-            colorBlending.blendConstants[3] = 0.0f;
-        }
-
-        VkGraphicsPipelineCreateInfo pipelineInfo;
-        {
-            pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-            pipelineInfo.pNext = NULL;
-            pipelineInfo.flags = 0;
-            pipelineInfo.stageCount = 2;
-            pipelineInfo.pStages = shaderStages;
-            pipelineInfo.pVertexInputState = &vertexInputInfo;
-            pipelineInfo.pInputAssemblyState = &inputAssembly;
-            pipelineInfo.pTessellationState = NULL;
-            pipelineInfo.pViewportState = &viewportState;
-            pipelineInfo.pRasterizationState = &rasterizer;
-            pipelineInfo.pMultisampleState = &multisampling;
-            pipelineInfo.pDepthStencilState = NULL;
-            pipelineInfo.pColorBlendState = &colorBlending;
-            pipelineInfo.pDynamicState = NULL;
-            pipelineInfo.layout = pipelineLayout;
-            pipelineInfo.renderPass = renderPass;
-            pipelineInfo.subpass = 0;
-            pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-            pipelineInfo.basePipelineIndex = 0;
-        }
-
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
-        }
+        double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+        printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
     }
 
     // 13. Create Framebuffer.
@@ -753,7 +813,8 @@ int main(int argc, char **argv) {
         {
             beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
             beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            // BN. In the benchmark mode the Command Buffer is submitted multiple times.
+            beginInfo.flags = (benchFrames > 0) ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
             beginInfo.pInheritanceInfo = NULL;
         }
 
@@ -784,6 +845,26 @@ int main(int argc, char **argv) {
         // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
         vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
+        // HF.3.1. Set the dynamic viewport and scissor to the render target size.
+        VkViewport viewport;
+        {
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float) renderImageWidth;
+            viewport.height = (float) renderImageHeight;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+        }
+
+        VkRect2D scissor;
+        {
+            scissor.offset = { 0, 0 };
+            scissor.extent = { renderImageWidth, renderImageHeight };
+        }
+
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
         // 17.3. Add a Draw command.
         // Draw 3 vertices using the pipeline bound previously.
         uint32_t vertexCount = 3;
@@ -824,6 +905,236 @@ int main(int argc, char **argv) {
         //vkResetFences(device, 1, &fence);
     }
 
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
+
+    // BN. Benchmark mode: render the frames without the readback and time each submission.
+    // All frames draw into the same render target, so there is only a single frame in flight.
+    // The output image is still rendered and written by the regular submission below.
+    if (benchFrames > 0) {
+        BenchTimer benchTimer;
+        CreateBenchTimer(physicalDevice, device, graphicsQueueFamilyIdx, 1, &benchTimer);
+
+        VkCommandBuffer benchCmdBuffers[3] = { benchTimer.beginCmdBuffers[0], cmdBuffer, benchTimer.endCmdBuffers[0] };
+
+        VkSubmitInfo submitInfo;
+        {
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = NULL;
+            submitInfo.waitSemaphoreCount = 0;
+            submitInfo.pWaitSemaphores = NULL;
+            submitInfo.pWaitDstStageMask = NULL;
+            submitInfo.commandBufferCount = 3;
+            submitInfo.pCommandBuffers = benchCmdBuffers;
+            submitInfo.signalSemaphoreCount = 0;
+            submitInfo.pSignalSemaphores = NULL;
+        }
+
+        const std::chrono::steady_clock::time_point benchStart = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < benchFrames; frame++) {
+            const std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+
+            if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+            benchTimer.pending[0] = true;
+
+            const std::chrono::steady_clock::time_point cpuEnd = std::chrono::steady_clock::now();
+            benchTimer.cpuTimes.push_back(std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count());
+
+            if (vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+                throw std::runtime_error("failed to wait for fence!");
+            }
+            vkResetFences(device, 1, &fence);
+
+            CollectBenchTimestamps(device, &benchTimer, 0);
+        }
+        const std::chrono::steady_clock::time_point benchEnd = std::chrono::steady_clock::now();
+
+        PrintBenchResults(physicalDevice, benchTimer, std::chrono::duration<double>(benchEnd - benchStart).count());
+        DestroyBenchTimer(device, &benchTimer);
+    }
+
+    // MG. The devices of the farm: the device of main and, with DEMO_MULTI_GPU, every other matching device.
+    // The extra devices only get what the farm needs, the SPIR-V loaded above is reused for their shader modules.
+    std::vector<FarmDevice> farmDevices(farmWorkerCounts.empty() ? 0 : 1 + farmExtraDevices.size());
+    for (size_t deviceIdx = 0; deviceIdx < farmDevices.size(); deviceIdx++) {
+        FarmDevice& farmDevice = farmDevices[deviceIdx];
+
+        if (deviceIdx == 0) {
+            farmDevice.physicalDevice = physicalDevice;
+            farmDevice.device = device;
+            farmDevice.queueFamilyIdx = graphicsQueueFamilyIdx;
+            farmDevice.queues = farmQueues;
+            farmDevice.arena = &memoryArena;
+            farmDevice.renderPass = renderPass;
+            farmDevice.pipeline = pipeline;
+            farmDevice.owned = false;
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            farmDevice.name = properties.deviceName;
+        } else {
+            CreateFarmDevice(farmExtraDevices[deviceIdx - 1].first, farmExtraDevices[deviceIdx - 1].second,
+                             (farmSharedQueue ? 1 : farmMaxWorkers), renderImageFormat, vertCode, fragCode,
+                             enableValidationLayers, &farmDevice);
+        }
+    }
+
+    // HF.4. Headless render farm: each worker thread records renders into its own pool of render targets,
+    // submits them in batches and reads every result back through its own readback ring.
+    // The output image is still rendered and written by the regular submission below.
+    for (size_t sizeIdx = 0; (sizeIdx < farmSizes.size()) && !farmWorkerCounts.empty(); sizeIdx++) {
+        for (size_t countIdx = 0; countIdx < farmWorkerCounts.size(); countIdx++) {
+            const uint32_t workerCount = farmWorkerCounts[countIdx];
+            const uint32_t deviceCount = (uint32_t)farmDevices.size();
+
+            // MG.1. The workers are assigned to the devices round robin, each worker uses a single device.
+            // Every device has its own run, the render counter is shared by all of them.
+            std::atomic<uint32_t> claimedRenders(0);
+            FarmFailure farmFailure;
+            farmFailure.failed.store(false);
+            std::vector<FarmRun> runs(deviceCount);
+            std::vector<FarmSubmitter> submitters(deviceCount);
+            for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+                const FarmDevice& farmDevice = farmDevices[deviceIdx];
+                const uint32_t deviceWorkers = workerCount / deviceCount + ((deviceIdx < (workerCount % deviceCount)) ? 1 : 0);
+
+                FarmRun& run = runs[deviceIdx];
+                {
+                    run.device = farmDevice.device;
+                    run.renderPass = farmDevice.renderPass;
+                    run.pipeline = farmDevice.pipeline;
+                    run.extent = farmSizes[sizeIdx];
+                    run.batchSize = farmBatch;
+                    run.renderCount = farmRenders;
+                    run.claimedRenders = &claimedRenders;
+                    run.submitter = NULL;
+                    run.failure = &farmFailure;
+                }
+
+                // HF.4.1. Without a queue for every worker the batches are submitted by a single thread.
+                const bool sharedQueue = farmSharedQueue || (deviceWorkers > farmDevice.queues.size());
+                if (sharedQueue && (deviceWorkers > 0)) {
+                    StartFarmSubmitter(farmDevice.queues[0], &farmFailure, &submitters[deviceIdx]);
+                    run.submitter = &submitters[deviceIdx];
+                }
+            }
+
+            // HF.4.2. The render targets and readback slots are allocated before the threads start,
+            // the memory arenas are only used from this thread.
+            std::vector<FarmWorker> workers(workerCount);
+            for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+                const uint32_t deviceIdx = workerIdx % deviceCount;
+                const FarmDevice& farmDevice = farmDevices[deviceIdx];
+                FarmRun& run = runs[deviceIdx];
+
+                CreateFarmWorker(farmDevice.physicalDevice, farmDevice.device, farmDevice.arena, farmDevice.queueFamilyIdx,
+                                 renderImageFormat, farmTargets, &run,
+                                 (run.submitter != NULL) ? VK_NULL_HANDLE : farmDevice.queues[workerIdx / deviceCount],
+                                 &workers[workerIdx]);
+                workers[workerIdx].deviceIdx = deviceIdx;
+            }
+
+            const std::chrono::steady_clock::time_point farmStart = std::chrono::steady_clock::now();
+            for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+                workers[workerIdx].thread = std::thread(FarmWorkerMain, &workers[workerIdx]);
+            }
+            for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+                workers[workerIdx].thread.join();
+            }
+            const std::chrono::steady_clock::time_point farmEnd = std::chrono::steady_clock::now();
+
+            for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+                if (runs[deviceIdx].submitter != NULL) {
+                    StopFarmSubmitter(&submitters[deviceIdx]);
+                }
+            }
+
+            // FF.1. A failed worker leaves its submissions in flight, they are waited for before the workers are destroyed.
+            const bool farmFailed = farmFailure.failed.load();
+            if (farmFailed) {
+                for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+                    vkDeviceWaitIdle(farmDevices[deviceIdx].device);
+                }
+            } else {
+                PrintFarmResults(runs, farmDevices, workers, std::chrono::duration<double>(farmEnd - farmStart).count());
+            }
+
+            for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+                const FarmDevice& farmDevice = farmDevices[workers[workerIdx].deviceIdx];
+                DestroyFarmWorker(farmDevice.device, farmDevice.arena, &workers[workerIdx]);
+            }
+
+            // FF.2. Every farm thread is joined, the failure is rethrown on the main thread.
+            if (farmFailed) {
+                std::rethrow_exception(farmFailure.error);
+            }
+        }
+    }
+
+    // MG. Destroy the extra farm devices, the first one is destroyed with the rest of main's resources.
+    for (size_t deviceIdx = 0; deviceIdx < farmDevices.size(); deviceIdx++) {
+        DestroyFarmDevice(&farmDevices[deviceIdx]);
+    }
+
+    // R.1. Create the readback ring and record the capture of the rendered image.
+    // The copy is executed in the same submission after the draw commands.
+    // H.2. Map the output file and import it as the destination of the copy.
+    // The PAM header is padded with a comment, so the pixels start at a 16 byte aligned offset.
+    ReadbackHostMemory outputMemory = { NULL, 0, 0 };
+    int outputFd = -1;
+    size_t outputFileSize = 0;
+    if (hostImportAlignment != 0) {
+        char header[256];
+        int headerSize = snprintf(header, sizeof(header), "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\n",
+                                  renderImageWidth, renderImageHeight);
+        // "#" + padding + "\n" + "ENDHDR\n"
+        const int padding = (16 - (headerSize + 9) % 16) % 16;
+        headerSize += snprintf(header + headerSize, sizeof(header) - headerSize, "#%*s\nENDHDR\n", padding, "");
+
+        outputFileSize = headerSize + (size_t)renderImageWidth * renderImageHeight * 4;
+        const VkDeviceSize mapSize = (outputFileSize + hostImportAlignment - 1) / hostImportAlignment * hostImportAlignment;
+
+        outputFd = open(outputFileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if ((outputFd >= 0) && (ftruncate(outputFd, mapSize) == 0)) {
+            void *mapped = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, outputFd, 0);
+            if ((mapped != MAP_FAILED) && (((uintptr_t)mapped % hostImportAlignment) == 0)) {
+                memcpy(mapped, header, headerSize);
+                outputMemory = { mapped, mapSize, (VkDeviceSize)headerSize };
+            } else if (mapped != MAP_FAILED) {
+                munmap(mapped, mapSize);
+            }
+        }
+    }
+
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, 1,
+                       (outputMemory.pointer != NULL) ? &outputMemory : NULL, &readbackRing);
+
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
+
+    // The import can still be refused by the driver, in that case the regular PPM output is written.
+    if ((hostImportAlignment != 0) && !readbackRing.slots[0].imported) {
+        printf("Host import: failed to import the output file, using the staging buffer\n");
+
+        if (outputMemory.pointer != NULL) {
+            munmap(outputMemory.pointer, outputMemory.size);
+            outputMemory.pointer = NULL;
+        }
+        if (outputFd >= 0) {
+            close(outputFd);
+            outputFd = -1;
+        }
+    }
+
+    VkCommandBuffer frameCmdBuffers[2] = {
+        cmdBuffer,
+        RecordReadback(device, &readbackRing, renderImage, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, fence, 0),
+    };
+
     // 20. Submit the recorded Command Buffer to the Queue.
     {
         VkSubmitInfo submitInfo;
@@ -833,8 +1144,8 @@ int main(int argc, char **argv) {
             submitInfo.waitSemaphoreCount = 0;
             submitInfo.pWaitSemaphores = NULL;
             submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
+            submitInfo.commandBufferCount = 2;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
             submitInfo.signalSemaphoreCount = 0;
             submitInfo.pSignalSemaphores = NULL;
         }
@@ -857,59 +1168,22 @@ int main(int argc, char **argv) {
     // The ImageView is created for the "renderImage" thus the image is rendered into that.
 
     {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, renderImage, renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
-
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
-        }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
-
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
+        // 22. Get the finished capture from the readback ring.
+        // The staging buffer is persistently mapped, no copy or map is required.
+        ReadbackSlot *slot = PollReadback(device, &readbackRing);
+        if (slot == NULL) {
+            throw std::runtime_error("failed to read back the rendered image!");
         }
 
         // 25. Write out the image to a ppm file.
-        {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+        // With the host import the GPU already wrote the pixels into the output file.
+        if (!slot->imported) {
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, slot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4,
+                     (renderImageFormat == VK_FORMAT_B8G8R8A8_UNORM), ppmMmap);
         }
 
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
-
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
-
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
+        ReleaseReadback(slot);
     }
 
     // XX. Destroy Fence.
@@ -918,6 +1192,18 @@ int main(int argc, char **argv) {
     // XX. Free Command Buffer.
     vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
+
+    // H.XX. Unmap the output file after the imported memory is freed and cut the alignment padding.
+    if (outputMemory.pointer != NULL) {
+        munmap(outputMemory.pointer, outputMemory.size);
+        if (ftruncate(outputFd, outputFileSize) != 0) {
+            printf("Host import: failed to truncate '%s'\n", outputFileName);
+        }
+        close(outputFd);
+    }
+
     // XX. Destroy Command Pool
     vkDestroyCommandPool(device, cmdPool, NULL);
 
@@ -943,11 +1229,18 @@ int main(int argc, char **argv) {
     vkDestroyImageView(device, renderImageView, NULL);
 
     // XX. Free render target image's memory.
-    vkFreeMemory(device, renderImageMemory, NULL);
+    ArenaFree(&memoryArena, renderImageMemory);
 
     // XX. Destroy render target image.
     vkDestroyImage(device, renderImage, NULL);
 
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
     // XX. Destroy Device
     vkDestroyDevice(device, NULL);
 
@@ -957,342 +1250,852 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
+VkRenderPass CreateTriangleRenderPass(const VkDevice device, VkFormat format) {
+    VkAttachmentDescription colorAttachment;
+    {
+        colorAttachment.flags = 0;
+        colorAttachment.format = format;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     }
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    VkAttachmentReference colorAttachmentRef;
+    {
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
 
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
+    VkSubpassDescription subpass;
+    {
+        subpass.flags = 0;
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.inputAttachmentCount = 0;
+        subpass.pInputAttachments = NULL;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pResolveAttachments = NULL;
+        subpass.pDepthStencilAttachment = NULL;
+        subpass.preserveAttachmentCount = 0;
+        subpass.pPreserveAttachments = NULL;
+    }
 
-            return queueFamilyIdx;
-        }
+    VkRenderPassCreateInfo renderPassInfo;
+    {
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.pNext = NULL;
+        renderPassInfo.flags = 0;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 0;
+        renderPassInfo.pDependencies = NULL;
+    }
 
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
     }
 
-    return UINT32_MAX;
+    return renderPass;
 }
 
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+VkPipeline CreateTrianglePipeline(const VkDevice device,
+                                  const VkRenderPass renderPass,
+                                  const VkPipelineLayout pipelineLayout,
+                                  const VkShaderModule vertShaderModule,
+                                  const VkShaderModule fragShaderModule,
+                                  const VkPipelineCache pipelineCache) {
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo;
+    {
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.pNext = NULL;
+        vertShaderStageInfo.flags = 0;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = NULL;
+    }
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo;
+    {
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.pNext = NULL;
+        fragShaderStageInfo.flags = 0;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+        fragShaderStageInfo.pSpecializationInfo = NULL;
+    }
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+    {
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.pNext = NULL;
+        vertexInputInfo.flags = 0;
+        vertexInputInfo.vertexBindingDescriptionCount = 0;
+        vertexInputInfo.pVertexBindingDescriptions = NULL;
+        vertexInputInfo.vertexAttributeDescriptionCount = 0;
+        vertexInputInfo.pVertexAttributeDescriptions = NULL;
+    }
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+    {
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.pNext = NULL;
+        inputAssembly.flags = 0;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+    }
+
+    // HF.3. The viewport and scissor are dynamic, so the farm render targets of any size use the same Pipeline.
+    VkPipelineViewportStateCreateInfo viewportState{};
+    {
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = NULL;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = NULL;
+    }
+
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState;
+    {
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.pNext = NULL;
+        dynamicState.flags = 0;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates = dynamicStates;
+    }
+
+    VkPipelineRasterizationStateCreateInfo rasterizer;
+    {
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.pNext = NULL;
+        rasterizer.flags = 0;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+        rasterizer.depthBiasConstantFactor = 0.0;
+        rasterizer.depthBiasClamp = 0.0;
+        rasterizer.depthBiasSlopeFactor = 0.0;
+        rasterizer.lineWidth = 1.0f;
+    }
+
+    VkPipelineMultisampleStateCreateInfo multisampling;
+    {
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.pNext = NULL;
+        multisampling.flags = 0;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.minSampleShading = 0.0;
+        multisampling.pSampleMask = NULL;
+        multisampling.alphaToCoverageEnable = VK_FALSE;
+        multisampling.alphaToOneEnable = VK_FALSE;
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
+    VkPipelineColorBlendAttachmentState colorBlendAttachment;
+    {
+        colorBlendAttachment.blendEnable = VK_FALSE;
+        colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+                                              | VK_COLOR_COMPONENT_G_BIT
+                                              | VK_COLOR_COMPONENT_B_BIT
+                                              | VK_COLOR_COMPONENT_A_BIT;
+    }
+
+    VkPipelineColorBlendStateCreateInfo colorBlending;
+    {
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.pNext = NULL;
+        colorBlending.flags = 0;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+    }
+
+    VkGraphicsPipelineCreateInfo pipelineInfo;
+    {
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = NULL;
+        pipelineInfo.flags = 0;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pTessellationState = NULL;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = NULL;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        pipelineInfo.basePipelineIndex = 0;
+    }
+
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create graphics pipeline!");
+    }
+
+    return pipeline;
 }
 
-#if HAVE_SHADERC
+void ParseFarmWorkerCounts(const char *list, std::vector<uint32_t> *outCounts) {
+    outCounts->clear();
+    if (list == NULL) {
+        return;
+    }
+
+    // HF.P.1. A zero count is skipped, so "0" disables the farm.
+    const char *current = list;
+    while (*current != '\0') {
+        char *end;
+        const unsigned long count = strtoul(current, &end, 10);
+        if ((end == current) || ((*end != ',') && (*end != '\0'))) {
+            throw std::runtime_error("unknown farm worker count!");
+        }
 
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+        if (count > 0) {
+            outCounts->push_back((uint32_t)count);
+        }
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+        current = (*end == ',') ? (end + 1) : end;
     }
+}
+
+void ParseFarmSizes(const char *list, std::vector<VkExtent2D> *outSizes) {
+    outSizes->clear();
+
+    // HF.P.2. Each entry is "WIDTHxHEIGHT".
+    const char *current = list;
+    while (*current != '\0') {
+        char *end;
+        const unsigned long width = strtoul(current, &end, 10);
+        if ((end == current) || (*end != 'x')) {
+            throw std::runtime_error("unknown farm size!");
+        }
 
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
+        const char *heightStart = end + 1;
+        const unsigned long height = strtoul(heightStart, &end, 10);
+        if ((end == heightStart) || ((*end != ',') && (*end != '\0')) || (width == 0) || (height == 0)) {
+            throw std::runtime_error("unknown farm size!");
+        }
+
+        outSizes->push_back({ (uint32_t)width, (uint32_t)height });
+        current = (*end == ',') ? (end + 1) : end;
+    }
 }
 
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+VkFormat ParseFarmFormat(const char *name) {
+    // HF.P.3. Only 4 byte per pixel formats are supported, the readback ring expects tightly packed 4 byte pixels.
+    if ((name == NULL) || (strcmp(name, "rgba8") == 0)) {
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    } else if (strcmp(name, "bgra8") == 0) {
+        return VK_FORMAT_B8G8R8A8_UNORM;
+    } else if (strcmp(name, "srgb") == 0) {
+        return VK_FORMAT_R8G8B8A8_SRGB;
+    }
 
-    return { module.begin(), module.end() };
+    throw std::runtime_error("unknown farm format!");
 }
 
-#else
+void CreateFarmDevice(const VkPhysicalDevice physicalDevice,
+                      uint32_t queueFamilyIdx,
+                      uint32_t queueCount,
+                      VkFormat format,
+                      const std::vector<uint32_t>& vertCode,
+                      const std::vector<uint32_t>& fragCode,
+                      bool enableValidationLayers,
+                      FarmDevice *outDevice) {
+    outDevice->physicalDevice = physicalDevice;
+    outDevice->queueFamilyIdx = queueFamilyIdx;
+    outDevice->owned = true;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    outDevice->name = properties.deviceName;
+
+    // MG.3. Create the logical device with a queue for each worker (limited by the queue family), as in step 3.
+    {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        queueCount = std::min(queueCount, queueFamilies[queueFamilyIdx].queueCount);
+    }
+
+    {
+        std::vector<float> queuePriorities(queueCount, 1.0f);
+        VkDeviceQueueCreateInfo queueCreateInfo;
+        {
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.pNext = NULL;
+            queueCreateInfo.flags = 0;
+            queueCreateInfo.queueFamilyIndex = queueFamilyIdx;
+            queueCreateInfo.queueCount = queueCount;
+            queueCreateInfo.pQueuePriorities = queuePriorities.data();
+        }
+
+        VkDeviceCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            createInfo.queueCreateInfoCount = 1;
+            createInfo.pQueueCreateInfos = &queueCreateInfo;
+            createInfo.pEnabledFeatures = NULL;
+            createInfo.enabledExtensionCount = 0;
+            createInfo.ppEnabledExtensionNames = NULL;
+            createInfo.enabledLayerCount = 0;
+
+            if (enableValidationLayers) {
+                createInfo.enabledLayerCount = static_cast<uint32_t>(g_validationLayers.size());
+                createInfo.ppEnabledLayerNames = g_validationLayers.data();
+            }
+        }
 
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
+        if (vkCreateDevice(physicalDevice, &createInfo, NULL, &outDevice->device) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create logical device!");
+        }
+    }
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
+    const VkDevice device = outDevice->device;
+    outDevice->queues.resize(queueCount);
+    for (uint32_t queueIdx = 0; queueIdx < queueCount; queueIdx++) {
+        vkGetDeviceQueue(device, queueFamilyIdx, queueIdx, &outDevice->queues[queueIdx]);
     }
 
-    size_t fileSize = (size_t) file.tellg();
+    // MG.4. The render targets of the device's workers are sub-allocated from its own memory arena.
+    CreateMemoryArena(physicalDevice, device, &outDevice->ownedArena);
+    outDevice->arena = &outDevice->ownedArena;
+
+    // MG.5. Create the Render Pass, the Shader Modules and the Pipeline, as in steps 8-12.
+    // The pipeline cache of main belongs to the other device, so no cache is used here.
+    outDevice->renderPass = CreateTriangleRenderPass(device, format);
+
+    const std::vector<uint32_t> *codes[] = { &vertCode, &fragCode };
+    VkShaderModule *modules[] = { &outDevice->vertShaderModule, &outDevice->fragShaderModule };
+    for (uint32_t idx = 0; idx < 2; idx++) {
+        VkShaderModuleCreateInfo moduleInfo;
+        {
+            moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            moduleInfo.pNext = NULL;
+            moduleInfo.flags = 0;
+            moduleInfo.codeSize = codes[idx]->size() * sizeof(uint32_t);
+            moduleInfo.pCode = codes[idx]->data();
+        }
 
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+        if (vkCreateShaderModule(device, &moduleInfo, NULL, modules[idx]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader module!");
+        }
     }
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+    {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo;
+        {
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.pNext = NULL;
+            pipelineLayoutInfo.flags = 0;
+            pipelineLayoutInfo.setLayoutCount = 0;
+            pipelineLayoutInfo.pSetLayouts = NULL;
+            pipelineLayoutInfo.pushConstantRangeCount = 0;
+            pipelineLayoutInfo.pPushConstantRanges = NULL;
+        }
 
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &outDevice->pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+    }
 
-    file.close();
+    outDevice->pipeline = CreateTrianglePipeline(device, outDevice->renderPass, outDevice->pipelineLayout,
+                                                 outDevice->vertShaderModule, outDevice->fragShaderModule, VK_NULL_HANDLE);
+}
 
-    return buffer;
+void DestroyFarmDevice(FarmDevice *farmDevice) {
+    if (!farmDevice->owned) {
+        return;
+    }
+
+    const VkDevice device = farmDevice->device;
+    vkDestroyPipeline(device, farmDevice->pipeline, NULL);
+    vkDestroyPipelineLayout(device, farmDevice->pipelineLayout, NULL);
+    vkDestroyShaderModule(device, farmDevice->fragShaderModule, NULL);
+    vkDestroyShaderModule(device, farmDevice->vertShaderModule, NULL);
+    vkDestroyRenderPass(device, farmDevice->renderPass, NULL);
+    DestroyMemoryArena(&farmDevice->ownedArena);
+    vkDestroyDevice(device, NULL);
 }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
-    {
+void CreateFarmWorker(const VkPhysicalDevice physicalDevice,
+                      const VkDevice device,
+                      MemoryArena *arena,
+                      uint32_t queueFamilyIdx,
+                      VkFormat format,
+                      uint32_t targetCount,
+                      FarmRun *run,
+                      const VkQueue queue,
+                      FarmWorker *outWorker) {
+    outWorker->run = run;
+    outWorker->queue = queue;
+    outWorker->renders = 0;
+    outWorker->captures = 0;
+
+    // HF.5. Split the render targets into batches, every batch is one submission in flight.
+    const uint32_t batchCount = std::max(1u, targetCount / run->batchSize);
+    outWorker->targets.resize(batchCount * run->batchSize);
+
+    // HF.5.1. Create the render targets the same way as the output image.
+    for (size_t targetIdx = 0; targetIdx < outWorker->targets.size(); targetIdx++) {
+        FarmTarget& target = outWorker->targets[targetIdx];
+
         VkImageCreateInfo imageInfo;
         {
             imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
             imageInfo.pNext = NULL;
             imageInfo.flags = 0;
             imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
+            imageInfo.format = format;
+            imageInfo.extent = { run->extent.width, run->extent.height, 1 };
             imageInfo.mipLevels = 1;
             imageInfo.arrayLayers = 1;
             imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
             imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             imageInfo.queueFamilyIndexCount = 0;
             imageInfo.pQueueFamilyIndices = NULL;
             imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         }
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
+        if (vkCreateImage(device, &imageInfo, NULL, &target.image) != VK_SUCCESS) {
             throw std::runtime_error("failed to create 2D image!");
         }
-    }
 
-    *outImage = readableImage;
+        target.memory = ArenaAllocateImage(arena, target.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
-    {
-        // A.2.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
-
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
+        VkImageViewCreateInfo viewInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.pNext = NULL;
+            viewInfo.flags = 0;
+            viewInfo.image = target.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = format;
+            viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        }
+
+        if (vkCreateImageView(device, &viewInfo, NULL, &target.imageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image views!");
         }
 
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        VkFramebufferCreateInfo framebufferInfo;
+        {
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.pNext = NULL;
+            framebufferInfo.flags = 0;
+            framebufferInfo.renderPass = run->renderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &target.imageView;
+            framebufferInfo.width = run->extent.width;
+            framebufferInfo.height = run->extent.height;
+            framebufferInfo.layers = 1;
         }
 
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
+        if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &target.framebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
     }
 
-    *outMemory = readableImageMemory;
+    // HF.5.2. Every batch has its own transient Command Pool, Command Buffers are never reset one by one.
+    outWorker->batches.resize(batchCount);
+    for (uint32_t batchIdx = 0; batchIdx < batchCount; batchIdx++) {
+        FarmBatch& batch = outWorker->batches[batchIdx];
+        batch.firstTarget = batchIdx * run->batchSize;
+        batch.renderCount = 0;
+        batch.inFlight = false;
+        batch.queued = false;
+        batch.submitted = false;
 
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
-    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &batch.cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+
+        batch.drawCmdBuffers.resize(run->batchSize);
         VkCommandBufferAllocateInfo allocInfo;
         {
             allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
+            allocInfo.commandPool = batch.cmdPool;
             allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            allocInfo.commandBufferCount = run->batchSize;
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+        if (vkAllocateCommandBuffers(device, &allocInfo, batch.drawCmdBuffers.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate command buffers!");
         }
-    }
 
-    // Start recording image copy commands.
+        // HF.5.3. The submit infos only change in their Command Buffer count.
+        batch.frameCmdBuffers.resize(run->batchSize * 2);
+        batch.submitInfos.resize(run->batchSize);
+        for (uint32_t renderIdx = 0; renderIdx < run->batchSize; renderIdx++) {
+            VkSubmitInfo& submitInfo = batch.submitInfos[renderIdx];
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = NULL;
+            submitInfo.waitSemaphoreCount = 0;
+            submitInfo.pWaitSemaphores = NULL;
+            submitInfo.pWaitDstStageMask = NULL;
+            submitInfo.commandBufferCount = 2;
+            submitInfo.pCommandBuffers = &batch.frameCmdBuffers[renderIdx * 2];
+            submitInfo.signalSemaphoreCount = 0;
+            submitInfo.pSignalSemaphores = NULL;
+        }
 
-    // A.4. Start Command Buffer.
-    {
-        VkCommandBufferBeginInfo beginInfo;
+        VkFenceCreateInfo fenceInfo;
         {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            beginInfo.pInheritanceInfo = NULL;
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = NULL;
+            fenceInfo.flags = 0;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
+        if (vkCreateFence(device, &fenceInfo, NULL, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create synchronization objects for a frame!");
         }
     }
 
-    // A.4. Transition destination image to transfer destination layout.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
+    // HF.5.4. Every render target has its own readback slot, so no render misses its capture.
+    CreateReadbackRing(physicalDevice, device, arena, queueFamilyIdx, run->extent.width, run->extent.height,
+                       (uint32_t)outWorker->targets.size(), NULL, &outWorker->readbackRing);
+}
+
+void DestroyFarmWorker(const VkDevice device, MemoryArena *arena, FarmWorker *worker) {
+    DestroyReadbackRing(device, &worker->readbackRing);
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+    // The Command Buffers are freed with their pools.
+    for (size_t batchIdx = 0; batchIdx < worker->batches.size(); batchIdx++) {
+        vkDestroyFence(device, worker->batches[batchIdx].fence, NULL);
+        vkDestroyCommandPool(device, worker->batches[batchIdx].cmdPool, NULL);
     }
+    worker->batches.clear();
+
+    for (size_t targetIdx = 0; targetIdx < worker->targets.size(); targetIdx++) {
+        FarmTarget& target = worker->targets[targetIdx];
+        vkDestroyFramebuffer(device, target.framebuffer, NULL);
+        vkDestroyImageView(device, target.imageView, NULL);
+        ArenaFree(arena, target.memory);
+        vkDestroyImage(device, target.image, NULL);
+    }
+    worker->targets.clear();
+}
 
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+void FarmWorkerMain(FarmWorker *worker) {
+    try {
+        RunFarmWorker(worker);
+    } catch (...) {
+        RecordFarmFailure(worker->run->failure);
+    }
+}
+
+void RecordFarmFailure(FarmFailure *failure) {
+    // FF.3. Called from a catch block, only the first exception is kept.
+    std::lock_guard<std::mutex> lock(failure->mutex);
+    if (!failure->failed.load()) {
+        failure->error = std::current_exception();
+        failure->failed.store(true);
+    }
+}
+
+void RunFarmWorker(FarmWorker *worker) {
+    FarmRun *run = worker->run;
+    const VkDevice device = run->device;
+
+    size_t batchIdx = 0;
+    while (true) {
+        FarmBatch& batch = worker->batches[batchIdx];
+        batchIdx = (batchIdx + 1) % worker->batches.size();
+
+        // HF.6. The batches are reused round robin, the oldest submission is waited for only when its
+        // render targets are needed again.
+        if (batch.inFlight) {
+            WaitFarmBatch(worker, &batch);
+        }
+
+        // HF.6.1. Claim the next renders, the workers which are done first take more of them.
+        // FF. After a failure of any farm thread no new renders are started.
+        if (run->failure->failed.load()) {
+            break;
+        }
+        const uint32_t firstRender = run->claimedRenders->fetch_add(run->batchSize);
+        if (firstRender >= run->renderCount) {
+            break;
         }
+        const uint32_t renderCount = std::min(run->batchSize, run->renderCount - firstRender);
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+        // HF.6.2. Record the draw and the readback of each render target in the batch.
+        vkResetCommandPool(device, batch.cmdPool, 0);
+        for (uint32_t renderIdx = 0; renderIdx < renderCount; renderIdx++) {
+            const FarmTarget& target = worker->targets[batch.firstTarget + renderIdx];
+
+            RecordFarmDraw(batch.drawCmdBuffers[renderIdx], *run, target.framebuffer);
+
+            const VkCommandBuffer readbackCmdBuffer = RecordReadback(device, &worker->readbackRing, target.image,
+                                                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, batch.fence,
+                                                                     firstRender + renderIdx);
+
+            batch.frameCmdBuffers[renderIdx * 2] = batch.drawCmdBuffers[renderIdx];
+            batch.frameCmdBuffers[renderIdx * 2 + 1] = readbackCmdBuffer;
+            batch.submitInfos[renderIdx].commandBufferCount = (readbackCmdBuffer != VK_NULL_HANDLE) ? 2 : 1;
+        }
+
+        // HF.6.3. Submit every render of the batch with a single vkQueueSubmit and a single fence.
+        batch.renderCount = renderCount;
+        batch.inFlight = true;
+        if (run->submitter != NULL) {
+            QueueFarmBatch(run->submitter, &batch);
+        } else if (vkQueueSubmit(worker->queue, renderCount, batch.submitInfos.data(), batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit command buffer!");
+        }
     }
 
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
-    }
-
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    // HF.6.4. Drain the submissions which are still in flight.
+    for (size_t idx = 0; idx < worker->batches.size(); idx++) {
+        if (worker->batches[idx].inFlight) {
+            WaitFarmBatch(worker, &worker->batches[idx]);
         }
+    }
+}
+
+void RecordFarmDraw(const VkCommandBuffer cmdBuffer, const FarmRun& run, const VkFramebuffer framebuffer) {
+    // HF.7. The Command Pool of the batch was reset, so the Command Buffer is recorded for a single submit.
+    VkCommandBufferBeginInfo beginInfo;
+    {
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = NULL;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = NULL;
+    }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+    if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
     }
 
-    // A.8. End the Command Buffer.
+    VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+    VkRenderPassBeginInfo renderPassInfo;
     {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.pNext = NULL;
+        renderPassInfo.renderPass = run.renderPass;
+        renderPassInfo.framebuffer = framebuffer;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = run.extent;
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
     }
 
-    // A.9. Create a Fence.
-    VkFence fence;
+    vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, run.pipeline);
+
+    VkViewport viewport;
     {
-        VkFenceCreateInfo fenceInfo;
-        {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
-        }
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) run.extent.width;
+        viewport.height = (float) run.extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+    }
 
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
+    VkRect2D scissor;
+    {
+        scissor.offset = { 0, 0 };
+        scissor.extent = run.extent;
+    }
+
+    vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+    vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+    vkCmdEndRenderPass(cmdBuffer);
+
+    if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+void WaitFarmBatch(FarmWorker *worker, FarmBatch *batch) {
+    FarmRun *run = worker->run;
+
+    // HF.8. With the shared queue the batch can still wait in the submission thread.
+    // Its fence is only waited for after the batch is submitted.
+    if (run->submitter != NULL) {
+        std::unique_lock<std::mutex> lock(run->submitter->mutex);
+        run->submitter->cond.wait(lock, [batch] { return !batch->queued; });
+
+        // FF. The batch was dropped after a failure, its fence is never signaled.
+        if (!batch->submitted) {
+            batch->inFlight = false;
+            return;
         }
+    }
 
-        //vkResetFences(device, 1, &fence);
+    if (vkWaitForFences(run->device, 1, &batch->fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("failed to wait for fence!");
     }
 
-    // A.10. Submit the recorded Command Buffer to the Queue.
+    // HF.8.1. Consume the captures before the fence is reset, the readback ring polls the same fence.
+    for (ReadbackSlot *slot = PollReadback(run->device, &worker->readbackRing); slot != NULL;
+         slot = PollReadback(run->device, &worker->readbackRing)) {
+        worker->lastCapture.assign(slot->data, slot->data + worker->readbackRing.size);
+        worker->captures++;
+        ReleaseReadback(slot);
+    }
+
+    vkResetFences(run->device, 1, &batch->fence);
+    worker->renders += batch->renderCount;
+    batch->inFlight = false;
+}
+
+void StartFarmSubmitter(const VkQueue queue, FarmFailure *failure, FarmSubmitter *submitter) {
+    submitter->queue = queue;
+    submitter->pending.clear();
+    submitter->done = false;
+    submitter->submits = 0;
+    submitter->failure = failure;
+    submitter->thread = std::thread(FarmSubmitterMain, submitter);
+}
+
+void QueueFarmBatch(FarmSubmitter *submitter, FarmBatch *batch) {
     {
-        VkSubmitInfo submitInfo;
+        std::lock_guard<std::mutex> lock(submitter->mutex);
+        batch->queued = true;
+        submitter->pending.push_back(batch);
+    }
+    // The workers wait on the same condition variable, so every waiter is woken up.
+    submitter->cond.notify_all();
+}
+
+void StopFarmSubmitter(FarmSubmitter *submitter) {
+    {
+        std::lock_guard<std::mutex> lock(submitter->mutex);
+        submitter->done = true;
+    }
+    submitter->cond.notify_all();
+    submitter->thread.join();
+}
+
+void FarmSubmitterMain(FarmSubmitter *submitter) {
+    while (true) {
+        FarmBatch *batch;
         {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+            std::unique_lock<std::mutex> lock(submitter->mutex);
+            submitter->cond.wait(lock, [submitter] { return !submitter->pending.empty() || submitter->done; });
+
+            if (submitter->pending.empty()) {
+                break;
+            }
+
+            batch = submitter->pending.front();
+            submitter->pending.pop_front();
         }
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        // HF.9. Only this thread uses the queue, so the submit does not hold the lock.
+        // FF. After a failure the thread keeps running, the batches are handed back unsubmitted,
+        // so no worker waits for them forever.
+        bool submitted = false;
+        if (!submitter->failure->failed.load()) {
+            try {
+                if (vkQueueSubmit(submitter->queue, batch->renderCount, batch->submitInfos.data(), batch->fence) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to submit command buffer!");
+                }
+                submitted = true;
+            } catch (...) {
+                RecordFarmFailure(submitter->failure);
+            }
         }
-    }
 
-    // A.11. Wait the submitted Command Buffer to finish.
-    {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
+        {
+            std::lock_guard<std::mutex> lock(submitter->mutex);
+            batch->queued = false;
+            batch->submitted = submitted;
+            submitter->submits += submitted ? 1 : 0;
         }
+        submitter->cond.notify_all();
     }
+}
 
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
+void PrintFarmResults(const std::vector<FarmRun>& runs,
+                      const std::vector<FarmDevice>& farmDevices,
+                      const std::vector<FarmWorker>& workers,
+                      double totalSeconds) {
+    uint64_t renders = 0;
+    uint64_t captures = 0;
+    std::vector<uint64_t> deviceRenders(farmDevices.size(), 0);
+    std::vector<uint32_t> deviceWorkers(farmDevices.size(), 0);
+    for (size_t idx = 0; idx < workers.size(); idx++) {
+        renders += workers[idx].renders;
+        captures += workers[idx].captures;
+        deviceRenders[workers[idx].deviceIdx] += workers[idx].renders;
+        deviceWorkers[workers[idx].deviceIdx]++;
+    }
 
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+    bool sharedQueue = false;
+    for (size_t idx = 0; idx < runs.size(); idx++) {
+        sharedQueue = sharedQueue || (runs[idx].submitter != NULL);
+    }
+
+    // HF.10. One line per run, so the scaling over the worker counts and sizes can be compared.
+    const VkExtent2D extent = runs[0].extent;
+    const double captureBytes = (double)captures * extent.width * extent.height * 4;
+    printf("Farm: %zu workers (%s), %ux%u: %llu renders in %.3f s, %.1f renders/s, %llu captures, readback %.1f MB/s\n",
+           workers.size(), (sharedQueue ? "shared queue" : "own queues"), extent.width, extent.height,
+           (unsigned long long)renders, totalSeconds, (totalSeconds > 0.0) ? renders / totalSeconds : 0.0,
+           (unsigned long long)captures, (totalSeconds > 0.0) ? captureBytes / (1024.0 * 1024.0) / totalSeconds : 0.0);
+
+    // MG.2. The share of each device in the aggregate throughput above.
+    if (farmDevices.size() > 1) {
+        for (size_t idx = 0; idx < farmDevices.size(); idx++) {
+            printf("Farm:   device [%zu] %s: %u workers, %llu renders, %.1f renders/s\n",
+                   idx, farmDevices[idx].name.c_str(), deviceWorkers[idx], (unsigned long long)deviceRenders[idx],
+                   (totalSeconds > 0.0) ? deviceRenders[idx] / totalSeconds : 0.0);
+        }
+    }
 }
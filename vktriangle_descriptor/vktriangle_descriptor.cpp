@@ -12,16 +12,51 @@
  * Re-Compile shaders (optional):
  * $ glslangValidator -V passthrough.vert -o passthrough.vert.spv
  * $ glslangValidator -V passthrough.frag -o passthrough.frag.spv
+ * $ glslangValidator -V attributes.vert -o attributes.vert.spv
+ * $ glslangValidator -V postprocess.comp -o postprocess.comp.spv
  *
  * Compile with shaderc:
  * $ g++ vktriangle_descriptor.cpp -o triangle_descriptor -lvulkan -lglfw -lshaderc_shared -std=c++11 -DHAVE_SHADERC=1
  *
- * Run: the "passthrough.{vert,frag}*" files must be in the same dir.
+ * Run: the "passthrough.{vert,frag}*" (and for DEMO_POST_PROCESS the "postprocess.comp*", for DEMO_VERTEX_LAYOUT
+ *   the "attributes.vert*") files must be in the same dir.
  * $ ./triangle_descriptor
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_FORCE_STAGING: Upload the vertex buffer with a staging copy (1) even if device local memory
+ *   is also host visible (ReBAR/UMA). Default: 0
+ * DEMO_BENCH: Render N frames offscreen (without presenting) with GPU timestamp and CPU timing, then exit.
+ *   Unset or 0 disables it. Default: 0
+ * DEMO_PRESENT_MODE: fifo, fifo_relaxed, mailbox or immediate, an unsupported mode falls back to fifo. Default: fifo
+ * DEMO_FRAMES_IN_FLIGHT: Number of frames the CPU can record ahead of the GPU. Default: 2
+ * DEMO_SWAPCHAIN_IMAGES: Requested swapchain image count, clamped to the surface limits. Default: minImageCount + 1
+ * DEMO_MAX_FPS: Frame rate limit of the draw loop, 0 disables it. Default: 6 (avoids fast flashing frames),
+ *   0 with DEMO_CAPTURE_FRAMES so the stream is captured at the full frame rate
+ * DEMO_LATENCY_LOG: Log the acquire->present latency of every frame (1), otherwise only a summary at exit. Default: 0
+ * DEMO_COMMAND_STRATEGY: prerecorded (one Command Buffer per swapchain image, recorded once) or per_frame
+ *   (re-recorded every frame from a Command Pool per frame in flight, reset with vkResetCommandPool). Default: prerecorded
+ * DEMO_POST_PROCESS: off, serial or async. Inverts the rendered image with a compute shader, either on the graphics
+ *   queue after the draw (serial) or on a separate compute queue overlapping the next frame (async). Default: off
+ *   Example: compare the FPS of DEMO_BENCH=2000 DEMO_POST_PROCESS=serial and DEMO_BENCH=2000 DEMO_POST_PROCESS=async
+ * DEMO_TRACE: Record the draw loop zones and the GPU time of the frames, then write them as a Chrome trace
+ *   into the given JSON file at exit (chrome://tracing or ui.perfetto.dev). Default: unset (disabled)
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_VERTEX_LAYOUT: Vertex buffer layout: "position" (vec2 only), "aos" (interleaved float position, color,
+ *   UV and normal), "soa" (one binding per attribute) or "packed" (half float, RGBA8 and A2B10G10R10).
+ *   The benchmark mode reports the vertex fetch bandwidth. Default: position
+ * DEMO_CAPTURE_FRAMES: Enables the streaming capture of N frames, 0 captures until the window is closed. Default: unset (disabled)
+ * DEMO_CAPTURE_EVERY: Capture only every Nth frame. Default: 1
+ * DEMO_CAPTURE_FORMAT: ppm (numbered files), y4m or rgba (raw stream on stdout, logs go to stderr). Default: ppm
+ * DEMO_CAPTURE_OUTPUT: printf style file name pattern of the PPM sequence. Default: frame_%05u.ppm
+ *   Example: DEMO_CAPTURE_FRAMES=300 DEMO_CAPTURE_FORMAT=y4m ./<demo> | ffmpeg -i - out.mp4
  *
  * Dependencies:
  *  * C++11
@@ -35,6 +70,7 @@
  * Includes:
  *  * Validation layer enable.
  *  * PPM image output.
+ *  * Swapchain re-creation on window resize.
  *
  * Excludes:
  *  * No swapchain.
@@ -61,23 +97,30 @@
  * OFTWARE.
  */
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <future>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
 #include <GLFW/glfw3.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
@@ -87,43 +130,289 @@ const std::vector<const char*> g_swapchainDeviceExtension = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+// Compute post-process of the DEMO_POST_PROCESS mode.
+// The triangle is rendered into a scene image, the postprocess.comp filter writes the inverted colors
+// into an output image which is blitted into the Swapchain (or benchmark) image.
+enum PostProcessMode {
+    POST_PROCESS_OFF,
+    // The filter and the blit are submitted after the draw commands on the graphics queue.
+    POST_PROCESS_SERIAL,
+    // The filter runs on a separate compute queue, so it can overlap with the rendering of the next frame.
+    POST_PROCESS_ASYNC,
+};
+
+// The Swapchain formats (ex.: sRGB) usually can't be used as storage images.
+static const VkFormat g_postProcessFormat = VK_FORMAT_R8G8B8A8_UNORM;
+// Must match the "local_size" of the postprocess.comp shader.
+static const uint32_t g_postProcessGroupSize = 16;
+
+// Images and pre-recorded Command Buffers of a single Swapchain image.
+struct PostProcessTarget {
+    VkImage sceneImage;
+    VkImageView sceneView;
+    ArenaAllocation sceneMemory;
+    VkImage outputImage;
+    VkImageView outputView;
+    ArenaAllocation outputMemory;
+    VkDescriptorSet descriptorSet;
+    // Filter commands, allocated from the compute queue family.
+    VkCommandBuffer filterCmdBuffer;
+    // Blit of the output image into the Swapchain image, allocated from the graphics queue family.
+    VkCommandBuffer blitCmdBuffer;
+};
 
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
+struct PostProcess {
+    PostProcessMode mode;
+    uint32_t graphicsQueueFamilyIdx;
+    uint32_t computeQueueFamilyIdx;
+    VkQueue computeQueue;
+    // The queue families are different, the scene and output images change ownership between them.
+    bool ownershipTransfer;
+    VkShaderModule shaderModule;
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    VkCommandPool filterCmdPool;
+    VkCommandPool blitCmdPool;
+    // Holds the Descriptor Sets of the targets.
+    VkDescriptorPool descriptorPool;
+    std::vector<PostProcessTarget> targets;
+    // Async mode only: render->filter and filter->blit semaphores of each frame in flight.
+    std::vector<VkSemaphore> sceneReadySemaphores;
+    std::vector<VkSemaphore> filterDoneSemaphores;
+};
 
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
+static PostProcessMode ParsePostProcessMode(const char *name);
+static const char *PostProcessModeName(PostProcessMode mode);
+static uint32_t FindComputeQueueFamily(const VkPhysicalDevice device,
+                                       uint32_t graphicsQueueFamilyIdx,
+                                       uint32_t *outQueueIdx,
+                                       bool *hasIdx);
+static void CreatePostProcess(const VkPhysicalDevice physicalDevice,
+                              const VkDevice device,
+                              const VkPipelineCache pipelineCache,
+                              VkFormat swapFormat,
+                              uint32_t slotCount,
+                              PostProcess *postProcess);
+static void DestroyPostProcess(const VkDevice device, MemoryArena *arena, PostProcess *postProcess);
+// SC. The targets are size dependent, they are re-created with the Swapchain.
+static void CreatePostProcessTargets(const VkDevice device,
+                                     MemoryArena *arena,
+                                     const std::vector<VkImage>& swapImages,
+                                     VkImageLayout swapLayout,
+                                     uint32_t width,
+                                     uint32_t height,
+                                     PostProcess *postProcess);
+static void DestroyPostProcessTargets(const VkDevice device, MemoryArena *arena, PostProcess *postProcess);
+static void RecordSceneRelease(const PostProcess& postProcess, const VkCommandBuffer cmdBuffer, uint32_t targetIdx);
+static void SubmitAsyncPostProcess(const PostProcess& postProcess,
                                    const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
+                                   const VkCommandBuffer *renderCmdBuffers,
+                                   uint32_t renderCmdBufferCount,
+                                   const VkCommandBuffer *blitCmdBuffers,
+                                   uint32_t blitCmdBufferCount,
+                                   uint32_t targetIdx,
+                                   uint32_t slot,
+                                   const VkSemaphore waitSemaphore,
+                                   const VkSemaphore signalSemaphore,
+                                   const VkFence fence);
+
+// D. Uniform Buffer split into one dynamic offset slice for each Swapchain image.
+struct UniformSlices {
+    VkBuffer buffer;
+    ArenaAllocation memory;
+    // The arena keeps the host visible memory mapped for the whole lifetime of the buffer.
+    uint8_t *mapped;
+    uint32_t count;
+};
+
+static void CreateUniformSlices(const VkPhysicalDevice physicalDevice,
+                                const VkDevice device,
+                                MemoryArena *arena,
+                                const VkDescriptorSet descriptorSet,
+                                VkDeviceSize dataSize,
+                                VkDeviceSize sliceSize,
+                                uint32_t count,
+                                UniformSlices *outSlices);
+static void DestroyUniformSlices(const VkDevice device, MemoryArena *arena, UniformSlices *slices);
+
+static void CreateFramebuffers(const VkDevice device,
+                               const VkRenderPass renderPass,
+                               VkFormat format,
+                               VkExtent2D extent,
+                               const std::vector<VkImage>& images,
+                               const PostProcess& postProcess,
+                               std::vector<VkImageView> *outImageViews,
+                               std::vector<VkFramebuffer> *outFramebuffers);
+static void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers);
+static void RecordDrawCommands(const VkDevice device,
+                               const VkCommandPool cmdPool,
+                               const VkRenderPass renderPass,
+                               const VkPipeline pipeline,
+                               const VkPipelineLayout pipelineLayout,
+                               const VkDescriptorSet descriptorSet,
+                               VkDeviceSize uniformSliceSize,
+                               const VkBuffer vertexBuffer,
+                               const VertexLayoutData& vertexLayout,
+                               const std::vector<VkFramebuffer>& framebuffers,
+                               const PostProcess& postProcess,
+                               VkExtent2D extent,
+                               std::vector<VkCommandBuffer> *outCmdBuffers);
+// Record the draw commands of a single frame into "cmdBuffer", "imageIdx" selects the Uniform Buffer slice
+// and the post-process target of the Swapchain image.
+static void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                                VkCommandBufferUsageFlags usageFlags,
+                                const VkRenderPass renderPass,
+                                const VkPipeline pipeline,
+                                const VkPipelineLayout pipelineLayout,
+                                const VkDescriptorSet descriptorSet,
+                                VkDeviceSize uniformSliceSize,
+                                const VkBuffer vertexBuffer,
+                                const VertexLayoutData& vertexLayout,
+                                const VkFramebuffer framebuffer,
+                                const PostProcess& postProcess,
+                                VkExtent2D extent,
+                                uint32_t imageIdx);
 
 int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envPresentMode = getenv("DEMO_PRESENT_MODE");
+    const char *envFramesInFlight = getenv("DEMO_FRAMES_IN_FLIGHT");
+    const char *envSwapchainImages = getenv("DEMO_SWAPCHAIN_IMAGES");
+    const char *envMaxFps = getenv("DEMO_MAX_FPS");
+    const char *envLatencyLog = getenv("DEMO_LATENCY_LOG");
+    const char *envCommandStrategy = getenv("DEMO_COMMAND_STRATEGY");
+    const char *envBench = getenv("DEMO_BENCH");
+    const char *envForceStaging = getenv("DEMO_FORCE_STAGING");
+    const char *envVertexLayout = getenv("DEMO_VERTEX_LAYOUT");
+    const char *envCaptureFrames = getenv("DEMO_CAPTURE_FRAMES");
+    const char *envCaptureEvery = getenv("DEMO_CAPTURE_EVERY");
+    const char *envCaptureFormat = getenv("DEMO_CAPTURE_FORMAT");
+    const char *envCaptureOutput = getenv("DEMO_CAPTURE_OUTPUT");
+    const char *envPostProcess = getenv("DEMO_POST_PROCESS");
+    const char *envTrace = getenv("DEMO_TRACE");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    bool latencyLog = ((envLatencyLog != NULL) && (strncmp("1", envLatencyLog, 2) == 0));
+    uint32_t benchFrames = (envBench != NULL) ? (uint32_t)strtoul(envBench, NULL, 10) : 0;
+    bool forceStaging = ((envForceStaging != NULL) && (strncmp("1", envForceStaging, 2) == 0));
+    VertexLayout vertexLayoutMode = VERTEX_LAYOUT_POSITION;
+    if (envVertexLayout != NULL) {
+        vertexLayoutMode = ParseVertexLayout(envVertexLayout);
+    }
+    CommandStrategy commandStrategy = COMMAND_STRATEGY_PRERECORDED;
+    if (envCommandStrategy != NULL) {
+        commandStrategy = ParseCommandStrategy(envCommandStrategy);
+    }
+
+    // TC. Start the trace clock, the main thread is the first traced thread.
+    InitTracer((envTrace != NULL) && (envTrace[0] != '\0'));
+    TraceRegisterThread("main");
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
+    // FP. Configure the presentation and the frame pacing.
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (envPresentMode != NULL) {
+        requestedPresentMode = ParsePresentMode(envPresentMode);
+    }
+
+    uint32_t framesInFlight = 2;
+    if ((envFramesInFlight != NULL) && (atoi(envFramesInFlight) > 0)) {
+        framesInFlight = atoi(envFramesInFlight);
+    }
+
+    uint32_t requestedSwapchainImages = 0;
+    if ((envSwapchainImages != NULL) && (atoi(envSwapchainImages) > 0)) {
+        requestedSwapchainImages = atoi(envSwapchainImages);
+    }
+
+    // FP. The streaming capture is not limited by default, the captured frames are not shown to anyone.
+    double maxFps = (envCaptureFrames != NULL) ? 0 : 6;
+    if (envMaxFps != NULL) {
+        maxFps = atof(envMaxFps);
+    }
+
+    // C.0. Configure the streaming capture.
+    bool captureEnabled = (envCaptureFrames != NULL);
+
+    // PP. Configure the compute post-process.
+    PostProcess postProcess;
+    postProcess.mode = POST_PROCESS_OFF;
+    if (envPostProcess != NULL) {
+        postProcess.mode = ParsePostProcessMode(envPostProcess);
+    }
+    uint32_t captureFrameCount = captureEnabled ? (uint32_t)strtoul(envCaptureFrames, NULL, 10) : 0;
+    uint32_t captureEvery = 1;
+    if ((envCaptureEvery != NULL) && (atoi(envCaptureEvery) > 0)) {
+        captureEvery = atoi(envCaptureEvery);
+    }
+
+    CaptureFormat captureFormat = CAPTURE_FORMAT_PPM;
+    if (envCaptureFormat != NULL) {
+        if (strcmp(envCaptureFormat, "y4m") == 0) {
+            captureFormat = CAPTURE_FORMAT_Y4M;
+        } else if (strcmp(envCaptureFormat, "rgba") == 0) {
+            captureFormat = CAPTURE_FORMAT_RGBA;
+        } else if (strcmp(envCaptureFormat, "ppm") != 0) {
+            throw std::runtime_error("unknown capture format!");
+        }
+    }
+
+    const char *captureOutputPattern = "frame_%05u.ppm";
+    if (envCaptureOutput != NULL) {
+        captureOutputPattern = envCaptureOutput;
+    }
+
+    // The Y4M and RGBA streams take over stdout, every other message is redirected to stderr.
+    FILE *captureStream = NULL;
+    if (captureEnabled && (captureFormat != CAPTURE_FORMAT_PPM)) {
+        fflush(stdout);
+        captureStream = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Vertex layout: %s\n", VertexLayoutName(vertexLayoutMode));
+    printf("Command strategy: %s\n", (commandStrategy == COMMAND_STRATEGY_PER_FRAME) ? "per_frame" : "prerecorded");
+    if (benchFrames > 0) {
+        printf("Bench: %u frames, offscreen\n", benchFrames);
+    }
+    if (captureEnabled) {
+        static const char *captureFormatNames[] = { "ppm", "y4m", "rgba" };
+        printf("Capture: %s, every %u. frame, %u frames (0: until exit)\n",
+               captureFormatNames[captureFormat], captureEvery, captureFrameCount);
+    }
+
+    // ST.1. Start loading (or compiling) the shaders on worker threads.
+    // This runs in parallel with the Instance/Device creation, the results are only
+    // waited for at the Shader Module creation (on the Pipeline worker thread, PS.1).
+    // VL.2. The attribute layouts use the shader variant with the color, UV and normal inputs.
+    const std::string vertName = (vertexLayoutMode != VERTEX_LAYOUT_POSITION) ? "attributes.vert" : "passthrough.vert";
+    std::future<std::vector<uint32_t> > vertShaderLoad = LoadShaderAsync(vertName);
+    std::future<std::vector<uint32_t> > fragShaderLoad = LoadShaderAsync("passthrough.frag");
 
     // G.0. Initialize GLFW.
     {
@@ -136,12 +425,20 @@ int main(int argc, char **argv) {
     uint32_t windowWidth = 512;
     uint32_t windowHeight = 512;
     GLFWwindow* window;
+    bool framebufferResized = false;
     {
         // With GLFW_CLIENT_API set to GLFW_NO_API there will be no OpenGL (ES) context.
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        // SC. The window can be resized, except for the benchmark and the streaming capture (fixed frame size).
+        glfwWindowHint(GLFW_RESIZABLE, ((benchFrames == 0) && !captureEnabled) ? GLFW_TRUE : GLFW_FALSE);
+        // BN. The benchmark does not present, the window is only required for the surface.
+        glfwWindowHint(GLFW_VISIBLE, (benchFrames > 0) ? GLFW_FALSE : GLFW_TRUE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, "vktriangle GLFW", NULL, NULL);
+
+        // SC. Track the framebuffer size changes of the window.
+        glfwSetWindowUserPointer(window, &framebufferResized);
+        glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
     }
 
     // 1. Create Vulkan Instance.
@@ -211,7 +508,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
     {
         // 2.1 Query the number of physical devices.
@@ -227,19 +524,64 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, surface, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, surface, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((physicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 physicalDevice = device;
-                break;
+                graphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
+    }
+
+    // PP.1. Select the queue of the post-process filter.
+    // The serial mode records the filter for the graphics queue family.
+    uint32_t computeQueueIdx = 0;
+    postProcess.graphicsQueueFamilyIdx = graphicsQueueFamilyIdx;
+    postProcess.computeQueueFamilyIdx = graphicsQueueFamilyIdx;
+    if (postProcess.mode == POST_PROCESS_ASYNC) {
+        bool hasComputeIdx = false;
+        const uint32_t computeFamilyIdx = FindComputeQueueFamily(physicalDevice, graphicsQueueFamilyIdx, &computeQueueIdx, &hasComputeIdx);
+        if (hasComputeIdx) {
+            postProcess.computeQueueFamilyIdx = computeFamilyIdx;
+        } else {
+            printf("Post-process: no compute queue family for the async mode, falling back to serial\n");
+            postProcess.mode = POST_PROCESS_SERIAL;
+            computeQueueIdx = 0;
+        }
+    }
+
+    // PP.1.4. The serial mode records the filter into the graphics command buffers,
+    // so it also needs compute support on the graphics family.
+    if (postProcess.mode == POST_PROCESS_SERIAL) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        if (!(queueFamilies[graphicsQueueFamilyIdx].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            printf("Post-process: the graphics queue family has no compute support, the post-process is disabled\n");
+            postProcess.mode = POST_PROCESS_OFF;
+        }
     }
 
     // 3. Create a logical Vulkan Device.
@@ -248,15 +590,25 @@ int main(int argc, char **argv) {
     VkDevice device;
     {
         // 3.1. Build the device queue create info data (use only a singe queue).
-        float queuePriority = 1.0f;
-        VkDeviceQueueCreateInfo queueCreateInfo;
+        // PP. The async post-process adds a queue of the compute family, or a second queue of the graphics family.
+        float queuePriorities[] = { 1.0f, 1.0f };
+        VkDeviceQueueCreateInfo queueCreateInfos[2];
+        uint32_t queueCreateInfoCount = 1;
         {
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.pNext = NULL;
-            queueCreateInfo.flags = 0;
-            queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfos[0].pNext = NULL;
+            queueCreateInfos[0].flags = 0;
+            queueCreateInfos[0].queueFamilyIndex = graphicsQueueFamilyIdx;
+            queueCreateInfos[0].queueCount = 1;
+            queueCreateInfos[0].pQueuePriorities = queuePriorities;
+        }
+
+        if (postProcess.computeQueueFamilyIdx != graphicsQueueFamilyIdx) {
+            queueCreateInfos[1] = queueCreateInfos[0];
+            queueCreateInfos[1].queueFamilyIndex = postProcess.computeQueueFamilyIdx;
+            queueCreateInfoCount = 2;
+        } else {
+            queueCreateInfos[0].queueCount = computeQueueIdx + 1;
         }
 
         // 3.2. The queue family/families must be provided to allow the device to use them.
@@ -270,8 +622,8 @@ int main(int argc, char **argv) {
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             createInfo.pNext = NULL;
             createInfo.flags = 0;
-            createInfo.queueCreateInfoCount = 1;
-            createInfo.pQueueCreateInfos = &queueCreateInfo;
+            createInfo.queueCreateInfoCount = queueCreateInfoCount;
+            createInfo.pQueueCreateInfos = queueCreateInfos;
             createInfo.pEnabledFeatures = NULL;
             // G.4. Specify the swapchain extension when creating a VkDevice.
             createInfo.enabledExtensionCount = (uint32_t)g_swapchainDeviceExtension.size();
@@ -298,26 +650,23 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // PP. Get the queue of the filter, the serial mode submits everything to the graphics queue.
+    postProcess.computeQueue = queue;
+    if (postProcess.mode == POST_PROCESS_ASYNC) {
+        vkGetDeviceQueue(device, postProcess.computeQueueFamilyIdx, computeQueueIdx, &postProcess.computeQueue);
+    }
+
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // G.5. Create the Swapchain.
     // Creating a correct Swapchain requires querying a few things.
     // Like: surface format, max/min size, presentation mode.
-    VkSurfaceFormatKHR surfaceFormat;
-    // By standard the FIFO presentation mode should always be available.
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    VkExtent2D swapExtent = { windowWidth, windowHeight };
-
-    VkSwapchainKHR swapchain;
+    // SC. Everything except the size is stored in the config, the same values are used when the Swapchain is re-created.
+    SwapchainConfig swapchainConfig;
     {
-        // G.5.1. Query the surface capabilities and select the swapchain's extent (width, height).
-        VkSurfaceCapabilitiesKHR surfaceCapabilities;
-        {
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
-
-            if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
-                swapExtent = surfaceCapabilities.currentExtent;
-            }
-        }
-
         // G.5.2. Select a surface format.
         {
             uint32_t formatCount;
@@ -329,101 +678,25 @@ int main(int argc, char **argv) {
 
             for (VkSurfaceFormatKHR &entry : surfaceFormats) {
                 if ((entry.format == VK_FORMAT_B8G8R8A8_SRGB) && (entry.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)) {
-                    surfaceFormat = entry;
+                    swapchainConfig.surfaceFormat = entry;
                     break;
                 }
             }
         }
 
-        // G.5.3. TODO: Select a presentation mode, if the FIFO is not good.
-        /*
-        {
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, NULL);
-
-            std::vector<VkPresentModeKHR> presentModes;
-            presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
-        }
-        */
-
-        // G.5.4. Specify the number of images in the swap chain.
-        // For better performance using "min + 1";
-        uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
-        VkSwapchainCreateInfoKHR createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.surface = surface;
-            createInfo.minImageCount = imageCount;
-            createInfo.imageFormat = surfaceFormat.format;
-            createInfo.imageColorSpace = surfaceFormat.colorSpace;
-            createInfo.imageExtent = swapExtent;
-            createInfo.imageArrayLayers = 1;
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-            // If the graphics and presentation queue is different this should not be exclusive.
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = NULL;
-            createInfo.preTransform = surfaceCapabilities.currentTransform;
-            createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-            createInfo.presentMode = swapchainPresentMode;
-            createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
-        }
-
-        if (vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
+        swapchainConfig.requestedPresentMode = requestedPresentMode;
+        swapchainConfig.requestedImageCount = requestedSwapchainImages;
+        swapchainConfig.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        // PP. The post-process blits the filtered image into the Swapchain images.
+        if (postProcess.mode != POST_PROCESS_OFF) {
+            swapchainConfig.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
         }
     }
 
-    // G.6. Get the Swapchain images.
-    std::vector<VkImage> swapImages;
-    {
-        uint32_t imageCount;
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, NULL);
-        swapImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapImages.data());
-    }
-
-    // Old 5. and 6. steps are removed.
-    // The Swapchain creation takes care of the render target image creation.
-    uint32_t renderImageWidth = swapExtent.width;
-    uint32_t renderImageHeight = swapExtent.height;
-
-    // G.7. Create Image Views for the Swapchain Images.
-    // This replaces the old 7. step.
-    std::vector<VkImageView> swapImageViews;
-    swapImageViews.resize(swapImages.size());
-    {
-        VkImageViewCreateInfo createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            //createInfo.image = renderImage;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = surfaceFormat.format;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
-        }
-
-        for (size_t idx = 0; idx < swapImages.size(); idx++) {
-            createInfo.image = swapImages[idx];
+    const VkSurfaceFormatKHR surfaceFormat = swapchainConfig.surfaceFormat;
 
-            if (vkCreateImageView(device, &createInfo, NULL, &swapImageViews[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
-        }
-    }
+    // Layout of the rendered images after the Render Pass.
+    const VkImageLayout targetLayout = (benchFrames > 0) ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     // V.0. Prepare the Vertex Coordinates.
     std::vector<float> vertexCoordinates = {
@@ -432,87 +705,9 @@ int main(int argc, char **argv) {
         -0.5,  0.5
     };
 
-    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
-    // This buffer will hold the Vertex coordinates in a vec2 like format.
-    VkBuffer vertexBuffer;
-    {
-        VkBufferCreateInfo bufferInfo;
-        {
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            bufferInfo.pNext = NULL;
-            bufferInfo.flags = 0;
-            bufferInfo.size = sizeof(float) * vertexCoordinates.size();
-            // The buffer will be used as a Vertex Input attribute.
-            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            bufferInfo.queueFamilyIndexCount = 0;
-            bufferInfo.pQueueFamilyIndices = NULL;
-        }
-
-        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create vertex buffer!");
-        }
-    }
-
-    // V.2. Allocate and bind the memory for the Vertex Buffer.
-    // For each Buffer a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory vertexBufferMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, vertexBuffer, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &vertexBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the Vertex buffer with the allocated memory.
-        vkBindBufferMemory(device, vertexBuffer, vertexBufferMemory, 0);
-    }
-
-    // V.3. Upload the Vertex Buffer data.
-    {
-        // V.3.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map vertex buffer!");
-        }
-
-        // V.3.2. Copy data into the "data".
-        ::memcpy(data, vertexCoordinates.data(), sizeof(float) * vertexCoordinates.size());
-
-        // V.3.3. Flush the data.
-        // This is required as a non-coherent buffer was created.
-        VkMappedMemoryRange memoryRange;
-        {
-            memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            memoryRange.pNext = NULL;
-            memoryRange.memory = vertexBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
-        }
-        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-        // V.3.4. Unmap the mapped vertex buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, vertexBufferMemory);
-    }
+    // VL.1. Build the buffer content of the selected vertex layout.
+    VertexLayoutData vertexLayout;
+    BuildVertexLayout(physicalDevice, vertexLayoutMode, vertexCoordinates, &vertexLayout);
 
     // 8. Create a Render Pass.
     // A Render Pass is required to use vkCmdDraw* commands.
@@ -521,7 +716,8 @@ int main(int argc, char **argv) {
         VkAttachmentDescription colorAttachment;
         {
             colorAttachment.flags = 0;
-            colorAttachment.format = surfaceFormat.format;
+            // PP. The post-process renders into its own scene images.
+            colorAttachment.format = (postProcess.mode != POST_PROCESS_OFF) ? g_postProcessFormat : surfaceFormat.format;
             colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
             colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
             colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -529,7 +725,9 @@ int main(int argc, char **argv) {
             colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
             // G.XX. To present an image to a surface the layout should be in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR.
-            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            // BN. The offscreen images of the benchmark are only read back, see "targetLayout".
+            // PP. The scene image is moved to the filter by the barrier after the Render Pass, see "RecordSceneRelease".
+            colorAttachment.finalLayout = (postProcess.mode != POST_PROCESS_OFF) ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : targetLayout;
         }
 
         VkAttachmentReference colorAttachmentRef;
@@ -570,71 +768,6 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 9. Create Vertex shader.
-    VkShaderModule vertShaderModule;
-    {
-        // 9.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> vertSrc = LoadGLSL("passthrough.vert");
-        std::vector<uint32_t> vertCode = CompileGLSL(shaderc_vertex_shader, vertSrc);
-        #else
-        std::vector<uint32_t> vertCode = LoadSPIRV("passthrough.vert.spv");
-        #endif
-
-        if (vertCode.size() == 0) {
-            throw std::runtime_error("failed to load vertex shader!");
-        }
-
-        // 9.2. Specify the vertex shader module information.
-        // Notes:
-        // * "codeSize" is in bytes.
-        // * "pCode" points to an array of SPIR-V opcodes.
-        VkShaderModuleCreateInfo vertInfo;
-        {
-            vertInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            vertInfo.pNext = NULL;
-            vertInfo.flags = 0;
-            vertInfo.codeSize = vertCode.size() * sizeof(uint32_t);
-            vertInfo.pCode = reinterpret_cast<uint32_t*>(vertCode.data());
-        }
-
-        // 9.3. Create the Vertex Shader Module.
-        if (vkCreateShaderModule(device, &vertInfo, NULL, &vertShaderModule) != VK_SUCCESS) {
-           throw std::runtime_error("failed to create shader module!");
-        }
-    }
-
-    // 10. Create Fragment shader.
-    VkShaderModule fragShaderModule;
-    {
-        // 10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> fragSrc = LoadGLSL("passthrough.frag");
-        std::vector<uint32_t> fragCode = CompileGLSL(shaderc_fragment_shader, fragSrc);
-        #else
-        std::vector<uint32_t> fragCode = LoadSPIRV("passthrough.frag.spv");
-        #endif
-
-        if (fragCode.size() == 0) {
-            throw std::runtime_error("failed to load fragment shader!");
-        }
-
-        // 10.2. Specify the fragment shader module information.
-        VkShaderModuleCreateInfo fragInfo;
-        {
-            fragInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            fragInfo.pNext = NULL;
-            fragInfo.flags = 0;
-            fragInfo.codeSize = fragCode.size() * sizeof(uint32_t);
-            fragInfo.pCode = reinterpret_cast<uint32_t*>(fragCode.data());
-        }
-
-        // 10.3. Create the Fragment Shader Module.
-        if (vkCreateShaderModule(device, &fragInfo, NULL, &fragShaderModule) != VK_SUCCESS) {
-           throw std::runtime_error("failed to create shader module!");
-        }
-    }
-
     // D.1. Create a Descriptor Set Layout (aka layout on shader uniforms).
     VkDescriptorSetLayout descriptorSetLayout;
     {
@@ -642,7 +775,7 @@ int main(int argc, char **argv) {
         {
             {
                 0,                                                          // binding
-                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,                          // descriptorType
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,                  // descriptorType
                 1,                                                          // descriptorCount
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,  // stageFlags
                 NULL                                                        // pImmutableSamplers
@@ -663,525 +796,1378 @@ int main(int argc, char **argv) {
         }
     }
 
-    // D.2. Create the Descriptor Pool.
-    // A Descriptor Pool is a "storage" for Descriptor to allocate from.
-    VkDescriptorPool descriptorPool;
+    // 11. Create Pipeline Layout.
+    // Currently there are no descriptors added (no uniforms).
+    VkPipelineLayout pipelineLayout;
     {
-        // D.2.1. Define size for single Uniform Buffer.
-        VkDescriptorPoolSize poolSizes[] =
-        {
-            {
-                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, // type
-                1,                                 // descriptorCount
-            }
-        };
-
-        VkDescriptorPoolCreateInfo poolInfo;
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo;
         {
-            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolInfo.pNext = NULL;
-            poolInfo.flags = 0;     // VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT ??
-            poolInfo.maxSets = 1;
-            poolInfo.poolSizeCount = 1;
-            poolInfo.pPoolSizes = poolSizes;
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.pNext = NULL;
+            pipelineLayoutInfo.flags = 0;
+            // D.X. Connect the created Desctiptor Set Layout to the pipeline layout.
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 0;
         }
 
-        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
         }
     }
 
-    // D.3. Allocate a Descriptor Set from the Descriptor Pool.
-    VkDescriptorSet descriptorSet;
-    {
-        VkDescriptorSetAllocateInfo allocInfo;
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, pipelineCacheFileName, &pipelineCacheHit);
+
+    // PS.1. Create the Pipeline on a worker thread while the Swapchain and the buffers are created.
+    // The Pipeline does not depend on the Swapchain: the viewport and scissor are dynamic and the
+    // Render Pass only needs the surface format. The shader loads (ST.1) are waited for on the worker.
+    std::future<VkPipeline> pipelineBuild = std::async(std::launch::async, [&]() -> VkPipeline {
+        // 9. Create Vertex shader.
+        VkShaderModule vertShaderModule;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.descriptorPool = descriptorPool;
-            allocInfo.descriptorSetCount = 1;
-            allocInfo.pSetLayouts = &descriptorSetLayout;
-        }
+            // 9.1. Wait for the vertex shader loaded (or compiled) by the worker thread (ST.1).
+            std::vector<uint32_t> vertCode = vertShaderLoad.get();
 
-        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor set!");
-        }
-    }
+            if (vertCode.size() == 0) {
+                throw std::runtime_error("failed to load vertex shader!");
+            }
 
-    // D.X. Uniform Buffer data: color information.
-    std::vector<float> uniformData = {
-        1.0, 0.0, 0.0, 1.0,
-        0.0, 1.0, 0.0, 1.0,
-        0.0, 0.0, 1.0, 1.0
-    };
+            // 9.2. Specify the vertex shader module information.
+            // Notes:
+            // * "codeSize" is in bytes.
+            // * "pCode" points to an array of SPIR-V opcodes.
+            VkShaderModuleCreateInfo vertInfo;
+            {
+                vertInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+                vertInfo.pNext = NULL;
+                vertInfo.flags = 0;
+                vertInfo.codeSize = vertCode.size() * sizeof(uint32_t);
+                vertInfo.pCode = reinterpret_cast<uint32_t*>(vertCode.data());
+            }
 
-    // D.5. Create a Buffer of the Uniform data.
-    VkBuffer uniformBuffer;
-    {
-        VkBufferCreateInfo bufferInfo;
-        {
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            bufferInfo.pNext = NULL;
-            bufferInfo.flags = 0;
-            // Make the buffer vec4 size.
-            bufferInfo.size = sizeof(float) * uniformData.size();
-            // The buffer will be used as an Uniform Buffer.
-            bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            bufferInfo.queueFamilyIndexCount = 0;
-            bufferInfo.pQueueFamilyIndices = NULL;
+            // 9.3. Create the Vertex Shader Module.
+            if (vkCreateShaderModule(device, &vertInfo, NULL, &vertShaderModule) != VK_SUCCESS) {
+               throw std::runtime_error("failed to create shader module!");
+            }
         }
+        // RH. Destroyed when the worker returns, the Pipeline does not reference the module after its creation.
+        ShaderModuleHandle vertShaderOwner(device, vertShaderModule, vkDestroyShaderModule);
 
-        if (vkCreateBuffer(device, &bufferInfo, NULL, &uniformBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create vertex buffer!");
-        }
-    }
+        // 10. Create Fragment shader.
+        VkShaderModule fragShaderModule;
+        {
+            // 10.1. Wait for the fragment shader loaded (or compiled) by the worker thread (ST.1).
+            std::vector<uint32_t> fragCode = fragShaderLoad.get();
 
-    // D.6. Allocate memory for the Uniform Buffer.
-    VkDeviceMemory uniformBufferMemory;
-    {
-        // D.6.1 Query the memory requirments for the buffer.
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, uniformBuffer, &memRequirements);
+            if (fragCode.size() == 0) {
+                throw std::runtime_error("failed to load fragment shader!");
+            }
 
-        // D.6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            // 10.2. Specify the fragment shader module information.
+            VkShaderModuleCreateInfo fragInfo;
+            {
+                fragInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+                fragInfo.pNext = NULL;
+                fragInfo.flags = 0;
+                fragInfo.codeSize = fragCode.size() * sizeof(uint32_t);
+                fragInfo.pCode = reinterpret_cast<uint32_t*>(fragCode.data());
+            }
 
-        // D.6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            // 10.3. Create the Fragment Shader Module.
+            if (vkCreateShaderModule(device, &fragInfo, NULL, &fragShaderModule) != VK_SUCCESS) {
+               throw std::runtime_error("failed to create shader module!");
+            }
         }
+        // RH. Destroyed when the worker returns, the Pipeline does not reference the module after its creation.
+        ShaderModuleHandle fragShaderOwner(device, fragShaderModule, vkDestroyShaderModule);
+
+        // 12. Create the Rendering Pipeline
+        VkPipeline pipeline;
+        {
+            // VL.3. The packed layout stores the normal as UNORM, the shader decodes it if the constant is set.
+            const VkBool32 packedNormal = (vertexLayout.layout == VERTEX_LAYOUT_PACKED) ? VK_TRUE : VK_FALSE;
+            const VkSpecializationMapEntry specEntry = { /* constantID */ 0, /* offset */ 0, /* size */ sizeof(VkBool32) };
+
+            VkSpecializationInfo specInfo;
+            {
+                specInfo.mapEntryCount = 1;
+                specInfo.pMapEntries = &specEntry;
+                specInfo.dataSize = sizeof(packedNormal);
+                specInfo.pData = &packedNormal;
+            }
+
+            VkPipelineShaderStageCreateInfo vertShaderStageInfo;
+            {
+                vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                vertShaderStageInfo.pNext = NULL;
+                vertShaderStageInfo.flags = 0;
+                vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+                vertShaderStageInfo.module = vertShaderModule;
+                vertShaderStageInfo.pName = "main";
+                vertShaderStageInfo.pSpecializationInfo = (vertexLayout.layout != VERTEX_LAYOUT_POSITION) ? &specInfo : NULL;
+            }
+
+            VkPipelineShaderStageCreateInfo fragShaderStageInfo;
+            {
+                fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                fragShaderStageInfo.pNext = NULL;
+                fragShaderStageInfo.flags = 0;
+                fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+                fragShaderStageInfo.module = fragShaderModule;
+                fragShaderStageInfo.pName = "main";
+                fragShaderStageInfo.pSpecializationInfo = NULL;
+            }
+
+            VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+            // V.4. Describe the Vertex input binding information.
+            VkVertexInputBindingDescription vec2VertexBinding;
+            {
+                // The binding information is mapped to the VkVertexInputAttributeDescription.binding.
+                vec2VertexBinding.binding = 0;
+                // The stride information is based on the vertex input type: vec2. (see shader)
+                vec2VertexBinding.stride = sizeof(float) * 2;
+                vec2VertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            }
+
+            // V.5. Describe the Vertex input attribute information.
+            VkVertexInputAttributeDescription positionVertexAttribute;
+            {
+                positionVertexAttribute.binding = 0;
+                // The attribute location is from the Vertex shader.
+                positionVertexAttribute.location = 0;
+                // Format and offset is used during the data read from the buffer.
+                positionVertexAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+                positionVertexAttribute.offset = 0;
+            }
+
+            // VL.4. The other layouts provide their own bindings and attributes.
+            const bool positionLayout = (vertexLayout.layout == VERTEX_LAYOUT_POSITION);
+
+            // V.6. Connect the Attribute and Binding infors to the VertexInputState.
+            VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+            {
+                vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+                vertexInputInfo.pNext = NULL;
+                vertexInputInfo.flags = 0;
+                vertexInputInfo.vertexBindingDescriptionCount = positionLayout ? 1 : (uint32_t)vertexLayout.bindings.size();
+                vertexInputInfo.pVertexBindingDescriptions = positionLayout ? &vec2VertexBinding : vertexLayout.bindings.data();
+                vertexInputInfo.vertexAttributeDescriptionCount = positionLayout ? 1 : (uint32_t)vertexLayout.attributes.size();
+                vertexInputInfo.pVertexAttributeDescriptions = positionLayout ? &positionVertexAttribute : vertexLayout.attributes.data();
+            }
 
-        // D.6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &uniformBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+            VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+            {
+                inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+                inputAssembly.pNext = NULL;
+                inputAssembly.flags = 0;
+                inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+                inputAssembly.primitiveRestartEnable = VK_FALSE;
+            }
+
+            // SC. The viewport and the scissor are dynamic states, they are set when the draw commands are recorded.
+            // This way the Pipeline is not re-created when the Swapchain size changes.
+            VkPipelineViewportStateCreateInfo viewportState{};
+            {
+                viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+                viewportState.viewportCount = 1;
+                viewportState.pViewports = NULL;
+                viewportState.scissorCount = 1;
+                viewportState.pScissors = NULL;
+            }
+
+            VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+            VkPipelineDynamicStateCreateInfo dynamicState;
+            {
+                dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+                dynamicState.pNext = NULL;
+                dynamicState.flags = 0;
+                dynamicState.dynamicStateCount = 2;
+                dynamicState.pDynamicStates = dynamicStates;
+            }
+
+            VkPipelineRasterizationStateCreateInfo rasterizer;
+            {
+                rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+                rasterizer.pNext = NULL;
+                rasterizer.flags = 0;
+                rasterizer.depthClampEnable = VK_FALSE;
+                rasterizer.rasterizerDiscardEnable = VK_FALSE;
+                rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+                rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+                rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+                rasterizer.depthBiasEnable = VK_FALSE;
+                rasterizer.depthBiasConstantFactor = 0.0;
+                rasterizer.depthBiasClamp = 0.0;
+                rasterizer.depthBiasSlopeFactor = 0.0;
+                rasterizer.lineWidth = 1.0f;
+            }
+
+            VkPipelineMultisampleStateCreateInfo multisampling;
+            {
+                multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+                multisampling.pNext = NULL;
+                multisampling.flags = 0;
+                multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+                multisampling.sampleShadingEnable = VK_FALSE;
+                multisampling.minSampleShading = 0.0;
+                multisampling.pSampleMask = NULL;
+                multisampling.alphaToCoverageEnable = VK_FALSE;
+                multisampling.alphaToOneEnable = VK_FALSE;
+            }
+
+            VkPipelineColorBlendAttachmentState colorBlendAttachment;
+            {
+                colorBlendAttachment.blendEnable = VK_FALSE;
+                colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+                colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+                colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+                colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+                colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+                                                      | VK_COLOR_COMPONENT_G_BIT
+                                                      | VK_COLOR_COMPONENT_B_BIT
+                                                      | VK_COLOR_COMPONENT_A_BIT;
+            }
+
+            VkPipelineColorBlendStateCreateInfo colorBlending;
+            {
+                colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+                colorBlending.pNext = NULL;
+                colorBlending.flags = 0;
+                colorBlending.logicOpEnable = VK_FALSE;
+                colorBlending.logicOp = VK_LOGIC_OP_COPY;
+                colorBlending.attachmentCount = 1;
+                colorBlending.pAttachments = &colorBlendAttachment;
+                colorBlending.blendConstants[0] = 0.0f;
+                colorBlending.blendConstants[1] = 0.0f;
+                colorBlending.blendConstants[2] = 0.0f;
+                colorBlending.blendConstants[3] = 0.0f;
+            }
+
+            VkGraphicsPipelineCreateInfo pipelineInfo;
+            {
+                pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+                pipelineInfo.pNext = NULL;
+                pipelineInfo.flags = 0;
+                pipelineInfo.stageCount = 2;
+                pipelineInfo.pStages = shaderStages;
+                pipelineInfo.pVertexInputState = &vertexInputInfo;
+                pipelineInfo.pInputAssemblyState = &inputAssembly;
+                pipelineInfo.pTessellationState = NULL;
+                pipelineInfo.pViewportState = &viewportState;
+                pipelineInfo.pRasterizationState = &rasterizer;
+                pipelineInfo.pMultisampleState = &multisampling;
+                pipelineInfo.pDepthStencilState = NULL;
+                pipelineInfo.pColorBlendState = &colorBlending;
+                pipelineInfo.pDynamicState = &dynamicState;
+                pipelineInfo.layout = pipelineLayout;
+                pipelineInfo.renderPass = renderPass;
+                pipelineInfo.subpass = 0;
+                pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+                pipelineInfo.basePipelineIndex = 0;
+            }
+
+            std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+            if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+
+            double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+            printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
         }
 
-        // D.6.4 "Connect" the Unifor Buffer with the allocated memory.
-        vkBindBufferMemory(device, uniformBuffer, uniformBufferMemory, 0);
+        return pipeline;
+    });
+
+    // G.5.3. Create the Swapchain with the selected config, the Pipeline is built meanwhile (PS.1).
+    // By standard the FIFO presentation mode should always be available.
+    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D swapExtent = { windowWidth, windowHeight };
+    VkSwapchainKHR swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, VK_NULL_HANDLE, &swapExtent, &swapchainPresentMode);
+
+    // G.6. Get the Swapchain images.
+    std::vector<VkImage> swapImages = GetSwapchainImages(device, swapchain);
+
+    printf("Present mode: %s, swapchain images: %u, frames in flight: %u, max FPS: %.1f\n",
+           PresentModeName(swapchainPresentMode), (uint32_t)swapImages.size(), framesInFlight, maxFps);
+
+    // BN. The benchmark renders into offscreen images instead of the Swapchain images,
+    // so no image is acquired or presented. Every later step uses them in place of the Swapchain images.
+    std::vector<ArenaAllocation> benchImageMemories;
+    if (benchFrames > 0) {
+        VkImageCreateInfo imageInfo;
+        {
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = NULL;
+            imageInfo.flags = 0;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = surfaceFormat.format;
+            imageInfo.extent = { swapExtent.width, swapExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.queueFamilyIndexCount = 0;
+            imageInfo.pQueueFamilyIndices = NULL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        if (postProcess.mode != POST_PROCESS_OFF) {
+            imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        benchImageMemories.resize(swapImages.size());
+        for (size_t idx = 0; idx < swapImages.size(); idx++) {
+            if (vkCreateImage(device, &imageInfo, NULL, &swapImages[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create benchmark image!");
+            }
+            benchImageMemories[idx] = ArenaAllocateImage(&memoryArena, swapImages[idx], VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
     }
 
-    // D.7. Upload the Uniform Buffer data.
+    // Old 5. and 6. steps are removed.
+    // The Swapchain creation takes care of the render target image creation.
+    // SC. Updated when the Swapchain is re-created.
+    uint32_t renderImageWidth = swapExtent.width;
+    uint32_t renderImageHeight = swapExtent.height;
+
+    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
+    // This buffer will hold the Vertex coordinates in a vec2 like format.
+    VkBuffer vertexBuffer;
     {
-        // D.7.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map uniform buffer!");
+        VkBufferCreateInfo bufferInfo;
+        {
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = NULL;
+            bufferInfo.flags = 0;
+            bufferInfo.size = vertexLayout.data.size();
+            // The buffer will be used as a Vertex Input attribute.
+            // The data is copied into it from a staging buffer if the memory is not host visible.
+            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = NULL;
+        }
+
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create vertex buffer!");
         }
+    }
+
+    // U. Create the staging uploader for the device local buffers.
+    StagingUploader stagingUploader;
+    CreateStagingUploader(device, &memoryArena, graphicsQueueFamilyIdx, forceStaging, &stagingUploader);
+
+    // V.2. Allocate device local memory for the Vertex Buffer and upload the Vertex Buffer data.
+    // The vertices are fetched by the GPU in every frame, so they should not be read over PCIe.
+    // If the device local memory is not host visible the data is copied from a staging buffer.
+    ArenaAllocation vertexBufferMemory = UploadDeviceLocalBuffer(device, &stagingUploader, vertexBuffer,
+                                                                  vertexLayout.data.data(), vertexLayout.data.size(),
+                                                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 
-        // D.7.2. Copy data into the "data".
-        ::memcpy(data, uniformData.data(), sizeof(float) * uniformData.size());
+    // V.3. Submit the batched uploads.
+    // The copies are ordered before the draws on the same queue, no wait is required here.
+    SubmitStagingUploads(device, &stagingUploader, queue);
+    printf("Buffer uploads: %u direct, %u staged\n", stagingUploader.directCount, stagingUploader.stagedCount);
 
-        // D.7.3. Flush the data.
-        // This is required as a non-coherent buffer was created.
-        VkMappedMemoryRange memoryRange;
+    // D.2. Create the Descriptor Pool.
+    // A Descriptor Pool is a "storage" for Descriptor to allocate from.
+    VkDescriptorPool descriptorPool;
+    {
+        // D.2.1. Define size for single (dynamic) Uniform Buffer.
+        VkDescriptorPoolSize poolSizes[] =
         {
-            memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            memoryRange.pNext = NULL;
-            memoryRange.memory = uniformBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
+            {
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, // type
+                1,                                 // descriptorCount
+            }
+        };
+
+        VkDescriptorPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;     // VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT ??
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = poolSizes;
         }
-        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
 
-        // D.7.4. Unmap the mapped uniform buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, uniformBufferMemory);
+        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
     }
 
-    // D.8. Update Descriptor Set contents.
+    // D.3. Allocate a Descriptor Set from the Descriptor Pool.
+    VkDescriptorSet descriptorSet;
     {
-        VkDescriptorBufferInfo bufferInfo;
+        VkDescriptorSetAllocateInfo allocInfo;
         {
-            bufferInfo.buffer = uniformBuffer;
-            bufferInfo.offset = 0;
-            bufferInfo.range = VK_WHOLE_SIZE;
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.descriptorPool = descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &descriptorSetLayout;
         }
 
-        VkWriteDescriptorSet descriptorWrite;
+        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+    }
+
+    // D.X. Uniform Buffer data: color information.
+    std::vector<float> uniformData = {
+        1.0, 0.0, 0.0, 1.0,
+        0.0, 1.0, 0.0, 1.0,
+        0.0, 0.0, 1.0, 1.0
+    };
+
+    // D.4. Split the Uniform Buffer into one slice for each swapchain image.
+    // The Command Buffers are recorded per swapchain image, so each of them binds its own slice with a
+    // dynamic offset. The slice of an image is only rewritten after the image's previous frame finished.
+    // Slices are aligned to minUniformBufferOffsetAlignment for the dynamic offsets and to
+    // nonCoherentAtomSize, so the flush of a single slice does not touch its neighbours.
+    const VkDeviceSize uniformDataSize = sizeof(float) * uniformData.size();
+    VkDeviceSize uniformSliceSize;
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        VkDeviceSize alignment = std::max(properties.limits.minUniformBufferOffsetAlignment, memoryArena.nonCoherentAtomSize);
+        uniformSliceSize = AlignUp(uniformDataSize, alignment);
+    }
+
+    // D.5. Create the Uniform Buffer with its memory and point the Descriptor Set to it.
+    // SC. The slices are re-created with the Swapchain, as the image count can change.
+    UniformSlices uniformSlices;
+    CreateUniformSlices(physicalDevice, device, &memoryArena, descriptorSet, uniformDataSize, uniformSliceSize,
+                        (uint32_t)swapImages.size(), &uniformSlices);
+
+    // PP.2. Create the filter pipeline, the post-process images and the pre-recorded Command Buffers.
+    // SC. The images and the Command Buffers (targets) are re-created with the Swapchain.
+    if (postProcess.mode != POST_PROCESS_OFF) {
+        CreatePostProcess(physicalDevice, device, pipelineCache, surfaceFormat.format, framesInFlight, &postProcess);
+        CreatePostProcessTargets(device, &memoryArena, swapImages, targetLayout, swapExtent.width, swapExtent.height, &postProcess);
+
+        printf("Post-process: %s, graphics queue family %u, compute queue family %u (queue %u)\n",
+               PostProcessModeName(postProcess.mode), postProcess.graphicsQueueFamilyIdx,
+               postProcess.computeQueueFamilyIdx, computeQueueIdx);
+    }
+
+    // G.7. Create Image Views for the Swapchain Images.
+    // G.8. Create Frambuffer for each Swapchain Image view.
+    // SC. Both are size dependent, they are re-created with the Swapchain.
+    std::vector<VkImageView> swapImageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, postProcess, &swapImageViews, &framebuffers);
+
+    // 14. Create Command Pool.
+    // Required to create Command buffers.
+    VkCommandPool cmdPool;
+    {
+        VkCommandPoolCreateInfo poolInfo;
         {
-            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrite.pNext = NULL;
-            descriptorWrite.dstSet = descriptorSet;
-            descriptorWrite.dstBinding = 0;
-            descriptorWrite.dstArrayElement = 0;
-            descriptorWrite.descriptorCount = 1;
-            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrite.pImageInfo = NULL;
-            descriptorWrite.pBufferInfo = &bufferInfo;
-            descriptorWrite.pTexelBufferView = NULL;
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
+        }
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    // PS.2. Wait for the Pipeline, the Command Buffers are the first to use it.
+    // An exception of the worker is re-thrown here.
+    VkPipeline pipeline = pipelineBuild.get();
+
+    // G.9. Create and record a Command Buffer for each Swapchain Image View (Framebuffer).
+    // SC. The Command Buffers reference the Framebuffers, they are re-recorded with the Swapchain.
+    // CB. The per frame strategy records in the draw loop instead.
+    // CB. Record times in milliseconds: the up front recordings or the recording of every frame.
+    std::vector<double> recordTimes;
+    std::vector<VkCommandBuffer> cmdBuffers;
+    if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+        const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+        RecordDrawCommands(device, cmdPool, renderPass, pipeline, pipelineLayout, descriptorSet, uniformSliceSize,
+                           vertexBuffer, vertexLayout, framebuffers, postProcess, swapExtent, &cmdBuffers);
+        recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+    }
+
+    // Recording of the draw commands into the Command Buffer is done.
+    // Now the Command Buffer should be sent to the GPU.
+
+    const uint32_t imagesInFlight = framesInFlight;
+
+    // G.14. As there are multiple images now more sync objects are required.
+    // This replaces the old 19. step.
+    // imageAvailableSemaphores will store the Semaphores to check if the next image is available to draw on to.
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    // renderFinishedSemaphores will store the Semaphores to check if the image finished rendering.
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    std::vector<VkFence> swapImagesFences;
+    std::vector<VkFence> activeFences;
+    {
+        imageAvailableSemaphores.resize(imagesInFlight);
+        renderFinishedSemaphores.resize(imagesInFlight);
+        activeFences.resize(imagesInFlight);
+        swapImagesFences.resize(swapImages.size(), VK_NULL_HANDLE);
+
+        VkSemaphoreCreateInfo semaphoreInfo;
+        {
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext = NULL;
+            semaphoreInfo.flags = 0;
+        }
+
+        VkFenceCreateInfo fenceInfo;
+        {
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = 0;
+            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;;
+        }
+
+        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &imageAvailableSemaphores[idx]) != VK_SUCCESS ||
+                vkCreateSemaphore(device, &semaphoreInfo, NULL, &renderFinishedSemaphores[idx]) != VK_SUCCESS ||
+                vkCreateFence(device, &fenceInfo, NULL, &activeFences[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
+        }
+    }
+
+    // CB.1. Create a Command Pool for each frame in flight.
+    std::vector<FrameCommandPool> frameCommandPools;
+    if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+        CreateFrameCommandPools(device, graphicsQueueFamilyIdx, imagesInFlight, &frameCommandPools);
+    }
+
+    // BN. Create the timestamp queries of the benchmark, one pair for each frame in flight.
+    // TC. The trace uses the same queries for the GPU zones of the frames.
+    const bool benchTimerEnabled = (benchFrames > 0) || g_tracer.enabled;
+    BenchTimer benchTimer;
+    if (benchTimerEnabled) {
+        CreateBenchTimer(physicalDevice, device, graphicsQueueFamilyIdx, imagesInFlight, &benchTimer);
+    }
+    if (g_tracer.enabled) {
+        CalibrateTraceGpuClock(physicalDevice, device, queue, graphicsQueueFamilyIdx, &benchTimer.traceClock);
+    }
+
+    // R.1. Create the readback ring.
+    // One slot for each image in flight and an extra one, so finished captures can be consumed
+    // while the next frames are rendered.
+    // C. The streamed frames stay in their slots until the writer thread is done with them.
+    const uint32_t readbackSlotCount = imagesInFlight + 1 + (captureEnabled ? g_captureQueueSize : 0);
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+    // R.1.1. The Swapchain images are BGRA, their readback is written out with R and B swapped.
+    const bool swapRB = (surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB) || (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
+
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
+
+    // Newest completed capture, it stays in its readback slot until the output image is written.
+    ReadbackSlot *capturedSlot = NULL;
+    uint64_t frameIdx = 0;
+
+    // C.3. Start the writer thread of the streaming capture.
+    // Captured frames are handed over to the writer instead of being kept for the single output image.
+    FrameWriter frameWriter;
+    uint32_t captureRecorded = 0;
+    if (captureEnabled) {
+        StartFrameWriter(captureFormat, captureOutputPattern, captureStream, renderImageWidth, renderImageHeight, swapRB, &frameWriter);
+
+        if (captureFormat == CAPTURE_FORMAT_RGBA) {
+            printf("Capture: raw stream, use: ffmpeg -f rawvideo -pix_fmt rgba -s %ux%u -i -\n", renderImageWidth, renderImageHeight);
+        }
+    }
+
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
+
+    // G.25. Draw and Present loop.
+    // Draw and Present a series of images.
+    uint32_t activeSyncIdx = 0;
+
+    // FP. The limiter paces the start of the frames, the latency is measured from acquire to present.
+    FramePacer framePacer;
+    InitFramePacer(maxFps, latencyLog, &framePacer);
+    const std::chrono::steady_clock::time_point benchStart = std::chrono::steady_clock::now();
+    bool swapchainOutOfDate = false;
+    while (!glfwWindowShouldClose(window)) {
+        // TC. Each iteration is a zone, the steps of the frame are nested into it.
+        TraceZone frameZone("frame");
+
+        // G.25.0. Run GLFW event polling.
+        {
+            TraceZone zone("poll events");
+            glfwPollEvents();
         }
 
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, NULL);
-    }
+        // SC.1. Re-create the Swapchain after a resize or an out of date (or suboptimal) acquire/present.
+        if (swapchainOutOfDate || framebufferResized) {
+            TraceZone zone("swapchain re-creation");
+
+            // SC.1.1. A minimized window has a zero sized framebuffer, wait until it is restored.
+            int framebufferWidth = 0;
+            int framebufferHeight = 0;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            while (((framebufferWidth == 0) || (framebufferHeight == 0)) && !glfwWindowShouldClose(window)) {
+                glfwWaitEvents();
+                glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            }
+
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
+
+            swapchainOutOfDate = false;
+            framebufferResized = false;
+
+            // SC.1.2. Wait until the frames in flight are done, they still use the old resources.
+            vkDeviceWaitIdle(device);
+
+            // SC.1.3. Consume the remaining captures, the readback ring is re-created with the new size.
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                if (captureEnabled) {
+                    QueueFrame(&frameWriter, slot);
+                } else {
+                    ReleaseReadback(slot);
+                }
+            }
+            // The queued frames are still read from the ring, wait for the writer before it is destroyed.
+            if (captureEnabled) {
+                FlushFrameWriter(&frameWriter);
+            }
+            // The kept capture has the old size, the next frames are captured again.
+            capturedSlot = NULL;
+            DestroyReadbackRing(device, &readbackRing);
+
+            // SC.1.4. Destroy the size dependent resources.
+            if (!cmdBuffers.empty()) {
+                vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+                cmdBuffers.clear();
+            }
+            DestroyFramebuffers(device, &swapImageViews, &framebuffers);
+            if (postProcess.mode != POST_PROCESS_OFF) {
+                DestroyPostProcessTargets(device, &memoryArena, &postProcess);
+            }
+
+            // SC.1.5. Create the new Swapchain from the old one, then destroy the retired Swapchain.
+            const VkSwapchainKHR oldSwapchain = swapchain;
+            swapExtent = { (uint32_t)framebufferWidth, (uint32_t)framebufferHeight };
+            swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, oldSwapchain, &swapExtent, &swapchainPresentMode);
+            vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+            swapImages = GetSwapchainImages(device, swapchain);
+
+            // D. Each image needs its own Uniform Buffer slice, re-allocate them if the image count changed.
+            // No submitted Command Buffer references the Descriptor Set any more, so it can be updated.
+            if (swapImages.size() != uniformSlices.count) {
+                DestroyUniformSlices(device, &memoryArena, &uniformSlices);
+                CreateUniformSlices(physicalDevice, device, &memoryArena, descriptorSet, uniformDataSize, uniformSliceSize,
+                                    (uint32_t)swapImages.size(), &uniformSlices);
+            }
+
+            // C. The streamed frames must keep their size.
+            if (captureEnabled && ((swapExtent.width != renderImageWidth) || (swapExtent.height != renderImageHeight))) {
+                throw std::runtime_error("failed to keep the capture size after a swapchain re-creation!");
+            }
+            renderImageWidth = swapExtent.width;
+            renderImageHeight = swapExtent.height;
+
+            // SC.1.6. Rebuild the size dependent resources, the Render Pass and the Pipelines are kept.
+            if (postProcess.mode != POST_PROCESS_OFF) {
+                CreatePostProcessTargets(device, &memoryArena, swapImages, targetLayout, swapExtent.width, swapExtent.height, &postProcess);
+            }
+            CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, postProcess, &swapImageViews, &framebuffers);
+            if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+                const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+                RecordDrawCommands(device, cmdPool, renderPass, pipeline, pipelineLayout, descriptorSet, uniformSliceSize,
+                                   vertexBuffer, vertexLayout, framebuffers, postProcess, swapExtent, &cmdBuffers);
+                recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+            }
+            swapImagesFences.assign(swapImages.size(), VK_NULL_HANDLE);
+            CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+            printf("Swapchain: re-created with %ux%u, %u images\n", swapExtent.width, swapExtent.height, (uint32_t)swapImages.size());
+        }
+
+        // FP. Wait for the start of the next frame, the benchmark runs uncapped.
+        if (benchFrames == 0) {
+            TraceZone zone("pace frame");
+            PaceFrame(&framePacer);
+        }
+
+        // G.25.1. Wait for the previous fence to "finish".
+        {
+            TraceZone zone("wait frame fence");
+            vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
+        }
+
+        // BN. Collect the GPU time of the previous frame in this slot, the CPU time of the frame starts here.
+        if (benchTimerEnabled) {
+            CollectBenchTimestamps(device, &benchTimer, activeSyncIdx);
+        }
+        const std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+
+        // U.1. Release the staging buffers of the finished uploads, this does not block.
+        ReleaseStagingBuffers(device, &stagingUploader, false);
+
+        // R.2. Consume the finished captures of earlier frames.
+        {
+            TraceZone zone("consume captures");
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                if (captureEnabled) {
+                    QueueFrame(&frameWriter, slot);
+                } else {
+                    KeepNewestReadback(slot, &capturedSlot);
+                }
+            }
+            if (captureEnabled) {
+                ReclaimFrames(&frameWriter);
+            }
+        }
+
+        // G.25.2. Get the next Swapchain Image Index.
+        const std::chrono::steady_clock::time_point acquireStart = std::chrono::steady_clock::now();
+        // BN. The offscreen images of the benchmark are used in a round robin order.
+        uint32_t imageIndex;
+        if (benchFrames > 0) {
+            imageIndex = (uint32_t)(frameIdx % swapImages.size());
+        } else {
+            TraceZone zone("acquire image");
+            VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+
+            // SC.2. An out of date Swapchain can't be used, skip the frame and re-create the Swapchain.
+            // A suboptimal Swapchain still presents this frame, it is re-created afterwards.
+            if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+                swapchainOutOfDate = true;
+                continue;
+            } else if (acquireResult == VK_SUBOPTIMAL_KHR) {
+                swapchainOutOfDate = true;
+            } else if (acquireResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to acquire swapchain image!");
+            }
+        }
+
+        // G.25.3. Wait for the target image to be available.
+        if (swapImagesFences[imageIndex] != VK_NULL_HANDLE) {
+            TraceZone zone("wait image fence");
+            vkWaitForFences(device, 1, &swapImagesFences[imageIndex], VK_TRUE, UINT64_MAX);
+        }
+        // Connect the current fence to the given swapchaing image.
+        swapImagesFences[imageIndex] = activeFences[activeSyncIdx];
+
+        // D.X. Update the Uniform Buffer slice of the image in each frame.
+        // The previous frame of this image has finished, so the GPU no longer reads the slice.
+        {
+            TraceZone zone("update uniforms");
+
+            // D.X.1. Change the uniform data.
+            // Rotate the data by 4 floats.
+            std::rotate(uniformData.begin(), uniformData.begin() + 4, uniformData.end());
+
+            // D.X.2. Copy data into the persistently mapped slice.
+            const VkDeviceSize sliceOffset = uniformSliceSize * imageIndex;
+            ::memcpy(uniformSlices.mapped + sliceOffset, uniformData.data(), uniformDataSize);
+
+            // D.X.3. Flush only the written slice.
+            // This is required if a non-coherent memory type was selected.
+            VkMappedMemoryRange memoryRange;
+            {
+                memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+                memoryRange.pNext = NULL;
+                memoryRange.memory = uniformSlices.memory.memory;
+                memoryRange.offset = uniformSlices.memory.offset + sliceOffset;
+                memoryRange.size = uniformSliceSize;
+            }
+            vkFlushMappedMemoryRanges(device, 1, &memoryRange);
+        }
+
+        // CB.2. Record the draw commands of this frame into the Command Pool of the frame in flight.
+        // Its last submission was waited for with the fence at G.25.1, so the pool can be reset as a whole.
+        // The reset keeps the pool memory, the recording reuses it without new allocations.
+        VkCommandBuffer drawCmdBuffer;
+        if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+            TraceZone zone("record commands");
+            const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+            FrameCommandPool& framePool = frameCommandPools[activeSyncIdx];
+            vkResetCommandPool(device, framePool.cmdPool, 0);
+            RecordFrameCommands(framePool.cmdBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, renderPass, pipeline,
+                                pipelineLayout, descriptorSet, uniformSliceSize, vertexBuffer, vertexLayout,
+                                framebuffers[imageIndex], postProcess, swapExtent, imageIndex);
+            recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+            drawCmdBuffer = framePool.cmdBuffer;
+        } else {
+            drawCmdBuffer = cmdBuffers[imageIndex];
+        }
+
+        // Configure a few sync points.
+        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx] };
+        // PP. With the post-process the Swapchain image is first written by the blit.
+        VkPipelineStageFlags waitStages[] = {
+            (postProcess.mode != POST_PROCESS_OFF) ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        };
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx] };
+
+        // R.3. Record the capture of this frame, it is executed in the same submission after the draw commands.
+        // If no readback slot is free the frame is not captured, the loop never waits for the CPU side.
+        // C.4. When streaming only the selected frames are copied, the window is closed after the last one.
+        bool captureFrame = true;
+        if (captureEnabled) {
+            captureFrame = ((frameIdx % captureEvery) == 0) && ((captureFrameCount == 0) || (captureRecorded < captureFrameCount));
+        } else if (benchFrames > 0) {
+            // BN. Only the last frame of the benchmark is read back for the output image.
+            captureFrame = ((frameIdx + 1) == benchFrames);
+        }
+
+        VkCommandBuffer readbackCmdBuffer =
+            captureFrame ? RecordReadback(device, &readbackRing, swapImages[imageIndex], targetLayout, activeFences[activeSyncIdx], frameIdx) : VK_NULL_HANDLE;
+
+        // BN. The benchmark wraps the draw Command Buffer with the timestamp writes of the slot.
+        // PP. The post-process adds the filter and the blit after the draw commands.
+        // In the async mode the filter goes to the compute queue, and the Command Buffers after
+        // "renderCmdBufferCount" are submitted in a separate batch, see PP.4.
+        VkCommandBuffer frameCmdBuffers[6];
+        uint32_t frameCmdBufferCount = 0;
+        if (benchTimerEnabled) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.beginCmdBuffers[activeSyncIdx];
+        }
+        frameCmdBuffers[frameCmdBufferCount++] = drawCmdBuffer;
+        const uint32_t renderCmdBufferCount = frameCmdBufferCount;
+        if (postProcess.mode == POST_PROCESS_SERIAL) {
+            frameCmdBuffers[frameCmdBufferCount++] = postProcess.targets[imageIndex].filterCmdBuffer;
+        }
+        if (postProcess.mode != POST_PROCESS_OFF) {
+            frameCmdBuffers[frameCmdBufferCount++] = postProcess.targets[imageIndex].blitCmdBuffer;
+        }
+        if (benchTimerEnabled) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.endCmdBuffers[activeSyncIdx];
+        }
+        if (readbackCmdBuffer != VK_NULL_HANDLE) {
+            frameCmdBuffers[frameCmdBufferCount++] = readbackCmdBuffer;
+        }
+        frameIdx++;
+
+        if (captureEnabled && (readbackCmdBuffer != VK_NULL_HANDLE)) {
+            captureRecorded++;
+            if (captureRecorded == captureFrameCount) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+        }
+
+        if ((benchFrames > 0) && (frameIdx == benchFrames)) {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+
+        // G.25.4. Build the Submit info using the sync points.
+        VkSubmitInfo submitInfo;
+        {
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = NULL;
+            // BN. Without acquire and present there is nothing to wait for or to signal.
+            submitInfo.waitSemaphoreCount = (benchFrames > 0) ? 0 : 1;
+            submitInfo.pWaitSemaphores = waitSemaphores;
+            submitInfo.pWaitDstStageMask = waitStages;
+            submitInfo.commandBufferCount = frameCmdBufferCount;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
+            submitInfo.signalSemaphoreCount = (benchFrames > 0) ? 0 : 1;
+            submitInfo.pSignalSemaphores = signalSemaphores;
+        }
+
+        vkResetFences(device, 1, &activeFences[activeSyncIdx]);
+
+        // A fence is provided to have a CPU side sync point.
+        {
+            TraceZone zone("queue submit");
+            if (postProcess.mode == POST_PROCESS_ASYNC) {
+                SubmitAsyncPostProcess(postProcess, queue,
+                                       frameCmdBuffers, renderCmdBufferCount,
+                                       frameCmdBuffers + renderCmdBufferCount, frameCmdBufferCount - renderCmdBufferCount,
+                                       imageIndex, activeSyncIdx,
+                                       (benchFrames > 0) ? VK_NULL_HANDLE : waitSemaphores[0],
+                                       (benchFrames > 0) ? VK_NULL_HANDLE : signalSemaphores[0],
+                                       activeFences[activeSyncIdx]);
+            } else if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+        }
+
+        if (benchFrames > 0) {
+            const std::chrono::steady_clock::time_point cpuEnd = std::chrono::steady_clock::now();
+            benchTimer.cpuTimes.push_back(std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count());
+        }
+        if (benchTimerEnabled) {
+            benchTimer.pending[activeSyncIdx] = true;
+        }
+
+        VkPresentInfoKHR presentInfo;
+        {
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.pNext = 0;
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = signalSemaphores;
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = &swapchain;
+            presentInfo.pImageIndices = &imageIndex;
+            presentInfo.pResults = NULL;
+        }
+
+        if (benchFrames == 0) {
+            // SC.3. Re-create the Swapchain before the next frame if it no longer matches the surface.
+            VkResult presentResult;
+            {
+                TraceZone zone("queue present");
+                presentResult = vkQueuePresentKHR(queue, &presentInfo);
+            }
+            if ((presentResult == VK_ERROR_OUT_OF_DATE_KHR) || (presentResult == VK_SUBOPTIMAL_KHR)) {
+                swapchainOutOfDate = true;
+            } else if (presentResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to present swapchain image!");
+            }
+
+            // FP. Track the acquire->present latency of the frame.
+            const std::chrono::steady_clock::time_point presentEnd = std::chrono::steady_clock::now();
+            RecordFrameLatency(&framePacer, imageIndex, std::chrono::duration<double, std::milli>(presentEnd - acquireStart).count());
+        }
+
+        activeSyncIdx = (activeSyncIdx + 1) % imagesInFlight;
+    }
+
+    // At this point the image is rendered into the Framebuffer's attachment which is an ImageView.
+
+    PrintFrameLatency(framePacer);
+
+    // R.4. Wait for the frames in flight and consume the remaining captures.
+    vkWaitForFences(device, imagesInFlight, activeFences.data(), VK_TRUE, UINT64_MAX);
+    for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+        if (captureEnabled) {
+            QueueFrame(&frameWriter, slot);
+        } else {
+            KeepNewestReadback(slot, &capturedSlot);
+        }
+    }
+    if (captureEnabled) {
+        ReclaimFrames(&frameWriter);
+    }
+
+    // BN. Collect the GPU times of the last frames and report the benchmark.
+    if (benchFrames > 0) {
+        const std::chrono::steady_clock::time_point benchEnd = std::chrono::steady_clock::now();
+        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+            CollectBenchTimestamps(device, &benchTimer, idx);
+        }
+        PrintBenchResults(physicalDevice, benchTimer, std::chrono::duration<double>(benchEnd - benchStart).count());
+        PrintVertexFetchReport(vertexLayout, vertexLayout.vertexCount, benchTimer);
+        PrintCommandStrategyResults(commandStrategy, recordTimes);
+    }
+
+    // C.5. Write out the queued frames and stop the writer thread.
+    if (captureEnabled) {
+        StopFrameWriter(&frameWriter);
+    }
+
+    // TC. Export the trace, every traced thread is stopped by now.
+    if (g_tracer.enabled) {
+        WriteTrace(envTrace);
+    }
+
+    if (capturedSlot != NULL) {
+        // 25. Write out the image to a ppm file.
+        {
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, capturedSlot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, swapRB, ppmMmap);
+        }
+    }
+
+    // G.XX. Destroy Sync object.
+    for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+        vkDestroySemaphore(device, imageAvailableSemaphores[idx], NULL);
+        vkDestroySemaphore(device, renderFinishedSemaphores[idx], NULL);
+        vkDestroyFence(device, activeFences[idx], NULL);
+    }
+
+    // G.XX. Free Command Buffers.
+    if (!cmdBuffers.empty()) {
+        vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+    }
+
+    // CB.XX. Destroy the per frame Command Pools, this also frees their Command Buffers.
+    DestroyFrameCommandPools(device, &frameCommandPools);
+
+    // BN.XX. Destroy the benchmark timer.
+    if (benchTimerEnabled) {
+        DestroyBenchTimer(device, &benchTimer);
+    }
+
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
+
+    // XX. Destroy Command Pool
+    vkDestroyCommandPool(device, cmdPool, NULL);
+
+    // G.XX. Destory Framebuffers and the Swapchain image views.
+    DestroyFramebuffers(device, &swapImageViews, &framebuffers);
+
+    // PP.XX. Destroy the post-process resources.
+    if (postProcess.mode != POST_PROCESS_OFF) {
+        DestroyPostProcess(device, &memoryArena, &postProcess);
+    }
+
+    // XX. Destory Pipeline.
+    vkDestroyPipeline(device, pipeline, NULL);
+
+    // XX. Destory Pipeline Layout.
+    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+
+    // D.XX. Destroy Uniform Buffer and free its memory.
+    DestroyUniformSlices(device, &memoryArena, &uniformSlices);
+
+    // D.XX. Free Descriptor Set.
+    vkResetDescriptorPool(device, descriptorPool, 0);
+
+    // D.XX. Destroy Descriptor Pool.
+    vkDestroyDescriptorPool(device, descriptorPool, NULL);
+
+    // D.XX. Destroy Descriptor Set Layout.
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
+
+    // XX. Destory Render Pass.
+    vkDestroyRenderPass(device, renderPass, NULL);
+
+    // U.XX. Destroy the staging uploader, it waits for the pending uploads.
+    DestroyStagingUploader(device, &stagingUploader);
+
+    // XX. Free the Vertex Buffer's memory.
+    ArenaFree(&memoryArena, vertexBufferMemory);
+
+    // XX. Destroy the Vertex Buffer.
+    vkDestroyBuffer(device, vertexBuffer, NULL);
+
+    // BN.XX. Destroy the offscreen images of the benchmark.
+    for (size_t idx = 0; idx < benchImageMemories.size(); idx++) {
+        vkDestroyImage(device, swapImages[idx], NULL);
+        ArenaFree(&memoryArena, benchImageMemories[idx]);
+    }
+
+    // G.XX. Destroy swapchain.
+    vkDestroySwapchainKHR(device, swapchain, NULL);
+
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
+    // XX. Destroy Device
+    vkDestroyDevice(device, NULL);
+
+    // G.XX. Destory Surface.
+    vkDestroySurfaceKHR(instance, surface, NULL);
+
+    // XY. Destroy instance
+    vkDestroyInstance(instance, NULL);
+
+    // G.XX. Destory GLFW Window.
+    glfwDestroyWindow(window);
+
+    // G.XX. Cleanup GLFW.
+    glfwTerminate();
+
+    return 0;
+}
+
+PostProcessMode ParsePostProcessMode(const char *name) {
+    if (strcmp(name, "off") == 0) {
+        return POST_PROCESS_OFF;
+    } else if (strcmp(name, "serial") == 0) {
+        return POST_PROCESS_SERIAL;
+    } else if (strcmp(name, "async") == 0) {
+        return POST_PROCESS_ASYNC;
+    }
+
+    throw std::runtime_error("unknown post-process mode!");
+}
+
+const char *PostProcessModeName(PostProcessMode mode) {
+    switch (mode) {
+        case POST_PROCESS_OFF: return "off";
+        case POST_PROCESS_SERIAL: return "serial";
+        case POST_PROCESS_ASYNC: return "async";
+        default: return "unknown";
+    }
+}
+
+uint32_t FindComputeQueueFamily(const VkPhysicalDevice device,
+                                uint32_t graphicsQueueFamilyIdx,
+                                uint32_t *outQueueIdx,
+                                bool *hasIdx) {
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    // PP.1.1. Prefer a compute family without graphics support, these are the async compute queues of the GPU.
+    for (uint32_t idx = 0; idx < queueFamilyCount; idx++) {
+        const VkQueueFlags flags = queueFamilies[idx].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            *outQueueIdx = 0;
+            *hasIdx = true;
+            return idx;
+        }
+    }
+
+    // PP.1.2. Otherwise use a second queue of the graphics family (if there is one) if it supports compute.
+    // A graphics family is not required to support compute.
+    if (queueFamilies[graphicsQueueFamilyIdx].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        *outQueueIdx = (queueFamilies[graphicsQueueFamilyIdx].queueCount > 1) ? 1 : 0;
+        *hasIdx = true;
+        return graphicsQueueFamilyIdx;
+    }
+
+    // PP.1.3. Finally any other family with compute support.
+    for (uint32_t idx = 0; idx < queueFamilyCount; idx++) {
+        if (queueFamilies[idx].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            *outQueueIdx = 0;
+            *hasIdx = true;
+            return idx;
+        }
+    }
+
+    *hasIdx = false;
+    return UINT32_MAX;
+}
+
+static void CreatePostProcessImage(const VkDevice device,
+                                   MemoryArena *arena,
+                                   VkImageUsageFlags usage,
+                                   uint32_t width,
+                                   uint32_t height,
+                                   VkImage *outImage,
+                                   ArenaAllocation *outMemory,
+                                   VkImageView *outView) {
+    // The images are exclusive, the queue family ownership is transferred with barriers.
+    VkImageCreateInfo imageInfo;
+    {
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.pNext = NULL;
+        imageInfo.flags = 0;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = g_postProcessFormat;
+        imageInfo.extent = { width, height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.queueFamilyIndexCount = 0;
+        imageInfo.pQueueFamilyIndices = NULL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    if (vkCreateImage(device, &imageInfo, NULL, outImage) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create post-process image!");
+    }
+
+    *outMemory = ArenaAllocateImage(arena, *outImage, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageViewCreateInfo viewInfo;
+    {
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.pNext = NULL;
+        viewInfo.flags = 0;
+        viewInfo.image = *outImage;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = g_postProcessFormat;
+        viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    if (vkCreateImageView(device, &viewInfo, NULL, outView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create post-process image view!");
+    }
+}
+
+static VkImageMemoryBarrier PostProcessBarrier(const VkImage image,
+                                               VkAccessFlags srcAccess,
+                                               VkAccessFlags dstAccess,
+                                               VkImageLayout oldLayout,
+                                               VkImageLayout newLayout,
+                                               uint32_t srcQueueFamilyIdx,
+                                               uint32_t dstQueueFamilyIdx) {
+    VkImageMemoryBarrier barrier;
+    {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = NULL;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = srcQueueFamilyIdx;
+        barrier.dstQueueFamilyIndex = dstQueueFamilyIdx;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    return barrier;
+}
+
+void CreatePostProcess(const VkPhysicalDevice physicalDevice,
+                       const VkDevice device,
+                       const VkPipelineCache pipelineCache,
+                       VkFormat swapFormat,
+                       uint32_t slotCount,
+                       PostProcess *postProcess) {
+    postProcess->ownershipTransfer = (postProcess->graphicsQueueFamilyIdx != postProcess->computeQueueFamilyIdx);
 
-    // 11. Create Pipeline Layout.
-    // Currently there are no descriptors added (no uniforms).
-    VkPipelineLayout pipelineLayout;
+    // PP.2.1. Check the blit support of the formats, the blit converts the filtered image into the Swapchain format.
     {
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo;
-        {
-            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-            pipelineLayoutInfo.pNext = NULL;
-            pipelineLayoutInfo.flags = 0;
-            // D.X. Connect the created Desctiptor Set Layout to the pipeline layout.
-            pipelineLayoutInfo.setLayoutCount = 1;
-            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-            pipelineLayoutInfo.pushConstantRangeCount = 0;
-        }
+        VkFormatProperties srcProperties;
+        VkFormatProperties dstProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, g_postProcessFormat, &srcProperties);
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, swapFormat, &dstProperties);
 
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
+        if (!(srcProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) ||
+            !(dstProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+            throw std::runtime_error("failed to find blit support for the post-process!");
         }
     }
 
-    // 12. Create the Rendering Pipeline
-    VkPipeline pipeline;
+    // PP.2.2. Create the compute shader.
     {
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo;
-        {
-            vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vertShaderStageInfo.pNext = NULL;
-            vertShaderStageInfo.flags = 0;
-            vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vertShaderStageInfo.module = vertShaderModule;
-            vertShaderStageInfo.pName = "main";
-            vertShaderStageInfo.pSpecializationInfo = NULL;
-        }
+        #if HAVE_SHADERC
+        std::vector<char> compSrc = LoadGLSL("postprocess.comp");
+        std::vector<uint32_t> compCode = CompileGLSL(shaderc_compute_shader, compSrc);
+        #else
+        std::vector<uint32_t> compCode = LoadSPIRV("postprocess.comp.spv");
+        #endif
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo;
-        {
-            fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            fragShaderStageInfo.pNext = NULL;
-            fragShaderStageInfo.flags = 0;
-            fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-            fragShaderStageInfo.module = fragShaderModule;
-            fragShaderStageInfo.pName = "main";
-            fragShaderStageInfo.pSpecializationInfo = NULL;
+        if (compCode.size() == 0) {
+            throw std::runtime_error("failed to load compute shader!");
         }
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
-
-        // V.4. Describe the Vertex input binding information.
-        VkVertexInputBindingDescription vec2VertexBinding;
+        VkShaderModuleCreateInfo compInfo;
         {
-            // The binding information is mapped to the VkVertexInputAttributeDescription.binding.
-            vec2VertexBinding.binding = 0;
-            // The stride information is based on the vertex input type: vec2. (see shader)
-            vec2VertexBinding.stride = sizeof(float) * 2;
-            vec2VertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            compInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            compInfo.pNext = NULL;
+            compInfo.flags = 0;
+            compInfo.codeSize = compCode.size() * sizeof(uint32_t);
+            compInfo.pCode = compCode.data();
         }
 
-        // V.5. Describe the Vertex input attribute information.
-        VkVertexInputAttributeDescription positionVertexAttribute;
-        {
-            positionVertexAttribute.binding = 0;
-            // The attribute location is from the Vertex shader.
-            positionVertexAttribute.location = 0;
-            // Format and offset is used during the data read from the buffer.
-            positionVertexAttribute.format = VK_FORMAT_R32G32_SFLOAT;
-            positionVertexAttribute.offset = 0;
+        if (vkCreateShaderModule(device, &compInfo, NULL, &postProcess->shaderModule) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader module!");
         }
+    }
 
-        // V.6. Connect the Attribute and Binding infors to the VertexInputState.
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+    // PP.2.3. Create the Descriptor Set Layout and the Compute Pipeline.
+    {
+        VkDescriptorSetLayoutBinding bindings[] =
         {
-            vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-            vertexInputInfo.pNext = NULL;
-            vertexInputInfo.flags = 0;
-            vertexInputInfo.vertexBindingDescriptionCount = 1;
-            vertexInputInfo.pVertexBindingDescriptions = &vec2VertexBinding;
-            vertexInputInfo.vertexAttributeDescriptionCount = 1;
-            vertexInputInfo.pVertexAttributeDescriptions = &positionVertexAttribute;
-        }
+            {
+                0,                                  // binding
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,   // descriptorType
+                1,                                  // descriptorCount
+                VK_SHADER_STAGE_COMPUTE_BIT,        // stageFlags
+                NULL                                // pImmutableSamplers
+            },
+            {
+                1,                                  // binding
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,   // descriptorType
+                1,                                  // descriptorCount
+                VK_SHADER_STAGE_COMPUTE_BIT,        // stageFlags
+                NULL                                // pImmutableSamplers
+            }
+        };
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+        VkDescriptorSetLayoutCreateInfo setLayoutInfo;
         {
-            inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-            inputAssembly.pNext = NULL;
-            inputAssembly.flags = 0;
-            inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-            inputAssembly.primitiveRestartEnable = VK_FALSE;
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.pNext = NULL;
+            setLayoutInfo.flags = 0;
+            setLayoutInfo.bindingCount = 2;
+            setLayoutInfo.pBindings = bindings;
         }
 
-        VkViewport viewport;
-        {
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) swapExtent.width;
-            viewport.height = (float) swapExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
+        if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, NULL, &postProcess->setLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
         }
 
-        VkRect2D scissor;
+        VkPipelineLayoutCreateInfo layoutInfo;
         {
-            scissor.offset = { 0, 0 };
-            scissor.extent = swapExtent;
+            layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            layoutInfo.pNext = NULL;
+            layoutInfo.flags = 0;
+            layoutInfo.setLayoutCount = 1;
+            layoutInfo.pSetLayouts = &postProcess->setLayout;
+            layoutInfo.pushConstantRangeCount = 0;
+            layoutInfo.pPushConstantRanges = NULL;
         }
 
-        VkPipelineViewportStateCreateInfo viewportState{};
-        {
-            viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-            viewportState.viewportCount = 1;
-            viewportState.pViewports = &viewport;
-            viewportState.scissorCount = 1;
-            viewportState.pScissors = &scissor;
+        if (vkCreatePipelineLayout(device, &layoutInfo, NULL, &postProcess->pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
         }
 
-        VkPipelineRasterizationStateCreateInfo rasterizer;
-        {
-            rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-            rasterizer.pNext = NULL;
-            rasterizer.flags = 0;
-            rasterizer.depthClampEnable = VK_FALSE;
-            rasterizer.rasterizerDiscardEnable = VK_FALSE;
-            rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-            rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-            rasterizer.depthBiasEnable = VK_FALSE;
-            rasterizer.depthBiasConstantFactor = 0.0;
-            rasterizer.depthBiasClamp = 0.0;
-            rasterizer.depthBiasSlopeFactor = 0.0;
-            rasterizer.lineWidth = 1.0f;
-        }
-
-        VkPipelineMultisampleStateCreateInfo multisampling;
-        {
-            multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-            multisampling.pNext = NULL;
-            multisampling.flags = 0;
-            multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-            multisampling.sampleShadingEnable = VK_FALSE;
-            multisampling.minSampleShading = 0.0;
-            multisampling.pSampleMask = NULL;
-            multisampling.alphaToCoverageEnable = VK_FALSE;
-            multisampling.alphaToOneEnable = VK_FALSE;
-        }
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment;
-        {
-            colorBlendAttachment.blendEnable = VK_FALSE;
-            colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-                                                  | VK_COLOR_COMPONENT_G_BIT
-                                                  | VK_COLOR_COMPONENT_B_BIT
-                                                  | VK_COLOR_COMPONENT_A_BIT;
-        }
-
-        VkPipelineColorBlendStateCreateInfo colorBlending;
+        VkComputePipelineCreateInfo pipelineInfo;
         {
-            colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-            colorBlending.pNext = NULL;
-            colorBlending.flags = 0;
-            colorBlending.logicOpEnable = VK_FALSE;
-            colorBlending.logicOp = VK_LOGIC_OP_COPY;
-            colorBlending.attachmentCount = 1;
-            colorBlending.pAttachments = &colorBlendAttachment;
-            colorBlending.blendConstants[0] = 0.0f;
-            colorBlending.blendConstants[1] = 0.0f;
-            colorBlending.blendConstants[2] = 0.0f;
-            colorBlending.blendConstants[3] = 0.0f;
-        }
-
-        VkGraphicsPipelineCreateInfo pipelineInfo;
-        {
-            pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
             pipelineInfo.pNext = NULL;
             pipelineInfo.flags = 0;
-            pipelineInfo.stageCount = 2;
-            pipelineInfo.pStages = shaderStages;
-            pipelineInfo.pVertexInputState = &vertexInputInfo;
-            pipelineInfo.pInputAssemblyState = &inputAssembly;
-            pipelineInfo.pTessellationState = NULL;
-            pipelineInfo.pViewportState = &viewportState;
-            pipelineInfo.pRasterizationState = &rasterizer;
-            pipelineInfo.pMultisampleState = &multisampling;
-            pipelineInfo.pDepthStencilState = NULL;
-            pipelineInfo.pColorBlendState = &colorBlending;
-            pipelineInfo.pDynamicState = NULL;
-            pipelineInfo.layout = pipelineLayout;
-            pipelineInfo.renderPass = renderPass;
-            pipelineInfo.subpass = 0;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.pNext = NULL;
+            pipelineInfo.stage.flags = 0;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = postProcess->shaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.stage.pSpecializationInfo = NULL;
+            pipelineInfo.layout = postProcess->pipelineLayout;
             pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-            pipelineInfo.basePipelineIndex = 0;
-        }
-
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
-        }
-    }
-
-    // G.8. Create Frambuffer for each Swapchain Image view.
-    // Replaces old 13. step.
-    std::vector<VkFramebuffer> framebuffers;
-    {
-        framebuffers.resize(swapImageViews.size());
-
-        VkFramebufferCreateInfo framebufferInfo;
-        {
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.pNext = NULL;
-            framebufferInfo.flags = 0;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = 1;
-            //framebufferInfo.pAttachments = &renderImageView;
-            framebufferInfo.width = swapExtent.width;
-            framebufferInfo.height = swapExtent.height;
-            framebufferInfo.layers = 1;
+            pipelineInfo.basePipelineIndex = -1;
         }
 
-        for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-            framebufferInfo.pAttachments = &swapImageViews[idx];
-
-            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &framebuffers[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
-            }
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &postProcess->pipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
         }
     }
 
-    // 14. Create Command Pool.
-    // Required to create Command buffers.
-    VkCommandPool cmdPool;
+    // PP.2.4. Create the Command Pools, the filter commands are recorded for the compute queue family.
     {
         VkCommandPoolCreateInfo poolInfo;
         {
             poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
             poolInfo.pNext = NULL;
             poolInfo.flags = 0;
-            poolInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-        }
-
-        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create command pool!");
-        }
-    }
-
-    // G.9. Create a Command Buffer for each Swapchain Image View (Framebuffer).
-    std::vector<VkCommandBuffer> cmdBuffers;
-    {
-        cmdBuffers.resize(swapImageViews.size());
-
-        VkCommandBufferAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = cmdBuffers.size();
-        }
-
-        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
-        }
-    }
-
-    // Start recording draw commands.
-    // G.10. In the current example all Command Buffers will have the same data.
-
-    // 16. Start Command Buffer
-    // G.11. Start all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        VkCommandBufferBeginInfo beginInfo;
-        {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
-            // can't be used.
-            beginInfo.flags = 0;
-            beginInfo.pInheritanceInfo = NULL;
+            poolInfo.queueFamilyIndex = postProcess->computeQueueFamilyIdx;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffers[idx], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-    }
-
-    // 17. Insert draw commands into Command Buffer.
-    // G.12. Insert same draw commands into all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        // 17.1. Add Begin RenderPass command
-        // This makes it possible to use the vmCmdDraw* calls.
-        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-        VkRenderPassBeginInfo renderPassInfo;
-        {
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.pNext = NULL;
-            renderPassInfo.renderPass = renderPass;
-            // G.12.1. Each Command Buffer will use a different Framebuffer
-            renderPassInfo.framebuffer = framebuffers[idx];
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &postProcess->filterCmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create post-process command pool!");
         }
 
-        vkCmdBeginRenderPass(cmdBuffers[idx], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
-        vkCmdBindPipeline(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-        // D.X. Bind descriptor set
-        vkCmdBindDescriptorSets(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
-
-        // V.7. Bind the Vertex buffers as specified by the pipeline.
-        VkDeviceSize bufferOffsets[] = { 0 };
-        vkCmdBindVertexBuffers(cmdBuffers[idx], 0, 1, &vertexBuffer, bufferOffsets);
-
-        // 17.3. Add a Draw command.
-        // Draw 3 vertices using the pipeline bound previously.
-        uint32_t vertexCount = 3;
-        uint32_t instanceCount = 1;
-
-        // D.XX. Only render a single instance (color "rotation" is done in a different way).
-        vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, 0);
-
-        // 17.4. End the Render Pass.
-        vkCmdEndRenderPass(cmdBuffers[idx]);
-    }
-
-    // 18. End the Command Buffer recording.
-    // G.13. End all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        if (vkEndCommandBuffer(cmdBuffers[idx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+        poolInfo.queueFamilyIndex = postProcess->graphicsQueueFamilyIdx;
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &postProcess->blitCmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create post-process command pool!");
         }
     }
 
-    // Recording of the draw commands into the Command Buffer is done.
-    // Now the Command Buffer should be sent to the GPU.
-
-    const uint32_t imagesInFlight = 2;
-
-    // G.14. As there are multiple images now more sync objects are required.
-    // This replaces the old 19. step.
-    // imageAvailableSemaphores will store the Semaphores to check if the next image is available to draw on to.
-    std::vector<VkSemaphore> imageAvailableSemaphores;
-    // renderFinishedSemaphores will store the Semaphores to check if the image finished rendering.
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> swapImagesFences;
-    std::vector<VkFence> activeFences;
-    {
-        imageAvailableSemaphores.resize(imagesInFlight);
-        renderFinishedSemaphores.resize(imagesInFlight);
-        activeFences.resize(imagesInFlight);
-        swapImagesFences.resize(swapImages.size(), VK_NULL_HANDLE);
-
+    // PP.2.5. Create the semaphores which link the graphics and the compute queue.
+    if (postProcess->mode == POST_PROCESS_ASYNC) {
         VkSemaphoreCreateInfo semaphoreInfo;
         {
             semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1189,454 +2175,617 @@ int main(int argc, char **argv) {
             semaphoreInfo.flags = 0;
         }
 
-        VkFenceCreateInfo fenceInfo;
-        {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;;
-        }
-
-        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
-            if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &imageAvailableSemaphores[idx]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, NULL, &renderFinishedSemaphores[idx]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, NULL, &activeFences[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create synchronization objects for a frame!");
+        postProcess->sceneReadySemaphores.resize(slotCount);
+        postProcess->filterDoneSemaphores.resize(slotCount);
+        for (uint32_t idx = 0; idx < slotCount; idx++) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &postProcess->sceneReadySemaphores[idx]) != VK_SUCCESS ||
+                vkCreateSemaphore(device, &semaphoreInfo, NULL, &postProcess->filterDoneSemaphores[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create post-process semaphores!");
             }
         }
     }
+}
 
-    // G.25. Draw and Present loop.
-    // Draw and Present a series of images.
-    uint32_t activeSyncIdx = 0;
-    while (!glfwWindowShouldClose(window)) {
-        // G.25.0. Run GLFW event polling.
-        glfwPollEvents();
-
-        // D.X. Update the Uniform Buffer data in each frame.
+void CreatePostProcessTargets(const VkDevice device,
+                              MemoryArena *arena,
+                              const std::vector<VkImage>& swapImages,
+                              VkImageLayout swapLayout,
+                              uint32_t width,
+                              uint32_t height,
+                              PostProcess *postProcess) {
+    const uint32_t targetCount = (uint32_t)swapImages.size();
+    const uint32_t graphicsIdx = postProcess->graphicsQueueFamilyIdx;
+    const uint32_t computeIdx = postProcess->computeQueueFamilyIdx;
+
+    // Queue family indices of the ownership transfer barriers.
+    const uint32_t releaseGraphicsIdx = postProcess->ownershipTransfer ? graphicsIdx : VK_QUEUE_FAMILY_IGNORED;
+    const uint32_t releaseComputeIdx = postProcess->ownershipTransfer ? computeIdx : VK_QUEUE_FAMILY_IGNORED;
+
+    // PP.2.6. Create the Descriptor Pool, it is sized for the current number of Swapchain images.
+    {
+        VkDescriptorPoolSize poolSize;
         {
-            // D.X.1. Map buffer memory to "data" pointer.
-            void *data;
-            if (vkMapMemory(device, uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-                throw std::runtime_error("failed to map uniform buffer!");
-            }
-
-            // D.X.2. Change the uniform data.
-            // Rotate the data by 4 floats.
-            std::rotate(uniformData.begin(), uniformData.begin() + 4, uniformData.end());
-
-            // D.X.3. Copy data into the "data".
-            ::memcpy(data, uniformData.data(), sizeof(float) * uniformData.size());
-
-            // D.X.4. Flush the data.
-            // This is required as a non-coherent buffer was created.
-            VkMappedMemoryRange memoryRange;
-            {
-                memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-                memoryRange.pNext = NULL;
-                memoryRange.memory = uniformBufferMemory;
-                memoryRange.offset = 0;
-                memoryRange.size = VK_WHOLE_SIZE;
-            }
-            vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-            // D.X.5. Unmap the mapped uniform buffer.
-            // After this the "data" pointer is a non-valid pointer.
-            vkUnmapMemory(device, uniformBufferMemory);
-        }
-
-        // G.25.1. Wait for the previous fence to "finish".
-        vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
-
-        // G.25.2. Get the next Swapchain Image Index.
-        uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
-
-        // G.25.3. Wait for the target image to be available.
-        if (swapImagesFences[imageIndex] != VK_NULL_HANDLE) {
-            vkWaitForFences(device, 1, &swapImagesFences[imageIndex], VK_TRUE, UINT64_MAX);
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            poolSize.descriptorCount = 2 * targetCount;
         }
-        // Connect the current fence to the given swapchaing image.
-        swapImagesFences[imageIndex] = activeFences[activeSyncIdx];
-
-        // Configure a few sync points.
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx] };
 
-        // G.25.4. Build the Submit info using the sync points.
-        VkSubmitInfo submitInfo;
+        VkDescriptorPoolCreateInfo poolInfo;
         {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 1;
-            submitInfo.pWaitSemaphores = waitSemaphores;
-            submitInfo.pWaitDstStageMask = waitStages;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffers[imageIndex];
-            submitInfo.signalSemaphoreCount = 1;
-            submitInfo.pSignalSemaphores = signalSemaphores;
-        }
-
-        vkResetFences(device, 1, &activeFences[activeSyncIdx]);
-
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.maxSets = targetCount;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
         }
 
-        VkPresentInfoKHR presentInfo;
-        {
-            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-            presentInfo.pNext = 0;
-            presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = signalSemaphores;
-            presentInfo.swapchainCount = 1;
-            presentInfo.pSwapchains = &swapchain;
-            presentInfo.pImageIndices = &imageIndex;
-            presentInfo.pResults = NULL;
+        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &postProcess->descriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
         }
 
-        vkQueuePresentKHR(queue, &presentInfo);
-
-        activeSyncIdx = (activeSyncIdx + 1) % imagesInFlight;
-
-        // G.XX. Artificially slow down the rendering to avoid Epileptic seizure.
-        usleep((int)(0.15 * 1000000));
     }
 
-    // At this point the image is rendered into the Framebuffer's attachment which is an ImageView.
+    // PP.2.7. Create the scene and output images of each Swapchain image.
+    postProcess->targets.resize(targetCount);
+    for (uint32_t idx = 0; idx < targetCount; idx++) {
+        PostProcessTarget& target = postProcess->targets[idx];
 
-    {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, swapImages[0], renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
-
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
-        }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
+        CreatePostProcessImage(device, arena, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                               width, height, &target.sceneImage, &target.sceneMemory, &target.sceneView);
+        CreatePostProcessImage(device, arena, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                               width, height, &target.outputImage, &target.outputMemory, &target.outputView);
 
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
+        VkDescriptorSetAllocateInfo allocInfo;
         {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.descriptorPool = postProcess->descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &postProcess->setLayout;
         }
 
-        // 25. Write out the image to a ppm file.
-        {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+        if (vkAllocateDescriptorSets(device, &allocInfo, &target.descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
         }
 
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
+        VkDescriptorImageInfo imageInfos[2];
+        {
+            imageInfos[0].sampler = VK_NULL_HANDLE;
+            imageInfos[0].imageView = target.sceneView;
+            imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageInfos[1].sampler = VK_NULL_HANDLE;
+            imageInfos[1].imageView = target.outputView;
+            imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
 
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
+        VkWriteDescriptorSet writes[2];
+        for (uint32_t binding = 0; binding < 2; binding++) {
+            writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[binding].pNext = NULL;
+            writes[binding].dstSet = target.descriptorSet;
+            writes[binding].dstBinding = binding;
+            writes[binding].dstArrayElement = 0;
+            writes[binding].descriptorCount = 1;
+            writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[binding].pImageInfo = &imageInfos[binding];
+            writes[binding].pBufferInfo = NULL;
+            writes[binding].pTexelBufferView = NULL;
+        }
 
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
+        vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
     }
 
-    // G.XX. Destroy Sync object.
-    for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
-        vkDestroySemaphore(device, imageAvailableSemaphores[idx], NULL);
-        vkDestroySemaphore(device, renderFinishedSemaphores[idx], NULL);
-        vkDestroyFence(device, activeFences[idx], NULL);
-    }
+    // PP.2.8. Allocate and record the filter and blit Command Buffers, they are re-submitted for every frame.
+    {
+        std::vector<VkCommandBuffer> filterCmdBuffers(targetCount);
+        std::vector<VkCommandBuffer> blitCmdBuffers(targetCount);
 
-    // G.XX. Free Command Buffers.
-    vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = postProcess->filterCmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = targetCount;
+        }
 
-    // XX. Destroy Command Pool
-    vkDestroyCommandPool(device, cmdPool, NULL);
+        if (vkAllocateCommandBuffers(device, &allocInfo, filterCmdBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate post-process command buffers!");
+        }
 
-    // G.XX. Destory Framebuffers
-    for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-        vkDestroyFramebuffer(device, framebuffers[idx], NULL);
+        allocInfo.commandPool = postProcess->blitCmdPool;
+        if (vkAllocateCommandBuffers(device, &allocInfo, blitCmdBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate post-process command buffers!");
+        }
+
+        for (uint32_t idx = 0; idx < targetCount; idx++) {
+            postProcess->targets[idx].filterCmdBuffer = filterCmdBuffers[idx];
+            postProcess->targets[idx].blitCmdBuffer = blitCmdBuffers[idx];
+        }
     }
 
-    // XX. Destory Pipeline.
-    vkDestroyPipeline(device, pipeline, NULL);
+    VkCommandBufferBeginInfo beginInfo;
+    {
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.pNext = NULL;
+        beginInfo.flags = 0;
+        beginInfo.pInheritanceInfo = NULL;
+    }
 
-    // XX. Destory Fragment Shader Module.
-    vkDestroyShaderModule(device, fragShaderModule, NULL);
+    for (uint32_t idx = 0; idx < targetCount; idx++) {
+        const PostProcessTarget& target = postProcess->targets[idx];
 
-    // XX. Destory Vertex Shader Module.
-    vkDestroyShaderModule(device, vertShaderModule, NULL);
+        // PP.2.9. Filter: acquire the scene image from the graphics family (the release is in the draw Command Buffer),
+        // the previous contents of the output image are not needed.
+        const VkCommandBuffer filterCmd = target.filterCmdBuffer;
+        if (vkBeginCommandBuffer(filterCmd, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
 
-    // XX. Destory Pipeline Layout.
-    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+        {
+            VkImageMemoryBarrier barriers[2];
+            uint32_t barrierCount = 0;
+            if (postProcess->ownershipTransfer) {
+                barriers[barrierCount++] = PostProcessBarrier(target.sceneImage, 0, VK_ACCESS_SHADER_READ_BIT,
+                                                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                                                              graphicsIdx, computeIdx);
+            }
+            barriers[barrierCount++] = PostProcessBarrier(target.outputImage, 0, VK_ACCESS_SHADER_WRITE_BIT,
+                                                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                          VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
 
-    // D.XX. Free Uniform Buffer memory.
-    vkFreeMemory(device, uniformBufferMemory, NULL);
+            vkCmdPipelineBarrier(filterCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 0, NULL, 0, NULL, barrierCount, barriers);
+        }
 
-    // D.XX. Destroy Uniform Buffer.
-    vkDestroyBuffer(device, uniformBuffer, NULL);
+        vkCmdBindPipeline(filterCmd, VK_PIPELINE_BIND_POINT_COMPUTE, postProcess->pipeline);
+        vkCmdBindDescriptorSets(filterCmd, VK_PIPELINE_BIND_POINT_COMPUTE, postProcess->pipelineLayout, 0, 1, &target.descriptorSet, 0, NULL);
+        vkCmdDispatch(filterCmd,
+                      (width + g_postProcessGroupSize - 1) / g_postProcessGroupSize,
+                      (height + g_postProcessGroupSize - 1) / g_postProcessGroupSize,
+                      1);
 
-    // D.XX. Free Descriptor Set.
-    vkResetDescriptorPool(device, descriptorPool, 0);
+        // PP.2.10. Release the output image to the graphics family (or make it available for the blit).
+        {
+            const VkImageMemoryBarrier barrier =
+                PostProcessBarrier(target.outputImage, VK_ACCESS_SHADER_WRITE_BIT,
+                                   postProcess->ownershipTransfer ? 0 : VK_ACCESS_TRANSFER_READ_BIT,
+                                   VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   releaseComputeIdx, releaseGraphicsIdx);
+            const VkPipelineStageFlags dstStage =
+                postProcess->ownershipTransfer ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
 
-    // D.XX. Destroy Descriptor Pool.
-    vkDestroyDescriptorPool(device, descriptorPool, NULL);
+            vkCmdPipelineBarrier(filterCmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage,
+                                 0, 0, NULL, 0, NULL, 1, &barrier);
+        }
 
-    // D.XX. Destroy Descriptor Set Layout.
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
+        if (vkEndCommandBuffer(filterCmd) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
 
-    // XX. Destory Render Pass.
-    vkDestroyRenderPass(device, renderPass, NULL);
+        // PP.2.11. Blit: acquire the output image and copy it into the Swapchain image.
+        // The blit waits in the transfer stage, for the filter (async mode) and for the acquired Swapchain image.
+        const VkCommandBuffer blitCmd = target.blitCmdBuffer;
+        if (vkBeginCommandBuffer(blitCmd, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
 
-    // XX. Free the Vertex Buffer's memory.
-    vkFreeMemory(device, vertexBufferMemory, NULL);
+        {
+            VkImageMemoryBarrier barriers[2];
+            uint32_t barrierCount = 0;
+            if (postProcess->ownershipTransfer) {
+                barriers[barrierCount++] = PostProcessBarrier(target.outputImage, 0, VK_ACCESS_TRANSFER_READ_BIT,
+                                                              VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                              computeIdx, graphicsIdx);
+            }
+            barriers[barrierCount++] = PostProcessBarrier(swapImages[idx], 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                          VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
 
-    // XX. Destroy the Vertex Buffer.
-    vkDestroyBuffer(device, vertexBuffer, NULL);
+            vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 0, NULL, 0, NULL, barrierCount, barriers);
+        }
 
-    // G.XX. Destroy swapchain image views.
-    for (size_t idx = 0; idx < swapImageViews.size(); idx++) {
-        vkDestroyImageView(device, swapImageViews[idx], NULL);
-    }
+        // The blit also converts the colors into the Swapchain format (ex.: sRGB encoding, BGRA order).
+        VkImageBlit region;
+        {
+            region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.srcOffsets[0] = { 0, 0, 0 };
+            region.srcOffsets[1] = { (int32_t)width, (int32_t)height, 1 };
+            region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.dstOffsets[0] = { 0, 0, 0 };
+            region.dstOffsets[1] = { (int32_t)width, (int32_t)height, 1 };
+        }
 
-    // G.XX. Destroy swapchain.
-    vkDestroySwapchainKHR(device, swapchain, NULL);
+        vkCmdBlitImage(blitCmd,
+                       target.outputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       swapImages[idx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1, &region, VK_FILTER_NEAREST);
 
-    // XX. Destroy Device
-    vkDestroyDevice(device, NULL);
+        // PP.2.12. Move the Swapchain image to the layout the render pass would leave it in.
+        // The readback (if any) continues in the transfer stage.
+        {
+            const VkImageMemoryBarrier barrier =
+                PostProcessBarrier(swapImages[idx], VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, swapLayout,
+                                   VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
 
-    // G.XX. Destory Surface.
-    vkDestroySurfaceKHR(instance, surface, NULL);
+            vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 0, NULL, 0, NULL, 1, &barrier);
+        }
 
-    // XY. Destroy instance
-    vkDestroyInstance(instance, NULL);
+        if (vkEndCommandBuffer(blitCmd) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+}
 
-    // G.XX. Destory GLFW Window.
-    glfwDestroyWindow(window);
+void DestroyPostProcess(const VkDevice device, MemoryArena *arena, PostProcess *postProcess) {
+    DestroyPostProcessTargets(device, arena, postProcess);
 
-    // G.XX. Cleanup GLFW.
-    glfwTerminate();
+    for (size_t idx = 0; idx < postProcess->sceneReadySemaphores.size(); idx++) {
+        vkDestroySemaphore(device, postProcess->sceneReadySemaphores[idx], NULL);
+        vkDestroySemaphore(device, postProcess->filterDoneSemaphores[idx], NULL);
+    }
 
-    return 0;
+    vkDestroyCommandPool(device, postProcess->filterCmdPool, NULL);
+    vkDestroyCommandPool(device, postProcess->blitCmdPool, NULL);
+    vkDestroyPipeline(device, postProcess->pipeline, NULL);
+    vkDestroyPipelineLayout(device, postProcess->pipelineLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, postProcess->setLayout, NULL);
+    vkDestroyShaderModule(device, postProcess->shaderModule, NULL);
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
+void DestroyPostProcessTargets(const VkDevice device, MemoryArena *arena, PostProcess *postProcess) {
+    // The caller must make sure that the targets are no longer in use.
+    for (size_t idx = 0; idx < postProcess->targets.size(); idx++) {
+        PostProcessTarget& target = postProcess->targets[idx];
+
+        vkFreeCommandBuffers(device, postProcess->filterCmdPool, 1, &target.filterCmdBuffer);
+        vkFreeCommandBuffers(device, postProcess->blitCmdPool, 1, &target.blitCmdBuffer);
+        vkDestroyImageView(device, target.sceneView, NULL);
+        vkDestroyImage(device, target.sceneImage, NULL);
+        ArenaFree(arena, target.sceneMemory);
+        vkDestroyImageView(device, target.outputView, NULL);
+        vkDestroyImage(device, target.outputImage, NULL);
+        ArenaFree(arena, target.outputMemory);
     }
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
-
-            // G.XX. Check if the selected graphics queue family supports presentation.
-            // At the moment the example expects that the graphics and presentation queue is the same.
-            // This is not always the case.
-            // TODO: add support for different graphics and presentation family indices.
-            VkBool32 presentSupport;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, queueFamilyIdx, surface, &presentSupport);
-            if (presentSupport) {
-                return queueFamilyIdx;
-            }
-        }
+    // The Descriptor Sets are freed with their pool.
+    vkDestroyDescriptorPool(device, postProcess->descriptorPool, NULL);
+    postProcess->targets.clear();
+}
 
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
+void RecordSceneRelease(const PostProcess& postProcess, const VkCommandBuffer cmdBuffer, uint32_t targetIdx) {
+    // PP.3. Hand over the rendered scene image to the filter.
+    // With different queue families this is the release half of the ownership transfer,
+    // the destination access is executed by the acquire barrier of the filter Command Buffer.
+    const VkImage sceneImage = postProcess.targets[targetIdx].sceneImage;
+
+    VkImageMemoryBarrier barrier;
+    VkPipelineStageFlags dstStage;
+    if (postProcess.ownershipTransfer) {
+        barrier = PostProcessBarrier(sceneImage, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
+                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                                     postProcess.graphicsQueueFamilyIdx, postProcess.computeQueueFamilyIdx);
+        dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    } else {
+        barrier = PostProcessBarrier(sceneImage, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                                     VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+        dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
     }
 
-    return UINT32_MAX;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, dstStage,
+                         0, 0, NULL, 0, NULL, 1, &barrier);
 }
 
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
+void SubmitAsyncPostProcess(const PostProcess& postProcess,
+                            const VkQueue queue,
+                            const VkCommandBuffer *renderCmdBuffers,
+                            uint32_t renderCmdBufferCount,
+                            const VkCommandBuffer *blitCmdBuffers,
+                            uint32_t blitCmdBufferCount,
+                            uint32_t targetIdx,
+                            uint32_t slot,
+                            const VkSemaphore waitSemaphore,
+                            const VkSemaphore signalSemaphore,
+                            const VkFence fence) {
+    // PP.4. The frame is split into three batches: render -> filter (compute queue) -> blit.
+    // The graphics queue only waits for the filter in the transfer stage of the blit, so the
+    // draw commands of the next frame can run while the filter of this frame is executed.
+    const VkSemaphore sceneReady = postProcess.sceneReadySemaphores[slot];
+    const VkSemaphore filterDone = postProcess.filterDoneSemaphores[slot];
+
+    // PP.4.1. Render batch on the graphics queue.
+    VkSubmitInfo renderInfo;
+    {
+        renderInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        renderInfo.pNext = NULL;
+        renderInfo.waitSemaphoreCount = 0;
+        renderInfo.pWaitSemaphores = NULL;
+        renderInfo.pWaitDstStageMask = NULL;
+        renderInfo.commandBufferCount = renderCmdBufferCount;
+        renderInfo.pCommandBuffers = renderCmdBuffers;
+        renderInfo.signalSemaphoreCount = 1;
+        renderInfo.pSignalSemaphores = &sceneReady;
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
-}
+    if (vkQueueSubmit(queue, 1, &renderInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
 
-#if HAVE_SHADERC
+    // PP.4.2. Filter batch on the compute queue.
+    const VkPipelineStageFlags filterWaitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkSubmitInfo filterInfo;
+    {
+        filterInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        filterInfo.pNext = NULL;
+        filterInfo.waitSemaphoreCount = 1;
+        filterInfo.pWaitSemaphores = &sceneReady;
+        filterInfo.pWaitDstStageMask = &filterWaitStage;
+        filterInfo.commandBufferCount = 1;
+        filterInfo.pCommandBuffers = &postProcess.targets[targetIdx].filterCmdBuffer;
+        filterInfo.signalSemaphoreCount = 1;
+        filterInfo.pSignalSemaphores = &filterDone;
+    }
 
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+    if (vkQueueSubmit(postProcess.computeQueue, 1, &filterInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+    // PP.4.3. Blit batch on the graphics queue, it also waits for the acquired Swapchain image (if any).
+    // The fence of the frame is signaled here, after the filter and the blit are both done.
+    VkSemaphore blitWaitSemaphores[] = { filterDone, waitSemaphore };
+    VkPipelineStageFlags blitWaitStages[] = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT };
+    VkSubmitInfo blitInfo;
+    {
+        blitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        blitInfo.pNext = NULL;
+        blitInfo.waitSemaphoreCount = (waitSemaphore != VK_NULL_HANDLE) ? 2 : 1;
+        blitInfo.pWaitSemaphores = blitWaitSemaphores;
+        blitInfo.pWaitDstStageMask = blitWaitStages;
+        blitInfo.commandBufferCount = blitCmdBufferCount;
+        blitInfo.pCommandBuffers = blitCmdBuffers;
+        blitInfo.signalSemaphoreCount = (signalSemaphore != VK_NULL_HANDLE) ? 1 : 0;
+        blitInfo.pSignalSemaphores = &signalSemaphore;
     }
 
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
+    if (vkQueueSubmit(queue, 1, &blitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
 }
 
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+void CreateUniformSlices(const VkPhysicalDevice physicalDevice,
+                         const VkDevice device,
+                         MemoryArena *arena,
+                         const VkDescriptorSet descriptorSet,
+                         VkDeviceSize dataSize,
+                         VkDeviceSize sliceSize,
+                         uint32_t count,
+                         UniformSlices *outSlices) {
+    // D.5.1. Create a Buffer of the Uniform data.
+    {
+        VkBufferCreateInfo bufferInfo;
+        {
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = NULL;
+            bufferInfo.flags = 0;
+            // Make the buffer big enough for all slices.
+            bufferInfo.size = sliceSize * count;
+            // The buffer will be used as an Uniform Buffer.
+            bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = NULL;
+        }
 
-    return { module.begin(), module.end() };
-}
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &outSlices->buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create uniform buffer!");
+        }
+    }
 
-#else
+    // D.5.2. Allocate memory for the Uniform Buffer.
+    // The memory is sub-allocated from the memory arena and bound to the buffer.
+    // The CPU rewrites the data in every frame, so device local memory is only used if it is
+    // also host visible (ReBAR/UMA), otherwise the buffer stays in host visible memory.
+    {
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, outSlices->buffer, &memRequirements);
 
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
+        uint32_t memoryTypeIndex = FindPreferredMemoryType(physicalDevice,
+                                                           memRequirements.memoryTypeBits,
+                                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
+        outSlices->memory = ArenaAllocate(arena, memRequirements, memoryTypeIndex, true);
+        vkBindBufferMemory(device, outSlices->buffer, outSlices->memory.memory, outSlices->memory.offset);
     }
 
-    size_t fileSize = (size_t) file.tellg();
+    // D.5.3. The slices are written in the draw loop, so there is no upload here.
+    outSlices->mapped = (uint8_t*)outSlices->memory.mapped;
+    outSlices->count = count;
 
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
-    }
+    // D.5.4. Update Descriptor Set contents.
+    {
+        VkDescriptorBufferInfo bufferInfo;
+        {
+            bufferInfo.buffer = outSlices->buffer;
+            bufferInfo.offset = 0;
+            // The dynamic offset selects the slice, the range covers a single slice.
+            bufferInfo.range = dataSize;
+        }
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+        VkWriteDescriptorSet descriptorWrite;
+        {
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.pNext = NULL;
+            descriptorWrite.dstSet = descriptorSet;
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrite.pImageInfo = NULL;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            descriptorWrite.pTexelBufferView = NULL;
+        }
 
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, NULL);
+    }
+}
 
-    file.close();
+void DestroyUniformSlices(const VkDevice device, MemoryArena *arena, UniformSlices *slices) {
+    ArenaFree(arena, slices->memory);
+    vkDestroyBuffer(device, slices->buffer, NULL);
 
-    return buffer;
+    slices->buffer = VK_NULL_HANDLE;
+    slices->mapped = NULL;
+    slices->count = 0;
 }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
+void CreateFramebuffers(const VkDevice device,
+                        const VkRenderPass renderPass,
+                        VkFormat format,
+                        VkExtent2D extent,
+                        const std::vector<VkImage>& images,
+                        const PostProcess& postProcess,
+                        std::vector<VkImageView> *outImageViews,
+                        std::vector<VkFramebuffer> *outFramebuffers) {
+    // G.7.1. Create Image Views for the Swapchain Images.
+    outImageViews->resize(images.size());
     {
-        VkImageCreateInfo imageInfo;
+        VkImageViewCreateInfo createInfo;
         {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            //createInfo.image = renderImage;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = format;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
         }
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            createInfo.image = images[idx];
+
+            if (vkCreateImageView(device, &createInfo, NULL, &(*outImageViews)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
+            }
         }
     }
 
-    *outImage = readableImage;
-
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
+    // G.8.1. Create Frambuffer for each Swapchain Image view.
+    outFramebuffers->resize(images.size());
     {
-        // A.2.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
-
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
+        VkFramebufferCreateInfo framebufferInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.pNext = NULL;
+            framebufferInfo.flags = 0;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            //framebufferInfo.pAttachments = &renderImageView;
+            framebufferInfo.width = extent.width;
+            framebufferInfo.height = extent.height;
+            framebufferInfo.layers = 1;
         }
 
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            // PP. With the post-process the draw commands render into the scene images.
+            framebufferInfo.pAttachments = (postProcess.mode != POST_PROCESS_OFF) ? &postProcess.targets[idx].sceneView : &(*outImageViews)[idx];
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &(*outFramebuffers)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
         }
+    }
+}
+
+void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers) {
+    for (size_t idx = 0; idx < framebuffers->size(); idx++) {
+        vkDestroyFramebuffer(device, (*framebuffers)[idx], NULL);
+    }
 
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
+    for (size_t idx = 0; idx < imageViews->size(); idx++) {
+        vkDestroyImageView(device, (*imageViews)[idx], NULL);
     }
 
-    *outMemory = readableImageMemory;
+    framebuffers->clear();
+    imageViews->clear();
+}
 
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
+void RecordDrawCommands(const VkDevice device,
+                        const VkCommandPool cmdPool,
+                        const VkRenderPass renderPass,
+                        const VkPipeline pipeline,
+                        const VkPipelineLayout pipelineLayout,
+                        const VkDescriptorSet descriptorSet,
+                        VkDeviceSize uniformSliceSize,
+                        const VkBuffer vertexBuffer,
+                        const VertexLayoutData& vertexLayout,
+                        const std::vector<VkFramebuffer>& framebuffers,
+                        const PostProcess& postProcess,
+                        VkExtent2D extent,
+                        std::vector<VkCommandBuffer> *outCmdBuffers) {
+    std::vector<VkCommandBuffer>& cmdBuffers = *outCmdBuffers;
+
+    // G.9.1. Allocate a Command Buffer for each Framebuffer.
     {
+        cmdBuffers.resize(framebuffers.size());
+
         VkCommandBufferAllocateInfo allocInfo;
         {
             allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.pNext = NULL;
             allocInfo.commandPool = cmdPool;
             allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            allocInfo.commandBufferCount = cmdBuffers.size();
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate command buffers!");
         }
     }
 
-    // Start recording image copy commands.
+    // Start recording draw commands.
+    // G.10. In the current example all Command Buffers will have the same data.
+    // G.12. Each Command Buffer uses a different Framebuffer and Uniform Buffer slice (idx).
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++) {
+        // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
+        // can't be used.
+        RecordFrameCommands(cmdBuffers[idx], 0, renderPass, pipeline, pipelineLayout, descriptorSet, uniformSliceSize,
+                            vertexBuffer, vertexLayout, framebuffers[idx], postProcess, extent, (uint32_t)idx);
+    }
+}
 
-    // A.4. Start Command Buffer.
+void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                         VkCommandBufferUsageFlags usageFlags,
+                         const VkRenderPass renderPass,
+                         const VkPipeline pipeline,
+                         const VkPipelineLayout pipelineLayout,
+                         const VkDescriptorSet descriptorSet,
+                         VkDeviceSize uniformSliceSize,
+                         const VkBuffer vertexBuffer,
+                         const VertexLayoutData& vertexLayout,
+                         const VkFramebuffer framebuffer,
+                         const PostProcess& postProcess,
+                         VkExtent2D extent,
+                         uint32_t imageIdx) {
+    // 16. Start Command Buffer
     {
         VkCommandBufferBeginInfo beginInfo;
         {
             beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
             beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.flags = usageFlags;
             beginInfo.pInheritanceInfo = NULL;
         }
 
@@ -1645,147 +2794,77 @@ void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
         }
     }
 
-    // A.4. Transition destination image to transfer destination layout.
+    // 17. Insert draw commands into Command Buffer.
     {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        // 17.1. Add Begin RenderPass command
+        // This makes it possible to use the vmCmdDraw* calls.
+        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        VkRenderPassBeginInfo renderPassInfo;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.pNext = NULL;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = framebuffer;
+            renderPassInfo.renderArea.offset = { 0, 0 };
+            renderPassInfo.renderArea.extent = extent;
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
         }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        // SC. Set the dynamic viewport and scissor to the current Swapchain size.
+        VkViewport viewport;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float) extent.width;
+            viewport.height = (float) extent.height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
         }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
-
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
-    }
-
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        VkRect2D scissor;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            scissor.offset = { 0, 0 };
+            scissor.extent = extent;
         }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
-    // A.8. End the Command Buffer.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
-    }
+        // D.X. Bind descriptor set with the Uniform Buffer slice of this swapchain image.
+        uint32_t dynamicOffset = (uint32_t)(uniformSliceSize * imageIdx);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
 
-    // A.9. Create a Fence.
-    VkFence fence;
-    {
-        VkFenceCreateInfo fenceInfo;
-        {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
-        }
+        // V.7. Bind the Vertex buffers as specified by the pipeline.
+        // VL.5. The SoA layout binds the same buffer once for each attribute stream.
+        std::vector<VkBuffer> vertexBuffers(vertexLayout.bindingOffsets.size(), vertexBuffer);
+        vkCmdBindVertexBuffers(cmdBuffer, 0, (uint32_t)vertexBuffers.size(), vertexBuffers.data(),
+                               vertexLayout.bindingOffsets.data());
 
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
-        }
+        // 17.3. Add a Draw command.
+        // Draw 3 vertices using the pipeline bound previously.
+        uint32_t vertexCount = 3;
+        uint32_t instanceCount = 1;
 
-        //vkResetFences(device, 1, &fence);
-    }
+        // D.XX. Only render a single instance (color "rotation" is done in a different way).
+        vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 0);
 
-    // A.10. Submit the recorded Command Buffer to the Queue.
-    {
-        VkSubmitInfo submitInfo;
-        {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
-        }
+        // 17.4. End the Render Pass.
+        vkCmdEndRenderPass(cmdBuffer);
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        // PP.3. Hand over the scene image to the filter.
+        if (postProcess.mode != POST_PROCESS_OFF) {
+            RecordSceneRelease(postProcess, cmdBuffer, imageIdx);
         }
     }
 
-    // A.11. Wait the submitted Command Buffer to finish.
-    {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
-        }
+    // 18. End the Command Buffer recording.
+    if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
     }
-
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
-
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }
@@ -1,6 +1,7 @@
 /**
  * Single file Vulkan triangle example rendered into an exported/imporeted image with GLFW.
- * The example creates a thread that renders a triangle into an exported image.
+ * The example creates a thread (or with DEMO_FD_TRANSPORT=process a separate process) that renders
+ * a triangle into an exported image.
  * The image is then imported in the main thread with a different instance.
  *
  * The example uses vertex data baked into the shaders.
@@ -21,7 +22,29 @@
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_PRESENT_MODE: fifo, fifo_relaxed, mailbox or immediate, an unsupported mode falls back to fifo. Default: fifo
+ * DEMO_FRAMES_IN_FLIGHT: Number of frames the CPU can record ahead of the GPU. Default: 2
+ * DEMO_SWAPCHAIN_IMAGES: Requested swapchain image count, clamped to the surface limits. Default: minImageCount + 1
+ * DEMO_MAX_FPS: Frame rate limit of the draw loop, 0 disables it. Default: 0
+ * DEMO_LATENCY_LOG: Log the acquire->present latency of every frame (1), otherwise only a summary at exit. Default: 0
+ * DEMO_EXTERNAL_SEMAPHORE: Share a ring of images, each with its own timeline semaphore (1). The producer renders
+ *   continuously and the consumer's submit waits on the newest written image. Otherwise a single image is rendered
+ *   once per second without GPU sync. Default: 0
+ * DEMO_IMAGE_RING: Number of images in the ring (DEMO_EXTERNAL_SEMAPHORE=1 only), clamped to 2-8. Default: 3
+ * DEMO_FD_TRANSPORT: thread (FDs handed over in memory), socket (SCM_RIGHTS over a Unix socket pair, the producer
+ *   is still a thread) or process (the producer is forked into a separate process, the FDs are sent over the socket
+ *   pair and the consumer stops it by shutting down its end of the socket). Default: thread
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_TRACE: Record the zones of the consumer and the producer thread and the GPU time of the produced frames,
+ *   then write them as a Chrome trace into the given JSON file at exit (chrome://tracing or ui.perfetto.dev).
+ *   With DEMO_FD_TRANSPORT=process only the consumer process is recorded. Default: unset (disabled)
  *
  * Dependencies:
  *  * C++11
@@ -34,6 +57,7 @@
  *
  * Includes:
  *  * Validation layer enable.
+ *  * Swapchain re-creation on window resize.
  *
  * Excludes:
  *  * No swapchain.
@@ -60,27 +84,35 @@
  * OFTWARE.
  */
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <stdexcept>
 #include <vector>
+#include <new>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
-
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
@@ -101,39 +133,118 @@ const std::vector<const char*> g_deviceExtensions = {
     "VK_KHR_dedicated_allocation",
     "VK_KHR_get_memory_requirements2",
 };
+// Extensions required by the shared timeline semaphore (DEMO_EXTERNAL_SEMAPHORE=1).
+const std::vector<const char*> g_semaphoreInstanceExtensions = {
+    "VK_KHR_external_semaphore_capabilities",
+};
+const std::vector<const char*> g_semaphoreDeviceExtensions = {
+    "VK_KHR_external_semaphore",
+    "VK_KHR_external_semaphore_fd", // _fd for Linux file descriptor
+    "VK_KHR_timeline_semaphore",
+};
+
+
+static void CreateSwapchainImageViews(const VkDevice device,
+                                      VkFormat format,
+                                      const std::vector<VkImage>& images,
+                                      std::vector<VkImageView> *outImageViews);
+static void DestroySwapchainImageViews(const VkDevice device, std::vector<VkImageView> *imageViews);
+static void RecordBlitCommands(const VkDevice device,
+                               const VkCommandPool cmdPool,
+                               uint32_t queueFamilyIdx,
+                               const VkImage *importedImages,
+                               uint32_t ringImageCount,
+                               VkExtent2D importedExtent,
+                               bool externalSemaphore,
+                               const std::vector<VkImage>& swapImages,
+                               VkExtent2D extent,
+                               std::vector<VkCommandBuffer> *outCmdBuffers);
+
+static VkSemaphore CreateExportedTimelineSemaphore(const VkInstance instance,
+                                                   const VkPhysicalDevice physicalDevice,
+                                                   const VkDevice device,
+                                                   int *outFd);
+static VkSemaphore ImportTimelineSemaphore(const VkDevice device, int fd);
+
+// IR. Ring of exported images (DEMO_EXTERNAL_SEMAPHORE=1).
+static const uint32_t g_maxRingImages = 8;
+// Larger than the number of images, so the queues are never full (an image is in at most one queue).
+static const uint32_t g_ringQueueCapacity = 16;
+
+struct RingQueueEntry {
+    uint32_t imageIdx;
+    // Timeline value to wait for before the image can be used.
+    uint64_t value;
+};
 
+// Lock-free single producer/single consumer queue of ring image indices.
+// Only plain data and lock-free atomics, so it also works in memory shared between processes.
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the ring queues require lock-free atomics");
+struct RingQueue {
+    std::atomic<uint32_t> head; // Next entry to pop, only written by the consumer of the queue.
+    std::atomic<uint32_t> tail; // Next entry to push, only written by the producer of the queue.
+    RingQueueEntry entries[g_ringQueueCapacity];
+};
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+// Queues of the ring, mapped by both sides from a memfd:
+// * ready: written images (producer -> consumer), the value is the one of the image's own semaphore.
+// * released: images not used anymore (consumer -> producer), the value is the one of the release semaphore.
+struct ImageRingShared {
+    RingQueue ready;
+    RingQueue released;
+};
 
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
+// File descriptors of the ring, sent once from the producer to the consumer. Unused ones are -1.
+struct ExportedRingFds {
+    uint32_t imageCount;
+    int imageFds[g_maxRingImages];
+    int semaphoreFds[g_maxRingImages];
+    int releaseSemaphoreFd;
+    int sharedFd;
+};
 
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
-                                   const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
+static bool RingQueuePush(RingQueue *queue, const RingQueueEntry& entry);
+static bool RingQueuePop(RingQueue *queue, RingQueueEntry *outEntry);
+static ImageRingShared *MapImageRingShared(int fd, bool create);
+static std::vector<int*> CollectRingFds(ExportedRingFds *fds);
+static void SendRingFds(int socketFd, ExportedRingFds fds);
+static void ReceiveRingFds(int socketFd, ExportedRingFds *outFds);
+static void CloseRingFds(ExportedRingFds fds);
+static bool SocketClosed(int socketFd, int timeoutMs);
 
 struct VulkanThreadOptions {
     bool enableValidationLayers;
-    volatile int exposedImageFd;
+    // DV. DEMO_DEVICE of the consumer, so the producer exports from the same physical device.
+    const char *deviceSelector;
+    std::string pipelineCacheFileName;
+    bool ppmMmap;
+    bool externalSemaphore;
+    uint32_t ringImageCount;
+    // IR. The FDs are sent on this Unix socket if it is valid, otherwise they are stored into "exposedFds".
+    int fdSocket;
+    // IR. The producer runs in a forked process, the memory of the options is not shared anymore.
+    // The consumer requests the stop by shutting down its end of "fdSocket".
+    bool processProducer;
+    volatile bool fdsReady;
+    ExportedRingFds exposedFds;
 
     std::mutex syncMutex;
     std::condition_variable signal;
+
+    // IR. Stop request of the semaphore synced producer.
+    std::atomic<bool> stopRequested;
 };
 
 static void *VulkanImageProducerThread(void *arg) {
     assert(arg != nullptr);
     VulkanThreadOptions *options = (VulkanThreadOptions*)arg;
+    TraceRegisterThread("producer");
+
+    // ST.1. Start loading (or compiling) the shaders on worker threads.
+    // This runs in parallel with the Instance/Device creation of the producer, the results are only
+    // waited for at the Shader Module creation.
+    std::future<std::vector<uint32_t> > vertShaderLoad = LoadShaderAsync("passthrough.vert");
+    std::future<std::vector<uint32_t> > fragShaderLoad = LoadShaderAsync("passthrough.frag");
 
     // T.1. Create a new vulkan instance in a thread.
     VkInstance threadInstance;
@@ -151,6 +262,11 @@ static void *VulkanImageProducerThread(void *arg) {
             appInfo.apiVersion = VK_API_VERSION_1_0;
         }
 
+        std::vector<const char*> instanceExtensions = g_instanceExtensions;
+        if (options->externalSemaphore) {
+            instanceExtensions.insert(instanceExtensions.end(), g_semaphoreInstanceExtensions.begin(), g_semaphoreInstanceExtensions.end());
+        }
+
         // T.1.2. Specify the Instance creation information.
         // The Instance level Validation and debug layers must be specified here.
         VkInstanceCreateInfo createInfo;
@@ -171,8 +287,8 @@ static void *VulkanImageProducerThread(void *arg) {
                 //createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugInfo;
             }
 
-            createInfo.enabledExtensionCount = static_cast<uint32_t>(g_instanceExtensions.size());
-            createInfo.ppEnabledExtensionNames = g_instanceExtensions.data();
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
+            createInfo.ppEnabledExtensionNames = instanceExtensions.data();
         }
 
         // T.1.3. Create the Vulkan instance.
@@ -182,7 +298,7 @@ static void *VulkanImageProducerThread(void *arg) {
     }
 
     // T.2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice threadPhysicalDevice;
+    VkPhysicalDevice threadPhysicalDevice = VK_NULL_HANDLE;
     uint32_t threadGraphicsQueueFamilyIdx;
     {
         // T.2.1 Query the number of physical devices.
@@ -198,19 +314,32 @@ static void *VulkanImageProducerThread(void *arg) {
         vkEnumeratePhysicalDevices(threadInstance, &deviceCount, devices.data());
 
         // T.2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            threadGraphicsQueueFamilyIdx = FindQueueFamily(device, VK_NULL_HANDLE, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, VK_NULL_HANDLE, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, options->deviceSelector)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((threadPhysicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 threadPhysicalDevice = device;
-                break;
+                threadGraphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (threadPhysicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(threadPhysicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
     }
 
     // T.3. Create a logical Vulkan Device.
@@ -233,18 +362,30 @@ static void *VulkanImageProducerThread(void *arg) {
         // T.3.2. The queue family/families must be provided to allow the device to use them.
         std::vector<uint32_t> uniqueQueueFamilies = { threadGraphicsQueueFamilyIdx };
 
+        // T.ES.1. The shared semaphore is a timeline semaphore, the feature must be enabled.
+        std::vector<const char*> deviceExtensions = g_deviceExtensions;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures;
+        {
+            timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+            timelineFeatures.pNext = NULL;
+            timelineFeatures.timelineSemaphore = VK_TRUE;
+        }
+        if (options->externalSemaphore) {
+            deviceExtensions.insert(deviceExtensions.end(), g_semaphoreDeviceExtensions.begin(), g_semaphoreDeviceExtensions.end());
+        }
+
         // T.3.3. Specify the device creation information.
         VkDeviceCreateInfo createInfo;
         {
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-            createInfo.pNext = NULL;
+            createInfo.pNext = options->externalSemaphore ? &timelineFeatures : NULL;
             createInfo.flags = 0;
             createInfo.queueCreateInfoCount = 1;
             createInfo.pQueueCreateInfos = &queueCreateInfo;
             createInfo.pEnabledFeatures = NULL;
             // G.4. Specify the swapchain extension when creating a VkDevice.
-            createInfo.enabledExtensionCount = (uint32_t)g_deviceExtensions.size();
-            createInfo.ppEnabledExtensionNames = g_deviceExtensions.data();
+            createInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
             createInfo.enabledLayerCount = 0;
 
             if (options->enableValidationLayers) {
@@ -267,14 +408,20 @@ static void *VulkanImageProducerThread(void *arg) {
         vkGetDeviceQueue(threadDevice, threadGraphicsQueueFamilyIdx, 0, &threadQueue);
     }
 
-    // T.5. Create a 256x256 2D Image to draw onto.
+    // T.A. Create the memory arena of the thread's device.
+    // The exported render target needs a dedicated allocation, only the readback buffers are sub-allocated.
+    MemoryArena threadMemoryArena;
+    CreateMemoryArena(threadPhysicalDevice, threadDevice, &threadMemoryArena);
+
+    // T.5. Create a 256x256 2D Image to draw onto (one for each image of the ring).
     // This will be the render target image.
     // Note: An Image by itself does not allocate memory on the GPU.
     uint32_t renderImageWidth = 256;
     uint32_t renderImageHeight = 256;
     VkFormat renderImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage renderImage;
-    {
+    const uint32_t ringImageCount = options->ringImageCount;
+    VkImage renderImages[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         // T.5.1. Create the required external memory structs
         VkExternalMemoryImageCreateInfoKHR externalInfo;
         {
@@ -311,7 +458,7 @@ static void *VulkanImageProducerThread(void *arg) {
         }
 
         // T.5.3. Create the image.
-        if (vkCreateImage(threadDevice, &imageInfo, NULL, &renderImage) != VK_SUCCESS) {
+        if (vkCreateImage(threadDevice, &imageInfo, NULL, &renderImages[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create 2D image!");
         }
     }
@@ -319,11 +466,11 @@ static void *VulkanImageProducerThread(void *arg) {
     // T.6. Allocate and bind the memory for the render target image.
     // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
     // To enable memory sharing the VkExportMemoryAllocateInfo struct is required.
-    VkDeviceMemory renderImageMemory;
-    {
+    VkDeviceMemory renderImageMemories[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         // T.6.1 Query the memory requirments for the image.
         VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(threadDevice, renderImage, &memRequirements);
+        vkGetImageMemoryRequirements(threadDevice, renderImages[ringIdx], &memRequirements);
 
         // T.6.2 Find a memory type based on the requirements.
         // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
@@ -336,7 +483,7 @@ static void *VulkanImageProducerThread(void *arg) {
         {
             dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
             dedicatedInfo.pNext = NULL;
-            dedicatedInfo.image = renderImage;
+            dedicatedInfo.image = renderImages[ringIdx];
             dedicatedInfo.buffer = VK_NULL_HANDLE;
         }
 
@@ -357,51 +504,92 @@ static void *VulkanImageProducerThread(void *arg) {
         }
 
         // T.6.5 Allocate the memory.
-        if (vkAllocateMemory(threadDevice, &allocInfo, NULL, &renderImageMemory) != VK_SUCCESS) {
+        if (vkAllocateMemory(threadDevice, &allocInfo, NULL, &renderImageMemories[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate image memory!");
         }
 
         // T.6.6 "Connect" the image with the allocated memory.
-        vkBindImageMemory(threadDevice, renderImage, renderImageMemory, 0);
+        vkBindImageMemory(threadDevice, renderImages[ringIdx], renderImageMemories[ringIdx], 0);
     }
 
     // T.7. Get the file descriptor which can be shared with the other Vulkan Instance
-    int imageFd = -1;
+    ExportedRingFds ringFds;
     {
+        ringFds.imageCount = ringImageCount;
+        for (uint32_t ringIdx = 0; ringIdx < g_maxRingImages; ringIdx++) {
+            ringFds.imageFds[ringIdx] = -1;
+            ringFds.semaphoreFds[ringIdx] = -1;
+        }
+        ringFds.releaseSemaphoreFd = -1;
+        ringFds.sharedFd = -1;
+    }
+
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         PFN_vkGetMemoryFdKHR vkGetMemoryFdKHR = (PFN_vkGetMemoryFdKHR)vkGetDeviceProcAddr(threadDevice, "vkGetMemoryFdKHR");
 
         VkMemoryGetFdInfoKHR getFdInfo;
         {
             getFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
             getFdInfo.pNext = NULL;
-            getFdInfo.memory = renderImageMemory;
+            getFdInfo.memory = renderImageMemories[ringIdx];
             getFdInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
         }
 
-        if (vkGetMemoryFdKHR(threadDevice, &getFdInfo, &imageFd) != VK_SUCCESS) {
+        if (vkGetMemoryFdKHR(threadDevice, &getFdInfo, &ringFds.imageFds[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("unable to get image FD!");
         }
-        printf("[thread] FD: %d\n", imageFd);
+        printf("[thread] FD %u: %d\n", ringIdx, ringFds.imageFds[ringIdx]);
     }
 
-    // TODO: sync
-    {
+    // T.IR.1. Create the semaphores and the shared queues of the ring.
+    // Each image has its own timeline semaphore, signaled when the producer wrote the image.
+    // The consumer signals the release semaphore when the reads of its submitted frames are done.
+    VkSemaphore writeSemaphores[g_maxRingImages];
+    uint64_t writeValues[g_maxRingImages];
+    VkSemaphore releaseSemaphore = VK_NULL_HANDLE;
+    ImageRingShared *ringShared = NULL;
+    if (options->externalSemaphore) {
+        for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+            writeSemaphores[ringIdx] = CreateExportedTimelineSemaphore(threadInstance, threadPhysicalDevice, threadDevice, &ringFds.semaphoreFds[ringIdx]);
+            writeValues[ringIdx] = 0;
+        }
+        releaseSemaphore = CreateExportedTimelineSemaphore(threadInstance, threadPhysicalDevice, threadDevice, &ringFds.releaseSemaphoreFd);
+
+        ringFds.sharedFd = memfd_create("vkdemo_image_ring", MFD_CLOEXEC);
+        if (ringFds.sharedFd < 0) {
+            throw std::runtime_error("failed to create the shared ring memory!");
+        }
+        ringShared = MapImageRingShared(ringFds.sharedFd, true);
+
+        // T.IR.2. Initially every image is released, the consumer has not started yet.
+        for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+            RingQueuePush(&ringShared->released, RingQueueEntry{ ringIdx, 0 });
+        }
+    }
+
+    // T.IR.3. The FDs are only exchanged once, the frames are synced by the semaphores (or not at all).
+    // Over the socket the receiver gets its own copies, otherwise the FDs are owned by the consumer from now on.
+    if (options->fdSocket >= 0) {
+        SendRingFds(options->fdSocket, ringFds);
+        CloseRingFds(ringFds);
+    } else {
         std::unique_lock<std::mutex> lock(options->syncMutex);
-        options->exposedImageFd = imageFd;
+        options->exposedFds = ringFds;
+        options->fdsReady = true;
         options->signal.notify_one(); // signal the othre side that the FD is ready
     }
 
     // T.8. Create an Image View for the Render Target Image.
     // Will be used by the Framebuffer as Color Attachment.
-    VkImageView renderImageView;
-    {
+    VkImageView renderImageViews[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         // T.8.1. Specify the view information.
         VkImageViewCreateInfo createInfo;
         {
             createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
             createInfo.pNext = NULL;
             createInfo.flags = 0;
-            createInfo.image = renderImage;
+            createInfo.image = renderImages[ringIdx];
             createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
             createInfo.format = renderImageFormat;
             createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -416,7 +604,7 @@ static void *VulkanImageProducerThread(void *arg) {
         }
 
         // T.8.2. Create the Image View.
-        if (vkCreateImageView(threadDevice, &createInfo, NULL, &renderImageView) != VK_SUCCESS) {
+        if (vkCreateImageView(threadDevice, &createInfo, NULL, &renderImageViews[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create image views!");
         }
     }
@@ -479,13 +667,8 @@ static void *VulkanImageProducerThread(void *arg) {
     // T.10. Create Vertex shader.
     VkShaderModule vertShaderModule;
     {
-        // T.10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> vertSrc = LoadGLSL("passthrough.vert");
-        std::vector<uint32_t> vertCode = CompileGLSL(shaderc_vertex_shader, vertSrc);
-        #else
-        std::vector<uint32_t> vertCode = LoadSPIRV("passthrough.vert.spv");
-        #endif
+        // T.10.1. Wait for the vertex shader loaded (or compiled) by the worker thread (ST.1).
+        std::vector<uint32_t> vertCode = vertShaderLoad.get();
 
         if (vertCode.size() == 0) {
             throw std::runtime_error("failed to load vertex shader!");
@@ -513,13 +696,8 @@ static void *VulkanImageProducerThread(void *arg) {
     // T.11. Create Fragment shader.
     VkShaderModule fragShaderModule;
     {
-        // 10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> fragSrc = LoadGLSL("passthrough.frag");
-        std::vector<uint32_t> fragCode = CompileGLSL(shaderc_fragment_shader, fragSrc);
-        #else
-        std::vector<uint32_t> fragCode = LoadSPIRV("passthrough.frag.spv");
-        #endif
+        // T.11.1. Wait for the fragment shader loaded (or compiled) by the worker thread (ST.1).
+        std::vector<uint32_t> fragCode = fragShaderLoad.get();
 
         if (fragCode.size() == 0) {
             throw std::runtime_error("failed to load fragment shader!");
@@ -560,6 +738,11 @@ static void *VulkanImageProducerThread(void *arg) {
         }
     }
 
+    // T.PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(threadPhysicalDevice, threadDevice, options->pipelineCacheFileName, &pipelineCacheHit);
+
     // T.13. Create the Rendering Pipeline
     VkPipeline pipeline;
     {
@@ -715,15 +898,19 @@ static void *VulkanImageProducerThread(void *arg) {
             pipelineInfo.basePipelineIndex = 0;
         }
 
-        if (vkCreateGraphicsPipelines(threadDevice, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+        std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+        if (vkCreateGraphicsPipelines(threadDevice, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
+
+        double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+        printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
     }
 
-    // T.14. Create Framebuffer.
+    // T.14. Create Framebuffer (one for each image of the ring).
     // Frame buffer is the render target.
-    VkFramebuffer framebuffer;
-    {
+    VkFramebuffer framebuffers[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         VkFramebufferCreateInfo framebufferInfo;
         {
             framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -731,26 +918,27 @@ static void *VulkanImageProducerThread(void *arg) {
             framebufferInfo.flags = 0;
             framebufferInfo.renderPass = renderPass;
             framebufferInfo.attachmentCount = 1;
-            framebufferInfo.pAttachments = &renderImageView;
+            framebufferInfo.pAttachments = &renderImageViews[ringIdx];
             framebufferInfo.width = renderImageWidth;
             framebufferInfo.height = renderImageHeight;
             framebufferInfo.layers = 1;
         }
 
-        if (vkCreateFramebuffer(threadDevice, &framebufferInfo, NULL, &framebuffer) != VK_SUCCESS) {
+        if (vkCreateFramebuffer(threadDevice, &framebufferInfo, NULL, &framebuffers[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create framebuffer!");
         }
     }
 
     // T.15. Create Command Pool.
     // Required to create Command buffers.
+    // The Command Buffer is re-recorded every frame, the whole pool is reset instead of the buffer.
     VkCommandPool cmdPool;
     {
         VkCommandPoolCreateInfo poolInfo;
         {
             poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
             poolInfo.pNext = NULL;
-            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
             poolInfo.queueFamilyIndex = threadGraphicsQueueFamilyIdx;
         }
 
@@ -793,13 +981,79 @@ static void *VulkanImageProducerThread(void *arg) {
         }
     }
 
+    // T.TC.1. Create a begin and an end timestamp query for the GPU zone of the frames.
+    // The thread waits for every frame, so one pair is enough.
+    VkQueryPool traceQueryPool = VK_NULL_HANDLE;
+    TraceGpuClock traceClock;
+    if (g_tracer.enabled) {
+        VkQueryPoolCreateInfo queryPoolInfo;
+        {
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.pNext = NULL;
+            queryPoolInfo.flags = 0;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2;
+            queryPoolInfo.pipelineStatistics = 0;
+        }
+
+        if (vkCreateQueryPool(threadDevice, &queryPoolInfo, NULL, &traceQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+
+        CalibrateTraceGpuClock(threadPhysicalDevice, threadDevice, threadQueue, threadGraphicsQueueFamilyIdx, &traceClock);
+    }
+
     // Start recording draw commands.
 
-    std::unique_lock<std::mutex> syncLock(options->syncMutex);
+    // T.R.1. Create the readback ring.
+    // The thread waits for each frame, one slot holds the newest capture and the other one receives the next frame.
+    ReadbackRing readbackRing;
+    CreateReadbackRing(threadPhysicalDevice, threadDevice, &threadMemoryArena, threadGraphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, 2, NULL, &readbackRing);
+
+    // Newest completed capture, it stays in its readback slot until the output image is written.
+    ReadbackSlot *capturedSlot = NULL;
+    uint64_t frameIdx = 0;
+
+    std::unique_lock<std::mutex> syncLock(options->syncMutex, std::defer_lock);
+    if (!options->externalSemaphore) {
+        syncLock.lock();
+    }
+
     int counter = 0;
-    while (options->signal.wait_for(syncLock, std::chrono::seconds(1)) == std::cv_status::timeout)
+    while (true)
     {
-        vkResetCommandBuffer(cmdBuffer, 0);
+        RingQueueEntry releasedEntry = { 0, 0 };
+        if (options->externalSemaphore) {
+            // T.IR.4. Take a released image, the consumer's reads of it are waited for on the GPU.
+            // The queue is only empty if the consumer holds every image, no lock is taken in the frame path.
+            // The consumer's submits only wait for already submitted frames, so the loop can stop any time.
+            if (options->stopRequested.load() || (options->processProducer && SocketClosed(options->fdSocket, 0))) {
+                break;
+            }
+            if (!RingQueuePop(&ringShared->released, &releasedEntry)) {
+                TraceZone zone("wait released image");
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+        } else if (options->processProducer) {
+            TraceZone zone("wait socket");
+            if (SocketClosed(options->fdSocket, 1000)) {
+                break;
+            }
+        } else {
+            TraceZone zone("wait signal");
+            if (options->signal.wait_for(syncLock, std::chrono::seconds(1)) != std::cv_status::timeout) {
+                break;
+            }
+        }
+        const uint32_t ringIdx = releasedEntry.imageIdx;
+        TraceZone frameZone("frame");
+        // T.TC. The recording spans several steps, its zone is recorded explicitly at T.19.
+        const uint64_t recordStartNs = TraceNow();
+
+        // T.16.1. The previous frame was waited for at T.22, reset the pool of its Command Buffer.
+        // Without VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT the pool memory is reused by the next recording.
+        vkResetCommandPool(threadDevice, cmdPool, 0);
 
         // T.17. Start Command Buffer
         {
@@ -816,6 +1070,13 @@ static void *VulkanImageProducerThread(void *arg) {
             }
         }
 
+        // T.TC.2. The begin timestamp is written before the release wait of the semaphore synced mode,
+        // so the GPU zone also shows how long the producer waits for the consumer.
+        if (traceQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(cmdBuffer, traceQueryPool, 0, 2);
+            vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, traceQueryPool, 0);
+        }
+
         // T.18. Insert draw commands into Command Buffer.
         {
             // T.18.1. Add Begin RenderPass command
@@ -826,7 +1087,7 @@ static void *VulkanImageProducerThread(void *arg) {
                 renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
                 renderPassInfo.pNext = NULL;
                 renderPassInfo.renderPass = renderPass;
-                renderPassInfo.framebuffer = framebuffer;
+                renderPassInfo.framebuffer = framebuffers[ringIdx];
                 renderPassInfo.renderArea.offset = { 0, 0 };
                 renderPassInfo.renderArea.extent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
                 renderPassInfo.clearValueCount = 1;
@@ -849,127 +1110,146 @@ static void *VulkanImageProducerThread(void *arg) {
             vkCmdEndRenderPass(cmdBuffer);
         }
 
+        if (traceQueryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, traceQueryPool, 1);
+        }
+
         // T.19. End the Command Buffer recording.
         {
             if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
                 throw std::runtime_error("failed to record command buffer!");
             }
         }
+        TraceRecord("record commands", recordStartNs, TraceNow(), false);
 
         // T.21. Submit the recorded Command Buffer to the Queue.
+        // T.R.2. The capture of the frame is recorded into the same submission.
         {
+            // T.IR.5. Wait for the release of the image and signal its own semaphore when it is written.
+            const uint64_t writtenValue = options->externalSemaphore ? (writeValues[ringIdx] + 1) : 0;
+            const VkPipelineStageFlags releaseWaitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            VkTimelineSemaphoreSubmitInfoKHR timelineInfo;
+            {
+                timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+                timelineInfo.pNext = NULL;
+                timelineInfo.waitSemaphoreValueCount = 1;
+                timelineInfo.pWaitSemaphoreValues = &releasedEntry.value;
+                timelineInfo.signalSemaphoreValueCount = 1;
+                timelineInfo.pSignalSemaphoreValues = &writtenValue;
+            }
+
+            VkCommandBuffer frameCmdBuffers[2] = {
+                cmdBuffer,
+                RecordReadback(threadDevice, &readbackRing, renderImages[ringIdx], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, fence, frameIdx),
+            };
+            frameIdx++;
+
             VkSubmitInfo submitInfo;
             {
                 submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-                submitInfo.pNext = NULL;
-                submitInfo.waitSemaphoreCount = 0;
-                submitInfo.pWaitSemaphores = NULL;
-                submitInfo.pWaitDstStageMask = NULL;
-                submitInfo.commandBufferCount = 1;
-                submitInfo.pCommandBuffers = &cmdBuffer;
-                submitInfo.signalSemaphoreCount = 0;
-                submitInfo.pSignalSemaphores = NULL;
+                submitInfo.pNext = options->externalSemaphore ? &timelineInfo : NULL;
+                submitInfo.waitSemaphoreCount = options->externalSemaphore ? 1 : 0;
+                submitInfo.pWaitSemaphores = &releaseSemaphore;
+                submitInfo.pWaitDstStageMask = &releaseWaitStage;
+                submitInfo.commandBufferCount = (frameCmdBuffers[1] != VK_NULL_HANDLE) ? 2 : 1;
+                submitInfo.pCommandBuffers = frameCmdBuffers;
+                submitInfo.signalSemaphoreCount = options->externalSemaphore ? 1 : 0;
+                submitInfo.pSignalSemaphores = &writeSemaphores[ringIdx];
             }
 
             // A fence is provided to have a CPU side sync point.
+            TraceZone zone("queue submit");
             if (vkQueueSubmit(threadQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
                 throw std::runtime_error("failed to submit command buffer!");
             }
+
+            // T.IR.6. Pass the image to the consumer right away, it waits for the written value on its GPU.
+            if (options->externalSemaphore) {
+                writeValues[ringIdx] = writtenValue;
+                RingQueuePush(&ringShared->ready, RingQueueEntry{ ringIdx, writtenValue });
+            }
         }
 
         // T.22. Wait the submitted Command Buffer to finish.
         {
             // -1 means to wait for ever to finish.
-            if (vkWaitForFences(threadDevice, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-                throw std::runtime_error("failed to wait for fence!");
+            {
+                TraceZone zone("wait frame fence");
+                if (vkWaitForFences(threadDevice, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to wait for fence!");
+                }
             }
-            vkResetFences(threadDevice, 1, &fence);
-        }
-    }
 
+            // T.TC.3. The frame is done, record its GPU zone.
+            if (traceQueryPool != VK_NULL_HANDLE) {
+                uint64_t timestamps[2];
+                VkResult result = vkGetQueryPoolResults(threadDevice, traceQueryPool, 0, 2, sizeof(timestamps), timestamps,
+                                                        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("failed to get timestamp query results!");
+                }
+                TraceGpuZone(traceClock, "producer gpu frame", timestamps[0], timestamps[1]);
+            }
 
-    {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(threadPhysicalDevice,
-                               threadDevice,
-                               threadQueue,
-                               cmdPool,
-                               renderImage,
-                               renderImageWidth, renderImageHeight,
-                               &readableImage,
-                               &readableImageMemory);
+            // T.R.3. Consume the capture before the fence is reused.
+            for (ReadbackSlot *slot = PollReadback(threadDevice, &readbackRing); slot != NULL; slot = PollReadback(threadDevice, &readbackRing)) {
+                KeepNewestReadback(slot, &capturedSlot);
+            }
 
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
+            vkResetFences(threadDevice, 1, &fence);
         }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(threadDevice, readableImage, &subResource, &subResourceLayout);
+    }
 
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(threadDevice, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
-        }
 
+    if (capturedSlot != NULL) {
         // 25. Write out the image to a ppm file.
         {
-            std::ofstream file("thread_out.ppm", std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM("thread_out.ppm", capturedSlot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, false, options->ppmMmap);
         }
-
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(threadDevice, readableImageMemory);
-
-        // XX. Free linear image's memory.
-        vkFreeMemory(threadDevice, readableImageMemory, NULL);
-
-        // XX. Destory linar image memory.
-        vkDestroyImage(threadDevice, readableImage, NULL);
     }
     printf("written out the image\n");
 
 
     // T.X. Release resources
+    DestroyReadbackRing(threadDevice, &readbackRing);
+    if (traceQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(threadDevice, traceQueryPool, NULL);
+    }
     vkFreeCommandBuffers(threadDevice, cmdPool, 1, &cmdBuffer);
     vkDestroyCommandPool(threadDevice, cmdPool, NULL);
 
     vkDestroyFence(threadDevice, fence, NULL);
 
+    // T.IR.XX. Destroy the semaphores and unmap the queues of the ring.
+    if (options->externalSemaphore) {
+        for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+            vkDestroySemaphore(threadDevice, writeSemaphores[ringIdx], NULL);
+        }
+        vkDestroySemaphore(threadDevice, releaseSemaphore, NULL);
+        munmap(ringShared, sizeof(ImageRingShared));
+    }
+
     vkDestroyShaderModule(threadDevice, vertShaderModule, NULL);
     vkDestroyShaderModule(threadDevice, fragShaderModule, NULL);
 
     vkDestroyPipelineLayout(threadDevice, pipelineLayout, NULL);
     vkDestroyPipeline(threadDevice, pipeline, NULL);
+    SavePipelineCache(threadPhysicalDevice, threadDevice, pipelineCache, options->pipelineCacheFileName);
+    vkDestroyPipelineCache(threadDevice, pipelineCache, NULL);
     vkDestroyRenderPass(threadDevice, renderPass, NULL);
-    vkDestroyFramebuffer(threadDevice, framebuffer, NULL);
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+        vkDestroyFramebuffer(threadDevice, framebuffers[ringIdx], NULL);
+    }
 
-    vkDestroyImageView(threadDevice, renderImageView, NULL);
-    vkFreeMemory(threadDevice, renderImageMemory, NULL);
-    vkDestroyImage(threadDevice, renderImage, NULL);
+    // T.A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&threadMemoryArena);
+
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+        vkDestroyImageView(threadDevice, renderImageViews[ringIdx], NULL);
+        vkFreeMemory(threadDevice, renderImageMemories[ringIdx], NULL);
+        vkDestroyImage(threadDevice, renderImages[ringIdx], NULL);
+    }
     vkDestroyDevice(threadDevice, NULL);
     vkDestroyInstance(threadInstance, NULL);
 
@@ -981,28 +1261,148 @@ int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envPresentMode = getenv("DEMO_PRESENT_MODE");
+    const char *envFramesInFlight = getenv("DEMO_FRAMES_IN_FLIGHT");
+    const char *envSwapchainImages = getenv("DEMO_SWAPCHAIN_IMAGES");
+    const char *envMaxFps = getenv("DEMO_MAX_FPS");
+    const char *envLatencyLog = getenv("DEMO_LATENCY_LOG");
+    const char *envExternalSemaphore = getenv("DEMO_EXTERNAL_SEMAPHORE");
+    const char *envImageRing = getenv("DEMO_IMAGE_RING");
+    const char *envFdTransport = getenv("DEMO_FD_TRANSPORT");
+    const char *envTrace = getenv("DEMO_TRACE");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    bool latencyLog = ((envLatencyLog != NULL) && (strncmp("1", envLatencyLog, 2) == 0));
+    bool externalSemaphore = ((envExternalSemaphore != NULL) && (strncmp("1", envExternalSemaphore, 2) == 0));
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
+    // TC. Start the trace clock before the producer thread, the main thread is the first traced thread.
+    InitTracer((envTrace != NULL) && (envTrace[0] != '\0'));
+    TraceRegisterThread("consumer");
+
+    // FP. Configure the presentation and the frame pacing.
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (envPresentMode != NULL) {
+        requestedPresentMode = ParsePresentMode(envPresentMode);
+    }
+
+    uint32_t framesInFlight = 2;
+    if ((envFramesInFlight != NULL) && (atoi(envFramesInFlight) > 0)) {
+        framesInFlight = atoi(envFramesInFlight);
+    }
+
+    uint32_t requestedSwapchainImages = 0;
+    if ((envSwapchainImages != NULL) && (atoi(envSwapchainImages) > 0)) {
+        requestedSwapchainImages = atoi(envSwapchainImages);
+    }
+
+    double maxFps = 0;
+    if (envMaxFps != NULL) {
+        maxFps = atof(envMaxFps);
+    }
+
+    // IR. Configure the image ring, without the semaphores a single image is shared.
+    uint32_t ringImageCount = 1;
+    if (externalSemaphore) {
+        ringImageCount = 3;
+        if ((envImageRing != NULL) && (atoi(envImageRing) > 0)) {
+            ringImageCount = std::min(std::max((uint32_t)atoi(envImageRing), 2u), g_maxRingImages);
+        }
+    }
+
+    bool socketTransport = false;
+    bool processProducer = false;
+    if (envFdTransport != NULL) {
+        if (strcmp(envFdTransport, "socket") == 0) {
+            socketTransport = true;
+        } else if (strcmp(envFdTransport, "process") == 0) {
+            socketTransport = true;
+            processProducer = true;
+        } else if (strcmp(envFdTransport, "thread") != 0) {
+            throw std::runtime_error("unknown FD transport!");
+        }
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Frame sync: %s\n", (externalSemaphore ? "external timeline semaphores" : "none (1 FPS producer)"));
+    printf("Image ring: %u image(s), FD transport: %s\n", ringImageCount,
+           (processProducer ? "process" : (socketTransport ? "socket" : "thread")));
+
+    // IR. Over the socket pair the FDs are passed the same way as between processes (SCM_RIGHTS).
+    int fdSockets[2] = { -1, -1 };
+    if (socketTransport && (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fdSockets) != 0)) {
+        throw std::runtime_error("failed to create the FD socket pair!");
+    }
 
     // T.X.
     VulkanThreadOptions threadOptions;
     {
         threadOptions.enableValidationLayers = enableValidationLayers;
-        threadOptions.exposedImageFd = -1;
-    }
+        threadOptions.deviceSelector = envDevice;
+        threadOptions.pipelineCacheFileName = pipelineCacheFileName;
+        threadOptions.ppmMmap = ppmMmap;
+        threadOptions.externalSemaphore = externalSemaphore;
+        threadOptions.ringImageCount = ringImageCount;
+        threadOptions.fdSocket = fdSockets[1];
+        threadOptions.processProducer = processProducer;
+        threadOptions.fdsReady = false;
+        threadOptions.stopRequested.store(false);
+    }
+
+    // PR. The producer process is forked before any other thread, Vulkan object or GLFW state exists,
+    // so the child starts from a clean state. It only shares the socket pair with the consumer.
+    std::thread renderThread;
+    pid_t producerPid = -1;
+    if (processProducer) {
+        fflush(stdout);
+        producerPid = fork();
+        if (producerPid < 0) {
+            throw std::runtime_error("failed to fork the producer process!");
+        }
+
+        if (producerPid == 0) {
+            // PR.1. The child is the producer: it sends the FDs, renders until the socket is shut down and exits.
+            // _exit skips the consumer's exit handlers, they belong to the parent.
+            close(fdSockets[0]);
+            int exitCode = 0;
+            try {
+                VulkanImageProducerThread(&threadOptions);
+            } catch (const std::exception& error) {
+                printf("Producer process failed: %s\n", error.what());
+                exitCode = 1;
+            }
+            close(fdSockets[1]);
+            fflush(stdout);
+            _exit(exitCode);
+        }
 
-    std::thread renderThread = std::thread(VulkanImageProducerThread, &threadOptions);
+        // PR.2. Only the child keeps its end of the socket, so the consumer sees EOF if the producer exits early.
+        close(fdSockets[1]);
+        fdSockets[1] = -1;
+    } else {
+        renderThread = std::thread(VulkanImageProducerThread, &threadOptions);
+    }
 
     // G.0. Initialize GLFW.
     {
@@ -1015,12 +1415,18 @@ int main(int argc, char **argv) {
     uint32_t windowWidth = 1024;
     uint32_t windowHeight = 512;
     GLFWwindow* window;
+    bool framebufferResized = false;
     {
         // With GLFW_CLIENT_API set to GLFW_NO_API there will be no OpenGL (ES) context.
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        // SC. The window can be resized, the imported image is scaled by the blit.
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, "vktriangle GLFW", NULL, NULL);
+
+        // SC. Track the framebuffer size changes of the window.
+        glfwSetWindowUserPointer(window, &framebufferResized);
+        glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
     }
 
     // 1. Create Vulkan Instance.
@@ -1029,6 +1435,9 @@ int main(int argc, char **argv) {
     VkInstance instance;
     {
         std::vector<const char*> extensions = g_instanceExtensions;
+        if (externalSemaphore) {
+            extensions.insert(extensions.end(), g_semaphoreInstanceExtensions.begin(), g_semaphoreInstanceExtensions.end());
+        }
 
         // G.2. Add VK_KHR_surface extensions for the instance creation.
         // With this a presentation surface can be accessed.
@@ -1091,7 +1500,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
     {
         // 2.1 Query the number of physical devices.
@@ -1107,19 +1516,32 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, surface, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, surface, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((physicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 physicalDevice = device;
-                break;
+                graphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
     }
 
     // 3. Create a logical Vulkan Device.
@@ -1150,10 +1572,21 @@ int main(int argc, char **argv) {
             deviceExtensions.push_back(extension);
         }
 
+        // ES.1. The imported semaphore is a timeline semaphore, the feature must be enabled.
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures;
+        {
+            timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+            timelineFeatures.pNext = NULL;
+            timelineFeatures.timelineSemaphore = VK_TRUE;
+        }
+        if (externalSemaphore) {
+            deviceExtensions.insert(deviceExtensions.end(), g_semaphoreDeviceExtensions.begin(), g_semaphoreDeviceExtensions.end());
+        }
+
         VkDeviceCreateInfo createInfo;
         {
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-            createInfo.pNext = NULL;
+            createInfo.pNext = externalSemaphore ? &timelineFeatures : NULL;
             createInfo.flags = 0;
             createInfo.queueCreateInfoCount = 1;
             createInfo.pQueueCreateInfos = &queueCreateInfo;
@@ -1183,26 +1616,17 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // G.5. Create the Swapchain.
     // Creating a correct Swapchain requires querying a few things.
     // Like: surface format, max/min size, presentation mode.
-    VkSurfaceFormatKHR surfaceFormat;
-    // By standard the FIFO presentation mode should always be available.
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    VkExtent2D swapExtent = { windowWidth, windowHeight };
-
-    VkSwapchainKHR swapchain;
+    // SC. Everything except the size is stored in the config, the same values are used when the Swapchain is re-created.
+    SwapchainConfig swapchainConfig;
     {
-        // G.5.1. Query the surface capabilities and select the swapchain's extent (width, height).
-        VkSurfaceCapabilitiesKHR surfaceCapabilities;
-        {
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
-
-            if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
-                swapExtent = surfaceCapabilities.currentExtent;
-            }
-        }
-
         // G.5.2. Select a surface format.
         {
             uint32_t formatCount;
@@ -1214,119 +1638,76 @@ int main(int argc, char **argv) {
 
             for (VkSurfaceFormatKHR &entry : surfaceFormats) {
                 if ((entry.format == VK_FORMAT_B8G8R8A8_SRGB) && (entry.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)) {
-                    surfaceFormat = entry;
+                    swapchainConfig.surfaceFormat = entry;
                     break;
                 }
             }
         }
 
-        // G.5.3. TODO: Select a presentation mode, if the FIFO is not good.
-        /*
-        {
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, NULL);
-
-            std::vector<VkPresentModeKHR> presentModes;
-            presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
-        }
-        */
-
-        // G.5.4. Specify the number of images in the swap chain.
-        // For better performance using "min + 1";
-        uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
-        VkSwapchainCreateInfoKHR createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.surface = surface;
-            createInfo.minImageCount = imageCount;
-            createInfo.imageFormat = surfaceFormat.format;
-            createInfo.imageColorSpace = surfaceFormat.colorSpace;
-            createInfo.imageExtent = swapExtent;
-            createInfo.imageArrayLayers = 1;
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            // If the graphics and presentation queue is different this should not be exclusive.
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = NULL;
-            createInfo.preTransform = surfaceCapabilities.currentTransform;
-            createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-            createInfo.presentMode = swapchainPresentMode;
-            createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
-        }
-
-        if (vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
-        }
+        swapchainConfig.requestedPresentMode = requestedPresentMode;
+        swapchainConfig.requestedImageCount = requestedSwapchainImages;
+        swapchainConfig.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     }
 
+    const VkSurfaceFormatKHR surfaceFormat = swapchainConfig.surfaceFormat;
+    // By standard the FIFO presentation mode should always be available.
+    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D swapExtent = { windowWidth, windowHeight };
+    VkSwapchainKHR swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, VK_NULL_HANDLE, &swapExtent, &swapchainPresentMode);
+
     // G.6. Get the Swapchain images.
-    std::vector<VkImage> swapImages;
-    {
-        uint32_t imageCount;
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, NULL);
-        swapImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapImages.data());
-    }
+    std::vector<VkImage> swapImages = GetSwapchainImages(device, swapchain);
+
+    printf("Present mode: %s, swapchain images: %u, frames in flight: %u, max FPS: %.1f\n",
+           PresentModeName(swapchainPresentMode), (uint32_t)swapImages.size(), framesInFlight, maxFps);
 
     // Old 5. and 6. steps are removed.
     // The Swapchain creation takes care of the render target image creation.
+    // SC. Updated when the Swapchain is re-created.
     uint32_t renderImageWidth = swapExtent.width;
     uint32_t renderImageHeight = swapExtent.height;
 
     // G.7. Create Image Views for the Swapchain Images.
     // This replaces the old 7. step.
+    // SC. The views are re-created with the Swapchain.
     std::vector<VkImageView> swapImageViews;
-    swapImageViews.resize(swapImages.size());
-    {
-        VkImageViewCreateInfo createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            //createInfo.image = renderImage;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = surfaceFormat.format;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
-        }
-
-        for (size_t idx = 0; idx < swapImages.size(); idx++) {
-            createInfo.image = swapImages[idx];
-
-            if (vkCreateImageView(device, &createInfo, NULL, &swapImageViews[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
+    CreateSwapchainImageViews(device, surfaceFormat.format, swapImages, &swapImageViews);
+
+    // T.XX. Wait for the other side to provide the image FDs
+    ExportedRingFds ringFds;
+    printf("Waiting for FD\n");
+    if (socketTransport) {
+        ReceiveRingFds(fdSockets[0], &ringFds);
+    } else {
+        std::unique_lock<std::mutex> lock(threadOptions.syncMutex);
+        if (!threadOptions.fdsReady) {
+            threadOptions.signal.wait(lock);
         }
+        ringFds = threadOptions.exposedFds;
     }
+    printf("Waiting for done: %d (%u image(s))\n", ringFds.imageFds[0], ringFds.imageCount);
 
-    // T.XX. Wait for the other side to provide the image FD
-    {
-        std::unique_lock<std::mutex> lock(threadOptions.syncMutex);
-        printf("Waiting for FD\n");
-        if (threadOptions.exposedImageFd == -1) {
-            threadOptions.signal.wait(lock);
+    // IR.1. Import the semaphores and map the queues of the ring.
+    VkSemaphore importedWriteSemaphores[g_maxRingImages];
+    VkSemaphore importedReleaseSemaphore = VK_NULL_HANDLE;
+    ImageRingShared *ringShared = NULL;
+    if (externalSemaphore) {
+        for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+            importedWriteSemaphores[ringIdx] = ImportTimelineSemaphore(device, ringFds.semaphoreFds[ringIdx]);
         }
-        printf("Waiting for done: %d\n", threadOptions.exposedImageFd);
+        importedReleaseSemaphore = ImportTimelineSemaphore(device, ringFds.releaseSemaphoreFd);
+
+        ringShared = MapImageRingShared(ringFds.sharedFd, false);
+        close(ringFds.sharedFd);
     }
-    int importedImageFd = threadOptions.exposedImageFd;
 
     uint32_t importedImageWidth = 256;
     uint32_t importedImageHeight = 256;
     VkFormat importedImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
 
-    VkImage importedImage;
-    {
+    // IR.2. Import every image of the ring.
+    VkImage importedImages[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         // T.5.1. Create the required external memory structs
         VkExternalMemoryImageCreateInfoKHR externalInfo;
         {
@@ -1363,7 +1744,7 @@ int main(int argc, char **argv) {
         }
 
         // T.5.3. Create the image.
-        if (vkCreateImage(device, &imageInfo, NULL, &importedImage) != VK_SUCCESS) {
+        if (vkCreateImage(device, &imageInfo, NULL, &importedImages[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create 2D image!");
         }
     }
@@ -1371,11 +1752,11 @@ int main(int argc, char **argv) {
     // T.6. Allocate and bind the memory for the render target image.
     // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
     // To enable memory sharing the VkExportMemoryAllocateInfo struct is required.
-    VkDeviceMemory importedImageMemory;
-    {
+    VkDeviceMemory importedImageMemories[g_maxRingImages];
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
         // T.6.1 Query the memory requirments for the image.
         VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, importedImage, &memRequirements);
+        vkGetImageMemoryRequirements(device, importedImages[ringIdx], &memRequirements);
 
         // T.6.2 Find a memory type based on the requirements.
         // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
@@ -1388,7 +1769,7 @@ int main(int argc, char **argv) {
         {
             dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
             dedicatedInfo.pNext = NULL;
-            dedicatedInfo.image = importedImage;
+            dedicatedInfo.image = importedImages[ringIdx];
             dedicatedInfo.buffer = VK_NULL_HANDLE;
         }
 
@@ -1397,7 +1778,7 @@ int main(int argc, char **argv) {
             importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR;
             importInfo.pNext = &dedicatedInfo;
             importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
-            importInfo.fd = importedImageFd;
+            importInfo.fd = ringFds.imageFds[ringIdx];
         }
 
         // T.6.4. Based on the memory requirements specify the allocation information.
@@ -1410,12 +1791,12 @@ int main(int argc, char **argv) {
         }
 
         // T.6.5 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &importedImageMemory) != VK_SUCCESS) {
+        if (vkAllocateMemory(device, &allocInfo, NULL, &importedImageMemories[ringIdx]) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate image memory!");
         }
 
         // T.6.6 "Connect" the image with the allocated memory.
-        VkResult r = vkBindImageMemory(device, importedImage, importedImageMemory, 0);
+        VkResult r = vkBindImageMemory(device, importedImages[ringIdx], importedImageMemories[ringIdx], 0);
         printf("import Bind result: %d :%d\n", r == VK_SUCCESS, r);
     }
 
@@ -1438,216 +1819,277 @@ int main(int argc, char **argv) {
         }
     }
 
-    // G.9. Create a Command Buffer for each Swapchain Image View (Framebuffer).
+    // G.9. Create and record a Command Buffer for each Swapchain Image View (Framebuffer).
+    // IR.3. The blit source is also selected by the Command Buffer: "ringIdx * swapImages.size() + imageIndex".
+    // SC. The Command Buffers reference the Swapchain images, they are re-recorded with the Swapchain.
+    const VkExtent2D importedExtent = { importedImageWidth, importedImageHeight };
     std::vector<VkCommandBuffer> cmdBuffers;
+    RecordBlitCommands(device, cmdPool, graphicsQueueFamilyIdx, importedImages, ringImageCount, importedExtent,
+                       externalSemaphore, swapImages, swapExtent, &cmdBuffers);
+
+    // Recording of the draw commands into the Command Buffer is done.
+    // Now the Command Buffer should be sent to the GPU.
+
+    const uint32_t imagesInFlight = framesInFlight;
+
+    // G.14. As there are multiple images now more sync objects are required.
+    // This replaces the old 19. step.
+    // imageAvailableSemaphores will store the Semaphores to check if the next image is available to draw on to.
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    // renderFinishedSemaphores will store the Semaphores to check if the image finished rendering.
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    std::vector<VkFence> swapImagesFences;
+    std::vector<VkFence> activeFences;
     {
-        cmdBuffers.resize(swapImageViews.size());
+        imageAvailableSemaphores.resize(imagesInFlight);
+        renderFinishedSemaphores.resize(imagesInFlight);
+        activeFences.resize(imagesInFlight);
+        swapImagesFences.resize(swapImages.size(), VK_NULL_HANDLE);
 
-        VkCommandBufferAllocateInfo allocInfo;
+        VkSemaphoreCreateInfo semaphoreInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = cmdBuffers.size();
-        }
-
-        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext = NULL;
+            semaphoreInfo.flags = 0;
         }
-    }
-
-    // Start recording draw commands.
-    // G.10. In the current example all Command Buffers will have the same data.
 
-    // 16. Start Command Buffer
-    // G.11. Start all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        VkCommandBufferBeginInfo beginInfo;
+        VkFenceCreateInfo fenceInfo;
         {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
-            // can't be used.
-            beginInfo.flags = 0;
-            beginInfo.pInheritanceInfo = NULL;
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.pNext = 0;
+            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffers[idx], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
+        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &imageAvailableSemaphores[idx]) != VK_SUCCESS ||
+                vkCreateSemaphore(device, &semaphoreInfo, NULL, &renderFinishedSemaphores[idx]) != VK_SUCCESS ||
+                vkCreateFence(device, &fenceInfo, NULL, &activeFences[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
         }
     }
 
-    // 17. Insert draw commands into Command Buffer.
-    // G.12. Insert same draw commands into all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        VkImageMemoryBarrier baseStartBarrier;
-        {
-            baseStartBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            baseStartBarrier.pNext = NULL;
-            //startBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            //startBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            baseStartBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            //startBarrier.newLayout =
-            baseStartBarrier.srcQueueFamilyIndex = graphicsQueueFamilyIdx;
-            baseStartBarrier.dstQueueFamilyIndex = graphicsQueueFamilyIdx;
-            //startBarrier.image = ..
-            baseStartBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
+    // R.1. Create the readback ring.
+    // One slot for each image in flight and an extra one, so finished captures can be consumed
+    // while the next frames are rendered.
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, imagesInFlight + 1, NULL, &readbackRing);
 
-        VkImageMemoryBarrier importedImageBarrier = baseStartBarrier;
-        {
-            importedImageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            importedImageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    // R.1.1. The Swapchain images are BGRA, their readback is written out with R and B swapped.
+    const bool swapRB = (surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB) || (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
 
-            importedImageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            importedImageBarrier.image = importedImage;
-        }
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
 
-        VkImageMemoryBarrier presentImageStartBarrier = baseStartBarrier;
-        {
-            presentImageStartBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            presentImageStartBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            presentImageStartBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            presentImageStartBarrier.image = swapImages[idx];
-        }
+    // Newest completed capture, it stays in its readback slot until the output image is written.
+    ReadbackSlot *capturedSlot = NULL;
+    uint64_t frameIdx = 0;
 
-        VkImageMemoryBarrier startBarriers[2] = { importedImageBarrier, presentImageStartBarrier };
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
 
-        vkCmdPipelineBarrier(cmdBuffers[idx], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-                             0, NULL, // memory barriers
-                             0, NULL, // buffer barriers
-                             2, startBarriers);
+    // G.25. Draw and Present loop.
+    // Draw and Present a series of images.
+    uint32_t activeSyncIdx = 0;
+    // IR. The displayed image of the ring and the last value signaled on the release semaphore.
+    RingQueueEntry displayed = { 0, 0 };
+    bool hasDisplayed = !externalSemaphore;
+    uint64_t displayedReleaseValue = 0;
+    uint64_t releaseValue = 0;
+
+    // FP. The limiter paces the start of the frames, the latency is measured from acquire to present.
+    FramePacer framePacer;
+    InitFramePacer(maxFps, latencyLog, &framePacer);
+    bool swapchainOutOfDate = false;
+    while (!glfwWindowShouldClose(window)) {
+        // TC. Each iteration is a zone, the steps of the frame are nested into it.
+        TraceZone frameZone("frame");
 
-        VkImageBlit blitRegion;
+        // G.25.0. Run GLFW event polling.
         {
-            blitRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-            blitRegion.srcOffsets[0] = { 0, 0, 0 };
-            blitRegion.srcOffsets[1] = { (int32_t)importedImageWidth, (int32_t)importedImageHeight, 1 };
-            blitRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-            blitRegion.dstOffsets[0] = { 0, 0, 0 };
-            blitRegion.dstOffsets[1] = { (int32_t)swapExtent.width, (int32_t)swapExtent.height, 1 };
+            TraceZone zone("poll events");
+            glfwPollEvents();
         }
 
-        vkCmdBlitImage(cmdBuffers[idx], importedImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapImages[idx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitRegion, VK_FILTER_LINEAR);
-        // TODO: swapImage image transition to present src khr
+        // SC.1. Re-create the Swapchain after a resize or an out of date (or suboptimal) acquire/present.
+        // The imported ring is not size dependent, only the Swapchain side is rebuilt.
+        if (swapchainOutOfDate || framebufferResized) {
+            TraceZone zone("swapchain re-creation");
 
-        VkImageMemoryBarrier presentImageEndBarrier = presentImageStartBarrier;
-        {
-            presentImageEndBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            presentImageEndBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            // SC.1.1. A minimized window has a zero sized framebuffer, wait until it is restored.
+            int framebufferWidth = 0;
+            int framebufferHeight = 0;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            while (((framebufferWidth == 0) || (framebufferHeight == 0)) && !glfwWindowShouldClose(window)) {
+                glfwWaitEvents();
+                glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            }
 
-            presentImageEndBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            presentImageEndBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-            presentImageEndBarrier.image = swapImages[idx];
-        }
-        VkImageMemoryBarrier endBarriers[1] = { presentImageEndBarrier };
-        vkCmdPipelineBarrier(cmdBuffers[idx], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-                             0, NULL, // memory barriers
-                             0, NULL, // buffer barriers
-                             1, endBarriers);
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
 
-    }
+            swapchainOutOfDate = false;
+            framebufferResized = false;
 
-    // 18. End the Command Buffer recording.
-    // G.13. End all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        if (vkEndCommandBuffer(cmdBuffers[idx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
-    }
+            // SC.1.2. Wait until the frames in flight are done, they still use the old resources.
+            vkDeviceWaitIdle(device);
 
-    // Recording of the draw commands into the Command Buffer is done.
-    // Now the Command Buffer should be sent to the GPU.
+            // SC.1.3. Drop the remaining captures, the readback ring is re-created with the new size.
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                ReleaseReadback(slot);
+            }
+            // The kept capture has the old size, the next frames are captured again.
+            capturedSlot = NULL;
+            DestroyReadbackRing(device, &readbackRing);
 
-    const uint32_t imagesInFlight = 2;
+            // SC.1.4. Destroy the size dependent resources.
+            vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+            DestroySwapchainImageViews(device, &swapImageViews);
 
-    // G.14. As there are multiple images now more sync objects are required.
-    // This replaces the old 19. step.
-    // imageAvailableSemaphores will store the Semaphores to check if the next image is available to draw on to.
-    std::vector<VkSemaphore> imageAvailableSemaphores;
-    // renderFinishedSemaphores will store the Semaphores to check if the image finished rendering.
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> swapImagesFences;
-    std::vector<VkFence> activeFences;
-    {
-        imageAvailableSemaphores.resize(imagesInFlight);
-        renderFinishedSemaphores.resize(imagesInFlight);
-        activeFences.resize(imagesInFlight);
-        swapImagesFences.resize(swapImages.size(), VK_NULL_HANDLE);
+            // SC.1.5. Create the new Swapchain from the old one, then destroy the retired Swapchain.
+            const VkSwapchainKHR oldSwapchain = swapchain;
+            swapExtent = { (uint32_t)framebufferWidth, (uint32_t)framebufferHeight };
+            swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, oldSwapchain, &swapExtent, &swapchainPresentMode);
+            vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+            swapImages = GetSwapchainImages(device, swapchain);
+            renderImageWidth = swapExtent.width;
+            renderImageHeight = swapExtent.height;
 
-        VkSemaphoreCreateInfo semaphoreInfo;
+            // SC.1.6. Rebuild the size dependent resources.
+            CreateSwapchainImageViews(device, surfaceFormat.format, swapImages, &swapImageViews);
+            RecordBlitCommands(device, cmdPool, graphicsQueueFamilyIdx, importedImages, ringImageCount, importedExtent,
+                               externalSemaphore, swapImages, swapExtent, &cmdBuffers);
+            swapImagesFences.assign(swapImages.size(), VK_NULL_HANDLE);
+            CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, imagesInFlight + 1, NULL, &readbackRing);
+
+            printf("Swapchain: re-created with %ux%u, %u images\n", swapExtent.width, swapExtent.height, (uint32_t)swapImages.size());
+        }
+
+        // FP. Wait for the start of the next frame.
         {
-            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-            semaphoreInfo.pNext = NULL;
-            semaphoreInfo.flags = 0;
+            TraceZone zone("pace frame");
+            PaceFrame(&framePacer);
         }
 
-        VkFenceCreateInfo fenceInfo;
+        // G.25.1. Wait for the previous fence to "finish".
         {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;;
+            TraceZone zone("wait frame fence");
+            vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
         }
 
-        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
-            if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &imageAvailableSemaphores[idx]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, NULL, &renderFinishedSemaphores[idx]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, NULL, &activeFences[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create synchronization objects for a frame!");
+        // R.2. Consume the finished captures of earlier frames.
+        {
+            TraceZone zone("consume captures");
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                KeepNewestReadback(slot, &capturedSlot);
             }
         }
-    }
 
-    // G.25. Draw and Present loop.
-    // Draw and Present a series of images.
-    uint32_t activeSyncIdx = 0;
-    while (!glfwWindowShouldClose(window)) {
-        // G.25.0. Run GLFW event polling.
-        glfwPollEvents();
+        // IR.4. Take the newest written image, the older ones are released without being read.
+        // The displayed one is released when a newer arrives, the producer waits for its reads on the GPU.
+        if (externalSemaphore) {
+            TraceZone zone("take ready image");
+            RingQueueEntry readyEntry;
+            while (RingQueuePop(&ringShared->ready, &readyEntry)) {
+                if (hasDisplayed) {
+                    RingQueuePush(&ringShared->released, RingQueueEntry{ displayed.imageIdx, displayedReleaseValue });
+                }
+                displayed = readyEntry;
+                displayedReleaseValue = 0;
+                hasDisplayed = true;
+            }
 
-        // G.25.1. Wait for the previous fence to "finish".
-        vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
+            // Nothing was written yet.
+            if (!hasDisplayed) {
+                continue;
+            }
+        }
 
         // G.25.2. Get the next Swapchain Image Index.
+        const std::chrono::steady_clock::time_point acquireStart = std::chrono::steady_clock::now();
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+        VkResult acquireResult;
+        {
+            TraceZone zone("acquire image");
+            acquireResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+        }
+
+        // SC.2. An out of date Swapchain can't be used, skip the frame and re-create the Swapchain.
+        // A suboptimal Swapchain still presents this frame, it is re-created afterwards.
+        if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+            swapchainOutOfDate = true;
+            continue;
+        } else if (acquireResult == VK_SUBOPTIMAL_KHR) {
+            swapchainOutOfDate = true;
+        } else if (acquireResult != VK_SUCCESS) {
+            throw std::runtime_error("failed to acquire swapchain image!");
+        }
 
         // G.25.3. Wait for the target image to be available.
         if (swapImagesFences[imageIndex] != VK_NULL_HANDLE) {
+            TraceZone zone("wait image fence");
             vkWaitForFences(device, 1, &swapImagesFences[imageIndex], VK_TRUE, UINT64_MAX);
         }
         // Connect the current fence to the given swapchaing image.
         swapImagesFences[imageIndex] = activeFences[activeSyncIdx];
 
         // Configure a few sync points.
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx] };
+        // IR.5. The blit waits for the written value of the displayed image and signals the next release value.
+        // The values of the binary semaphores are ignored.
+        const uint32_t syncSemaphoreCount = externalSemaphore ? 2 : 1;
+        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx],
+                                         externalSemaphore ? importedWriteSemaphores[displayed.imageIdx] : VK_NULL_HANDLE };
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT };
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx], importedReleaseSemaphore };
+        const uint64_t waitValues[] = { 0, displayed.value };
+        const uint64_t signalValues[] = { 0, releaseValue + 1 };
+
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo;
+        {
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timelineInfo.pNext = NULL;
+            timelineInfo.waitSemaphoreValueCount = syncSemaphoreCount;
+            timelineInfo.pWaitSemaphoreValues = waitValues;
+            timelineInfo.signalSemaphoreValueCount = syncSemaphoreCount;
+            timelineInfo.pSignalSemaphoreValues = signalValues;
+        }
+
+        // R.3. Record the capture of this frame, it is executed in the same submission after the draw commands.
+        // If no readback slot is free the frame is not captured, the loop never waits for the CPU side.
+        VkCommandBuffer frameCmdBuffers[2] = {
+            cmdBuffers[displayed.imageIdx * swapImages.size() + imageIndex],
+            RecordReadback(device, &readbackRing, swapImages[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, activeFences[activeSyncIdx], frameIdx),
+        };
+        frameIdx++;
 
         // G.25.4. Build the Submit info using the sync points.
         VkSubmitInfo submitInfo;
         {
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.pNext = externalSemaphore ? &timelineInfo : NULL;
+            submitInfo.waitSemaphoreCount = syncSemaphoreCount;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffers[imageIndex];
-            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.commandBufferCount = (frameCmdBuffers[1] != VK_NULL_HANDLE) ? 2 : 1;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
+            submitInfo.signalSemaphoreCount = syncSemaphoreCount;
             submitInfo.pSignalSemaphores = signalSemaphores;
         }
 
         vkResetFences(device, 1, &activeFences[activeSyncIdx]);
 
         // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        {
+            TraceZone zone("queue submit");
+            if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+        }
+        if (externalSemaphore) {
+            releaseValue++;
+            displayedReleaseValue = releaseValue;
         }
 
         VkPresentInfoKHR presentInfo;
@@ -1662,71 +2104,48 @@ int main(int argc, char **argv) {
             presentInfo.pResults = NULL;
         }
 
-        vkQueuePresentKHR(queue, &presentInfo);
+        // SC.3. Re-create the Swapchain before the next frame if it no longer matches the surface.
+        VkResult presentResult;
+        {
+            TraceZone zone("queue present");
+            presentResult = vkQueuePresentKHR(queue, &presentInfo);
+        }
+        if ((presentResult == VK_ERROR_OUT_OF_DATE_KHR) || (presentResult == VK_SUBOPTIMAL_KHR)) {
+            swapchainOutOfDate = true;
+        } else if (presentResult != VK_SUCCESS) {
+            throw std::runtime_error("failed to present swapchain image!");
+        }
+
+        // FP. Track the acquire->present latency of the frame.
+        const std::chrono::steady_clock::time_point presentEnd = std::chrono::steady_clock::now();
+        RecordFrameLatency(&framePacer, imageIndex, std::chrono::duration<double, std::milli>(presentEnd - acquireStart).count());
 
         activeSyncIdx = (activeSyncIdx + 1) % imagesInFlight;
-
-        // G.XX. Artificially slow down the rendering to avoid Epileptic seizure.
-        //usleep((int)(0.15 * 1000000));
     }
 
     // At this point the image is rendered into the Framebuffer's attachment which is an ImageView.
 
     printf("--- getting last image\n");
-    {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, swapImages[0], renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
+    PrintFrameLatency(framePacer);
 
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
-        }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
+    // IR.6. Request the producer stop, the submits above only wait for frames it already submitted.
+    threadOptions.stopRequested.store(true);
+    if (processProducer) {
+        shutdown(fdSockets[0], SHUT_RDWR);
+    }
 
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
-        }
+    // R.4. Wait for the frames in flight and consume the remaining captures.
+    vkWaitForFences(device, imagesInFlight, activeFences.data(), VK_TRUE, UINT64_MAX);
+    for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+        KeepNewestReadback(slot, &capturedSlot);
+    }
 
+    if (capturedSlot != NULL) {
         // 25. Write out the image to a ppm file.
         {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, capturedSlot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, swapRB, ppmMmap);
         }
-
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
-
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
-
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
     }
 
     // G.XX. Destroy Sync object.
@@ -1739,20 +2158,35 @@ int main(int argc, char **argv) {
     // G.XX. Free Command Buffers.
     vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
 
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
+
     // XX. Destroy Command Pool
     vkDestroyCommandPool(device, cmdPool, NULL);
 
-    vkDestroyImage(device, importedImage, NULL);
-    vkFreeMemory(device, importedImageMemory, NULL);
+    for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+        vkDestroyImage(device, importedImages[ringIdx], NULL);
+        vkFreeMemory(device, importedImageMemories[ringIdx], NULL);
+    }
 
-    // G.XX. Destroy swapchain image views.
-    for (size_t idx = 0; idx < swapImageViews.size(); idx++) {
-        vkDestroyImageView(device, swapImageViews[idx], NULL);
+    // IR.XX. Destroy the imported semaphores and unmap the queues of the ring.
+    if (externalSemaphore) {
+        for (uint32_t ringIdx = 0; ringIdx < ringImageCount; ringIdx++) {
+            vkDestroySemaphore(device, importedWriteSemaphores[ringIdx], NULL);
+        }
+        vkDestroySemaphore(device, importedReleaseSemaphore, NULL);
+        munmap(ringShared, sizeof(ImageRingShared));
     }
 
+    // G.XX. Destroy swapchain image views.
+    DestroySwapchainImageViews(device, &swapImageViews);
+
     // G.XX. Destroy swapchain.
     vkDestroySwapchainKHR(device, swapchain, NULL);
 
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
     // XX. Destroy Device
     vkDestroyDevice(device, NULL);
 
@@ -1769,365 +2203,513 @@ int main(int argc, char **argv) {
     glfwTerminate();
 
 
-    printf("waiting for render thread end\n");
-    {
-        std::unique_lock<std::mutex> lock(threadOptions.syncMutex);
-        threadOptions.signal.notify_one(); // signal the othre side that the FD is ready
+    if (processProducer) {
+        // PR.3. The producer process was stopped at IR.6, wait for it and report its failure.
+        printf("waiting for producer process end\n");
+        int status = 0;
+        while ((waitpid(producerPid, &status, 0) < 0) && (errno == EINTR)) {
+        }
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            throw std::runtime_error("the producer process failed!");
+        }
+    } else {
+        printf("waiting for render thread end\n");
+        {
+            std::unique_lock<std::mutex> lock(threadOptions.syncMutex);
+            threadOptions.signal.notify_one(); // signal the othre side that the FD is ready
+        }
+        renderThread.join();
     }
-    renderThread.join();
 
+    // TC. Export the trace, the producer thread is stopped by now.
+    if (g_tracer.enabled) {
+        WriteTrace(envTrace);
+    }
+
+    if (socketTransport) {
+        close(fdSockets[0]);
+        if (fdSockets[1] >= 0) {
+            close(fdSockets[1]);
+        }
+    }
 
     return 0;
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
+VkSemaphore CreateExportedTimelineSemaphore(const VkInstance instance,
+                                            const VkPhysicalDevice physicalDevice,
+                                            const VkDevice device,
+                                            int *outFd) {
+    VkSemaphoreTypeCreateInfoKHR typeInfo;
+    {
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.pNext = NULL;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
     }
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+    // SEM.1. Check if a timeline semaphore can be exported and imported as an opaque FD.
+    {
+        PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR vkGetPhysicalDeviceExternalSemaphorePropertiesKHR =
+            (PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceExternalSemaphorePropertiesKHR");
 
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+        VkPhysicalDeviceExternalSemaphoreInfoKHR semaphoreInfo;
+        {
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO_KHR;
+            semaphoreInfo.pNext = &typeInfo;
+            semaphoreInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+        }
 
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
+        VkExternalSemaphorePropertiesKHR properties;
+        {
+            properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES_KHR;
+            properties.pNext = NULL;
+        }
+        vkGetPhysicalDeviceExternalSemaphorePropertiesKHR(physicalDevice, &semaphoreInfo, &properties);
 
-            if (surface != VK_NULL_HANDLE) {
-                // G.XX. Check if the selected graphics queue family supports presentation.
-                // At the moment the example expects that the graphics and presentation queue is the same.
-                // This is not always the case.
-                // TODO: add support for different graphics and presentation family indices.
-                VkBool32 presentSupport;
-                vkGetPhysicalDeviceSurfaceSupportKHR(device, queueFamilyIdx, surface, &presentSupport);
-                if (presentSupport) {
-                    return queueFamilyIdx;
-                }
-            } else {
-                return queueFamilyIdx;
-            }
+        const VkExternalSemaphoreFeatureFlagsKHR required = VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT_KHR
+                                                            | VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT_KHR;
+        if ((properties.externalSemaphoreFeatures & required) != required) {
+            throw std::runtime_error("timeline semaphores can't be shared as opaque FD!");
         }
+    }
 
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
+    // SEM.2. Create the semaphore with the export information.
+    VkSemaphore semaphore;
+    {
+        VkExportSemaphoreCreateInfoKHR exportInfo;
+        {
+            exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR;
+            exportInfo.pNext = &typeInfo;
+            exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+        }
+
+        VkSemaphoreCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            createInfo.pNext = &exportInfo;
+            createInfo.flags = 0;
+        }
+
+        if (vkCreateSemaphore(device, &createInfo, NULL, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timeline semaphore!");
+        }
     }
 
-    return UINT32_MAX;
-}
+    // SEM.3. Get the file descriptor which can be imported by the other Vulkan Instance.
+    {
+        PFN_vkGetSemaphoreFdKHR vkGetSemaphoreFdKHR = (PFN_vkGetSemaphoreFdKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreFdKHR");
 
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        VkSemaphoreGetFdInfoKHR getFdInfo;
+        {
+            getFdInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+            getFdInfo.pNext = NULL;
+            getFdInfo.semaphore = semaphore;
+            getFdInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+        }
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+        if (vkGetSemaphoreFdKHR(device, &getFdInfo, outFd) != VK_SUCCESS) {
+            throw std::runtime_error("unable to get semaphore FD!");
         }
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
+    return semaphore;
 }
 
-#if HAVE_SHADERC
+VkSemaphore ImportTimelineSemaphore(const VkDevice device, int fd) {
+    // SEM.4. The importing semaphore must have the same type as the exported one.
+    VkSemaphore semaphore;
+    {
+        VkSemaphoreTypeCreateInfoKHR typeInfo;
+        {
+            typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+            typeInfo.pNext = NULL;
+            typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+            typeInfo.initialValue = 0;
+        }
 
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+        VkSemaphoreCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            createInfo.pNext = &typeInfo;
+            createInfo.flags = 0;
+        }
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+        if (vkCreateSemaphore(device, &createInfo, NULL, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timeline semaphore!");
+        }
     }
 
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
+    // SEM.5. Import the payload, on success the FD is owned by the Vulkan implementation.
+    {
+        PFN_vkImportSemaphoreFdKHR vkImportSemaphoreFdKHR = (PFN_vkImportSemaphoreFdKHR)vkGetDeviceProcAddr(device, "vkImportSemaphoreFdKHR");
+
+        VkImportSemaphoreFdInfoKHR importInfo;
+        {
+            importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+            importInfo.pNext = NULL;
+            importInfo.semaphore = semaphore;
+            importInfo.flags = 0;
+            importInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR;
+            importInfo.fd = fd;
+        }
+
+        if (vkImportSemaphoreFdKHR(device, &importInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to import semaphore FD!");
+        }
+    }
+
+    return semaphore;
 }
 
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+bool RingQueuePush(RingQueue *queue, const RingQueueEntry& entry) {
+    // IRQ.1. The head is acquired to see which entries were already popped by the other side.
+    const uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+    if (tail - queue->head.load(std::memory_order_acquire) == g_ringQueueCapacity) {
+        return false;
+    }
 
-    return { module.begin(), module.end() };
+    // IRQ.2. The release store makes the entry visible before the new tail.
+    queue->entries[tail % g_ringQueueCapacity] = entry;
+    queue->tail.store(tail + 1, std::memory_order_release);
+    return true;
 }
 
-#else
+bool RingQueuePop(RingQueue *queue, RingQueueEntry *outEntry) {
+    // IRQ.3. The tail is acquired to see the entries pushed by the other side.
+    const uint32_t head = queue->head.load(std::memory_order_relaxed);
+    if (head == queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    }
 
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
+    // IRQ.4. The entry must be read before the slot is given back to the producer of the queue.
+    *outEntry = queue->entries[head % g_ringQueueCapacity];
+    queue->head.store(head + 1, std::memory_order_release);
+    return true;
+}
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
+ImageRingShared *MapImageRingShared(int fd, bool create) {
+    if (create && (ftruncate(fd, sizeof(ImageRingShared)) != 0)) {
+        throw std::runtime_error("failed to resize the shared ring memory!");
     }
 
-    size_t fileSize = (size_t) file.tellg();
+    void *mapped = mmap(NULL, sizeof(ImageRingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("failed to map the shared ring memory!");
+    }
 
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+    // Only the creator constructs the queues (empty), the other side maps them as they are.
+    if (create) {
+        return new (mapped) ImageRingShared();
     }
+    return (ImageRingShared*)mapped;
+}
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+std::vector<int*> CollectRingFds(ExportedRingFds *fds) {
+    // IRS.1. The valid FDs in a fixed order, both sides of the socket use the same order.
+    std::vector<int*> result;
+    for (uint32_t idx = 0; idx < fds->imageCount; idx++) {
+        result.push_back(&fds->imageFds[idx]);
+    }
+    for (uint32_t idx = 0; idx < fds->imageCount; idx++) {
+        if (fds->semaphoreFds[idx] >= 0) {
+            result.push_back(&fds->semaphoreFds[idx]);
+        }
+    }
+    if (fds->releaseSemaphoreFd >= 0) {
+        result.push_back(&fds->releaseSemaphoreFd);
+    }
+    if (fds->sharedFd >= 0) {
+        result.push_back(&fds->sharedFd);
+    }
+
+    return result;
+}
+
+void SendRingFds(int socketFd, ExportedRingFds fds) {
+    std::vector<int*> fdFields = CollectRingFds(&fds);
+    const size_t fdsSize = fdFields.size() * sizeof(int);
+
+    // IRS.2. The struct is the payload (for the counts and the unused fields),
+    // the FDs themselves are duplicated into the receiver by the SCM_RIGHTS control message.
+    struct iovec payload;
+    {
+        payload.iov_base = &fds;
+        payload.iov_len = sizeof(fds);
+    }
 
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
+    std::vector<uint64_t> control((CMSG_SPACE(fdsSize) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    struct msghdr message;
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = CMSG_SPACE(fdsSize);
+    }
 
-    file.close();
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(fdsSize);
+    int *data = (int*)CMSG_DATA(header);
+    for (size_t idx = 0; idx < fdFields.size(); idx++) {
+        data[idx] = *fdFields[idx];
+    }
 
-    return buffer;
+    if (sendmsg(socketFd, &message, 0) != (ssize_t)sizeof(fds)) {
+        throw std::runtime_error("failed to send the ring FDs!");
+    }
 }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
+void ReceiveRingFds(int socketFd, ExportedRingFds *outFds) {
+    struct iovec payload;
     {
-        VkImageCreateInfo imageInfo;
-        {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        }
+        payload.iov_base = outFds;
+        payload.iov_len = sizeof(*outFds);
+    }
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
-        }
+    const size_t maxFdsSize = (2 * g_maxRingImages + 2) * sizeof(int);
+    std::vector<uint64_t> control((CMSG_SPACE(maxFdsSize) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    struct msghdr message;
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = CMSG_SPACE(maxFdsSize);
     }
 
-    *outImage = readableImage;
+    // IRR.1. Blocks until the producer sent the FDs, they are received with close-on-exec.
+    if (recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(*outFds)) {
+        throw std::runtime_error("failed to receive the ring FDs!");
+    }
 
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if ((header == NULL) || (header->cmsg_level != SOL_SOCKET) || (header->cmsg_type != SCM_RIGHTS)
+        || (message.msg_flags & MSG_CTRUNC) || (outFds->imageCount == 0) || (outFds->imageCount > g_maxRingImages)) {
+        throw std::runtime_error("invalid ring FD message!");
+    }
+
+    // IRR.2. Replace the sender's FD numbers with the received ones, in the same order as they were sent.
+    std::vector<int*> fdFields = CollectRingFds(outFds);
+    const size_t receivedCount = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (receivedCount != fdFields.size()) {
+        throw std::runtime_error("invalid ring FD count!");
+    }
+
+    const int *data = (const int*)CMSG_DATA(header);
+    for (size_t idx = 0; idx < fdFields.size(); idx++) {
+        *fdFields[idx] = data[idx];
+    }
+}
+
+void CloseRingFds(ExportedRingFds fds) {
+    for (int *fd : CollectRingFds(&fds)) {
+        close(*fd);
+    }
+}
+
+bool SocketClosed(int socketFd, int timeoutMs) {
+    // PR.4. Nothing is sent after the FDs, so the socket only becomes readable (EOF) or hung up
+    // when the consumer shut down its end.
+    struct pollfd pollInfo;
     {
-        // A.2.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
+        pollInfo.fd = socketFd;
+        pollInfo.events = POLLIN;
+        pollInfo.revents = 0;
+    }
 
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
+    const int result = poll(&pollInfo, 1, timeoutMs);
+    if ((result < 0) && (errno != EINTR)) {
+        throw std::runtime_error("failed to poll the FD socket!");
+    }
+
+    return (result > 0);
+}
+
+void CreateSwapchainImageViews(const VkDevice device,
+                               VkFormat format,
+                               const std::vector<VkImage>& images,
+                               std::vector<VkImageView> *outImageViews) {
+    // G.7.1. Create Image Views for the Swapchain Images.
+    outImageViews->resize(images.size());
+    {
+        VkImageViewCreateInfo createInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            //createInfo.image = renderImage;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = format;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
         }
 
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            createInfo.image = images[idx];
+
+            if (vkCreateImageView(device, &createInfo, NULL, &(*outImageViews)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
+            }
         }
+    }
+}
 
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
+void DestroySwapchainImageViews(const VkDevice device, std::vector<VkImageView> *imageViews) {
+    for (size_t idx = 0; idx < imageViews->size(); idx++) {
+        vkDestroyImageView(device, (*imageViews)[idx], NULL);
     }
 
-    *outMemory = readableImageMemory;
+    imageViews->clear();
+}
 
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
+void RecordBlitCommands(const VkDevice device,
+                        const VkCommandPool cmdPool,
+                        uint32_t queueFamilyIdx,
+                        const VkImage *importedImages,
+                        uint32_t ringImageCount,
+                        VkExtent2D importedExtent,
+                        bool externalSemaphore,
+                        const std::vector<VkImage>& swapImages,
+                        VkExtent2D extent,
+                        std::vector<VkCommandBuffer> *outCmdBuffers) {
+    std::vector<VkCommandBuffer>& cmdBuffers = *outCmdBuffers;
+
+    // G.9.1. Allocate a Command Buffer for each (ring image, Swapchain image) pair.
     {
+        cmdBuffers.resize(swapImages.size() * ringImageCount);
+
         VkCommandBufferAllocateInfo allocInfo;
         {
             allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.pNext = NULL;
             allocInfo.commandPool = cmdPool;
             allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            allocInfo.commandBufferCount = cmdBuffers.size();
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate command buffers!");
         }
     }
 
-    // Start recording image copy commands.
+    // Start recording draw commands.
+    // G.10. In the current example all Command Buffers will have the same data.
 
-    // A.4. Start Command Buffer.
+    // 16. Start Command Buffer
+    // G.11. Start all Command Buffers.
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
     {
         VkCommandBufferBeginInfo beginInfo;
         {
             beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
             beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
+            // can't be used.
+            beginInfo.flags = 0;
             beginInfo.pInheritanceInfo = NULL;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+        if (vkBeginCommandBuffer(cmdBuffers[idx], &beginInfo) != VK_SUCCESS) {
             throw std::runtime_error("failed to begin recording command buffer!");
         }
     }
 
-    // A.4. Transition destination image to transfer destination layout.
+    // 17. Insert draw commands into Command Buffer.
+    // G.12. Insert same draw commands into all Command Buffers.
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
     {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        const size_t swapIdx = idx % swapImages.size();
+        const size_t ringIdx = idx / swapImages.size();
+
+        VkImageMemoryBarrier baseStartBarrier;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            baseStartBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            baseStartBarrier.pNext = NULL;
+            //startBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            //startBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            baseStartBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            //startBarrier.newLayout =
+            baseStartBarrier.srcQueueFamilyIndex = queueFamilyIdx;
+            baseStartBarrier.dstQueueFamilyIndex = queueFamilyIdx;
+            //startBarrier.image = ..
+            baseStartBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
         }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
-
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        VkImageMemoryBarrier importedImageBarrier = baseStartBarrier;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; //VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
+            importedImageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            importedImageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+            // ES.X. With the semaphore sync the producer's frame is complete, its contents must be kept.
+            if (externalSemaphore) {
+                importedImageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            }
+            importedImageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            importedImageBarrier.image = importedImages[ringIdx];
+        }
 
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
-    }
-
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        VkImageMemoryBarrier presentImageStartBarrier = baseStartBarrier;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            presentImageStartBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            presentImageStartBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+            presentImageStartBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            presentImageStartBarrier.image = swapImages[swapIdx];
         }
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+        VkImageMemoryBarrier startBarriers[2] = { importedImageBarrier, presentImageStartBarrier };
 
-    // A.8. End the Command Buffer.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
-    }
+        vkCmdPipelineBarrier(cmdBuffers[idx], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, NULL, // memory barriers
+                             0, NULL, // buffer barriers
+                             2, startBarriers);
 
-    // A.9. Create a Fence.
-    VkFence fence;
-    {
-        VkFenceCreateInfo fenceInfo;
+        VkImageBlit blitRegion;
         {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
-        }
-
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
+            blitRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            blitRegion.srcOffsets[0] = { 0, 0, 0 };
+            blitRegion.srcOffsets[1] = { (int32_t)importedExtent.width, (int32_t)importedExtent.height, 1 };
+            blitRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            blitRegion.dstOffsets[0] = { 0, 0, 0 };
+            blitRegion.dstOffsets[1] = { (int32_t)extent.width, (int32_t)extent.height, 1 };
         }
 
-        //vkResetFences(device, 1, &fence);
-    }
+        vkCmdBlitImage(cmdBuffers[idx], importedImages[ringIdx], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapImages[swapIdx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitRegion, VK_FILTER_LINEAR);
+        // TODO: swapImage image transition to present src khr
 
-    // A.10. Submit the recorded Command Buffer to the Queue.
-    {
-        VkSubmitInfo submitInfo;
+        VkImageMemoryBarrier presentImageEndBarrier = presentImageStartBarrier;
         {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
-        }
+            presentImageEndBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            presentImageEndBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+            presentImageEndBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            presentImageEndBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            presentImageEndBarrier.image = swapImages[swapIdx];
         }
+        VkImageMemoryBarrier endBarriers[1] = { presentImageEndBarrier };
+        vkCmdPipelineBarrier(cmdBuffers[idx], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, NULL, // memory barriers
+                             0, NULL, // buffer barriers
+                             1, endBarriers);
+
     }
 
-    // A.11. Wait the submitted Command Buffer to finish.
+    // 18. End the Command Buffer recording.
+    // G.13. End all Command Buffers.
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
     {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
+        if (vkEndCommandBuffer(cmdBuffers[idx]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
         }
     }
-
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
-
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }
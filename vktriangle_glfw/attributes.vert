@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Set for the packed vertex layout, its normal is stored as UNORM.
+layout(constant_id = 0) const bool packedNormal = false;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inUV;
+layout(location = 3) in vec3 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    vec3 normal = packedNormal ? (inNormal * 2.0 - 1.0) : inNormal;
+    // Lit from the viewer, the UV darkens the triangle towards its bottom edge.
+    float shade = max(dot(normalize(normal), vec3(0.0, 0.0, 1.0)), 0.0) * (1.0 - 0.25 * inUV.y);
+
+    // Same rotation as in "passthrough.vert": the instance index shifts the corner colors.
+    int shift = gl_InstanceIndex % 3;
+    vec3 color = (shift == 0) ? inColor.rgb : ((shift == 1) ? inColor.brg : inColor.gbr);
+
+    gl_Position = vec4(inPosition, 0.0, 1.0);
+    fragColor = color * shade;
+}
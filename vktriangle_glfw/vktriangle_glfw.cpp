@@ -12,16 +12,46 @@
  * Re-Compile shaders (optional):
  * $ glslangValidator -V passthrough.vert -o passthrough.vert.spv
  * $ glslangValidator -V passthrough.frag -o passthrough.frag.spv
+ * $ glslangValidator -V attributes.vert -o attributes.vert.spv
  *
  * Compile with shaderc:
  * $ g++ vktriangle_glfw.cpp -o triangle_glfw -lvulkan -lglfw -lshaderc_shared -std=c++11 -DHAVE_SHADERC=1
  *
- * Run: the "passthrough.{vert,frag}*" files must be in the same dir.
+ * Run: the "passthrough.{vert,frag}*" (and for DEMO_VERTEX_LAYOUT the "attributes.vert*") files must be in the same dir.
  * $ ./triangle_glfw
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_FORCE_STAGING: Upload the vertex buffer with a staging copy (1) even if device local memory
+ *   is also host visible (ReBAR/UMA). Default: 0
+ * DEMO_BENCH: Render N frames offscreen (without presenting) with GPU timestamp and CPU timing, then exit.
+ *   Unset or 0 disables it. Default: 0
+ * DEMO_PRESENT_MODE: fifo, fifo_relaxed, mailbox or immediate, an unsupported mode falls back to fifo. Default: fifo
+ * DEMO_FRAMES_IN_FLIGHT: Number of frames the CPU can record ahead of the GPU. Default: 2
+ * DEMO_SWAPCHAIN_IMAGES: Requested swapchain image count, clamped to the surface limits. Default: minImageCount + 1
+ * DEMO_MAX_FPS: Frame rate limit of the draw loop, 0 disables it. Default: 6 (avoids fast flashing frames),
+ *   0 with DEMO_CAPTURE_FRAMES so the stream is captured at the full frame rate
+ * DEMO_LATENCY_LOG: Log the acquire->present latency of every frame (1), otherwise only a summary at exit. Default: 0
+ * DEMO_COMMAND_STRATEGY: prerecorded (one Command Buffer per swapchain image, recorded once) or per_frame
+ *   (re-recorded every frame from a Command Pool per frame in flight, reset with vkResetCommandPool). Default: prerecorded
+ * DEMO_TRACE: Record the draw loop zones and the GPU time of the frames, then write them as a Chrome trace
+ *   into the given JSON file at exit (chrome://tracing or ui.perfetto.dev). Default: unset (disabled)
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_VERTEX_LAYOUT: Vertex buffer layout: "position" (vec2 only), "aos" (interleaved float position, color,
+ *   UV and normal), "soa" (one binding per attribute) or "packed" (half float, RGBA8 and A2B10G10R10).
+ *   The benchmark mode reports the vertex fetch bandwidth. Default: position
+ * DEMO_CAPTURE_FRAMES: Enables the streaming capture of N frames, 0 captures until the window is closed. Default: unset (disabled)
+ * DEMO_CAPTURE_EVERY: Capture only every Nth frame. Default: 1
+ * DEMO_CAPTURE_FORMAT: ppm (numbered files), y4m or rgba (raw stream on stdout, logs go to stderr). Default: ppm
+ * DEMO_CAPTURE_OUTPUT: printf style file name pattern of the PPM sequence. Default: frame_%05u.ppm
+ *   Example: DEMO_CAPTURE_FRAMES=300 DEMO_CAPTURE_FORMAT=y4m ./<demo> | ffmpeg -i - out.mp4
  *
  * Dependencies:
  *  * C++11
@@ -35,6 +65,7 @@
  * Includes:
  *  * Validation layer enable.
  *  * PPM image output.
+ *  * Swapchain re-creation on window resize.
  *
  * Excludes:
  *  * No swapchain.
@@ -60,23 +91,31 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * OFTWARE.
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <future>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
 #include <GLFW/glfw3.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
@@ -86,43 +125,165 @@ const std::vector<const char*> g_swapchainDeviceExtension = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
-
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
-                                   const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
+static void CreateFramebuffers(const VkDevice device,
+                               const VkRenderPass renderPass,
+                               VkFormat format,
+                               VkExtent2D extent,
+                               const std::vector<VkImage>& images,
+                               std::vector<VkImageView> *outImageViews,
+                               std::vector<VkFramebuffer> *outFramebuffers);
+static void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers);
+static void RecordDrawCommands(const VkDevice device,
+                               const VkCommandPool cmdPool,
+                               const VkRenderPass renderPass,
+                               const VkPipeline pipeline,
+                               const VkBuffer vertexBuffer,
+                               const VertexLayoutData& vertexLayout,
+                               const std::vector<VkFramebuffer>& framebuffers,
+                               VkExtent2D extent,
+                               std::vector<VkCommandBuffer> *outCmdBuffers);
+// Record the draw commands of a single frame into "cmdBuffer", "firstInstance" selects the triangle color.
+static void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                                VkCommandBufferUsageFlags usageFlags,
+                                const VkRenderPass renderPass,
+                                const VkPipeline pipeline,
+                                const VkBuffer vertexBuffer,
+                                const VertexLayoutData& vertexLayout,
+                                const VkFramebuffer framebuffer,
+                                VkExtent2D extent,
+                                uint32_t firstInstance);
 
 int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envPresentMode = getenv("DEMO_PRESENT_MODE");
+    const char *envFramesInFlight = getenv("DEMO_FRAMES_IN_FLIGHT");
+    const char *envSwapchainImages = getenv("DEMO_SWAPCHAIN_IMAGES");
+    const char *envMaxFps = getenv("DEMO_MAX_FPS");
+    const char *envLatencyLog = getenv("DEMO_LATENCY_LOG");
+    const char *envCommandStrategy = getenv("DEMO_COMMAND_STRATEGY");
+    const char *envTrace = getenv("DEMO_TRACE");
+    const char *envBench = getenv("DEMO_BENCH");
+    const char *envForceStaging = getenv("DEMO_FORCE_STAGING");
+    const char *envVertexLayout = getenv("DEMO_VERTEX_LAYOUT");
+    const char *envCaptureFrames = getenv("DEMO_CAPTURE_FRAMES");
+    const char *envCaptureEvery = getenv("DEMO_CAPTURE_EVERY");
+    const char *envCaptureFormat = getenv("DEMO_CAPTURE_FORMAT");
+    const char *envCaptureOutput = getenv("DEMO_CAPTURE_OUTPUT");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    bool latencyLog = ((envLatencyLog != NULL) && (strncmp("1", envLatencyLog, 2) == 0));
+    uint32_t benchFrames = (envBench != NULL) ? (uint32_t)strtoul(envBench, NULL, 10) : 0;
+    bool forceStaging = ((envForceStaging != NULL) && (strncmp("1", envForceStaging, 2) == 0));
+    VertexLayout vertexLayoutMode = VERTEX_LAYOUT_POSITION;
+    if (envVertexLayout != NULL) {
+        vertexLayoutMode = ParseVertexLayout(envVertexLayout);
+    }
+    CommandStrategy commandStrategy = COMMAND_STRATEGY_PRERECORDED;
+    if (envCommandStrategy != NULL) {
+        commandStrategy = ParseCommandStrategy(envCommandStrategy);
+    }
+
+    // TC. Start the trace clock, the main thread is the first traced thread.
+    InitTracer((envTrace != NULL) && (envTrace[0] != '\0'));
+    TraceRegisterThread("main");
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
+    // FP. Configure the presentation and the frame pacing.
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (envPresentMode != NULL) {
+        requestedPresentMode = ParsePresentMode(envPresentMode);
+    }
+
+    uint32_t framesInFlight = 2;
+    if ((envFramesInFlight != NULL) && (atoi(envFramesInFlight) > 0)) {
+        framesInFlight = atoi(envFramesInFlight);
+    }
+
+    uint32_t requestedSwapchainImages = 0;
+    if ((envSwapchainImages != NULL) && (atoi(envSwapchainImages) > 0)) {
+        requestedSwapchainImages = atoi(envSwapchainImages);
+    }
+
+    // FP. The streaming capture is not limited by default, the captured frames are not shown to anyone.
+    double maxFps = (envCaptureFrames != NULL) ? 0 : 6;
+    if (envMaxFps != NULL) {
+        maxFps = atof(envMaxFps);
+    }
+
+    // C.0. Configure the streaming capture.
+    bool captureEnabled = (envCaptureFrames != NULL);
+    uint32_t captureFrameCount = captureEnabled ? (uint32_t)strtoul(envCaptureFrames, NULL, 10) : 0;
+    uint32_t captureEvery = 1;
+    if ((envCaptureEvery != NULL) && (atoi(envCaptureEvery) > 0)) {
+        captureEvery = atoi(envCaptureEvery);
+    }
+
+    CaptureFormat captureFormat = CAPTURE_FORMAT_PPM;
+    if (envCaptureFormat != NULL) {
+        if (strcmp(envCaptureFormat, "y4m") == 0) {
+            captureFormat = CAPTURE_FORMAT_Y4M;
+        } else if (strcmp(envCaptureFormat, "rgba") == 0) {
+            captureFormat = CAPTURE_FORMAT_RGBA;
+        } else if (strcmp(envCaptureFormat, "ppm") != 0) {
+            throw std::runtime_error("unknown capture format!");
+        }
+    }
+
+    const char *captureOutputPattern = "frame_%05u.ppm";
+    if (envCaptureOutput != NULL) {
+        captureOutputPattern = envCaptureOutput;
+    }
+
+    // The Y4M and RGBA streams take over stdout, every other message is redirected to stderr.
+    FILE *captureStream = NULL;
+    if (captureEnabled && (captureFormat != CAPTURE_FORMAT_PPM)) {
+        fflush(stdout);
+        captureStream = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Vertex layout: %s\n", VertexLayoutName(vertexLayoutMode));
+    printf("Command strategy: %s\n", (commandStrategy == COMMAND_STRATEGY_PER_FRAME) ? "per_frame" : "prerecorded");
+    if (benchFrames > 0) {
+        printf("Bench: %u frames, offscreen\n", benchFrames);
+    }
+    if (captureEnabled) {
+        static const char *captureFormatNames[] = { "ppm", "y4m", "rgba" };
+        printf("Capture: %s, every %u. frame, %u frames (0: until exit)\n",
+               captureFormatNames[captureFormat], captureEvery, captureFrameCount);
+    }
+
+    // ST.1. Start loading (or compiling) the shaders on worker threads.
+    // This runs in parallel with the Instance/Device creation, the results are only
+    // waited for at the Shader Module creation (on the Pipeline worker thread, PS.1).
+    // VL.2. The attribute layouts use the shader variant with the color, UV and normal inputs.
+    const std::string vertName = (vertexLayoutMode != VERTEX_LAYOUT_POSITION) ? "attributes.vert" : "passthrough.vert";
+    std::future<std::vector<uint32_t> > vertShaderLoad = LoadShaderAsync(vertName);
+    std::future<std::vector<uint32_t> > fragShaderLoad = LoadShaderAsync("passthrough.frag");
 
     // G.0. Initialize GLFW.
     {
@@ -135,12 +296,20 @@ int main(int argc, char **argv) {
     uint32_t windowWidth = 512;
     uint32_t windowHeight = 512;
     GLFWwindow* window;
+    bool framebufferResized = false;
     {
         // With GLFW_CLIENT_API set to GLFW_NO_API there will be no OpenGL (ES) context.
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        // SC. The window can be resized, except for the benchmark and the streaming capture (fixed frame size).
+        glfwWindowHint(GLFW_RESIZABLE, ((benchFrames == 0) && !captureEnabled) ? GLFW_TRUE : GLFW_FALSE);
+        // BN. The benchmark does not present, the window is only required for the surface.
+        glfwWindowHint(GLFW_VISIBLE, (benchFrames > 0) ? GLFW_FALSE : GLFW_TRUE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, "vktriangle GLFW", NULL, NULL);
+
+        // SC. Track the framebuffer size changes of the window.
+        glfwSetWindowUserPointer(window, &framebufferResized);
+        glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
     }
 
     // 1. Create Vulkan Instance.
@@ -210,7 +379,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
     {
         // 2.1 Query the number of physical devices.
@@ -226,19 +395,32 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, surface, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, surface, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((physicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 physicalDevice = device;
-                break;
+                graphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
     }
 
     // 3. Create a logical Vulkan Device.
@@ -297,26 +479,17 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // G.5. Create the Swapchain.
     // Creating a correct Swapchain requires querying a few things.
     // Like: surface format, max/min size, presentation mode.
-    VkSurfaceFormatKHR surfaceFormat;
-    // By standard the FIFO presentation mode should always be available.
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    VkExtent2D swapExtent = { windowWidth, windowHeight };
-
-    VkSwapchainKHR swapchain;
+    // SC. Everything except the size is stored in the config, the same values are used when the Swapchain is re-created.
+    SwapchainConfig swapchainConfig;
     {
-        // G.5.1. Query the surface capabilities and select the swapchain's extent (width, height).
-        VkSurfaceCapabilitiesKHR surfaceCapabilities;
-        {
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
-
-            if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
-                swapExtent = surfaceCapabilities.currentExtent;
-            }
-        }
-
         // G.5.2. Select a surface format.
         {
             uint32_t formatCount;
@@ -328,101 +501,21 @@ int main(int argc, char **argv) {
 
             for (VkSurfaceFormatKHR &entry : surfaceFormats) {
                 if ((entry.format == VK_FORMAT_B8G8R8A8_SRGB) && (entry.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)) {
-                    surfaceFormat = entry;
+                    swapchainConfig.surfaceFormat = entry;
                     break;
                 }
             }
         }
 
-        // G.5.3. TODO: Select a presentation mode, if the FIFO is not good.
-        /*
-        {
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, NULL);
-
-            std::vector<VkPresentModeKHR> presentModes;
-            presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
-        }
-        */
-
-        // G.5.4. Specify the number of images in the swap chain.
-        // For better performance using "min + 1";
-        uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
-        VkSwapchainCreateInfoKHR createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.surface = surface;
-            createInfo.minImageCount = imageCount;
-            createInfo.imageFormat = surfaceFormat.format;
-            createInfo.imageColorSpace = surfaceFormat.colorSpace;
-            createInfo.imageExtent = swapExtent;
-            createInfo.imageArrayLayers = 1;
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-            // If the graphics and presentation queue is different this should not be exclusive.
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = NULL;
-            createInfo.preTransform = surfaceCapabilities.currentTransform;
-            createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-            createInfo.presentMode = swapchainPresentMode;
-            createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
-        }
-
-        if (vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
-        }
-    }
-
-    // G.6. Get the Swapchain images.
-    std::vector<VkImage> swapImages;
-    {
-        uint32_t imageCount;
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, NULL);
-        swapImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapImages.data());
+        swapchainConfig.requestedPresentMode = requestedPresentMode;
+        swapchainConfig.requestedImageCount = requestedSwapchainImages;
+        swapchainConfig.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     }
 
-    // Old 5. and 6. steps are removed.
-    // The Swapchain creation takes care of the render target image creation.
-    uint32_t renderImageWidth = swapExtent.width;
-    uint32_t renderImageHeight = swapExtent.height;
-
-    // G.7. Create Image Views for the Swapchain Images.
-    // This replaces the old 7. step.
-    std::vector<VkImageView> swapImageViews;
-    swapImageViews.resize(swapImages.size());
-    {
-        VkImageViewCreateInfo createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            //createInfo.image = renderImage;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = surfaceFormat.format;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
-        }
-
-        for (size_t idx = 0; idx < swapImages.size(); idx++) {
-            createInfo.image = swapImages[idx];
+    const VkSurfaceFormatKHR surfaceFormat = swapchainConfig.surfaceFormat;
 
-            if (vkCreateImageView(device, &createInfo, NULL, &swapImageViews[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
-        }
-    }
+    // Layout of the rendered images after the Render Pass.
+    const VkImageLayout targetLayout = (benchFrames > 0) ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     // V.0. Prepare the Vertex Coordinates.
     std::vector<float> vertexCoordinates = {
@@ -431,87 +524,9 @@ int main(int argc, char **argv) {
         -0.5,  0.5
     };
 
-    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
-    // This buffer will hold the Vertex coordinates in a vec2 like format.
-    VkBuffer vertexBuffer;
-    {
-        VkBufferCreateInfo bufferInfo;
-        {
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            bufferInfo.pNext = NULL;
-            bufferInfo.flags = 0;
-            bufferInfo.size = sizeof(float) * vertexCoordinates.size();
-            // The buffer will be used as a Vertex Input attribute.
-            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            bufferInfo.queueFamilyIndexCount = 0;
-            bufferInfo.pQueueFamilyIndices = NULL;
-        }
-
-        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create vertex buffer!");
-        }
-    }
-
-    // V.2. Allocate and bind the memory for the Vertex Buffer.
-    // For each Buffer a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory vertexBufferMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, vertexBuffer, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &vertexBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the Vertex buffer with the allocated memory.
-        vkBindBufferMemory(device, vertexBuffer, vertexBufferMemory, 0);
-    }
-
-    // V.3. Upload the Vertex Buffer data.
-    {
-        // V.3.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map vertex buffer!");
-        }
-
-        // V.3.2. Copy data into the "data".
-        ::memcpy(data, vertexCoordinates.data(), sizeof(float) * vertexCoordinates.size());
-
-        // V.3.3. Flush the data.
-        // This is required as a non-coherent buffer was created.
-        VkMappedMemoryRange memoryRange;
-        {
-            memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            memoryRange.pNext = NULL;
-            memoryRange.memory = vertexBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
-        }
-        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-        // V.3.4. Unmap the mapped vertex buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, vertexBufferMemory);
-    }
+    // VL.1. Build the buffer content of the selected vertex layout.
+    VertexLayoutData vertexLayout;
+    BuildVertexLayout(physicalDevice, vertexLayoutMode, vertexCoordinates, &vertexLayout);
 
     // 8. Create a Render Pass.
     // A Render Pass is required to use vkCmdDraw* commands.
@@ -528,7 +543,8 @@ int main(int argc, char **argv) {
             colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
             // G.XX. To present an image to a surface the layout should be in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR.
-            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            // BN. The offscreen images of the benchmark are only read back, see "targetLayout".
+            colorAttachment.finalLayout = targetLayout; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         }
 
         VkAttachmentReference colorAttachmentRef;
@@ -569,71 +585,6 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 9. Create Vertex shader.
-    VkShaderModule vertShaderModule;
-    {
-        // 9.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> vertSrc = LoadGLSL("passthrough.vert");
-        std::vector<uint32_t> vertCode = CompileGLSL(shaderc_vertex_shader, vertSrc);
-        #else
-        std::vector<uint32_t> vertCode = LoadSPIRV("passthrough.vert.spv");
-        #endif
-
-        if (vertCode.size() == 0) {
-            throw std::runtime_error("failed to load vertex shader!");
-        }
-
-        // 9.2. Specify the vertex shader module information.
-        // Notes:
-        // * "codeSize" is in bytes.
-        // * "pCode" points to an array of SPIR-V opcodes.
-        VkShaderModuleCreateInfo vertInfo;
-        {
-            vertInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            vertInfo.pNext = NULL;
-            vertInfo.flags = 0;
-            vertInfo.codeSize = vertCode.size() * sizeof(uint32_t);
-            vertInfo.pCode = reinterpret_cast<uint32_t*>(vertCode.data());
-        }
-
-        // 9.3. Create the Vertex Shader Module.
-        if (vkCreateShaderModule(device, &vertInfo, NULL, &vertShaderModule) != VK_SUCCESS) {
-           throw std::runtime_error("failed to create shader module!");
-        }
-    }
-
-    // 10. Create Fragment shader.
-    VkShaderModule fragShaderModule;
-    {
-        // 10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> fragSrc = LoadGLSL("passthrough.frag");
-        std::vector<uint32_t> fragCode = CompileGLSL(shaderc_fragment_shader, fragSrc);
-        #else
-        std::vector<uint32_t> fragCode = LoadSPIRV("passthrough.frag.spv");
-        #endif
-
-        if (fragCode.size() == 0) {
-            throw std::runtime_error("failed to load fragment shader!");
-        }
-
-        // 10.2. Specify the fragment shader module information.
-        VkShaderModuleCreateInfo fragInfo;
-        {
-            fragInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            fragInfo.pNext = NULL;
-            fragInfo.flags = 0;
-            fragInfo.codeSize = fragCode.size() * sizeof(uint32_t);
-            fragInfo.pCode = reinterpret_cast<uint32_t*>(fragCode.data());
-        }
-
-        // 10.3. Create the Fragment Shader Module.
-        if (vkCreateShaderModule(device, &fragInfo, NULL, &fragShaderModule) != VK_SUCCESS) {
-           throw std::runtime_error("failed to create shader module!");
-        }
-    }
-
     // 11. Create Pipeline Layout.
     // Currently there are no descriptors added (no uniforms).
     VkPipelineLayout pipelineLayout;
@@ -653,328 +604,407 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 12. Create the Rendering Pipeline
-    VkPipeline pipeline;
-    {
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo;
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, pipelineCacheFileName, &pipelineCacheHit);
+
+    // PS.1. Create the Pipeline on a worker thread while the Swapchain and the buffers are created.
+    // The Pipeline does not depend on the Swapchain: the viewport and scissor are dynamic and the
+    // Render Pass only needs the surface format. The shader loads (ST.1) are waited for on the worker.
+    std::future<VkPipeline> pipelineBuild = std::async(std::launch::async, [&]() -> VkPipeline {
+        // 9. Create Vertex shader.
+        VkShaderModule vertShaderModule;
         {
-            vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vertShaderStageInfo.pNext = NULL;
-            vertShaderStageInfo.flags = 0;
-            vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vertShaderStageInfo.module = vertShaderModule;
-            vertShaderStageInfo.pName = "main";
-            vertShaderStageInfo.pSpecializationInfo = NULL;
-        }
+            // 9.1. Wait for the vertex shader loaded (or compiled) by the worker thread (ST.1).
+            std::vector<uint32_t> vertCode = vertShaderLoad.get();
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo;
-        {
-            fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            fragShaderStageInfo.pNext = NULL;
-            fragShaderStageInfo.flags = 0;
-            fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-            fragShaderStageInfo.module = fragShaderModule;
-            fragShaderStageInfo.pName = "main";
-            fragShaderStageInfo.pSpecializationInfo = NULL;
-        }
+            if (vertCode.size() == 0) {
+                throw std::runtime_error("failed to load vertex shader!");
+            }
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+            // 9.2. Specify the vertex shader module information.
+            // Notes:
+            // * "codeSize" is in bytes.
+            // * "pCode" points to an array of SPIR-V opcodes.
+            VkShaderModuleCreateInfo vertInfo;
+            {
+                vertInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+                vertInfo.pNext = NULL;
+                vertInfo.flags = 0;
+                vertInfo.codeSize = vertCode.size() * sizeof(uint32_t);
+                vertInfo.pCode = reinterpret_cast<uint32_t*>(vertCode.data());
+            }
 
-        // V.4. Describe the Vertex input binding information.
-        VkVertexInputBindingDescription vec2VertexBinding;
-        {
-            // The binding information is mapped to the VkVertexInputAttributeDescription.binding.
-            vec2VertexBinding.binding = 0;
-            // The stride information is based on the vertex input type: vec2. (see shader)
-            vec2VertexBinding.stride = sizeof(float) * 2;
-            vec2VertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            // 9.3. Create the Vertex Shader Module.
+            if (vkCreateShaderModule(device, &vertInfo, NULL, &vertShaderModule) != VK_SUCCESS) {
+               throw std::runtime_error("failed to create shader module!");
+            }
         }
+        // RH. Destroyed when the worker returns, the Pipeline does not reference the module after its creation.
+        ShaderModuleHandle vertShaderOwner(device, vertShaderModule, vkDestroyShaderModule);
 
-        // V.5. Describe the Vertex input attribute information.
-        VkVertexInputAttributeDescription positionVertexAttribute;
+        // 10. Create Fragment shader.
+        VkShaderModule fragShaderModule;
         {
-            positionVertexAttribute.binding = 0;
-            // The attribute location is from the Vertex shader.
-            positionVertexAttribute.location = 0;
-            // Format and offset is used during the data read from the buffer.
-            positionVertexAttribute.format = VK_FORMAT_R32G32_SFLOAT;
-            positionVertexAttribute.offset = 0;
-        }
+            // 10.1. Wait for the fragment shader loaded (or compiled) by the worker thread (ST.1).
+            std::vector<uint32_t> fragCode = fragShaderLoad.get();
 
-        // V.6. Connect the Attribute and Binding infors to the VertexInputState.
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo;
-        {
-            vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-            vertexInputInfo.pNext = NULL;
-            vertexInputInfo.flags = 0;
-            vertexInputInfo.vertexBindingDescriptionCount = 1;
-            vertexInputInfo.pVertexBindingDescriptions = &vec2VertexBinding;
-            vertexInputInfo.vertexAttributeDescriptionCount = 1;
-            vertexInputInfo.pVertexAttributeDescriptions = &positionVertexAttribute;
-        }
+            if (fragCode.size() == 0) {
+                throw std::runtime_error("failed to load fragment shader!");
+            }
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly;
-        {
-            inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-            inputAssembly.pNext = NULL;
-            inputAssembly.flags = 0;
-            inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-            inputAssembly.primitiveRestartEnable = VK_FALSE;
-        }
+            // 10.2. Specify the fragment shader module information.
+            VkShaderModuleCreateInfo fragInfo;
+            {
+                fragInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+                fragInfo.pNext = NULL;
+                fragInfo.flags = 0;
+                fragInfo.codeSize = fragCode.size() * sizeof(uint32_t);
+                fragInfo.pCode = reinterpret_cast<uint32_t*>(fragCode.data());
+            }
 
-        VkViewport viewport;
-        {
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) swapExtent.width;
-            viewport.height = (float) swapExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
+            // 10.3. Create the Fragment Shader Module.
+            if (vkCreateShaderModule(device, &fragInfo, NULL, &fragShaderModule) != VK_SUCCESS) {
+               throw std::runtime_error("failed to create shader module!");
+            }
         }
+        // RH. Destroyed when the worker returns, the Pipeline does not reference the module after its creation.
+        ShaderModuleHandle fragShaderOwner(device, fragShaderModule, vkDestroyShaderModule);
 
-        VkRect2D scissor;
+        // 12. Create the Rendering Pipeline
+        VkPipeline pipeline;
         {
-            scissor.offset = { 0, 0 };
-            scissor.extent = swapExtent;
-        }
+            // VL.3. The packed layout stores the normal as UNORM, the shader decodes it if the constant is set.
+            const VkBool32 packedNormal = (vertexLayout.layout == VERTEX_LAYOUT_PACKED) ? VK_TRUE : VK_FALSE;
+            const VkSpecializationMapEntry specEntry = { /* constantID */ 0, /* offset */ 0, /* size */ sizeof(VkBool32) };
+
+            VkSpecializationInfo specInfo;
+            {
+                specInfo.mapEntryCount = 1;
+                specInfo.pMapEntries = &specEntry;
+                specInfo.dataSize = sizeof(packedNormal);
+                specInfo.pData = &packedNormal;
+            }
 
-        VkPipelineViewportStateCreateInfo viewportState{};
-        {
-            viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-            viewportState.viewportCount = 1;
-            viewportState.pViewports = &viewport;
-            viewportState.scissorCount = 1;
-            viewportState.pScissors = &scissor;
-        }
+            VkPipelineShaderStageCreateInfo vertShaderStageInfo;
+            {
+                vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                vertShaderStageInfo.pNext = NULL;
+                vertShaderStageInfo.flags = 0;
+                vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+                vertShaderStageInfo.module = vertShaderModule;
+                vertShaderStageInfo.pName = "main";
+                vertShaderStageInfo.pSpecializationInfo = (vertexLayout.layout != VERTEX_LAYOUT_POSITION) ? &specInfo : NULL;
+            }
 
-        VkPipelineRasterizationStateCreateInfo rasterizer;
-        {
-            rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-            rasterizer.pNext = NULL;
-            rasterizer.flags = 0;
-            rasterizer.depthClampEnable = VK_FALSE;
-            rasterizer.rasterizerDiscardEnable = VK_FALSE;
-            rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-            rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-            rasterizer.depthBiasEnable = VK_FALSE;
-            rasterizer.depthBiasConstantFactor = 0.0;
-            rasterizer.depthBiasClamp = 0.0;
-            rasterizer.depthBiasSlopeFactor = 0.0;
-            rasterizer.lineWidth = 1.0f;
-        }
-
-        VkPipelineMultisampleStateCreateInfo multisampling;
-        {
-            multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-            multisampling.pNext = NULL;
-            multisampling.flags = 0;
-            multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-            multisampling.sampleShadingEnable = VK_FALSE;
-            multisampling.minSampleShading = 0.0;
-            multisampling.pSampleMask = NULL;
-            multisampling.alphaToCoverageEnable = VK_FALSE;
-            multisampling.alphaToOneEnable = VK_FALSE;
-        }
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment;
-        {
-            colorBlendAttachment.blendEnable = VK_FALSE;
-            colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-            colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-            colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-            colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-                                                  | VK_COLOR_COMPONENT_G_BIT
-                                                  | VK_COLOR_COMPONENT_B_BIT
-                                                  | VK_COLOR_COMPONENT_A_BIT;
-        }
-
-        VkPipelineColorBlendStateCreateInfo colorBlending;
-        {
-            colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-            colorBlending.pNext = NULL;
-            colorBlending.flags = 0;
-            colorBlending.logicOpEnable = VK_FALSE;
-            colorBlending.logicOp = VK_LOGIC_OP_COPY;
-            colorBlending.attachmentCount = 1;
-            colorBlending.pAttachments = &colorBlendAttachment;
-            colorBlending.blendConstants[0] = 0.0f;
-            colorBlending.blendConstants[1] = 0.0f;
-            colorBlending.blendConstants[2] = 0.0f;
-            colorBlending.blendConstants[3] = 0.0f;
-        }
-
-        VkGraphicsPipelineCreateInfo pipelineInfo;
-        {
-            pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-            pipelineInfo.pNext = NULL;
-            pipelineInfo.flags = 0;
-            pipelineInfo.stageCount = 2;
-            pipelineInfo.pStages = shaderStages;
-            pipelineInfo.pVertexInputState = &vertexInputInfo;
-            pipelineInfo.pInputAssemblyState = &inputAssembly;
-            pipelineInfo.pTessellationState = NULL;
-            pipelineInfo.pViewportState = &viewportState;
-            pipelineInfo.pRasterizationState = &rasterizer;
-            pipelineInfo.pMultisampleState = &multisampling;
-            pipelineInfo.pDepthStencilState = NULL;
-            pipelineInfo.pColorBlendState = &colorBlending;
-            pipelineInfo.pDynamicState = NULL;
-            pipelineInfo.layout = pipelineLayout;
-            pipelineInfo.renderPass = renderPass;
-            pipelineInfo.subpass = 0;
-            pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-            pipelineInfo.basePipelineIndex = 0;
-        }
-
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
-        }
-    }
+            VkPipelineShaderStageCreateInfo fragShaderStageInfo;
+            {
+                fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                fragShaderStageInfo.pNext = NULL;
+                fragShaderStageInfo.flags = 0;
+                fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+                fragShaderStageInfo.module = fragShaderModule;
+                fragShaderStageInfo.pName = "main";
+                fragShaderStageInfo.pSpecializationInfo = NULL;
+            }
 
-    // G.8. Create Frambuffer for each Swapchain Image view.
-    // Replaces old 13. step.
-    std::vector<VkFramebuffer> framebuffers;
-    {
-        framebuffers.resize(swapImageViews.size());
+            VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-        VkFramebufferCreateInfo framebufferInfo;
-        {
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.pNext = NULL;
-            framebufferInfo.flags = 0;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = 1;
-            //framebufferInfo.pAttachments = &renderImageView;
-            framebufferInfo.width = swapExtent.width;
-            framebufferInfo.height = swapExtent.height;
-            framebufferInfo.layers = 1;
-        }
+            // V.4. Describe the Vertex input binding information.
+            VkVertexInputBindingDescription vec2VertexBinding;
+            {
+                // The binding information is mapped to the VkVertexInputAttributeDescription.binding.
+                vec2VertexBinding.binding = 0;
+                // The stride information is based on the vertex input type: vec2. (see shader)
+                vec2VertexBinding.stride = sizeof(float) * 2;
+                vec2VertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            }
 
-        for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-            framebufferInfo.pAttachments = &swapImageViews[idx];
+            // V.5. Describe the Vertex input attribute information.
+            VkVertexInputAttributeDescription positionVertexAttribute;
+            {
+                positionVertexAttribute.binding = 0;
+                // The attribute location is from the Vertex shader.
+                positionVertexAttribute.location = 0;
+                // Format and offset is used during the data read from the buffer.
+                positionVertexAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+                positionVertexAttribute.offset = 0;
+            }
 
-            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &framebuffers[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
+            // VL.4. The other layouts provide their own bindings and attributes.
+            const bool positionLayout = (vertexLayout.layout == VERTEX_LAYOUT_POSITION);
+
+            // V.6. Connect the Attribute and Binding infors to the VertexInputState.
+            VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+            {
+                vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+                vertexInputInfo.pNext = NULL;
+                vertexInputInfo.flags = 0;
+                vertexInputInfo.vertexBindingDescriptionCount = positionLayout ? 1 : (uint32_t)vertexLayout.bindings.size();
+                vertexInputInfo.pVertexBindingDescriptions = positionLayout ? &vec2VertexBinding : vertexLayout.bindings.data();
+                vertexInputInfo.vertexAttributeDescriptionCount = positionLayout ? 1 : (uint32_t)vertexLayout.attributes.size();
+                vertexInputInfo.pVertexAttributeDescriptions = positionLayout ? &positionVertexAttribute : vertexLayout.attributes.data();
             }
-        }
-    }
 
-    // 14. Create Command Pool.
-    // Required to create Command buffers.
-    VkCommandPool cmdPool;
-    {
-        VkCommandPoolCreateInfo poolInfo;
-        {
-            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-            poolInfo.pNext = NULL;
-            poolInfo.flags = 0;
-            poolInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
-        }
+            VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+            {
+                inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+                inputAssembly.pNext = NULL;
+                inputAssembly.flags = 0;
+                inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+                inputAssembly.primitiveRestartEnable = VK_FALSE;
+            }
 
-        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create command pool!");
+            // SC. The viewport and the scissor are dynamic states, they are set when the draw commands are recorded.
+            // This way the Pipeline is not re-created when the Swapchain size changes.
+            VkPipelineViewportStateCreateInfo viewportState{};
+            {
+                viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+                viewportState.viewportCount = 1;
+                viewportState.pViewports = NULL;
+                viewportState.scissorCount = 1;
+                viewportState.pScissors = NULL;
+            }
+
+            VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+            VkPipelineDynamicStateCreateInfo dynamicState;
+            {
+                dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+                dynamicState.pNext = NULL;
+                dynamicState.flags = 0;
+                dynamicState.dynamicStateCount = 2;
+                dynamicState.pDynamicStates = dynamicStates;
+            }
+
+            VkPipelineRasterizationStateCreateInfo rasterizer;
+            {
+                rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+                rasterizer.pNext = NULL;
+                rasterizer.flags = 0;
+                rasterizer.depthClampEnable = VK_FALSE;
+                rasterizer.rasterizerDiscardEnable = VK_FALSE;
+                rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+                rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+                rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+                rasterizer.depthBiasEnable = VK_FALSE;
+                rasterizer.depthBiasConstantFactor = 0.0;
+                rasterizer.depthBiasClamp = 0.0;
+                rasterizer.depthBiasSlopeFactor = 0.0;
+                rasterizer.lineWidth = 1.0f;
+            }
+
+            VkPipelineMultisampleStateCreateInfo multisampling;
+            {
+                multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+                multisampling.pNext = NULL;
+                multisampling.flags = 0;
+                multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+                multisampling.sampleShadingEnable = VK_FALSE;
+                multisampling.minSampleShading = 0.0;
+                multisampling.pSampleMask = NULL;
+                multisampling.alphaToCoverageEnable = VK_FALSE;
+                multisampling.alphaToOneEnable = VK_FALSE;
+            }
+
+            VkPipelineColorBlendAttachmentState colorBlendAttachment;
+            {
+                colorBlendAttachment.blendEnable = VK_FALSE;
+                colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+                colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+                colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+                colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+                colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+                                                      | VK_COLOR_COMPONENT_G_BIT
+                                                      | VK_COLOR_COMPONENT_B_BIT
+                                                      | VK_COLOR_COMPONENT_A_BIT;
+            }
+
+            VkPipelineColorBlendStateCreateInfo colorBlending;
+            {
+                colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+                colorBlending.pNext = NULL;
+                colorBlending.flags = 0;
+                colorBlending.logicOpEnable = VK_FALSE;
+                colorBlending.logicOp = VK_LOGIC_OP_COPY;
+                colorBlending.attachmentCount = 1;
+                colorBlending.pAttachments = &colorBlendAttachment;
+                colorBlending.blendConstants[0] = 0.0f;
+                colorBlending.blendConstants[1] = 0.0f;
+                colorBlending.blendConstants[2] = 0.0f;
+                colorBlending.blendConstants[3] = 0.0f;
+            }
+
+            VkGraphicsPipelineCreateInfo pipelineInfo;
+            {
+                pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+                pipelineInfo.pNext = NULL;
+                pipelineInfo.flags = 0;
+                pipelineInfo.stageCount = 2;
+                pipelineInfo.pStages = shaderStages;
+                pipelineInfo.pVertexInputState = &vertexInputInfo;
+                pipelineInfo.pInputAssemblyState = &inputAssembly;
+                pipelineInfo.pTessellationState = NULL;
+                pipelineInfo.pViewportState = &viewportState;
+                pipelineInfo.pRasterizationState = &rasterizer;
+                pipelineInfo.pMultisampleState = &multisampling;
+                pipelineInfo.pDepthStencilState = NULL;
+                pipelineInfo.pColorBlendState = &colorBlending;
+                pipelineInfo.pDynamicState = &dynamicState;
+                pipelineInfo.layout = pipelineLayout;
+                pipelineInfo.renderPass = renderPass;
+                pipelineInfo.subpass = 0;
+                pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+                pipelineInfo.basePipelineIndex = 0;
+            }
+
+            std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+            if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+
+            double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+            printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
         }
-    }
 
-    // G.9. Create a Command Buffer for each Swapchain Image View (Framebuffer).
-    std::vector<VkCommandBuffer> cmdBuffers;
-    {
-        cmdBuffers.resize(swapImageViews.size());
+        return pipeline;
+    });
 
-        VkCommandBufferAllocateInfo allocInfo;
+    // G.5.3. Create the Swapchain with the selected config, the Pipeline is built meanwhile (PS.1).
+    // By standard the FIFO presentation mode should always be available.
+    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D swapExtent = { windowWidth, windowHeight };
+    VkSwapchainKHR swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, VK_NULL_HANDLE, &swapExtent, &swapchainPresentMode);
+
+    // G.6. Get the Swapchain images.
+    std::vector<VkImage> swapImages = GetSwapchainImages(device, swapchain);
+
+    printf("Present mode: %s, swapchain images: %u, frames in flight: %u, max FPS: %.1f\n",
+           PresentModeName(swapchainPresentMode), (uint32_t)swapImages.size(), framesInFlight, maxFps);
+
+    // BN. The benchmark renders into offscreen images instead of the Swapchain images,
+    // so no image is acquired or presented. Every later step uses them in place of the Swapchain images.
+    std::vector<ArenaAllocation> benchImageMemories;
+    if (benchFrames > 0) {
+        VkImageCreateInfo imageInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = cmdBuffers.size();
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = NULL;
+            imageInfo.flags = 0;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = surfaceFormat.format;
+            imageInfo.extent = { swapExtent.width, swapExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.queueFamilyIndexCount = 0;
+            imageInfo.pQueueFamilyIndices = NULL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+        benchImageMemories.resize(swapImages.size());
+        for (size_t idx = 0; idx < swapImages.size(); idx++) {
+            if (vkCreateImage(device, &imageInfo, NULL, &swapImages[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create benchmark image!");
+            }
+            benchImageMemories[idx] = ArenaAllocateImage(&memoryArena, swapImages[idx], VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
         }
     }
 
-    // Start recording draw commands.
-    // G.10. In the current example all Command Buffers will have the same data.
+    // Old 5. and 6. steps are removed.
+    // The Swapchain creation takes care of the render target image creation.
+    // SC. Updated when the Swapchain is re-created.
+    uint32_t renderImageWidth = swapExtent.width;
+    uint32_t renderImageHeight = swapExtent.height;
 
-    // 16. Start Command Buffer
-    // G.11. Start all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
+    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
+    // This buffer will hold the Vertex coordinates in a vec2 like format.
+    VkBuffer vertexBuffer;
     {
-        VkCommandBufferBeginInfo beginInfo;
+        VkBufferCreateInfo bufferInfo;
         {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
-            // can't be used.
-            beginInfo.flags = 0;
-            beginInfo.pInheritanceInfo = NULL;
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = NULL;
+            bufferInfo.flags = 0;
+            bufferInfo.size = vertexLayout.data.size();
+            // The buffer will be used as a Vertex Input attribute.
+            // The data is copied into it from a staging buffer if the memory is not host visible.
+            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = NULL;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffers[idx], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create vertex buffer!");
         }
     }
 
-    // 17. Insert draw commands into Command Buffer.
-    // G.12. Insert same draw commands into all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        // 17.1. Add Begin RenderPass command
-        // This makes it possible to use the vmCmdDraw* calls.
-        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-        VkRenderPassBeginInfo renderPassInfo;
-        {
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.pNext = NULL;
-            renderPassInfo.renderPass = renderPass;
-            // G.12.1. Each Command Buffer will use a different Framebuffer
-            renderPassInfo.framebuffer = framebuffers[idx];
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
-        }
+    // U. Create the staging uploader for the device local buffers.
+    StagingUploader stagingUploader;
+    CreateStagingUploader(device, &memoryArena, graphicsQueueFamilyIdx, forceStaging, &stagingUploader);
 
-        vkCmdBeginRenderPass(cmdBuffers[idx], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // V.2. Allocate device local memory for the Vertex Buffer and upload the Vertex Buffer data.
+    // The vertices are fetched by the GPU in every frame, so they should not be read over PCIe.
+    // If the device local memory is not host visible the data is copied from a staging buffer.
+    ArenaAllocation vertexBufferMemory = UploadDeviceLocalBuffer(device, &stagingUploader, vertexBuffer,
+                                                                  vertexLayout.data.data(), vertexLayout.data.size(),
+                                                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 
-        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
-        vkCmdBindPipeline(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    // V.3. Submit the batched uploads.
+    // The copies are ordered before the draws on the same queue, no wait is required here.
+    SubmitStagingUploads(device, &stagingUploader, queue);
+    printf("Buffer uploads: %u direct, %u staged\n", stagingUploader.directCount, stagingUploader.stagedCount);
 
-        // V.7. Bind the Vertex buffers as specified by the pipeline.
-        VkDeviceSize bufferOffsets[] = { 0 };
-        vkCmdBindVertexBuffers(cmdBuffers[idx], 0, 1, &vertexBuffer, bufferOffsets);
+    // G.7. Create Image Views for the Swapchain Images.
+    // G.8. Create Frambuffer for each Swapchain Image view.
+    // SC. Both are size dependent, they are re-created with the Swapchain.
+    std::vector<VkImageView> swapImageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, &swapImageViews, &framebuffers);
 
-        // 17.3. Add a Draw command.
-        // Draw 3 vertices using the pipeline bound previously.
-        uint32_t vertexCount = 3;
-        uint32_t instanceCount = 1;
-        // G.XX. Each Command buffer uses a different starting Instance Index (idx).
-        // This will be used in the shader to provide a bit of animation.
-        vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, idx);
+    // 14. Create Command Pool.
+    // Required to create Command buffers.
+    VkCommandPool cmdPool;
+    {
+        VkCommandPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.queueFamilyIndex = graphicsQueueFamilyIdx;
+        }
 
-        // 17.4. End the Render Pass.
-        vkCmdEndRenderPass(cmdBuffers[idx]);
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
     }
 
-    // 18. End the Command Buffer recording.
-    // G.13. End all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        if (vkEndCommandBuffer(cmdBuffers[idx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+    // PS.2. Wait for the Pipeline, the Command Buffers are the first to use it.
+    // An exception of the worker is re-thrown here.
+    VkPipeline pipeline = pipelineBuild.get();
+
+    // G.9. Create and record a Command Buffer for each Swapchain Image View (Framebuffer).
+    // SC. The Command Buffers reference the Framebuffers, they are re-recorded with the Swapchain.
+    // CB. The per frame strategy records in the draw loop instead.
+    // CB. Record times in milliseconds: the up front recordings or the recording of every frame.
+    std::vector<double> recordTimes;
+    std::vector<VkCommandBuffer> cmdBuffers;
+    if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+        const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+        RecordDrawCommands(device, cmdPool, renderPass, pipeline, vertexBuffer, vertexLayout, framebuffers, swapExtent, &cmdBuffers);
+        recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
     }
 
     // Recording of the draw commands into the Command Buffer is done.
     // Now the Command Buffer should be sent to the GPU.
 
-    const uint32_t imagesInFlight = 2;
+    const uint32_t imagesInFlight = framesInFlight;
 
     // G.14. As there are multiple images now more sync objects are required.
     // This replaces the old 19. step.
@@ -1013,51 +1043,308 @@ int main(int argc, char **argv) {
         }
     }
 
+    // CB.1. Create a Command Pool for each frame in flight.
+    std::vector<FrameCommandPool> frameCommandPools;
+    if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+        CreateFrameCommandPools(device, graphicsQueueFamilyIdx, imagesInFlight, &frameCommandPools);
+    }
+
+    // BN. Create the timestamp queries of the benchmark, one pair for each frame in flight.
+    // TC. The trace uses the same queries for the GPU zones of the frames.
+    const bool benchTimerEnabled = (benchFrames > 0) || g_tracer.enabled;
+    BenchTimer benchTimer;
+    if (benchTimerEnabled) {
+        CreateBenchTimer(physicalDevice, device, graphicsQueueFamilyIdx, imagesInFlight, &benchTimer);
+    }
+    if (g_tracer.enabled) {
+        CalibrateTraceGpuClock(physicalDevice, device, queue, graphicsQueueFamilyIdx, &benchTimer.traceClock);
+    }
+
+    // R.1. Create the readback ring.
+    // One slot for each image in flight and an extra one, so finished captures can be consumed
+    // while the next frames are rendered.
+    // C. The streamed frames stay in their slots until the writer thread is done with them.
+    const uint32_t readbackSlotCount = imagesInFlight + 1 + (captureEnabled ? g_captureQueueSize : 0);
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+    // R.1.1. The Swapchain images are BGRA, their readback is written out with R and B swapped.
+    const bool swapRB = (surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB) || (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
+
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
+
+    // Newest completed capture, it stays in its readback slot until the output image is written.
+    ReadbackSlot *capturedSlot = NULL;
+    uint64_t frameIdx = 0;
+
+    // C.3. Start the writer thread of the streaming capture.
+    // Captured frames are handed over to the writer instead of being kept for the single output image.
+    FrameWriter frameWriter;
+    uint32_t captureRecorded = 0;
+    if (captureEnabled) {
+        StartFrameWriter(captureFormat, captureOutputPattern, captureStream, renderImageWidth, renderImageHeight, swapRB, &frameWriter);
+
+        if (captureFormat == CAPTURE_FORMAT_RGBA) {
+            printf("Capture: raw stream, use: ffmpeg -f rawvideo -pix_fmt rgba -s %ux%u -i -\n", renderImageWidth, renderImageHeight);
+        }
+    }
+
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
+
     // G.25. Draw and Present loop.
     // Draw and Present a series of images.
     uint32_t activeSyncIdx = 0;
+
+    // FP. The limiter paces the start of the frames, the latency is measured from acquire to present.
+    FramePacer framePacer;
+    InitFramePacer(maxFps, latencyLog, &framePacer);
+    const std::chrono::steady_clock::time_point benchStart = std::chrono::steady_clock::now();
+    bool swapchainOutOfDate = false;
     while (!glfwWindowShouldClose(window)) {
+        // TC. Each iteration is a zone, the steps of the frame are nested into it.
+        TraceZone frameZone("frame");
+
         // G.25.0. Run GLFW event polling.
-        glfwPollEvents();
+        {
+            TraceZone zone("poll events");
+            glfwPollEvents();
+        }
+
+        // SC.1. Re-create the Swapchain after a resize or an out of date (or suboptimal) acquire/present.
+        if (swapchainOutOfDate || framebufferResized) {
+            TraceZone zone("swapchain re-creation");
+
+            // SC.1.1. A minimized window has a zero sized framebuffer, wait until it is restored.
+            int framebufferWidth = 0;
+            int framebufferHeight = 0;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            while (((framebufferWidth == 0) || (framebufferHeight == 0)) && !glfwWindowShouldClose(window)) {
+                glfwWaitEvents();
+                glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            }
+
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
+
+            swapchainOutOfDate = false;
+            framebufferResized = false;
+
+            // SC.1.2. Wait until the frames in flight are done, they still use the old resources.
+            vkDeviceWaitIdle(device);
+
+            // SC.1.3. Consume the remaining captures, the readback ring is re-created with the new size.
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                if (captureEnabled) {
+                    QueueFrame(&frameWriter, slot);
+                } else {
+                    ReleaseReadback(slot);
+                }
+            }
+            // The queued frames are still read from the ring, wait for the writer before it is destroyed.
+            if (captureEnabled) {
+                FlushFrameWriter(&frameWriter);
+            }
+            // The kept capture has the old size, the next frames are captured again.
+            capturedSlot = NULL;
+            DestroyReadbackRing(device, &readbackRing);
+
+            // SC.1.4. Destroy the size dependent resources.
+            if (!cmdBuffers.empty()) {
+                vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+                cmdBuffers.clear();
+            }
+            DestroyFramebuffers(device, &swapImageViews, &framebuffers);
+
+            // SC.1.5. Create the new Swapchain from the old one, then destroy the retired Swapchain.
+            const VkSwapchainKHR oldSwapchain = swapchain;
+            swapExtent = { (uint32_t)framebufferWidth, (uint32_t)framebufferHeight };
+            swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, oldSwapchain, &swapExtent, &swapchainPresentMode);
+            vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+            swapImages = GetSwapchainImages(device, swapchain);
+
+            // C. The streamed frames must keep their size.
+            if (captureEnabled && ((swapExtent.width != renderImageWidth) || (swapExtent.height != renderImageHeight))) {
+                throw std::runtime_error("failed to keep the capture size after a swapchain re-creation!");
+            }
+            renderImageWidth = swapExtent.width;
+            renderImageHeight = swapExtent.height;
+
+            // SC.1.6. Rebuild the size dependent resources, the Render Pass and the Pipeline are kept.
+            CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, &swapImageViews, &framebuffers);
+            if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+                const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+                RecordDrawCommands(device, cmdPool, renderPass, pipeline, vertexBuffer, vertexLayout, framebuffers, swapExtent, &cmdBuffers);
+                recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+            }
+            swapImagesFences.assign(swapImages.size(), VK_NULL_HANDLE);
+            CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+            printf("Swapchain: re-created with %ux%u, %u images\n", swapExtent.width, swapExtent.height, (uint32_t)swapImages.size());
+        }
+
+        // FP. Wait for the start of the next frame, the benchmark runs uncapped.
+        if (benchFrames == 0) {
+            TraceZone zone("pace frame");
+            PaceFrame(&framePacer);
+        }
 
         // G.25.1. Wait for the previous fence to "finish".
-        vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
+        {
+            TraceZone zone("wait frame fence");
+            vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
+        }
+
+        // BN. Collect the GPU time of the previous frame in this slot, the CPU time of the frame starts here.
+        if (benchTimerEnabled) {
+            CollectBenchTimestamps(device, &benchTimer, activeSyncIdx);
+        }
+        const std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+
+        // U.1. Release the staging buffers of the finished uploads, this does not block.
+        ReleaseStagingBuffers(device, &stagingUploader, false);
+
+        // R.2. Consume the finished captures of earlier frames.
+        {
+            TraceZone zone("consume captures");
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                if (captureEnabled) {
+                    QueueFrame(&frameWriter, slot);
+                } else {
+                    KeepNewestReadback(slot, &capturedSlot);
+                }
+            }
+            if (captureEnabled) {
+                ReclaimFrames(&frameWriter);
+            }
+        }
 
         // G.25.2. Get the next Swapchain Image Index.
+        const std::chrono::steady_clock::time_point acquireStart = std::chrono::steady_clock::now();
+        // BN. The offscreen images of the benchmark are used in a round robin order.
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+        if (benchFrames > 0) {
+            imageIndex = (uint32_t)(frameIdx % swapImages.size());
+        } else {
+            TraceZone zone("acquire image");
+            VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+
+            // SC.2. An out of date Swapchain can't be used, skip the frame and re-create the Swapchain.
+            // A suboptimal Swapchain still presents this frame, it is re-created afterwards.
+            if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+                swapchainOutOfDate = true;
+                continue;
+            } else if (acquireResult == VK_SUBOPTIMAL_KHR) {
+                swapchainOutOfDate = true;
+            } else if (acquireResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to acquire swapchain image!");
+            }
+        }
 
         // G.25.3. Wait for the target image to be available.
         if (swapImagesFences[imageIndex] != VK_NULL_HANDLE) {
+            TraceZone zone("wait image fence");
             vkWaitForFences(device, 1, &swapImagesFences[imageIndex], VK_TRUE, UINT64_MAX);
         }
         // Connect the current fence to the given swapchaing image.
         swapImagesFences[imageIndex] = activeFences[activeSyncIdx];
 
+        // CB.2. Record the draw commands of this frame into the Command Pool of the frame in flight.
+        // Its last submission was waited for with the fence at G.25.1, so the pool can be reset as a whole.
+        // The reset keeps the pool memory, the recording reuses it without new allocations.
+        VkCommandBuffer drawCmdBuffer;
+        if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+            TraceZone zone("record commands");
+            const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+            FrameCommandPool& framePool = frameCommandPools[activeSyncIdx];
+            vkResetCommandPool(device, framePool.cmdPool, 0);
+            RecordFrameCommands(framePool.cmdBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, renderPass, pipeline,
+                                vertexBuffer, vertexLayout, framebuffers[imageIndex], swapExtent, imageIndex);
+            recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+            drawCmdBuffer = framePool.cmdBuffer;
+        } else {
+            drawCmdBuffer = cmdBuffers[imageIndex];
+        }
+
         // Configure a few sync points.
         VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx] };
         VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
         VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx] };
 
+        // R.3. Record the capture of this frame, it is executed in the same submission after the draw commands.
+        // If no readback slot is free the frame is not captured, the loop never waits for the CPU side.
+        // C.4. When streaming only the selected frames are copied, the window is closed after the last one.
+        bool captureFrame = true;
+        if (captureEnabled) {
+            captureFrame = ((frameIdx % captureEvery) == 0) && ((captureFrameCount == 0) || (captureRecorded < captureFrameCount));
+        } else if (benchFrames > 0) {
+            // BN. Only the last frame of the benchmark is read back for the output image.
+            captureFrame = ((frameIdx + 1) == benchFrames);
+        }
+
+        VkCommandBuffer readbackCmdBuffer =
+            captureFrame ? RecordReadback(device, &readbackRing, swapImages[imageIndex], targetLayout, activeFences[activeSyncIdx], frameIdx) : VK_NULL_HANDLE;
+
+        // BN. The benchmark wraps the draw Command Buffer with the timestamp writes of the slot.
+        VkCommandBuffer frameCmdBuffers[4];
+        uint32_t frameCmdBufferCount = 0;
+        if (benchTimerEnabled) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.beginCmdBuffers[activeSyncIdx];
+        }
+        frameCmdBuffers[frameCmdBufferCount++] = drawCmdBuffer;
+        if (benchTimerEnabled) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.endCmdBuffers[activeSyncIdx];
+        }
+        if (readbackCmdBuffer != VK_NULL_HANDLE) {
+            frameCmdBuffers[frameCmdBufferCount++] = readbackCmdBuffer;
+        }
+        frameIdx++;
+
+        if (captureEnabled && (readbackCmdBuffer != VK_NULL_HANDLE)) {
+            captureRecorded++;
+            if (captureRecorded == captureFrameCount) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+        }
+
+        if ((benchFrames > 0) && (frameIdx == benchFrames)) {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+
         // G.25.4. Build the Submit info using the sync points.
         VkSubmitInfo submitInfo;
         {
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
             submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 1;
+            // BN. Without acquire and present there is nothing to wait for or to signal.
+            submitInfo.waitSemaphoreCount = (benchFrames > 0) ? 0 : 1;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffers[imageIndex];
-            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.commandBufferCount = frameCmdBufferCount;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
+            submitInfo.signalSemaphoreCount = (benchFrames > 0) ? 0 : 1;
             submitInfo.pSignalSemaphores = signalSemaphores;
         }
 
         vkResetFences(device, 1, &activeFences[activeSyncIdx]);
 
         // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        {
+            TraceZone zone("queue submit");
+            if (vkQueueSubmit(queue, 1, &submitInfo, activeFences[activeSyncIdx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+        }
+
+        if (benchFrames > 0) {
+            const std::chrono::steady_clock::time_point cpuEnd = std::chrono::steady_clock::now();
+            benchTimer.cpuTimes.push_back(std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count());
+        }
+        if (benchTimerEnabled) {
+            benchTimer.pending[activeSyncIdx] = true;
         }
 
         VkPresentInfoKHR presentInfo;
@@ -1072,70 +1359,71 @@ int main(int argc, char **argv) {
             presentInfo.pResults = NULL;
         }
 
-        vkQueuePresentKHR(queue, &presentInfo);
+        if (benchFrames == 0) {
+            // SC.3. Re-create the Swapchain before the next frame if it no longer matches the surface.
+            VkResult presentResult;
+            {
+                TraceZone zone("queue present");
+                presentResult = vkQueuePresentKHR(queue, &presentInfo);
+            }
+            if ((presentResult == VK_ERROR_OUT_OF_DATE_KHR) || (presentResult == VK_SUBOPTIMAL_KHR)) {
+                swapchainOutOfDate = true;
+            } else if (presentResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to present swapchain image!");
+            }
+
+            // FP. Track the acquire->present latency of the frame.
+            const std::chrono::steady_clock::time_point presentEnd = std::chrono::steady_clock::now();
+            RecordFrameLatency(&framePacer, imageIndex, std::chrono::duration<double, std::milli>(presentEnd - acquireStart).count());
+        }
 
         activeSyncIdx = (activeSyncIdx + 1) % imagesInFlight;
-
-        // G.XX. Artificially slow down the rendering to avoid Epileptic seizure.
-        usleep((int)(0.15 * 1000000));
     }
 
     // At this point the image is rendered into the Framebuffer's attachment which is an ImageView.
 
-    {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, swapImages[0], renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
-
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
-        }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
+    PrintFrameLatency(framePacer);
 
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
+    // R.4. Wait for the frames in flight and consume the remaining captures.
+    vkWaitForFences(device, imagesInFlight, activeFences.data(), VK_TRUE, UINT64_MAX);
+    for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+        if (captureEnabled) {
+            QueueFrame(&frameWriter, slot);
+        } else {
+            KeepNewestReadback(slot, &capturedSlot);
         }
+    }
+    if (captureEnabled) {
+        ReclaimFrames(&frameWriter);
+    }
 
-        // 25. Write out the image to a ppm file.
-        {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+    // BN. Collect the GPU times of the last frames and report the benchmark.
+    if (benchFrames > 0) {
+        const std::chrono::steady_clock::time_point benchEnd = std::chrono::steady_clock::now();
+        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+            CollectBenchTimestamps(device, &benchTimer, idx);
         }
+        PrintBenchResults(physicalDevice, benchTimer, std::chrono::duration<double>(benchEnd - benchStart).count());
+        PrintVertexFetchReport(vertexLayout, vertexLayout.vertexCount, benchTimer);
+        PrintCommandStrategyResults(commandStrategy, recordTimes);
+    }
 
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
+    // C.5. Write out the queued frames and stop the writer thread.
+    if (captureEnabled) {
+        StopFrameWriter(&frameWriter);
+    }
 
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
+    // TC. Export the trace, every traced thread is stopped by now.
+    if (g_tracer.enabled) {
+        WriteTrace(envTrace);
+    }
 
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
+    if (capturedSlot != NULL) {
+        // 25. Write out the image to a ppm file.
+        {
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, capturedSlot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, swapRB, ppmMmap);
+        }
     }
 
     // G.XX. Destroy Sync object.
@@ -1146,45 +1434,61 @@ int main(int argc, char **argv) {
     }
 
     // G.XX. Free Command Buffers.
-    vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+    if (!cmdBuffers.empty()) {
+        vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+    }
+
+    // CB.XX. Destroy the per frame Command Pools, this also frees their Command Buffers.
+    DestroyFrameCommandPools(device, &frameCommandPools);
+
+    // BN.XX. Destroy the benchmark timer.
+    if (benchTimerEnabled) {
+        DestroyBenchTimer(device, &benchTimer);
+    }
+
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
 
     // XX. Destroy Command Pool
     vkDestroyCommandPool(device, cmdPool, NULL);
 
-    // G.XX. Destory Framebuffers
-    for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-        vkDestroyFramebuffer(device, framebuffers[idx], NULL);
-    }
+    // G.XX. Destory Framebuffers and the Swapchain image views.
+    DestroyFramebuffers(device, &swapImageViews, &framebuffers);
 
     // XX. Destory Pipeline.
     vkDestroyPipeline(device, pipeline, NULL);
 
-    // XX. Destory Fragment Shader Module.
-    vkDestroyShaderModule(device, fragShaderModule, NULL);
-
-    // XX. Destory Vertex Shader Module.
-    vkDestroyShaderModule(device, vertShaderModule, NULL);
-
     // XX. Destory Pipeline Layout.
     vkDestroyPipelineLayout(device, pipelineLayout, NULL);
 
     // XX. Destory Render Pass.
     vkDestroyRenderPass(device, renderPass, NULL);
 
+    // U.XX. Destroy the staging uploader, it waits for the pending uploads.
+    DestroyStagingUploader(device, &stagingUploader);
+
     // XX. Free the Vertex Buffer's memory.
-    vkFreeMemory(device, vertexBufferMemory, NULL);
+    ArenaFree(&memoryArena, vertexBufferMemory);
 
     // XX. Destroy the Vertex Buffer.
     vkDestroyBuffer(device, vertexBuffer, NULL);
 
-    // G.XX. Destroy swapchain image views.
-    for (size_t idx = 0; idx < swapImageViews.size(); idx++) {
-        vkDestroyImageView(device, swapImageViews[idx], NULL);
+    // BN.XX. Destroy the offscreen images of the benchmark.
+    for (size_t idx = 0; idx < benchImageMemories.size(); idx++) {
+        vkDestroyImage(device, swapImages[idx], NULL);
+        ArenaFree(&memoryArena, benchImageMemories[idx]);
     }
 
     // G.XX. Destroy swapchain.
     vkDestroySwapchainKHR(device, swapchain, NULL);
 
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
     // XX. Destroy Device
     vkDestroyDevice(device, NULL);
 
@@ -1203,201 +1507,138 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
-    }
-
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+void CreateFramebuffers(const VkDevice device,
+                        const VkRenderPass renderPass,
+                        VkFormat format,
+                        VkExtent2D extent,
+                        const std::vector<VkImage>& images,
+                        std::vector<VkImageView> *outImageViews,
+                        std::vector<VkFramebuffer> *outFramebuffers) {
+    // G.7.1. Create Image Views for the Swapchain Images.
+    outImageViews->resize(images.size());
+    {
+        VkImageViewCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            //createInfo.image = renderImage;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = format;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
+        }
 
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            createInfo.image = images[idx];
 
-            // G.XX. Check if the selected graphics queue family supports presentation.
-            // At the moment the example expects that the graphics and presentation queue is the same.
-            // This is not always the case.
-            // TODO: add support for different graphics and presentation family indices.
-            VkBool32 presentSupport;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, queueFamilyIdx, surface, &presentSupport);
-            if (presentSupport) {
-                return queueFamilyIdx;
+            if (vkCreateImageView(device, &createInfo, NULL, &(*outImageViews)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
             }
         }
-
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
     }
 
-    return UINT32_MAX;
-}
-
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+    // G.8.1. Create Frambuffer for each Swapchain Image view.
+    outFramebuffers->resize(images.size());
+    {
+        VkFramebufferCreateInfo framebufferInfo;
+        {
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.pNext = NULL;
+            framebufferInfo.flags = 0;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            //framebufferInfo.pAttachments = &renderImageView;
+            framebufferInfo.width = extent.width;
+            framebufferInfo.height = extent.height;
+            framebufferInfo.layers = 1;
         }
-    }
 
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
-#if HAVE_SHADERC
-
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            framebufferInfo.pAttachments = &(*outImageViews)[idx];
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &(*outFramebuffers)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
     }
-
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
-}
-
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
-
-    return { module.begin(), module.end() };
 }
 
-#else
-
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
+void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers) {
+    for (size_t idx = 0; idx < framebuffers->size(); idx++) {
+        vkDestroyFramebuffer(device, (*framebuffers)[idx], NULL);
     }
 
-    size_t fileSize = (size_t) file.tellg();
-
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+    for (size_t idx = 0; idx < imageViews->size(); idx++) {
+        vkDestroyImageView(device, (*imageViews)[idx], NULL);
     }
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
-
-    file.close();
-
-    return buffer;
+    framebuffers->clear();
+    imageViews->clear();
 }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
+void RecordDrawCommands(const VkDevice device,
+                        const VkCommandPool cmdPool,
+                        const VkRenderPass renderPass,
+                        const VkPipeline pipeline,
+                        const VkBuffer vertexBuffer,
+                        const VertexLayoutData& vertexLayout,
+                        const std::vector<VkFramebuffer>& framebuffers,
+                        VkExtent2D extent,
+                        std::vector<VkCommandBuffer> *outCmdBuffers) {
+    std::vector<VkCommandBuffer>& cmdBuffers = *outCmdBuffers;
+
+    // G.9.1. Allocate a Command Buffer for each Framebuffer.
     {
-        VkImageCreateInfo imageInfo;
-        {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        }
+        cmdBuffers.resize(framebuffers.size());
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
-        }
-    }
-
-    *outImage = readableImage;
-
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
-    {
-        // A.2.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
-
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
-    }
-
-    *outMemory = readableImageMemory;
-
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
-    {
         VkCommandBufferAllocateInfo allocInfo;
         {
             allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.pNext = NULL;
             allocInfo.commandPool = cmdPool;
             allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            allocInfo.commandBufferCount = cmdBuffers.size();
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
+        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate command buffers!");
         }
     }
 
-    // Start recording image copy commands.
+    // Start recording draw commands.
+    // G.10. In the current example all Command Buffers will have the same data.
+    // G.12. Each Command Buffer uses a different Framebuffer and starting Instance Index (idx).
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++) {
+        // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
+        // can't be used.
+        RecordFrameCommands(cmdBuffers[idx], 0, renderPass, pipeline, vertexBuffer, vertexLayout, framebuffers[idx], extent, (uint32_t)idx);
+    }
+}
 
-    // A.4. Start Command Buffer.
+void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                         VkCommandBufferUsageFlags usageFlags,
+                         const VkRenderPass renderPass,
+                         const VkPipeline pipeline,
+                         const VkBuffer vertexBuffer,
+                         const VertexLayoutData& vertexLayout,
+                         const VkFramebuffer framebuffer,
+                         VkExtent2D extent,
+                         uint32_t firstInstance) {
+    // 16. Start Command Buffer
     {
         VkCommandBufferBeginInfo beginInfo;
         {
             beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
             beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.flags = usageFlags;
             beginInfo.pInheritanceInfo = NULL;
         }
 
@@ -1406,147 +1647,67 @@ void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
         }
     }
 
-    // A.4. Transition destination image to transfer destination layout.
+    // 17. Insert draw commands into Command Buffer.
     {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        // 17.1. Add Begin RenderPass command
+        // This makes it possible to use the vmCmdDraw* calls.
+        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        VkRenderPassBeginInfo renderPassInfo;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.pNext = NULL;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = framebuffer;
+            renderPassInfo.renderArea.offset = { 0, 0 };
+            renderPassInfo.renderArea.extent = extent;
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
+        }
 
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
-    }
+        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        // SC. Set the dynamic viewport and scissor to the current Swapchain size.
+        VkViewport viewport;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
-
-    // A.8. End the Command Buffer.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float) extent.width;
+            viewport.height = (float) extent.height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
         }
-    }
 
-    // A.9. Create a Fence.
-    VkFence fence;
-    {
-        VkFenceCreateInfo fenceInfo;
+        VkRect2D scissor;
         {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
+            scissor.offset = { 0, 0 };
+            scissor.extent = extent;
         }
 
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
-        }
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
-        //vkResetFences(device, 1, &fence);
-    }
+        // V.7. Bind the Vertex buffers as specified by the pipeline.
+        // VL.5. The SoA layout binds the same buffer once for each attribute stream.
+        std::vector<VkBuffer> vertexBuffers(vertexLayout.bindingOffsets.size(), vertexBuffer);
+        vkCmdBindVertexBuffers(cmdBuffer, 0, (uint32_t)vertexBuffers.size(), vertexBuffers.data(),
+                               vertexLayout.bindingOffsets.data());
 
-    // A.10. Submit the recorded Command Buffer to the Queue.
-    {
-        VkSubmitInfo submitInfo;
-        {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
-        }
+        // 17.3. Add a Draw command.
+        // Draw 3 vertices using the pipeline bound previously.
+        uint32_t vertexCount = 3;
+        uint32_t instanceCount = 1;
+        // G.XX. The starting Instance Index is used in the shader to provide a bit of animation.
+        vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, firstInstance);
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
-        }
+        // 17.4. End the Render Pass.
+        vkCmdEndRenderPass(cmdBuffer);
     }
 
-    // A.11. Wait the submitted Command Buffer to finish.
-    {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
-        }
+    // 18. End the Command Buffer recording.
+    if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
     }
-
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
-
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }
@@ -25,7 +25,42 @@
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_FORCE_STAGING: Upload the vertex buffer with a staging copy (1) even if device local memory
+ *   is also host visible (ReBAR/UMA). Default: 0
+ * DEMO_BENCH: Render N frames offscreen (without presenting) with GPU timestamp and CPU timing, then exit.
+ *   Unset or 0 disables it. Default: 0
+ * DEMO_PRESENT_MODE: fifo, fifo_relaxed, mailbox or immediate, an unsupported mode falls back to fifo. Default: fifo
+ * DEMO_FRAMES_IN_FLIGHT: Number of frames the CPU can record ahead of the GPU. Default: 2
+ * DEMO_SWAPCHAIN_IMAGES: Requested swapchain image count, clamped to the surface limits. Default: minImageCount + 1
+ * DEMO_MAX_FPS: Frame rate limit of the draw loop, 0 disables it. Default: 6 (avoids fast flashing frames),
+ *   0 with DEMO_CAPTURE_FRAMES so the stream is captured at the full frame rate
+ * DEMO_LATENCY_LOG: Log the acquire->present latency of every frame (1), otherwise only a summary at exit. Default: 0
+ * DEMO_RECORD_THREADS: Record each subpass into a secondary Command Buffer on N worker threads,
+ *   0 records everything inline on the main thread. Default: 0
+ * DEMO_COMMAND_STRATEGY: prerecorded (one Command Buffer per swapchain image, recorded once) or per_frame
+ *   (re-recorded every frame from a Command Pool per frame in flight, reset with vkResetCommandPool,
+ *   the DEMO_RECORD_THREADS secondary Command Buffers are still recorded once). Default: prerecorded
+ * DEMO_TRANSIENT_ATTACHMENTS: Create the attachments 1-3 as transient (1) images in lazily allocated memory
+ *   (device local if there is no such memory type) and do not store them after the render pass. Default: 0
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_PIPELINE_THREADS: Create the subpass pipelines on N worker threads, 0 creates them on the main thread. Default: 3
+ * DEMO_PIPELINE_LIBRARY: Build the pipelines from VK_EXT_graphics_pipeline_library parts (1) when the device
+ *   supports it, or as monolithic pipelines (0). Default: 1
+ * DEMO_RENDER_PATH: subpass (VkRenderPass with 3 subpasses) or local_read (VK_KHR_dynamic_rendering with
+ *   VK_KHR_dynamic_rendering_local_read, no Render Pass or Framebuffers), an unsupported path falls back to subpass.
+ *   The local_read path records inline and uses monolithic pipelines. Default: subpass
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_CAPTURE_FRAMES: Enables the streaming capture of N frames, 0 captures until the window is closed. Default: unset (disabled)
+ * DEMO_CAPTURE_EVERY: Capture only every Nth frame. Default: 1
+ * DEMO_CAPTURE_FORMAT: ppm (numbered files), y4m or rgba (raw stream on stdout, logs go to stderr). Default: ppm
+ * DEMO_CAPTURE_OUTPUT: printf style file name pattern of the PPM sequence. Default: frame_%05u.ppm
+ *   Example: DEMO_CAPTURE_FRAMES=300 DEMO_CAPTURE_FORMAT=y4m ./<demo> | ffmpeg -i - out.mp4
  *
  * Dependencies:
  *  * C++11
@@ -39,6 +74,7 @@
  * Includes:
  *  * Validation layer enable.
  *  * PPM image output.
+ *  * Swapchain re-creation on window resize.
  *
  * Excludes:
  *  * No swapchain.
@@ -65,23 +101,31 @@
  * OFTWARE.
  */
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <future>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
 #include <GLFW/glfw3.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
 
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
@@ -91,75 +135,332 @@ const std::vector<const char*> g_swapchainDeviceExtension = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
-
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
-                                   const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
-
 static std::vector<VkAttachmentDescription> GenerateAttachmentDescriptions(uint32_t count, const VkFormat format);
 
 struct AllocatedImage {
     VkImage image;
-    VkDeviceMemory memory;
+    ArenaAllocation memory;
     VkImageView view;
+    // The memory is lazily allocated, the committed size can be queried with vkGetDeviceMemoryCommitment.
+    bool lazilyAllocated;
 };
 
-static AllocatedImage CreateAttachment2D(VkPhysicalDevice physicalDevice,
+static AllocatedImage CreateAttachment2D(MemoryArena *arena,
                                          VkDevice device,
                                          uint32_t imageWidth,
                                          uint32_t imageHeight,
-                                         VkFormat format);
+                                         VkFormat format,
+                                         bool transient);
+static void DestroyAttachment2D(VkDevice device, MemoryArena *arena, AllocatedImage *attachment);
+static void PrintAttachmentMemory(VkDevice device, const AllocatedImage *attachments, uint32_t count);
 
 struct AllocatedPipeline {
     VkPipelineLayout layout;
     VkPipeline pipeline;
-    VkPipelineCache cache;
 };
 
-static AllocatedPipeline CreatePipeline(const VkDevice device,
-                                        const VkShaderModule vertexShader,
-                                        const VkShaderModule fragmentShader,
+static VkPipelineLayout CreatePipelineLayout(const VkDevice device, const VkDescriptorSetLayout descriptorSetLayout);
+// PL. A zero "libraryFlags" creates a complete pipeline, otherwise a pipeline library
+// with only the given VK_EXT_graphics_pipeline_library state subsets.
+// LR. Without a Render Pass the pipeline is created for the local read dynamic rendering,
+// where "subpassIdx" selects the step and "colorFormat" is the format of the four color attachments.
+static VkPipeline CreatePipeline(const VkDevice device,
+                                 const VkPipelineCache pipelineCache,
+                                 const VkPipelineLayout layout,
+                                 const VkShaderModule vertexShader,
+                                 const VkShaderModule fragmentShader,
+                                 const VkRenderPass renderPass,
+                                 const uint32_t subpassIdx,
+                                 const uint32_t attachmentCount,
+                                 const VkFormat colorFormat,
+                                 const VkGraphicsPipelineLibraryFlagsEXT libraryFlags);
+static VkPipeline LinkPipelineLibraries(const VkDevice device,
+                                        const VkPipelineCache pipelineCache,
+                                        const VkPipelineLayout layout,
                                         const VkRenderPass renderPass,
                                         const uint32_t subpassIdx,
-                                        const VkExtent2D swapExtent,
-                                        const VkDescriptorSetLayout descriptorSetLayout,
-                                        const uint32_t attachmentCount);
+                                        const std::vector<VkPipeline>& libraries);
+static bool QueryPipelineLibrarySupport(const VkPhysicalDevice physicalDevice);
+
+// LR. Selects how the three drawing steps are chained.
+enum RenderPath {
+    // A VkRenderPass with one subpass for each step and input attachments.
+    RENDER_PATH_SUBPASS,
+    // A single dynamic rendering instance, the steps remap the attachment locations and
+    // read the earlier results in the VK_IMAGE_LAYOUT_RENDERING_LOCAL_READ_KHR layout.
+    RENDER_PATH_LOCAL_READ,
+};
+
+static RenderPath ParseRenderPath(const char *name);
+static bool QueryLocalReadSupport(const VkPhysicalDevice physicalDevice);
+
+// LR. Entry points of VK_KHR_dynamic_rendering and VK_KHR_dynamic_rendering_local_read.
+struct LocalReadFunctions {
+    PFN_vkCmdBeginRenderingKHR beginRendering;
+    PFN_vkCmdEndRenderingKHR endRendering;
+    PFN_vkCmdSetRenderingAttachmentLocationsKHR setAttachmentLocations;
+    PFN_vkCmdSetRenderingInputAttachmentIndicesKHR setInputAttachmentIndices;
+};
+
+static LocalReadFunctions LoadLocalReadFunctions(const VkDevice device);
+
+
+static ShaderModuleHandle BuildShader(const VkDevice device, std::future<std::vector<uint32_t> >& codeLoad);
+
+// Number of subpasses in the Render Pass.
+static const uint32_t g_subpassCount = 3;
+
+// LR. The dynamic rendering instance has the same four color attachments as the Render Pass:
+// present, red, green and blue. Each step maps the attachments to its fragment output locations
+// like the color references of the matching subpass.
+static const uint32_t g_localReadAttachmentCount = 4;
+static const uint32_t g_localReadLocations[g_subpassCount][g_localReadAttachmentCount] = {
+    { VK_ATTACHMENT_UNUSED, 1, 2, VK_ATTACHMENT_UNUSED },
+    { VK_ATTACHMENT_UNUSED, VK_ATTACHMENT_UNUSED, VK_ATTACHMENT_UNUSED, 3 },
+    { 0, VK_ATTACHMENT_UNUSED, VK_ATTACHMENT_UNUSED, VK_ATTACHMENT_UNUSED },
+};
+// LR. The compose step reads the red, green and blue attachments as "input_attachment_index" 0, 1 and 2.
+static const uint32_t g_localReadInputIndices[g_localReadAttachmentCount] = { VK_ATTACHMENT_UNUSED, 0, 1, 2 };
+
+// Objects used by the draw commands of the subpasses.
+struct SubpassDrawInfo {
+    AllocatedPipeline pipelines[g_subpassCount];
+    VkDescriptorSet descriptorSet;
+    VkBuffer vertexBuffer;
+    // SC. The viewport and scissor are dynamic, every (secondary) Command Buffer sets them.
+    VkExtent2D extent;
+
+    // LR. Targets of the dynamic rendering, only used without a Render Pass.
+    // The vectors and the attachments are updated in place when the Swapchain is re-created.
+    const std::vector<VkImage> *images;
+    const std::vector<VkImageView> *imageViews;
+    const AllocatedImage *attachments;
+    // Layout of the rendered images after the rendering.
+    VkImageLayout targetLayout;
+    bool transientAttachments;
+    LocalReadFunctions localRead;
+};
+
+static void RecordSubpassDraws(const VkCommandBuffer cmdBuffer, const SubpassDrawInfo& draws, uint32_t subpassIdx);
+// LR. Record all steps into one dynamic rendering instance, "imageIdx" selects the rendered image.
+static void RecordLocalReadDraws(const VkCommandBuffer cmdBuffer, const SubpassDrawInfo& draws, uint32_t imageIdx);
 
+// PL. Shaders and color attachment count of a subpass pipeline.
+struct SubpassPipelineDesc {
+    VkShaderModule vertexShader;
+    VkShaderModule fragmentShader;
+    uint32_t attachmentCount;
+};
+
+// PL. Run "jobCount" jobs on "threadCount" worker threads (on the calling thread if it is zero).
+// The first exception of the jobs is re-thrown after all workers are finished.
+static void RunPipelineJobs(uint32_t jobCount, uint32_t threadCount, const std::function<void(uint32_t)>& job);
+static void CreateSubpassPipelines(const VkDevice device,
+                                   const VkPipelineCache pipelineCache,
+                                   const VkRenderPass renderPass,
+                                   const VkDescriptorSetLayout descriptorSetLayout,
+                                   const SubpassPipelineDesc descs[g_subpassCount],
+                                   const VkFormat colorFormat,
+                                   bool usePipelineLibrary,
+                                   uint32_t threadCount,
+                                   AllocatedPipeline outPipelines[g_subpassCount]);
+
+// Per thread state of the multithreaded Command Buffer recording.
+// Command Pools are externally synchronized, so every thread allocates and records from its own pool.
+struct RecordWorker {
+    VkCommandPool cmdPool;
+    std::vector<VkCommandBuffer> cmdBuffers;
+    bool failed;
+};
 
-static VkShaderModule BuildShader(const VkDevice device, const std::string& filename, VkShaderStageFlagBits flags);
+static void CreateRecordWorkers(const VkDevice device, uint32_t queueFamilyIdx, uint32_t threadCount, std::vector<RecordWorker> *outWorkers);
+static void DestroyRecordWorkers(const VkDevice device, std::vector<RecordWorker> *workers);
+static void RecordSecondaryCommandBuffers(const VkDevice device,
+                                          std::vector<RecordWorker> *workers,
+                                          const VkRenderPass renderPass,
+                                          const std::vector<VkFramebuffer>& framebuffers,
+                                          const SubpassDrawInfo& draws,
+                                          std::vector<VkCommandBuffer> *outCmdBuffers);
+static void RecordWorkerMain(const VkDevice device,
+                             RecordWorker *worker,
+                             uint32_t workerIdx,
+                             uint32_t workerCount,
+                             const VkRenderPass renderPass,
+                             const std::vector<VkFramebuffer> *framebuffers,
+                             const SubpassDrawInfo *draws,
+                             std::vector<VkCommandBuffer> *outCmdBuffers);
+
+// LR. Estimated attachment memory traffic of one frame, for an immediate mode GPU and for a tiler.
+static void PrintAttachmentTraffic(VkExtent2D extent, bool transientAttachments);
+
+static void WriteDescriptorSet(const VkDevice device,
+                               const VkDescriptorSet descriptorSet,
+                               const VkBuffer uniformBuffer,
+                               const AllocatedImage *attachments,
+                               VkImageLayout inputLayout);
+// LR. Without a Render Pass only the image views are created, the Framebuffers are VK_NULL_HANDLE.
+static void CreateFramebuffers(const VkDevice device,
+                               const VkRenderPass renderPass,
+                               VkFormat format,
+                               VkExtent2D extent,
+                               const std::vector<VkImage>& images,
+                               const AllocatedImage *attachments,
+                               std::vector<VkImageView> *outImageViews,
+                               std::vector<VkFramebuffer> *outFramebuffers);
+static void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers);
+static void RecordDrawCommands(const VkDevice device,
+                               const VkCommandPool cmdPool,
+                               const VkRenderPass renderPass,
+                               const std::vector<VkFramebuffer>& framebuffers,
+                               const SubpassDrawInfo& draws,
+                               std::vector<RecordWorker> *recordWorkers,
+                               std::vector<VkCommandBuffer> *outSecondaryCmdBuffers,
+                               std::vector<VkCommandBuffer> *outCmdBuffers);
+// Record the draw commands of a single frame into "cmdBuffer".
+// MT. A non-empty "secondaryCmdBuffers" is executed instead of recording the draws inline.
+static void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                                VkCommandBufferUsageFlags usageFlags,
+                                const VkRenderPass renderPass,
+                                const VkFramebuffer framebuffer,
+                                const SubpassDrawInfo& draws,
+                                const std::vector<VkCommandBuffer>& secondaryCmdBuffers,
+                                uint32_t imageIdx);
 
 int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envPresentMode = getenv("DEMO_PRESENT_MODE");
+    const char *envFramesInFlight = getenv("DEMO_FRAMES_IN_FLIGHT");
+    const char *envSwapchainImages = getenv("DEMO_SWAPCHAIN_IMAGES");
+    const char *envMaxFps = getenv("DEMO_MAX_FPS");
+    const char *envLatencyLog = getenv("DEMO_LATENCY_LOG");
+    const char *envBench = getenv("DEMO_BENCH");
+    const char *envRecordThreads = getenv("DEMO_RECORD_THREADS");
+    const char *envCommandStrategy = getenv("DEMO_COMMAND_STRATEGY");
+    const char *envForceStaging = getenv("DEMO_FORCE_STAGING");
+    const char *envTransientAttachments = getenv("DEMO_TRANSIENT_ATTACHMENTS");
+    const char *envCaptureFrames = getenv("DEMO_CAPTURE_FRAMES");
+    const char *envCaptureEvery = getenv("DEMO_CAPTURE_EVERY");
+    const char *envCaptureFormat = getenv("DEMO_CAPTURE_FORMAT");
+    const char *envCaptureOutput = getenv("DEMO_CAPTURE_OUTPUT");
+    const char *envPipelineThreads = getenv("DEMO_PIPELINE_THREADS");
+    const char *envPipelineLibrary = getenv("DEMO_PIPELINE_LIBRARY");
+    const char *envRenderPath = getenv("DEMO_RENDER_PATH");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    bool latencyLog = ((envLatencyLog != NULL) && (strncmp("1", envLatencyLog, 2) == 0));
+    uint32_t benchFrames = (envBench != NULL) ? (uint32_t)strtoul(envBench, NULL, 10) : 0;
+    uint32_t recordThreads = (envRecordThreads != NULL) ? (uint32_t)strtoul(envRecordThreads, NULL, 10) : 0;
+    bool forceStaging = ((envForceStaging != NULL) && (strncmp("1", envForceStaging, 2) == 0));
+    bool transientAttachments = ((envTransientAttachments != NULL) && (strncmp("1", envTransientAttachments, 2) == 0));
+    uint32_t pipelineThreads = (envPipelineThreads != NULL) ? (uint32_t)strtoul(envPipelineThreads, NULL, 10) : g_subpassCount;
+    bool pipelineLibrary = ((envPipelineLibrary == NULL) || (strncmp("0", envPipelineLibrary, 2) != 0));
+    CommandStrategy commandStrategy = COMMAND_STRATEGY_PRERECORDED;
+    if (envCommandStrategy != NULL) {
+        commandStrategy = ParseCommandStrategy(envCommandStrategy);
+    }
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
+    // LR. Select the classic subpass chain or the dynamic rendering local read path.
+    RenderPath renderPath = RENDER_PATH_SUBPASS;
+    if (envRenderPath != NULL) {
+        renderPath = ParseRenderPath(envRenderPath);
+    }
+
+    // FP. Configure the presentation and the frame pacing.
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (envPresentMode != NULL) {
+        requestedPresentMode = ParsePresentMode(envPresentMode);
+    }
+
+    uint32_t framesInFlight = 2;
+    if ((envFramesInFlight != NULL) && (atoi(envFramesInFlight) > 0)) {
+        framesInFlight = atoi(envFramesInFlight);
+    }
+
+    uint32_t requestedSwapchainImages = 0;
+    if ((envSwapchainImages != NULL) && (atoi(envSwapchainImages) > 0)) {
+        requestedSwapchainImages = atoi(envSwapchainImages);
+    }
+
+    // FP. The streaming capture is not limited by default, the captured frames are not shown to anyone.
+    double maxFps = (envCaptureFrames != NULL) ? 0 : 6;
+    if (envMaxFps != NULL) {
+        maxFps = atof(envMaxFps);
+    }
+
+    // C.0. Configure the streaming capture.
+    bool captureEnabled = (envCaptureFrames != NULL);
+    uint32_t captureFrameCount = captureEnabled ? (uint32_t)strtoul(envCaptureFrames, NULL, 10) : 0;
+    uint32_t captureEvery = 1;
+    if ((envCaptureEvery != NULL) && (atoi(envCaptureEvery) > 0)) {
+        captureEvery = atoi(envCaptureEvery);
+    }
+
+    CaptureFormat captureFormat = CAPTURE_FORMAT_PPM;
+    if (envCaptureFormat != NULL) {
+        if (strcmp(envCaptureFormat, "y4m") == 0) {
+            captureFormat = CAPTURE_FORMAT_Y4M;
+        } else if (strcmp(envCaptureFormat, "rgba") == 0) {
+            captureFormat = CAPTURE_FORMAT_RGBA;
+        } else if (strcmp(envCaptureFormat, "ppm") != 0) {
+            throw std::runtime_error("unknown capture format!");
+        }
+    }
+
+    const char *captureOutputPattern = "frame_%05u.ppm";
+    if (envCaptureOutput != NULL) {
+        captureOutputPattern = envCaptureOutput;
+    }
+
+    // The Y4M and RGBA streams take over stdout, every other message is redirected to stderr.
+    FILE *captureStream = NULL;
+    if (captureEnabled && (captureFormat != CAPTURE_FORMAT_PPM)) {
+        fflush(stdout);
+        captureStream = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Command strategy: %s\n", (commandStrategy == COMMAND_STRATEGY_PER_FRAME) ? "per_frame" : "prerecorded");
+    if (benchFrames > 0) {
+        printf("Bench: %u frames, offscreen\n", benchFrames);
+    }
+    if (captureEnabled) {
+        static const char *captureFormatNames[] = { "ppm", "y4m", "rgba" };
+        printf("Capture: %s, every %u. frame, %u frames (0: until exit)\n",
+               captureFormatNames[captureFormat], captureEvery, captureFrameCount);
+    }
+
+    // ST.1. Start loading (or compiling) the shaders of both subpass pipelines on worker threads.
+    // This runs in parallel with the Instance/Device creation, the results are only
+    // waited for at the Shader Module creation (on the Pipeline worker thread, PS.1).
+    std::future<std::vector<uint32_t> > colorizerVertLoad = LoadShaderAsync("passthrough.vert");
+    std::future<std::vector<uint32_t> > colorizerFragLoad = LoadShaderAsync("subpass_0_colorizer.frag");
+    std::future<std::vector<uint32_t> > composeVertLoad = LoadShaderAsync("subpass_2_compose.vert");
+    std::future<std::vector<uint32_t> > composeFragLoad = LoadShaderAsync("subpass_2_compose.frag");
 
     // G.0. Initialize GLFW.
     {
@@ -172,12 +473,20 @@ int main(int argc, char **argv) {
     uint32_t windowWidth = 512;
     uint32_t windowHeight = 512;
     GLFWwindow* window;
+    bool framebufferResized = false;
     {
         // With GLFW_CLIENT_API set to GLFW_NO_API there will be no OpenGL (ES) context.
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        // SC. The window can be resized, except for the benchmark and the streaming capture (fixed frame size).
+        glfwWindowHint(GLFW_RESIZABLE, ((benchFrames == 0) && !captureEnabled) ? GLFW_TRUE : GLFW_FALSE);
+        // BN. The benchmark does not present, the window is only required for the surface.
+        glfwWindowHint(GLFW_VISIBLE, (benchFrames > 0) ? GLFW_FALSE : GLFW_TRUE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, "vktriangle GLFW", NULL, NULL);
+
+        // SC. Track the framebuffer size changes of the window.
+        glfwSetWindowUserPointer(window, &framebufferResized);
+        glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
     }
 
     // 1. Create Vulkan Instance.
@@ -205,7 +514,8 @@ int main(int argc, char **argv) {
             appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
             appInfo.pEngineName = "RAW2";
             appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.apiVersion = VK_API_VERSION_1_0;
+            // PL. The pipeline library feature query (vkGetPhysicalDeviceFeatures2) is a Vulkan 1.1 entry point.
+            appInfo.apiVersion = VK_API_VERSION_1_1;
         }
 
         // 1.2. Specify the Instance creation information.
@@ -248,7 +558,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
     {
         // 2.1 Query the number of physical devices.
@@ -264,19 +574,32 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, surface, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, VK_QUEUE_GRAPHICS_BIT, 0, surface, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((physicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 physicalDevice = device;
-                break;
+                graphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
     }
 
     // 3. Create a logical Vulkan Device.
@@ -300,19 +623,79 @@ int main(int argc, char **argv) {
         std::vector<uint32_t> uniqueQueueFamilies = { graphicsQueueFamilyIdx };
 
         // G.X. TODO: add device swapchane extension check.
+        std::vector<const char*> deviceExtensions = g_swapchainDeviceExtension;
+
+        // LR.0. Check the local read path before the pipeline library.
+        // The library parts are only built for the Render Pass, so the local read path uses monolithic pipelines.
+        if ((renderPath == RENDER_PATH_LOCAL_READ) && !QueryLocalReadSupport(physicalDevice)) {
+            renderPath = RENDER_PATH_SUBPASS;
+            printf("Render path: local read is not supported, using subpasses\n");
+        }
+
+        if (renderPath == RENDER_PATH_LOCAL_READ) {
+            pipelineLibrary = false;
+        }
+
+        // PL.0. Enable the graphics pipeline library if it is requested and supported.
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures;
+        {
+            pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+            pipelineLibraryFeatures.pNext = NULL;
+            pipelineLibraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+        }
+
+        if (pipelineLibrary && !QueryPipelineLibrarySupport(physicalDevice)) {
+            pipelineLibrary = false;
+            printf("Pipeline library: not supported, using monolithic pipelines\n");
+        }
+
+        if (pipelineLibrary) {
+            deviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+        }
+
+        // LR.0.1. Enable the dynamic rendering with local read.
+        // VK_KHR_dynamic_rendering depends on VK_KHR_depth_stencil_resolve and VK_KHR_create_renderpass2.
+        VkPhysicalDeviceDynamicRenderingLocalReadFeaturesKHR localReadFeatures;
+        {
+            localReadFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_LOCAL_READ_FEATURES_KHR;
+            localReadFeatures.pNext = NULL;
+            localReadFeatures.dynamicRenderingLocalRead = VK_TRUE;
+        }
+
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures;
+        {
+            dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+            dynamicRenderingFeatures.pNext = &localReadFeatures;
+            dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+        }
+
+        if (renderPath == RENDER_PATH_LOCAL_READ) {
+            deviceExtensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            deviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_LOCAL_READ_EXTENSION_NAME);
+        }
+
+        const void *featureChain = NULL;
+        if (pipelineLibrary) {
+            featureChain = &pipelineLibraryFeatures;
+        } else if (renderPath == RENDER_PATH_LOCAL_READ) {
+            featureChain = &dynamicRenderingFeatures;
+        }
 
         // 3.3. Specify the device creation information.
         VkDeviceCreateInfo createInfo;
         {
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-            createInfo.pNext = NULL;
+            createInfo.pNext = featureChain;
             createInfo.flags = 0;
             createInfo.queueCreateInfoCount = 1;
             createInfo.pQueueCreateInfos = &queueCreateInfo;
             createInfo.pEnabledFeatures = NULL;
             // G.4. Specify the swapchain extension when creating a VkDevice.
-            createInfo.enabledExtensionCount = (uint32_t)g_swapchainDeviceExtension.size();
-            createInfo.ppEnabledExtensionNames = g_swapchainDeviceExtension.data();
+            createInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
             createInfo.enabledLayerCount = 0;
 
             if (enableValidationLayers) {
@@ -328,6 +711,20 @@ int main(int argc, char **argv) {
         }
     }
 
+    // LR.1. The local read path records a single dynamic rendering instance inline.
+    // Secondary Command Buffers would need VkCommandBufferInheritanceRenderingInfoKHR,
+    // which is only wired up for the Render Pass.
+    const bool localRead = (renderPath == RENDER_PATH_LOCAL_READ);
+    LocalReadFunctions localReadFunctions = {};
+    if (localRead) {
+        localReadFunctions = LoadLocalReadFunctions(device);
+        if (recordThreads > 0) {
+            printf("Render path: local read records inline, DEMO_RECORD_THREADS=%u is ignored\n", recordThreads);
+            recordThreads = 0;
+        }
+    }
+    printf("Render path: %s\n", localRead ? "local_read (dynamic rendering)" : "subpass (render pass)");
+
     // 4. Get the selected Queue family's first queue.
     // A Queue is used to issue recorded command buffers to the GPU for execution.
     VkQueue queue;
@@ -335,26 +732,17 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // G.5. Create the Swapchain.
     // Creating a correct Swapchain requires querying a few things.
     // Like: surface format, max/min size, presentation mode.
-    VkSurfaceFormatKHR surfaceFormat;
-    // By standard the FIFO presentation mode should always be available.
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    VkExtent2D swapExtent = { windowWidth, windowHeight };
-
-    VkSwapchainKHR swapchain;
+    // SC. Everything except the size is stored in the config, the same values are used when the Swapchain is re-created.
+    SwapchainConfig swapchainConfig;
     {
-        // G.5.1. Query the surface capabilities and select the swapchain's extent (width, height).
-        VkSurfaceCapabilitiesKHR surfaceCapabilities;
-        {
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
-
-            if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
-                swapExtent = surfaceCapabilities.currentExtent;
-            }
-        }
-
         // G.5.2. Select a surface format.
         {
             uint32_t formatCount;
@@ -366,203 +754,27 @@ int main(int argc, char **argv) {
 
             for (VkSurfaceFormatKHR &entry : surfaceFormats) {
                 if ((entry.format == VK_FORMAT_B8G8R8A8_SRGB) && (entry.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)) {
-                    surfaceFormat = entry;
+                    swapchainConfig.surfaceFormat = entry;
                     break;
                 }
             }
         }
 
-        // G.5.3. TODO: Select a presentation mode, if the FIFO is not good.
-        /*
-        {
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, NULL);
-
-            std::vector<VkPresentModeKHR> presentModes;
-            presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data());
-        }
-        */
-
-        // G.5.4. Specify the number of images in the swap chain.
-        // For better performance using "min + 1";
-        uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
-        VkSwapchainCreateInfoKHR createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.surface = surface;
-            createInfo.minImageCount = imageCount;
-            createInfo.imageFormat = surfaceFormat.format;
-            createInfo.imageColorSpace = surfaceFormat.colorSpace;
-            createInfo.imageExtent = swapExtent;
-            createInfo.imageArrayLayers = 1;
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-            // If the graphics and presentation queue is different this should not be exclusive.
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = NULL;
-            createInfo.preTransform = surfaceCapabilities.currentTransform;
-            createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-            createInfo.presentMode = swapchainPresentMode;
-            createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
-        }
-
-        if (vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
-        }
-    }
-
-    // G.6. Get the Swapchain images.
-    std::vector<VkImage> swapImages;
-    {
-        uint32_t imageCount;
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, NULL);
-        swapImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapImages.data());
-    }
-
-    // Old 5. and 6. steps are removed.
-    // The Swapchain creation takes care of the render target image creation.
-    uint32_t renderImageWidth = swapExtent.width;
-    uint32_t renderImageHeight = swapExtent.height;
-
-    // G.7. Create Image Views for the Swapchain Images.
-    // This replaces the old 7. step.
-    std::vector<VkImageView> swapImageViews;
-    swapImageViews.resize(swapImages.size());
-    {
-        VkImageViewCreateInfo createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            //createInfo.image = renderImage;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = surfaceFormat.format;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
-        }
-
-        for (size_t idx = 0; idx < swapImages.size(); idx++) {
-            createInfo.image = swapImages[idx];
-
-            if (vkCreateImageView(device, &createInfo, NULL, &swapImageViews[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
-        }
-    }
-
-    // S.X. Create color images and image views for attachment usage
-    // TODO add deallocation
-    AllocatedImage extraColorImages[3] = {
-        CreateAttachment2D(physicalDevice, device, swapExtent.width, swapExtent.height, surfaceFormat.format),
-        CreateAttachment2D(physicalDevice, device, swapExtent.width, swapExtent.height, surfaceFormat.format),
-        CreateAttachment2D(physicalDevice, device, swapExtent.width, swapExtent.height, surfaceFormat.format),
-    };
-
-    // V.0. Prepare the Vertex Coordinates.
-    std::vector<float> vertexCoordinates = {
-         0.0, -0.5,
-         0.5,  0.5,
-        -0.5,  0.5
-    };
-
-    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
-    // This buffer will hold the Vertex coordinates in a vec2 like format.
-    VkBuffer vertexBuffer;
-    {
-        VkBufferCreateInfo bufferInfo;
-        {
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            bufferInfo.pNext = NULL;
-            bufferInfo.flags = 0;
-            bufferInfo.size = sizeof(float) * vertexCoordinates.size();
-            // The buffer will be used as a Vertex Input attribute.
-            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            bufferInfo.queueFamilyIndexCount = 0;
-            bufferInfo.pQueueFamilyIndices = NULL;
-        }
-
-        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create vertex buffer!");
-        }
-    }
-
-    // V.2. Allocate and bind the memory for the Vertex Buffer.
-    // For each Buffer a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory vertexBufferMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, vertexBuffer, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &vertexBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the Vertex buffer with the allocated memory.
-        vkBindBufferMemory(device, vertexBuffer, vertexBufferMemory, 0);
+        swapchainConfig.requestedPresentMode = requestedPresentMode;
+        swapchainConfig.requestedImageCount = requestedSwapchainImages;
+        swapchainConfig.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     }
 
-    // V.3. Upload the Vertex Buffer data.
-    {
-        // V.3.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map vertex buffer!");
-        }
-
-        // V.3.2. Copy data into the "data".
-        ::memcpy(data, vertexCoordinates.data(), sizeof(float) * vertexCoordinates.size());
-
-        // V.3.3. Flush the data.
-        // This is required as a non-coherent buffer was created.
-        VkMappedMemoryRange memoryRange;
-        {
-            memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            memoryRange.pNext = NULL;
-            memoryRange.memory = vertexBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
-        }
-        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
+    const VkSurfaceFormatKHR surfaceFormat = swapchainConfig.surfaceFormat;
 
-        // V.3.4. Unmap the mapped vertex buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, vertexBufferMemory);
-    }
+    // Layout of the rendered images after the Render Pass.
+    const VkImageLayout targetLayout = (benchFrames > 0) ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     // 8. Create a Render Pass.
     // A Render Pass is required to use vkCmdDraw* commands.
-    VkRenderPass renderPass;
-    {
+    // LR. The local read path uses dynamic rendering instead, it has no Render Pass.
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    if (!localRead) {
         /* Attachments:
          *  0) Present Image
          *  1) Red Image
@@ -572,7 +784,16 @@ int main(int argc, char **argv) {
         std::vector<VkAttachmentDescription> attachmentDesc = GenerateAttachmentDescriptions(4, surfaceFormat.format);
         {
             // G.XX. To present an image to a surface the layout should be in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR.
-            attachmentDesc[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            // BN. The offscreen images of the benchmark are only read back, see "targetLayout".
+            attachmentDesc[0].finalLayout = targetLayout; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+            // S.X. The red, green and blue images are consumed by subpass 2 and never read after the render pass.
+            // With DONT_CARE a tiler does not write them out to memory (and lazy memory is not committed).
+            if (transientAttachments) {
+                for (uint32_t idx = 1; idx < 4; idx++) {
+                    attachmentDesc[idx].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                }
+            }
         }
 
         std::vector<VkAttachmentReference> subpass0Colors{
@@ -697,12 +918,6 @@ int main(int argc, char **argv) {
         }
     }
 
-    VkShaderModule shaderColorizerVert = BuildShader(device, "passthrough.vert", VK_SHADER_STAGE_VERTEX_BIT);
-    VkShaderModule shaderColorizerFrag = BuildShader(device, "subpass_0_colorizer.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
-
-    VkShaderModule shaderComposeVert = BuildShader(device, "subpass_2_compose.vert", VK_SHADER_STAGE_VERTEX_BIT);
-    VkShaderModule shaderComposeFrag = BuildShader(device, "subpass_2_compose.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
-
     // D.1. Create a Descriptor Set Layout (aka layout on shader uniforms).
     VkDescriptorSetLayout descriptorSetLayout;
     {
@@ -752,68 +967,208 @@ int main(int argc, char **argv) {
         }
     }
 
-    // D.2. Create the Descriptor Pool.
-    // A Descriptor Pool is a "storage" for Descriptor to allocate from.
-    VkDescriptorPool descriptorPool;
-    {
-        // D.2.1. Define size for single Uniform Buffer.
-        VkDescriptorPoolSize poolSizes[] =
-        {
-            {
-                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, // type
-                1,                                 // descriptorCount
-            },
-            {
-                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, // type
-                3,                                 // descriptorCount
-            }
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, pipelineCacheFileName, &pipelineCacheHit);
+
+    // PS.1. Create the subpass Pipelines (PL.1) on a worker thread while the Swapchain and the buffers are created.
+    // The Pipelines do not depend on the Swapchain: the viewport and scissor are dynamic and the
+    // Render Pass only needs the surface format. The shader loads (ST.1) are waited for on the worker.
+    // RH. The Shader Modules are owned by the worker, they are destroyed when all Pipelines are created.
+    AllocatedPipeline subpassPipelines[g_subpassCount];
+    std::future<void> pipelineBuild = std::async(std::launch::async, [&]() {
+        ShaderModuleHandle shaderColorizerVert = BuildShader(device, colorizerVertLoad);
+        ShaderModuleHandle shaderColorizerFrag = BuildShader(device, colorizerFragLoad);
+
+        ShaderModuleHandle shaderComposeVert = BuildShader(device, composeVertLoad);
+        ShaderModuleHandle shaderComposeFrag = BuildShader(device, composeFragLoad);
+
+        // PL.1. Create the pipelines of the subpasses concurrently.
+        // The subpasses 0 and 1 share the colorizer shaders, only their subpass index and attachment count differ.
+        std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+        const SubpassPipelineDesc descs[g_subpassCount] = {
+            { shaderColorizerVert.Get(), shaderColorizerFrag.Get(), 3 },
+            { shaderColorizerVert.Get(), shaderColorizerFrag.Get(), 4 },
+            { shaderComposeVert.Get(), shaderComposeFrag.Get(), 1 },
         };
 
-        VkDescriptorPoolCreateInfo poolInfo;
-        {
-            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolInfo.pNext = NULL;
-            poolInfo.flags = 0;     // VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT ??
-            poolInfo.maxSets = 1;
-            poolInfo.poolSizeCount = 2;
-            poolInfo.pPoolSizes = poolSizes;
-        }
+        CreateSubpassPipelines(device, pipelineCache, renderPass, descriptorSetLayout, descs, surfaceFormat.format,
+                               pipelineLibrary, pipelineThreads, subpassPipelines);
 
-        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
-        }
-    }
+        double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+        printf("Pipeline creation: %.3f ms for %u pipelines (cache %s, %u threads, %s, %s)\n", pipelineTime, g_subpassCount,
+               (pipelineCacheHit ? "hit" : "miss"), pipelineThreads, (pipelineLibrary ? "linked libraries" : "monolithic"),
+               (localRead ? "dynamic rendering" : "render pass"));
+    });
 
-    // D.3. Allocate a Descriptor Set from the Descriptor Pool.
-    VkDescriptorSet descriptorSet;
-    {
-        VkDescriptorSetAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.descriptorPool = descriptorPool;
-            allocInfo.descriptorSetCount = 1;
-            allocInfo.pSetLayouts = &descriptorSetLayout;
-        }
+    // G.5.3. Create the Swapchain with the selected config, the Pipelines are built meanwhile (PS.1).
+    // By standard the FIFO presentation mode should always be available.
+    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D swapExtent = { windowWidth, windowHeight };
+    VkSwapchainKHR swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, VK_NULL_HANDLE, &swapExtent, &swapchainPresentMode);
 
-        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor set!");
-        }
-    }
+    // G.6. Get the Swapchain images.
+    std::vector<VkImage> swapImages = GetSwapchainImages(device, swapchain);
 
-    // D.X. Uniform Buffer data: color information.
-    std::vector<float> uniformData = {
-        1.0, 0.0, 0.0, 1.0,
-        0.0, 1.0, 0.0, 1.0,
-        0.0, 0.0, 1.0, 1.0
-    };
+    printf("Present mode: %s, swapchain images: %u, frames in flight: %u, max FPS: %.1f\n",
+           PresentModeName(swapchainPresentMode), (uint32_t)swapImages.size(), framesInFlight, maxFps);
 
-    // D.5. Create a Buffer of the Uniform data.
-    VkBuffer uniformBuffer;
-    {
-        VkBufferCreateInfo bufferInfo;
+    // BN. The benchmark renders into offscreen images instead of the Swapchain images,
+    // so no image is acquired or presented. Every later step uses them in place of the Swapchain images.
+    std::vector<ArenaAllocation> benchImageMemories;
+    if (benchFrames > 0) {
+        VkImageCreateInfo imageInfo;
         {
-            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = NULL;
+            imageInfo.flags = 0;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = surfaceFormat.format;
+            imageInfo.extent = { swapExtent.width, swapExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.queueFamilyIndexCount = 0;
+            imageInfo.pQueueFamilyIndices = NULL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        benchImageMemories.resize(swapImages.size());
+        for (size_t idx = 0; idx < swapImages.size(); idx++) {
+            if (vkCreateImage(device, &imageInfo, NULL, &swapImages[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create benchmark image!");
+            }
+            benchImageMemories[idx] = ArenaAllocateImage(&memoryArena, swapImages[idx], VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+    }
+
+    // Old 5. and 6. steps are removed.
+    // The Swapchain creation takes care of the render target image creation.
+    // SC. Updated when the Swapchain is re-created.
+    uint32_t renderImageWidth = swapExtent.width;
+    uint32_t renderImageHeight = swapExtent.height;
+
+    // S.X. Create color images and image views for attachment usage
+    // The attachments are only accessed inside the render pass, thus they can be transient images.
+    // SC. The attachments have the Swapchain size, they are re-created with it.
+    AllocatedImage extraColorImages[3] = {
+        CreateAttachment2D(&memoryArena, device, swapExtent.width, swapExtent.height, surfaceFormat.format, transientAttachments),
+        CreateAttachment2D(&memoryArena, device, swapExtent.width, swapExtent.height, surfaceFormat.format, transientAttachments),
+        CreateAttachment2D(&memoryArena, device, swapExtent.width, swapExtent.height, surfaceFormat.format, transientAttachments),
+    };
+
+    // V.0. Prepare the Vertex Coordinates.
+    std::vector<float> vertexCoordinates = {
+         0.0, -0.5,
+         0.5,  0.5,
+        -0.5,  0.5
+    };
+
+    // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
+    // This buffer will hold the Vertex coordinates in a vec2 like format.
+    VkBuffer vertexBuffer;
+    {
+        VkBufferCreateInfo bufferInfo;
+        {
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.pNext = NULL;
+            bufferInfo.flags = 0;
+            bufferInfo.size = sizeof(float) * vertexCoordinates.size();
+            // The buffer will be used as a Vertex Input attribute.
+            // The data is copied into it from a staging buffer if the memory is not host visible.
+            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = NULL;
+        }
+
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &vertexBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create vertex buffer!");
+        }
+    }
+
+    // U. Create the staging uploader for the device local buffers.
+    StagingUploader stagingUploader;
+    CreateStagingUploader(device, &memoryArena, graphicsQueueFamilyIdx, forceStaging, &stagingUploader);
+
+    // V.2. Allocate device local memory for the Vertex Buffer and upload the Vertex Buffer data.
+    // The vertices are fetched by the GPU in every frame, so they should not be read over PCIe.
+    // If the device local memory is not host visible the data is copied from a staging buffer.
+    ArenaAllocation vertexBufferMemory = UploadDeviceLocalBuffer(device, &stagingUploader, vertexBuffer,
+                                                                  vertexCoordinates.data(), sizeof(float) * vertexCoordinates.size(),
+                                                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+    // V.3. Submit the batched uploads.
+    // The copies are ordered before the draws on the same queue, no wait is required here.
+    SubmitStagingUploads(device, &stagingUploader, queue);
+    printf("Buffer uploads: %u direct, %u staged\n", stagingUploader.directCount, stagingUploader.stagedCount);
+
+    // D.2. Create the Descriptor Pool.
+    // A Descriptor Pool is a "storage" for Descriptor to allocate from.
+    VkDescriptorPool descriptorPool;
+    {
+        // D.2.1. Define size for single Uniform Buffer.
+        VkDescriptorPoolSize poolSizes[] =
+        {
+            {
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, // type
+                1,                                 // descriptorCount
+            },
+            {
+                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, // type
+                3,                                 // descriptorCount
+            }
+        };
+
+        VkDescriptorPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;     // VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT ??
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 2;
+            poolInfo.pPoolSizes = poolSizes;
+        }
+
+        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+    }
+
+    // D.3. Allocate a Descriptor Set from the Descriptor Pool.
+    VkDescriptorSet descriptorSet;
+    {
+        VkDescriptorSetAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.descriptorPool = descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &descriptorSetLayout;
+        }
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+    }
+
+    // D.X. Uniform Buffer data: color information.
+    std::vector<float> uniformData = {
+        1.0, 0.0, 0.0, 1.0,
+        0.0, 1.0, 0.0, 1.0,
+        0.0, 0.0, 1.0, 1.0
+    };
+
+    // D.5. Create a Buffer of the Uniform data.
+    VkBuffer uniformBuffer;
+    {
+        VkBufferCreateInfo bufferInfo;
+        {
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
             bufferInfo.pNext = NULL;
             bufferInfo.flags = 0;
             // Make the buffer vec4 size.
@@ -831,43 +1186,27 @@ int main(int argc, char **argv) {
     }
 
     // D.6. Allocate memory for the Uniform Buffer.
-    VkDeviceMemory uniformBufferMemory;
+    // The memory is sub-allocated from the memory arena and bound to the buffer.
+    // The CPU rewrites the data in every frame, so device local memory is only used if it is
+    // also host visible (ReBAR/UMA), otherwise the buffer stays in host visible memory.
+    ArenaAllocation uniformBufferMemory;
     {
-        // D.6.1 Query the memory requirments for the buffer.
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, uniformBuffer, &memRequirements);
 
-        // D.6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-        // D.6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // D.6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &uniformBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
+        uint32_t memoryTypeIndex = FindPreferredMemoryType(physicalDevice,
+                                                           memRequirements.memoryTypeBits,
+                                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-        // D.6.4 "Connect" the Unifor Buffer with the allocated memory.
-        vkBindBufferMemory(device, uniformBuffer, uniformBufferMemory, 0);
+        uniformBufferMemory = ArenaAllocate(&memoryArena, memRequirements, memoryTypeIndex, true);
+        vkBindBufferMemory(device, uniformBuffer, uniformBufferMemory.memory, uniformBufferMemory.offset);
     }
 
     // D.7. Upload the Uniform Buffer data.
     {
-        // D.7.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map uniform buffer!");
-        }
+        // D.7.1. The arena keeps the host visible memory mapped.
+        void *data = uniformBufferMemory.mapped;
 
         // D.7.2. Copy data into the "data".
         ::memcpy(data, uniformData.data(), sizeof(float) * uniformData.size());
@@ -878,102 +1217,26 @@ int main(int argc, char **argv) {
         {
             memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
             memoryRange.pNext = NULL;
-            memoryRange.memory = uniformBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
+            memoryRange.memory = uniformBufferMemory.memory;
+            memoryRange.offset = uniformBufferMemory.offset;
+            memoryRange.size = uniformBufferMemory.size;
         }
         vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-        // D.7.4. Unmap the mapped uniform buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, uniformBufferMemory);
     }
 
     // D.8. Update Descriptor Set contents.
-    {
-        VkDescriptorBufferInfo bufferInfo;
-        {
-            bufferInfo.buffer = uniformBuffer;
-            bufferInfo.offset = 0;
-            bufferInfo.range = VK_WHOLE_SIZE;
-        }
-        VkDescriptorImageInfo imageInfo[] = {
-            { VK_NULL_HANDLE,  extraColorImages[0].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
-            { VK_NULL_HANDLE,  extraColorImages[1].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
-            { VK_NULL_HANDLE,  extraColorImages[2].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
-        };
-
-        VkWriteDescriptorSet descriptorWrite[] = {
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL, /* sType, pNext */
-                descriptorSet, 0,                             /* dstSet, dstBinding */
-                0, 1,                                         /* dstArrayElement, descriptorCount */
-                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,            /* descriptorType */
-                NULL, &bufferInfo, NULL,                      /* pImageInfo, pBufferInfo, pTexelBufferView */
-            },
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
-                descriptorSet, 1,
-                0, 1,
-                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-                &imageInfo[0], NULL, NULL,
-            },
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
-                descriptorSet, 2,
-                0, 1,
-                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-                &imageInfo[1], NULL, NULL,
-            },
-            {
-                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
-                descriptorSet, 3,
-                0, 1,
-                VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-                &imageInfo[2], NULL, NULL,
-            }
-        };
-
-        vkUpdateDescriptorSets(device, 4, descriptorWrite, 0, NULL);
-    }
-
-    AllocatedPipeline pipeSubpass0 = CreatePipeline(device, shaderColorizerVert, shaderColorizerFrag, renderPass, 0, swapExtent, descriptorSetLayout, 3);
-    AllocatedPipeline pipeSubpass1 = CreatePipeline(device, shaderColorizerVert, shaderColorizerFrag, renderPass, 1, swapExtent, descriptorSetLayout, 4);
-    AllocatedPipeline pipeSubpass2 = CreatePipeline(device, shaderComposeVert, shaderComposeFrag, renderPass, 2, swapExtent, descriptorSetLayout, 1);
+    // SC. The input attachments are re-written when the Swapchain is re-created.
+    // LR. With local read the attachments are read in the same layout as they are written.
+    const VkImageLayout inputLayout = localRead ? VK_IMAGE_LAYOUT_RENDERING_LOCAL_READ_KHR : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    WriteDescriptorSet(device, descriptorSet, uniformBuffer, extraColorImages, inputLayout);
 
+    // G.7. Create Image Views for the Swapchain Images.
     // G.8. Create Frambuffer for each Swapchain Image view.
-    // Replaces old 13. step.
+    // SC. Both are size dependent, they are re-created with the Swapchain.
+    // LR. The local read path renders directly into the image views, no Framebuffer is created.
+    std::vector<VkImageView> swapImageViews;
     std::vector<VkFramebuffer> framebuffers;
-    {
-        framebuffers.resize(swapImageViews.size());
-
-        VkImageView attachments[4] = {
-            VK_NULL_HANDLE,
-            extraColorImages[0].view,
-            extraColorImages[1].view,
-            extraColorImages[2].view,
-        };
-        VkFramebufferCreateInfo framebufferInfo;
-        {
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.pNext = NULL;
-            framebufferInfo.flags = 0;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = 4;
-            framebufferInfo.pAttachments = attachments;
-            framebufferInfo.width = swapExtent.width;
-            framebufferInfo.height = swapExtent.height;
-            framebufferInfo.layers = 1;
-        }
-
-        for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-            attachments[0] = swapImageViews[idx];
-
-            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &framebuffers[idx]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
-            }
-        }
-    }
+    CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, extraColorImages, &swapImageViews, &framebuffers);
 
     // 14. Create Command Pool.
     // Required to create Command buffers.
@@ -992,149 +1255,59 @@ int main(int argc, char **argv) {
         }
     }
 
-    // G.9. Create a Command Buffer for each Swapchain Image View (Framebuffer).
-    std::vector<VkCommandBuffer> cmdBuffers;
-    {
-        cmdBuffers.resize(swapImageViews.size());
-
-        VkCommandBufferAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = cmdBuffers.size();
-        }
-
-        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
-        }
-    }
-
-    // Start recording draw commands.
-    // G.10. In the current example all Command Buffers will have the same data.
-
-    // 16. Start Command Buffer
-    // G.11. Start all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        VkCommandBufferBeginInfo beginInfo;
-        {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
-            // can't be used.
-            beginInfo.flags = 0;
-            beginInfo.pInheritanceInfo = NULL;
-        }
-
-        if (vkBeginCommandBuffer(cmdBuffers[idx], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-    }
+    // PS.2. Wait for the Pipelines, the subpass draws are the first to use them.
+    // An exception of the worker is re-thrown here.
+    pipelineBuild.get();
 
-    // 17. Insert draw commands into Command Buffer.
-    // G.12. Insert same draw commands into all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
+    // MT. Objects of the subpass draws, the draws are recorded either inline or into secondary Command Buffers.
+    SubpassDrawInfo subpassDraws;
     {
-        // 17.1. Add Begin RenderPass command
-        // This makes it possible to use the vmCmdDraw* calls.
-        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-        VkClearValue clears[4] = {
-            clearColor, clearColor, clearColor, clearColor,
-        };
-        VkRenderPassBeginInfo renderPassInfo;
-        {
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.pNext = NULL;
-            renderPassInfo.renderPass = renderPass;
-            // G.12.1. Each Command Buffer will use a different Framebuffer
-            renderPassInfo.framebuffer = framebuffers[idx];
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
-            renderPassInfo.clearValueCount = 4;
-            renderPassInfo.pClearValues = clears;
-        }
-
-        vkCmdBeginRenderPass(cmdBuffers[idx], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        // Subpass 0
-        {
-            vkCmdBindPipeline(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass0.pipeline);
-
-            // D.X. Bind descriptor set
-            vkCmdBindDescriptorSets(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass0.layout, 0, 1, &descriptorSet, 0, NULL);
-
-            // V.7. Bind the Vertex buffers as specified by the pipeline.
-            VkDeviceSize bufferOffsets[] = { 0 };
-            vkCmdBindVertexBuffers(cmdBuffers[idx], 0, 1, &vertexBuffer, bufferOffsets);
-
-            // 17.3. Add a Draw command.
-            // Draw 3 vertices using the pipeline bound previously.
-            uint32_t vertexCount = 3;
-            uint32_t instanceCount = 1;
-
-            // Y. Draw the red triangle
-            vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, 0);
-            // Y. Draw the green triangle
-            vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, 1);
-        }
-
-        // Subpass 1
-        vkCmdNextSubpass(cmdBuffers[idx], VK_SUBPASS_CONTENTS_INLINE);
-        {
-            vkCmdBindPipeline(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass1.pipeline);
-
-            // D.X. Bind descriptor set
-            vkCmdBindDescriptorSets(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass1.layout, 0, 1, &descriptorSet, 0, NULL);
-
-            // V.7. Bind the Vertex buffers as specified by the pipeline.
-            VkDeviceSize bufferOffsets[] = { 0 };
-            vkCmdBindVertexBuffers(cmdBuffers[idx], 0, 1, &vertexBuffer, bufferOffsets);
-
-            // 17.3. Add a Draw command.
-            // Draw 3 vertices using the pipeline bound previously.
-            uint32_t vertexCount = 3;
-            uint32_t instanceCount = 1;
-
-            // Y. Draw the blue triangle
-            vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, 2);
-        }
-
-        // Subpass 2
-        vkCmdNextSubpass(cmdBuffers[idx], VK_SUBPASS_CONTENTS_INLINE);
-        {
-            // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
-            vkCmdBindPipeline(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass2.pipeline);
-
-            // D.X. Bind descriptor set
-            vkCmdBindDescriptorSets(cmdBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeSubpass2.layout, 0, 1, &descriptorSet, 0, NULL);
-
-            // 17.3. Add a Draw command.
-            // Draw 3 vertices using the pipeline bound previously.
-            uint32_t vertexCount = 3;
-            uint32_t instanceCount = 1;
-
-            // Y. Compose the triangle.
-            vkCmdDraw(cmdBuffers[idx], vertexCount, instanceCount, 0, 0);
-        }
-
-        // 17.4. End the Render Pass.
-        vkCmdEndRenderPass(cmdBuffers[idx]);
+        for (uint32_t subpassIdx = 0; subpassIdx < g_subpassCount; subpassIdx++) {
+            subpassDraws.pipelines[subpassIdx] = subpassPipelines[subpassIdx];
+        }
+        subpassDraws.descriptorSet = descriptorSet;
+        subpassDraws.vertexBuffer = vertexBuffer;
+        subpassDraws.extent = swapExtent;
+        subpassDraws.images = &swapImages;
+        subpassDraws.imageViews = &swapImageViews;
+        subpassDraws.attachments = extraColorImages;
+        subpassDraws.targetLayout = targetLayout;
+        subpassDraws.transientAttachments = transientAttachments;
+        subpassDraws.localRead = localReadFunctions;
+    }
+
+    // MT. Without worker threads the draws are recorded inline.
+    std::vector<RecordWorker> recordWorkers;
+    if (recordThreads > 0) {
+        CreateRecordWorkers(device, graphicsQueueFamilyIdx, recordThreads, &recordWorkers);
+    }
+
+    // G.9. Create and record a Command Buffer for each Swapchain Image View (Framebuffer).
+    // SC. The Command Buffers reference the Framebuffers, they are re-recorded with the Swapchain.
+    // CB. The per frame strategy records the primary Command Buffers in the draw loop instead,
+    // only the secondary Command Buffers of the worker threads are recorded here.
+    // CB. Record times in milliseconds: the up front recordings or the recording of every frame.
+    std::vector<double> recordTimes;
+    const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+    std::vector<VkCommandBuffer> secondaryCmdBuffers;
+    std::vector<VkCommandBuffer> cmdBuffers;
+    if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+        RecordDrawCommands(device, cmdPool, renderPass, framebuffers, subpassDraws, &recordWorkers, &secondaryCmdBuffers, &cmdBuffers);
+    } else if (!recordWorkers.empty()) {
+        RecordSecondaryCommandBuffers(device, &recordWorkers, renderPass, framebuffers, subpassDraws, &secondaryCmdBuffers);
     }
 
-    // 18. End the Command Buffer recording.
-    // G.13. End all Command Buffers.
-    for (size_t idx = 0; idx < cmdBuffers.size(); idx++)
-    {
-        if (vkEndCommandBuffer(cmdBuffers[idx]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+    const std::chrono::steady_clock::time_point recordEnd = std::chrono::steady_clock::now();
+    if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+        recordTimes.push_back(std::chrono::duration<double, std::milli>(recordEnd - recordStart).count());
     }
+    printf("Command recording: %.3f ms, %u worker threads\n",
+           std::chrono::duration<double, std::milli>(recordEnd - recordStart).count(), recordThreads);
 
     // Recording of the draw commands into the Command Buffer is done.
     // Now the Command Buffer should be sent to the GPU.
 
-    const uint32_t imagesInFlight = 2;
+    const uint32_t imagesInFlight = framesInFlight;
 
     // G.14. As there are multiple images now more sync objects are required.
     // This replaces the old 19. step.
@@ -1173,22 +1346,163 @@ int main(int argc, char **argv) {
         }
     }
 
-    // G.25. Draw and Present loop.
-    // Draw and Present a series of images.
-    uint32_t activeSyncIdx = 0;
-    while (!glfwWindowShouldClose(window)) {
-        // G.25.0. Run GLFW event polling.
-        glfwPollEvents();
+    // CB.1. Create a Command Pool for each frame in flight.
+    std::vector<FrameCommandPool> frameCommandPools;
+    if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+        CreateFrameCommandPools(device, graphicsQueueFamilyIdx, imagesInFlight, &frameCommandPools);
+    }
 
-        // D.X. Update the Uniform Buffer data in each frame.
-        {
-            // D.X.1. Map buffer memory to "data" pointer.
-            void *data;
-            if (vkMapMemory(device, uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-                throw std::runtime_error("failed to map uniform buffer!");
-            }
+    // BN. Create the timestamp queries of the benchmark, one pair for each frame in flight.
+    BenchTimer benchTimer;
+    if (benchFrames > 0) {
+        CreateBenchTimer(physicalDevice, device, graphicsQueueFamilyIdx, imagesInFlight, &benchTimer);
+    }
 
-            // D.X.2. Change the uniform data.
+    // R.1. Create the readback ring.
+    // One slot for each image in flight and an extra one, so finished captures can be consumed
+    // while the next frames are rendered.
+    // C. The streamed frames stay in their slots until the writer thread is done with them.
+    const uint32_t readbackSlotCount = imagesInFlight + 1 + (captureEnabled ? g_captureQueueSize : 0);
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+    // R.1.1. The Swapchain images are BGRA, their readback is written out with R and B swapped.
+    const bool swapRB = (surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB) || (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
+
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
+
+    // Newest completed capture, it stays in its readback slot until the output image is written.
+    ReadbackSlot *capturedSlot = NULL;
+    uint64_t frameIdx = 0;
+
+    // C.3. Start the writer thread of the streaming capture.
+    // Captured frames are handed over to the writer instead of being kept for the single output image.
+    FrameWriter frameWriter;
+    uint32_t captureRecorded = 0;
+    if (captureEnabled) {
+        StartFrameWriter(captureFormat, captureOutputPattern, captureStream, renderImageWidth, renderImageHeight, swapRB, &frameWriter);
+
+        if (captureFormat == CAPTURE_FORMAT_RGBA) {
+            printf("Capture: raw stream, use: ffmpeg -f rawvideo -pix_fmt rgba -s %ux%u -i -\n", renderImageWidth, renderImageHeight);
+        }
+    }
+
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
+
+    // G.25. Draw and Present loop.
+    // Draw and Present a series of images.
+    uint32_t activeSyncIdx = 0;
+
+    // FP. The limiter paces the start of the frames, the latency is measured from acquire to present.
+    FramePacer framePacer;
+    InitFramePacer(maxFps, latencyLog, &framePacer);
+    const std::chrono::steady_clock::time_point benchStart = std::chrono::steady_clock::now();
+    bool swapchainOutOfDate = false;
+    while (!glfwWindowShouldClose(window)) {
+        // G.25.0. Run GLFW event polling.
+        glfwPollEvents();
+
+        // SC.1. Re-create the Swapchain after a resize or an out of date (or suboptimal) acquire/present.
+        if (swapchainOutOfDate || framebufferResized) {
+            // SC.1.1. A minimized window has a zero sized framebuffer, wait until it is restored.
+            int framebufferWidth = 0;
+            int framebufferHeight = 0;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            while (((framebufferWidth == 0) || (framebufferHeight == 0)) && !glfwWindowShouldClose(window)) {
+                glfwWaitEvents();
+                glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            }
+
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
+
+            swapchainOutOfDate = false;
+            framebufferResized = false;
+
+            // SC.1.2. Wait until the frames in flight are done, they still use the old resources.
+            vkDeviceWaitIdle(device);
+
+            // SC.1.3. Consume the remaining captures, the readback ring is re-created with the new size.
+            for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+                if (captureEnabled) {
+                    QueueFrame(&frameWriter, slot);
+                } else {
+                    ReleaseReadback(slot);
+                }
+            }
+            // The queued frames are still read from the ring, wait for the writer before it is destroyed.
+            if (captureEnabled) {
+                FlushFrameWriter(&frameWriter);
+            }
+            // The kept capture has the old size, the next frames are captured again.
+            capturedSlot = NULL;
+            DestroyReadbackRing(device, &readbackRing);
+
+            // SC.1.4. Destroy the size dependent resources.
+            // The worker pools are re-created, this also frees the secondary Command Buffers.
+            if (!cmdBuffers.empty()) {
+                vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+                cmdBuffers.clear();
+            }
+            DestroyRecordWorkers(device, &recordWorkers);
+            DestroyFramebuffers(device, &swapImageViews, &framebuffers);
+            for (AllocatedImage& attachment : extraColorImages) {
+                DestroyAttachment2D(device, &memoryArena, &attachment);
+            }
+
+            // SC.1.5. Create the new Swapchain from the old one, then destroy the retired Swapchain.
+            const VkSwapchainKHR oldSwapchain = swapchain;
+            swapExtent = { (uint32_t)framebufferWidth, (uint32_t)framebufferHeight };
+            swapchain = CreateSwapchain(physicalDevice, device, surface, swapchainConfig, oldSwapchain, &swapExtent, &swapchainPresentMode);
+            vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+            swapImages = GetSwapchainImages(device, swapchain);
+
+            // C. The streamed frames must keep their size.
+            if (captureEnabled && ((swapExtent.width != renderImageWidth) || (swapExtent.height != renderImageHeight))) {
+                throw std::runtime_error("failed to keep the capture size after a swapchain re-creation!");
+            }
+            renderImageWidth = swapExtent.width;
+            renderImageHeight = swapExtent.height;
+
+            // SC.1.6. Rebuild the size dependent resources, the Render Pass and the Pipelines are kept.
+            // LR. Without a Render Pass only the attachments and the image views are rebuilt.
+            for (AllocatedImage& attachment : extraColorImages) {
+                attachment = CreateAttachment2D(&memoryArena, device, swapExtent.width, swapExtent.height, surfaceFormat.format, transientAttachments);
+            }
+            WriteDescriptorSet(device, descriptorSet, uniformBuffer, extraColorImages, inputLayout);
+            CreateFramebuffers(device, renderPass, surfaceFormat.format, swapExtent, swapImages, extraColorImages, &swapImageViews, &framebuffers);
+            if (recordThreads > 0) {
+                CreateRecordWorkers(device, graphicsQueueFamilyIdx, recordThreads, &recordWorkers);
+            }
+            subpassDraws.extent = swapExtent;
+            if (commandStrategy == COMMAND_STRATEGY_PRERECORDED) {
+                const std::chrono::steady_clock::time_point resizeRecordStart = std::chrono::steady_clock::now();
+                RecordDrawCommands(device, cmdPool, renderPass, framebuffers, subpassDraws, &recordWorkers, &secondaryCmdBuffers, &cmdBuffers);
+                recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - resizeRecordStart).count());
+            } else if (!recordWorkers.empty()) {
+                RecordSecondaryCommandBuffers(device, &recordWorkers, renderPass, framebuffers, subpassDraws, &secondaryCmdBuffers);
+            }
+            swapImagesFences.assign(swapImages.size(), VK_NULL_HANDLE);
+            CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, readbackSlotCount, NULL, &readbackRing);
+
+            printf("Swapchain: re-created with %ux%u, %u images\n", swapExtent.width, swapExtent.height, (uint32_t)swapImages.size());
+        }
+
+        // FP. Wait for the start of the next frame, the benchmark runs uncapped.
+        if (benchFrames == 0) {
+            PaceFrame(&framePacer);
+        }
+
+        // D.X. Update the Uniform Buffer data in each frame.
+        {
+            // D.X.1. The arena keeps the host visible memory mapped.
+            void *data = uniformBufferMemory.mapped;
+
+            // D.X.2. Change the uniform data.
             // Rotate the data by 4 floats.
             std::rotate(uniformData.begin(), uniformData.begin() + 4, uniformData.end());
 
@@ -1201,23 +1515,57 @@ int main(int argc, char **argv) {
             {
                 memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
                 memoryRange.pNext = NULL;
-                memoryRange.memory = uniformBufferMemory;
-                memoryRange.offset = 0;
-                memoryRange.size = VK_WHOLE_SIZE;
+                memoryRange.memory = uniformBufferMemory.memory;
+                memoryRange.offset = uniformBufferMemory.offset;
+                memoryRange.size = uniformBufferMemory.size;
             }
             vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-            // D.X.5. Unmap the mapped uniform buffer.
-            // After this the "data" pointer is a non-valid pointer.
-            vkUnmapMemory(device, uniformBufferMemory);
         }
 
         // G.25.1. Wait for the previous fence to "finish".
         vkWaitForFences(device, 1, &activeFences[activeSyncIdx], VK_TRUE, UINT64_MAX);
 
+        // BN. Collect the GPU time of the previous frame in this slot, the CPU time of the frame starts here.
+        if (benchFrames > 0) {
+            CollectBenchTimestamps(device, &benchTimer, activeSyncIdx);
+        }
+        const std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+
+        // U.1. Release the staging buffers of the finished uploads, this does not block.
+        ReleaseStagingBuffers(device, &stagingUploader, false);
+
+        // R.2. Consume the finished captures of earlier frames.
+        for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+            if (captureEnabled) {
+                QueueFrame(&frameWriter, slot);
+            } else {
+                KeepNewestReadback(slot, &capturedSlot);
+            }
+        }
+        if (captureEnabled) {
+            ReclaimFrames(&frameWriter);
+        }
+
         // G.25.2. Get the next Swapchain Image Index.
+        const std::chrono::steady_clock::time_point acquireStart = std::chrono::steady_clock::now();
+        // BN. The offscreen images of the benchmark are used in a round robin order.
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+        if (benchFrames > 0) {
+            imageIndex = (uint32_t)(frameIdx % swapImages.size());
+        } else {
+            VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[activeSyncIdx], VK_NULL_HANDLE, &imageIndex);
+
+            // SC.2. An out of date Swapchain can't be used, skip the frame and re-create the Swapchain.
+            // A suboptimal Swapchain still presents this frame, it is re-created afterwards.
+            if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+                swapchainOutOfDate = true;
+                continue;
+            } else if (acquireResult == VK_SUBOPTIMAL_KHR) {
+                swapchainOutOfDate = true;
+            } else if (acquireResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to acquire swapchain image!");
+            }
+        }
 
         // G.25.3. Wait for the target image to be available.
         if (swapImagesFences[imageIndex] != VK_NULL_HANDLE) {
@@ -1226,22 +1574,80 @@ int main(int argc, char **argv) {
         // Connect the current fence to the given swapchaing image.
         swapImagesFences[imageIndex] = activeFences[activeSyncIdx];
 
+        // CB.2. Record the draw commands of this frame into the Command Pool of the frame in flight.
+        // Its last submission was waited for with the fence at G.25.1, so the pool can be reset as a whole.
+        // The reset keeps the pool memory, the recording reuses it without new allocations.
+        // MT. The previous frame of this image has finished (G.25.3), so its secondary Command Buffers are not pending.
+        VkCommandBuffer drawCmdBuffer;
+        if (commandStrategy == COMMAND_STRATEGY_PER_FRAME) {
+            const std::chrono::steady_clock::time_point frameRecordStart = std::chrono::steady_clock::now();
+            FrameCommandPool& framePool = frameCommandPools[activeSyncIdx];
+            vkResetCommandPool(device, framePool.cmdPool, 0);
+            RecordFrameCommands(framePool.cmdBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, renderPass,
+                                framebuffers[imageIndex], subpassDraws, secondaryCmdBuffers, imageIndex);
+            recordTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameRecordStart).count());
+            drawCmdBuffer = framePool.cmdBuffer;
+        } else {
+            drawCmdBuffer = cmdBuffers[imageIndex];
+        }
+
         // Configure a few sync points.
         VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[activeSyncIdx] };
         VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
         VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[activeSyncIdx] };
 
+        // R.3. Record the capture of this frame, it is executed in the same submission after the draw commands.
+        // If no readback slot is free the frame is not captured, the loop never waits for the CPU side.
+        // C.4. When streaming only the selected frames are copied, the window is closed after the last one.
+        bool captureFrame = true;
+        if (captureEnabled) {
+            captureFrame = ((frameIdx % captureEvery) == 0) && ((captureFrameCount == 0) || (captureRecorded < captureFrameCount));
+        } else if (benchFrames > 0) {
+            // BN. Only the last frame of the benchmark is read back for the output image.
+            captureFrame = ((frameIdx + 1) == benchFrames);
+        }
+
+        VkCommandBuffer readbackCmdBuffer =
+            captureFrame ? RecordReadback(device, &readbackRing, swapImages[imageIndex], targetLayout, activeFences[activeSyncIdx], frameIdx) : VK_NULL_HANDLE;
+
+        // BN. The benchmark wraps the draw Command Buffer with the timestamp writes of the slot.
+        VkCommandBuffer frameCmdBuffers[4];
+        uint32_t frameCmdBufferCount = 0;
+        if (benchFrames > 0) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.beginCmdBuffers[activeSyncIdx];
+        }
+        frameCmdBuffers[frameCmdBufferCount++] = drawCmdBuffer;
+        if (benchFrames > 0) {
+            frameCmdBuffers[frameCmdBufferCount++] = benchTimer.endCmdBuffers[activeSyncIdx];
+        }
+        if (readbackCmdBuffer != VK_NULL_HANDLE) {
+            frameCmdBuffers[frameCmdBufferCount++] = readbackCmdBuffer;
+        }
+        frameIdx++;
+
+        if (captureEnabled && (readbackCmdBuffer != VK_NULL_HANDLE)) {
+            captureRecorded++;
+            if (captureRecorded == captureFrameCount) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+        }
+
+        if ((benchFrames > 0) && (frameIdx == benchFrames)) {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+
         // G.25.4. Build the Submit info using the sync points.
         VkSubmitInfo submitInfo;
         {
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
             submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 1;
+            // BN. Without acquire and present there is nothing to wait for or to signal.
+            submitInfo.waitSemaphoreCount = (benchFrames > 0) ? 0 : 1;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffers[imageIndex];
-            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.commandBufferCount = frameCmdBufferCount;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
+            submitInfo.signalSemaphoreCount = (benchFrames > 0) ? 0 : 1;
             submitInfo.pSignalSemaphores = signalSemaphores;
         }
 
@@ -1252,6 +1658,12 @@ int main(int argc, char **argv) {
             throw std::runtime_error("failed to submit command buffer!");
         }
 
+        if (benchFrames > 0) {
+            const std::chrono::steady_clock::time_point cpuEnd = std::chrono::steady_clock::now();
+            benchTimer.cpuTimes.push_back(std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count());
+            benchTimer.pending[activeSyncIdx] = true;
+        }
+
         VkPresentInfoKHR presentInfo;
         {
             presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1264,70 +1676,64 @@ int main(int argc, char **argv) {
             presentInfo.pResults = NULL;
         }
 
-        vkQueuePresentKHR(queue, &presentInfo);
+        if (benchFrames == 0) {
+            // SC.3. Re-create the Swapchain before the next frame if it no longer matches the surface.
+            VkResult presentResult = vkQueuePresentKHR(queue, &presentInfo);
+            if ((presentResult == VK_ERROR_OUT_OF_DATE_KHR) || (presentResult == VK_SUBOPTIMAL_KHR)) {
+                swapchainOutOfDate = true;
+            } else if (presentResult != VK_SUCCESS) {
+                throw std::runtime_error("failed to present swapchain image!");
+            }
+
+            // FP. Track the acquire->present latency of the frame.
+            const std::chrono::steady_clock::time_point presentEnd = std::chrono::steady_clock::now();
+            RecordFrameLatency(&framePacer, imageIndex, std::chrono::duration<double, std::milli>(presentEnd - acquireStart).count());
+        }
 
         activeSyncIdx = (activeSyncIdx + 1) % imagesInFlight;
-
-        // G.XX. Artificially slow down the rendering to avoid Epileptic seizure.
-        usleep((int)(0.15 * 1000000));
     }
 
     // At this point the image is rendered into the Framebuffer's attachment which is an ImageView.
 
-    {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, swapImages[0], renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
-
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
+    PrintFrameLatency(framePacer);
+    PrintAttachmentMemory(device, extraColorImages, 3);
+
+    // R.4. Wait for the frames in flight and consume the remaining captures.
+    vkWaitForFences(device, imagesInFlight, activeFences.data(), VK_TRUE, UINT64_MAX);
+    for (ReadbackSlot *slot = PollReadback(device, &readbackRing); slot != NULL; slot = PollReadback(device, &readbackRing)) {
+        if (captureEnabled) {
+            QueueFrame(&frameWriter, slot);
+        } else {
+            KeepNewestReadback(slot, &capturedSlot);
         }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
+    }
+    if (captureEnabled) {
+        ReclaimFrames(&frameWriter);
+    }
 
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
+    // BN. Collect the GPU times of the last frames and report the benchmark.
+    if (benchFrames > 0) {
+        const std::chrono::steady_clock::time_point benchEnd = std::chrono::steady_clock::now();
+        for (uint32_t idx = 0; idx < imagesInFlight; idx++) {
+            CollectBenchTimestamps(device, &benchTimer, idx);
         }
+        PrintBenchResults(physicalDevice, benchTimer, std::chrono::duration<double>(benchEnd - benchStart).count());
+        printf("Bench: render path %s\n", localRead ? "local_read" : "subpass");
+        PrintAttachmentTraffic(swapExtent, transientAttachments);
+        PrintCommandStrategyResults(commandStrategy, recordTimes);
+    }
+
+    // C.5. Write out the queued frames and stop the writer thread.
+    if (captureEnabled) {
+        StopFrameWriter(&frameWriter);
+    }
 
+    if (capturedSlot != NULL) {
         // 25. Write out the image to a ppm file.
         {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, capturedSlot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, swapRB, ppmMmap);
         }
-
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
-
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
-
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
     }
 
     // G.XX. Destroy Sync object.
@@ -1338,38 +1744,42 @@ int main(int argc, char **argv) {
     }
 
     // G.XX. Free Command Buffers.
-    vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+    if (!cmdBuffers.empty()) {
+        vkFreeCommandBuffers(device, cmdPool, cmdBuffers.size(), cmdBuffers.data());
+    }
+
+    // CB.XX. Destroy the per frame Command Pools, this also frees their Command Buffers.
+    DestroyFrameCommandPools(device, &frameCommandPools);
+
+    // MT.XX. Free the secondary Command Buffers and the per thread Command Pools.
+    DestroyRecordWorkers(device, &recordWorkers);
+
+    // BN.XX. Destroy the benchmark timer.
+    if (benchFrames > 0) {
+        DestroyBenchTimer(device, &benchTimer);
+    }
+
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
 
     // XX. Destroy Command Pool
     vkDestroyCommandPool(device, cmdPool, NULL);
 
-    // G.XX. Destory Framebuffers
-    for (size_t idx = 0; idx < framebuffers.size(); idx++) {
-        vkDestroyFramebuffer(device, framebuffers[idx], NULL);
-    }
+    // G.XX. Destory Framebuffers and the Swapchain image views.
+    DestroyFramebuffers(device, &swapImageViews, &framebuffers);
 
     // XX. Destory Pipeline.
-    vkDestroyPipeline(device, pipeSubpass0.pipeline, NULL);
-    vkDestroyPipeline(device, pipeSubpass1.pipeline, NULL);
-    vkDestroyPipeline(device, pipeSubpass2.pipeline, NULL);
-
-    // XX. Destory Shader Modules.
-    vkDestroyShaderModule(device, shaderColorizerVert, NULL);
-    vkDestroyShaderModule(device, shaderColorizerFrag, NULL);
-    vkDestroyShaderModule(device, shaderComposeVert, NULL);
-    vkDestroyShaderModule(device, shaderComposeFrag, NULL);
+    for (uint32_t subpassIdx = 0; subpassIdx < g_subpassCount; subpassIdx++) {
+        vkDestroyPipeline(device, subpassPipelines[subpassIdx].pipeline, NULL);
+    }
 
     // XX. Destory Pipeline Layout.
-    vkDestroyPipelineLayout(device, pipeSubpass0.layout, NULL);
-    vkDestroyPipelineLayout(device, pipeSubpass1.layout, NULL);
-    vkDestroyPipelineLayout(device, pipeSubpass2.layout, NULL);
-
-    vkDestroyPipelineCache(device, pipeSubpass0.cache, NULL);
-    vkDestroyPipelineCache(device, pipeSubpass1.cache, NULL);
-    vkDestroyPipelineCache(device, pipeSubpass2.cache, NULL);
+    for (uint32_t subpassIdx = 0; subpassIdx < g_subpassCount; subpassIdx++) {
+        vkDestroyPipelineLayout(device, subpassPipelines[subpassIdx].layout, NULL);
+    }
 
     // D.XX. Free Uniform Buffer memory.
-    vkFreeMemory(device, uniformBufferMemory, NULL);
+    ArenaFree(&memoryArena, uniformBufferMemory);
 
     // D.XX. Destroy Uniform Buffer.
     vkDestroyBuffer(device, uniformBuffer, NULL);
@@ -1386,20 +1796,36 @@ int main(int argc, char **argv) {
     // XX. Destory Render Pass.
     vkDestroyRenderPass(device, renderPass, NULL);
 
+    // U.XX. Destroy the staging uploader, it waits for the pending uploads.
+    DestroyStagingUploader(device, &stagingUploader);
+
     // XX. Free the Vertex Buffer's memory.
-    vkFreeMemory(device, vertexBufferMemory, NULL);
+    ArenaFree(&memoryArena, vertexBufferMemory);
 
     // XX. Destroy the Vertex Buffer.
     vkDestroyBuffer(device, vertexBuffer, NULL);
 
-    // G.XX. Destroy swapchain image views.
-    for (size_t idx = 0; idx < swapImageViews.size(); idx++) {
-        vkDestroyImageView(device, swapImageViews[idx], NULL);
+    // ATT.XX. Destroy the extra color attachments.
+    for (AllocatedImage& attachment : extraColorImages) {
+        DestroyAttachment2D(device, &memoryArena, &attachment);
+    }
+
+    // BN.XX. Destroy the offscreen images of the benchmark.
+    for (size_t idx = 0; idx < benchImageMemories.size(); idx++) {
+        vkDestroyImage(device, swapImages[idx], NULL);
+        ArenaFree(&memoryArena, benchImageMemories[idx]);
     }
 
     // G.XX. Destroy swapchain.
     vkDestroySwapchainKHR(device, swapchain, NULL);
 
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
     // XX. Destroy Device
     vkDestroyDevice(device, NULL);
 
@@ -1418,517 +1844,173 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, const VkSurfaceKHR surface, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
-    }
-
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
-
-            // G.XX. Check if the selected graphics queue family supports presentation.
-            // At the moment the example expects that the graphics and presentation queue is the same.
-            // This is not always the case.
-            // TODO: add support for different graphics and presentation family indices.
-            VkBool32 presentSupport;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, queueFamilyIdx, surface, &presentSupport);
-            if (presentSupport) {
-                return queueFamilyIdx;
-            }
-        }
-
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
-    }
-
-    return UINT32_MAX;
-}
-
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
-#if HAVE_SHADERC
-
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
-
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
-    }
-
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
-}
-
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
-
-    if (module.GetNumErrors() > 0) {
-        fprintf(stderr, "-> Faild to comple:\n%s\n", module.GetErrorMessage().c_str());
-    }
-
-    return { module.begin(), module.end() };
-}
-
-#else
-
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
-    }
-
-    size_t fileSize = (size_t) file.tellg();
-
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+std::vector<VkAttachmentDescription> GenerateAttachmentDescriptions(uint32_t count, const VkFormat format) {
+    std::vector<VkAttachmentDescription> descriptions;
+    descriptions.resize(count);
+    for (VkAttachmentDescription& info : descriptions) {
+        info.flags = 0;
+        info.format = format;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        info.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        info.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        info.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     }
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
-
-    file.close();
-
-    return buffer;
+    return descriptions;
 }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
+AllocatedImage CreateAttachment2D(MemoryArena *arena,
+                                  VkDevice device,
+                                  uint32_t imageWidth,
+                                  uint32_t imageHeight,
+                                  VkFormat format,
+                                  bool transient) {
+    AllocatedImage result;
+    result.lazilyAllocated = false;
     {
+        // ATT.1. Specify the image creation information.
         VkImageCreateInfo imageInfo;
         {
             imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
             imageInfo.pNext = NULL;
             imageInfo.flags = 0;
             imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
+            imageInfo.format = format;
+            imageInfo.extent = { imageWidth, imageHeight,  1 };
             imageInfo.mipLevels = 1;
             imageInfo.arrayLayers = 1;
             imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            // Tiling optimal means that the image is in a GPU optimal mode.
+            // Usually this means that it should not be accessed from the CPU side directly as
+            // the image color channels can be in any order.
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            // Specifying the usage is important:
+            // * VK_IMAGE_USAGE_TRANSFER_SRC_BIT: the image can be used as a source for a transfer/copy operation.
+            // * VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT: the image can be used as a color attachment (aka can render on it).
+            // * VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT: the image content only lives inside a render pass,
+            //   it is only allowed with attachment usages (no transfer).
+            if (transient) {
+                imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            } else {
+                imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+            }
             imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             imageInfo.queueFamilyIndexCount = 0;
             imageInfo.pQueueFamilyIndices = NULL;
             imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         }
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
+        // ATT.2. Create the image.
+        if (vkCreateImage(device, &imageInfo, NULL, &result.image) != VK_SUCCESS) {
             throw std::runtime_error("failed to create 2D image!");
         }
     }
 
-    *outImage = readableImage;
-
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
-    {
-        // A.2.1 Query the memory requirments for the image.
+    // ATT.3. Allocate and bind the memory for the render target image.
+    // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
+    // The memory is sub-allocated from the memory arena and bound to the image.
+    // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
+    if (!transient) {
+        result.memory = ArenaAllocateImage(arena, result.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    } else {
+        // ATT.4. Transient images prefer lazily allocated memory (usually on tilers) which is only
+        // committed if the tile memory is not enough. Desktop GPUs have no such type: fall back to device local.
         VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
+        vkGetImageMemoryRequirements(device, result.image, &memRequirements);
 
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
+        const uint32_t memoryTypeIndex = FindPreferredMemoryType(arena->physicalDevice,
+                                                                 memRequirements.memoryTypeBits,
+                                                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+                                                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        result.lazilyAllocated = (arena->memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
 
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        result.memory = ArenaAllocate(arena, memRequirements, memoryTypeIndex, false);
+        if (vkBindImageMemory(device, result.image, result.memory.memory, result.memory.offset) != VK_SUCCESS) {
+            throw std::runtime_error("failed to bind image memory!");
         }
-
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
     }
 
-    *outMemory = readableImageMemory;
-
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
+    // ATT.5. Create an Image View for the Render Target Image.
+    // Will be used by the Framebuffer as Color Attachment.
     {
-        VkCommandBufferAllocateInfo allocInfo;
+        // ATT.5.1. Specify the view information.
+        VkImageViewCreateInfo createInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            createInfo.image = result.image;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = format;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+        // 7.2. Create the Image View.
+        if (vkCreateImageView(device, &createInfo, NULL, &result.view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image views!");
         }
     }
 
-    // Start recording image copy commands.
-
-    // A.4. Start Command Buffer.
-    {
-        VkCommandBufferBeginInfo beginInfo;
-        {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            beginInfo.pInheritanceInfo = NULL;
-        }
-
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-    }
+    return result;
+}
 
-    // A.4. Transition destination image to transfer destination layout.
+VkPipelineLayout CreatePipelineLayout(const VkDevice device, const VkDescriptorSetLayout descriptorSetLayout) {
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo;
     {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.pNext = NULL;
+        pipelineLayoutInfo.flags = 0;
+        // D.X. Connect the created Desctiptor Set Layout to the pipeline layout.
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 0;
     }
 
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
     }
 
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
-    }
-
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
+    return layout;
+}
 
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+VkPipeline CreatePipeline(const VkDevice device,
+                          const VkPipelineCache pipelineCache,
+                          const VkPipelineLayout layout,
+                          const VkShaderModule vertexShader,
+                          const VkShaderModule fragmentShader,
+                          const VkRenderPass renderPass,
+                          const uint32_t subpassIdx,
+                          const uint32_t attachmentCount,
+                          const VkFormat colorFormat,
+                          const VkGraphicsPipelineLibraryFlagsEXT libraryFlags) {
+    // LR. Without a Render Pass a complete pipeline uses the dynamic rendering attachments.
+    const bool dynamicRendering = (renderPass == VK_NULL_HANDLE) && (libraryFlags == 0);
 
-    // A.8. End the Command Buffer.
+    // Y. Create the Rendering Pipeline
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo;
     {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.pNext = NULL;
+        vertShaderStageInfo.flags = 0;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertexShader;
+        vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = NULL;
     }
 
-    // A.9. Create a Fence.
-    VkFence fence;
-    {
-        VkFenceCreateInfo fenceInfo;
-        {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
-        }
-
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
-        }
-
-        //vkResetFences(device, 1, &fence);
-    }
-
-    // A.10. Submit the recorded Command Buffer to the Queue.
-    {
-        VkSubmitInfo submitInfo;
-        {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
-        }
-
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
-        }
-    }
-
-    // A.11. Wait the submitted Command Buffer to finish.
-    {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
-        }
-    }
-
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
-
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
-}
-
-std::vector<VkAttachmentDescription> GenerateAttachmentDescriptions(uint32_t count, const VkFormat format) {
-    std::vector<VkAttachmentDescription> descriptions;
-    descriptions.resize(count);
-    for (VkAttachmentDescription& info : descriptions) {
-        info.flags = 0;
-        info.format = format;
-        info.samples = VK_SAMPLE_COUNT_1_BIT;
-        info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        info.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        info.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        info.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    }
-
-    return descriptions;
-}
-
-AllocatedImage CreateAttachment2D(VkPhysicalDevice physicalDevice,
-                                  VkDevice device,
-                                  uint32_t imageWidth,
-                                  uint32_t imageHeight,
-                                  VkFormat format) {
-    AllocatedImage result;
-    {
-        // ATT.1. Specify the image creation information.
-        VkImageCreateInfo imageInfo;
-        {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = format;
-            imageInfo.extent = { imageWidth, imageHeight,  1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            // Tiling optimal means that the image is in a GPU optimal mode.
-            // Usually this means that it should not be accessed from the CPU side directly as
-            // the image color channels can be in any order.
-            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-            // Specifying the usage is important:
-            // * VK_IMAGE_USAGE_TRANSFER_SRC_BIT: the image can be used as a source for a transfer/copy operation.
-            // * VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT: the image can be used as a color attachment (aka can render on it).
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        }
-
-        // ATT.2. Create the image.
-        if (vkCreateImage(device, &imageInfo, NULL, &result.image) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
-        }
-    }
-
-    // ATT.3. Allocate and bind the memory for the render target image.
-    // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
-    {
-        // ATT.3.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, result.image, &memRequirements);
-
-        // ATT.3.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-        // ATT.3.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // ATT.3.4 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &result.memory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // ATT.4.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, result.image, result.memory, 0);
-    }
-
-    // ATT.5. Create an Image View for the Render Target Image.
-    // Will be used by the Framebuffer as Color Attachment.
-    {
-        // ATT.5.1. Specify the view information.
-        VkImageViewCreateInfo createInfo;
-        {
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.pNext = NULL;
-            createInfo.flags = 0;
-            createInfo.image = result.image;
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = format;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
-        }
-
-        // 7.2. Create the Image View.
-        if (vkCreateImageView(device, &createInfo, NULL, &result.view) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create image views!");
-        }
-    }
-
-    return result;
-}
-
-AllocatedPipeline CreatePipeline(const VkDevice device,
-                                const VkShaderModule vertexShader,
-                                const VkShaderModule fragmentShader,
-                                const VkRenderPass renderPass,
-                                const uint32_t subpassIdx,
-                                const VkExtent2D swapExtent,
-                                const VkDescriptorSetLayout descriptorSetLayout,
-                                const uint32_t attachmentCount) {
-    AllocatedPipeline result;
-    {
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo;
-        {
-            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-            pipelineLayoutInfo.pNext = NULL;
-            pipelineLayoutInfo.flags = 0;
-            // D.X. Connect the created Desctiptor Set Layout to the pipeline layout.
-            pipelineLayoutInfo.setLayoutCount = 1;
-            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-            pipelineLayoutInfo.pushConstantRangeCount = 0;
-        }
-
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &result.layout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
-        }
-    }
-
-    // Y. Create the Rendering Pipeline
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo;
-    {
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.pNext = NULL;
-        vertShaderStageInfo.flags = 0;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertexShader;
-        vertShaderStageInfo.pName = "main";
-        vertShaderStageInfo.pSpecializationInfo = NULL;
-    }
-
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo;
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo;
     {
         fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         fragShaderStageInfo.pNext = NULL;
@@ -1939,7 +2021,17 @@ AllocatedPipeline CreatePipeline(const VkDevice device,
         fragShaderStageInfo.pSpecializationInfo = NULL;
     }
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+    // PL. A library only contains the shader stages of its state subsets.
+    const bool hasPreRasterization = (libraryFlags == 0) || (libraryFlags & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT);
+    const bool hasFragmentShader = (libraryFlags == 0) || (libraryFlags & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    if (hasPreRasterization) {
+        shaderStages.push_back(vertShaderStageInfo);
+    }
+    if (hasFragmentShader) {
+        shaderStages.push_back(fragShaderStageInfo);
+    }
 
     // V.4. Describe the Vertex input binding information.
     VkVertexInputBindingDescription vec2VertexBinding;
@@ -1983,29 +2075,25 @@ AllocatedPipeline CreatePipeline(const VkDevice device,
         inputAssembly.primitiveRestartEnable = VK_FALSE;
     }
 
-    VkViewport viewport;
-    {
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) swapExtent.width;
-        viewport.height = (float) swapExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-    }
-
-    VkRect2D scissor;
-    {
-        scissor.offset = { 0, 0 };
-        scissor.extent = swapExtent;
-    }
-
+    // SC. The viewport and the scissor are dynamic states, they are set when the draw commands are recorded.
+    // This way the Pipeline is not re-created when the Swapchain size changes.
     VkPipelineViewportStateCreateInfo viewportState{};
     {
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
+        viewportState.pViewports = NULL;
         viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        viewportState.pScissors = NULL;
+    }
+
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState;
+    {
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.pNext = NULL;
+        dynamicState.flags = 0;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates = dynamicStates;
     }
 
     VkPipelineRasterizationStateCreateInfo rasterizer;
@@ -2063,7 +2151,8 @@ AllocatedPipeline CreatePipeline(const VkDevice device,
         colorBlending.flags = 0;
         colorBlending.logicOpEnable = VK_FALSE;
         colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = attachmentCount;
+        // LR. Every step of the dynamic rendering has all four color attachments.
+        colorBlending.attachmentCount = dynamicRendering ? g_localReadAttachmentCount : attachmentCount;
         colorBlending.pAttachments = colorBlends.data();
         colorBlending.blendConstants[0] = 0.0f;
         colorBlending.blendConstants[1] = 0.0f;
@@ -2071,13 +2160,63 @@ AllocatedPipeline CreatePipeline(const VkDevice device,
         colorBlending.blendConstants[3] = 0.0f;
     }
 
+    // PL. The state of the other subsets is ignored when a library is created,
+    // except the dynamic state which is only given to the pre-rasterization part (viewport and scissor).
+    VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo;
+    {
+        libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+        libraryInfo.pNext = NULL;
+        libraryInfo.flags = libraryFlags;
+    }
+
+    // LR.2. Describe the dynamic rendering attachments and the step's mapping of them.
+    // The same mapping is set in the Command Buffer before the step's draws.
+    VkFormat colorFormats[g_localReadAttachmentCount] = { colorFormat, colorFormat, colorFormat, colorFormat };
+
+    VkRenderingInputAttachmentIndexInfoKHR inputIndexInfo;
+    {
+        inputIndexInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INPUT_ATTACHMENT_INDEX_INFO_KHR;
+        inputIndexInfo.pNext = NULL;
+        inputIndexInfo.colorAttachmentCount = g_localReadAttachmentCount;
+        inputIndexInfo.pColorAttachmentInputIndices = g_localReadInputIndices;
+        inputIndexInfo.pDepthInputAttachmentIndex = NULL;
+        inputIndexInfo.pStencilInputAttachmentIndex = NULL;
+    }
+
+    VkRenderingAttachmentLocationInfoKHR locationInfo;
+    {
+        locationInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_LOCATION_INFO_KHR;
+        // Only the compose step reads input attachments.
+        locationInfo.pNext = (subpassIdx == 2) ? &inputIndexInfo : NULL;
+        locationInfo.colorAttachmentCount = g_localReadAttachmentCount;
+        locationInfo.pColorAttachmentLocations = g_localReadLocations[subpassIdx];
+    }
+
+    VkPipelineRenderingCreateInfoKHR renderingInfo;
+    {
+        renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        renderingInfo.pNext = &locationInfo;
+        renderingInfo.viewMask = 0;
+        renderingInfo.colorAttachmentCount = g_localReadAttachmentCount;
+        renderingInfo.pColorAttachmentFormats = colorFormats;
+        renderingInfo.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+        renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    }
+
+    const void *pipelineNext = NULL;
+    if (libraryFlags != 0) {
+        pipelineNext = &libraryInfo;
+    } else if (dynamicRendering) {
+        pipelineNext = &renderingInfo;
+    }
+
     VkGraphicsPipelineCreateInfo pipelineInfo;
     {
         pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.pNext = NULL;
-        pipelineInfo.flags = 0;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pNext = pipelineNext;
+        pipelineInfo.flags = (libraryFlags != 0) ? VK_PIPELINE_CREATE_LIBRARY_BIT_KHR : 0;
+        pipelineInfo.stageCount = (uint32_t)shaderStages.size();
+        pipelineInfo.pStages = shaderStages.data();
         pipelineInfo.pVertexInputState = &vertexInputInfo;
         pipelineInfo.pInputAssemblyState = &inputAssembly;
         pipelineInfo.pTessellationState = NULL;
@@ -2086,56 +2225,946 @@ AllocatedPipeline CreatePipeline(const VkDevice device,
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = NULL;
         pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = NULL;
-        pipelineInfo.layout = result.layout;
+        pipelineInfo.pDynamicState = hasPreRasterization ? &dynamicState : NULL;
+        pipelineInfo.layout = layout;
         pipelineInfo.renderPass = renderPass;
-        pipelineInfo.subpass = subpassIdx,
+        pipelineInfo.subpass = dynamicRendering ? 0 : subpassIdx,
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
         pipelineInfo.basePipelineIndex = 0;
     }
 
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &result.cache);
-
-    if (vkCreateGraphicsPipelines(device, result.cache, 1, &pipelineInfo, NULL, &result.pipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
-    return result;
+    return pipeline;
+}
+
+VkPipeline LinkPipelineLibraries(const VkDevice device,
+                                 const VkPipelineCache pipelineCache,
+                                 const VkPipelineLayout layout,
+                                 const VkRenderPass renderPass,
+                                 const uint32_t subpassIdx,
+                                 const std::vector<VkPipeline>& libraries) {
+    // PL.5. All state comes from the libraries.
+    // Without VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT this is the fast link: no shader compilation happens here.
+    VkPipelineLibraryCreateInfoKHR linkInfo;
+    {
+        linkInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+        linkInfo.pNext = NULL;
+        linkInfo.libraryCount = (uint32_t)libraries.size();
+        linkInfo.pLibraries = libraries.data();
+    }
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    {
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = &linkInfo;
+        pipelineInfo.flags = 0;
+        pipelineInfo.layout = layout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = subpassIdx;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        pipelineInfo.basePipelineIndex = 0;
+    }
+
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to link graphics pipeline!");
+    }
+
+    return pipeline;
 }
 
-static VkShaderModule BuildShader(const VkDevice device, const std::string& filename, VkShaderStageFlagBits flags) {
-    // X.1. Load the GLSL shader from file and compile it with shaderc.
-    #if HAVE_SHADERC
-    std::vector<char> src = LoadGLSL(filename);
-    std::vector<uint32_t> code = CompileGLSL((flags & VK_SHADER_STAGE_VERTEX_BIT) ? shaderc_vertex_shader : shaderc_fragment_shader, src);
-    #else
-    std::vector<uint32_t> code = LoadSPIRV(filename + ".spv");
-    #endif
+bool QueryPipelineLibrarySupport(const VkPhysicalDevice physicalDevice) {
+    // PL.0.1. Check the device extensions.
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, NULL);
 
-    if (code.size() == 0) {
-        throw std::runtime_error("failed to load shader!");
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensions.data());
+
+    bool hasPipelineLibrary = false;
+    bool hasGraphicsPipelineLibrary = false;
+    for (const VkExtensionProperties& extension : extensions) {
+        hasPipelineLibrary |= (strcmp(extension.extensionName, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) == 0);
+        hasGraphicsPipelineLibrary |= (strcmp(extension.extensionName, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) == 0);
     }
 
-    // X.2. Specify the vertex shader module information.
-    // Notes:
-    // * "codeSize" is in bytes.
-    // * "pCode" points to an array of SPIR-V opcodes.
-    VkShaderModuleCreateInfo info;
+    // vkGetPhysicalDeviceFeatures2 is a Vulkan 1.1 entry point.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    if (!hasPipelineLibrary || !hasGraphicsPipelineLibrary || (properties.apiVersion < VK_API_VERSION_1_1)) {
+        return false;
+    }
+
+    // PL.0.2. Check the feature itself.
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures;
     {
-        info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        info.pNext = NULL;
-        info.flags = 0;
-        info.codeSize = code.size() * sizeof(uint32_t);
-        info.pCode = reinterpret_cast<uint32_t*>(code.data());
+        pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        pipelineLibraryFeatures.pNext = NULL;
+        pipelineLibraryFeatures.graphicsPipelineLibrary = VK_FALSE;
     }
 
-    VkShaderModule module;
-    // 9.3. Create the Vertex Shader Module.
-    if (vkCreateShaderModule(device, &info, NULL, &module) != VK_SUCCESS) {
-       throw std::runtime_error("failed to create shader module!");
+    VkPhysicalDeviceFeatures2 features;
+    {
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &pipelineLibraryFeatures;
+    }
+
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+    return pipelineLibraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+}
+
+RenderPath ParseRenderPath(const char *name) {
+    if (strcmp(name, "subpass") == 0) {
+        return RENDER_PATH_SUBPASS;
+    } else if (strcmp(name, "local_read") == 0) {
+        return RENDER_PATH_LOCAL_READ;
+    }
+
+    throw std::runtime_error("unknown render path!");
+}
+
+bool QueryLocalReadSupport(const VkPhysicalDevice physicalDevice) {
+    // LR.0.2. Check the device extensions, including the dependencies of VK_KHR_dynamic_rendering.
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, NULL);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensions.data());
+
+    static const char *requiredExtensions[] = {
+        VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+        VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+        VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+        VK_KHR_DYNAMIC_RENDERING_LOCAL_READ_EXTENSION_NAME,
+    };
+
+    for (const char *required : requiredExtensions) {
+        bool found = false;
+        for (const VkExtensionProperties& extension : extensions) {
+            found |= (strcmp(extension.extensionName, required) == 0);
+        }
+
+        if (!found) {
+            return false;
+        }
+    }
+
+    // vkGetPhysicalDeviceFeatures2 is a Vulkan 1.1 entry point.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    if (properties.apiVersion < VK_API_VERSION_1_1) {
+        return false;
+    }
+
+    // LR.0.3. Check the features themselves.
+    VkPhysicalDeviceDynamicRenderingLocalReadFeaturesKHR localReadFeatures;
+    {
+        localReadFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_LOCAL_READ_FEATURES_KHR;
+        localReadFeatures.pNext = NULL;
+        localReadFeatures.dynamicRenderingLocalRead = VK_FALSE;
+    }
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures;
+    {
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        dynamicRenderingFeatures.pNext = &localReadFeatures;
+        dynamicRenderingFeatures.dynamicRendering = VK_FALSE;
     }
 
-    return module;
+    VkPhysicalDeviceFeatures2 features;
+    {
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &dynamicRenderingFeatures;
+    }
+
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+    return (dynamicRenderingFeatures.dynamicRendering == VK_TRUE) && (localReadFeatures.dynamicRenderingLocalRead == VK_TRUE);
+}
+
+LocalReadFunctions LoadLocalReadFunctions(const VkDevice device) {
+    // LR.1.1. The extension commands are not exported by the loader, they are queried from the Device.
+    LocalReadFunctions functions;
+    functions.beginRendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+    functions.endRendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+    functions.setAttachmentLocations =
+        (PFN_vkCmdSetRenderingAttachmentLocationsKHR)vkGetDeviceProcAddr(device, "vkCmdSetRenderingAttachmentLocationsKHR");
+    functions.setInputAttachmentIndices =
+        (PFN_vkCmdSetRenderingInputAttachmentIndicesKHR)vkGetDeviceProcAddr(device, "vkCmdSetRenderingInputAttachmentIndicesKHR");
+
+    if ((functions.beginRendering == NULL) || (functions.endRendering == NULL)
+        || (functions.setAttachmentLocations == NULL) || (functions.setInputAttachmentIndices == NULL)) {
+        throw std::runtime_error("failed to load the dynamic rendering functions!");
+    }
+
+    return functions;
+}
+
+void RunPipelineJobs(uint32_t jobCount, uint32_t threadCount, const std::function<void(uint32_t)>& job) {
+    if (threadCount == 0) {
+        for (uint32_t jobIdx = 0; jobIdx < jobCount; jobIdx++) {
+            job(jobIdx);
+        }
+        return;
+    }
+
+    // PL.2. The workers take the next job until all are done.
+    // VkPipelineCache is internally synchronized (it is not created with the
+    // externally synchronized flag), so all workers share the same cache without a lock.
+    std::atomic<uint32_t> nextJob(0);
+    std::vector<std::future<void> > workers;
+    for (uint32_t threadIdx = 0; threadIdx < std::min(threadCount, jobCount); threadIdx++) {
+        workers.push_back(std::async(std::launch::async, [&nextJob, jobCount, &job]() {
+            for (uint32_t jobIdx = nextJob++; jobIdx < jobCount; jobIdx = nextJob++) {
+                job(jobIdx);
+            }
+        }));
+    }
+
+    // PL.3. Wait for all workers before re-throwing the first error, the jobs reference the caller's state.
+    for (std::future<void>& worker : workers) {
+        worker.wait();
+    }
+    for (std::future<void>& worker : workers) {
+        worker.get();
+    }
+}
+
+void CreateSubpassPipelines(const VkDevice device,
+                            const VkPipelineCache pipelineCache,
+                            const VkRenderPass renderPass,
+                            const VkDescriptorSetLayout descriptorSetLayout,
+                            const SubpassPipelineDesc descs[g_subpassCount],
+                            const VkFormat colorFormat,
+                            bool usePipelineLibrary,
+                            uint32_t threadCount,
+                            AllocatedPipeline outPipelines[g_subpassCount]) {
+    // PL.1.1. The Pipeline Layouts are cheap, they are created up front.
+    for (uint32_t subpassIdx = 0; subpassIdx < g_subpassCount; subpassIdx++) {
+        outPipelines[subpassIdx].layout = CreatePipelineLayout(device, descriptorSetLayout);
+        outPipelines[subpassIdx].pipeline = VK_NULL_HANDLE;
+    }
+
+    if (!usePipelineLibrary) {
+        // PL.1.2. Monolithic pipelines: one job for each subpass.
+        RunPipelineJobs(g_subpassCount, threadCount, [&](uint32_t subpassIdx) {
+            const SubpassPipelineDesc& desc = descs[subpassIdx];
+            outPipelines[subpassIdx].pipeline = CreatePipeline(device, pipelineCache, outPipelines[subpassIdx].layout,
+                                                               desc.vertexShader, desc.fragmentShader, renderPass, subpassIdx,
+                                                               desc.attachmentCount, colorFormat, 0);
+        });
+        return;
+    }
+
+    // PL.4. Pipeline libraries: the vertex input interface (binding, attributes and topology) is the same
+    // for all subpasses, so it is compiled once. The pre-rasterization, fragment shader and fragment output
+    // parts depend on the render pass and subpass index, they are compiled per subpass as separate jobs.
+    static const VkGraphicsPipelineLibraryFlagsEXT partFlags[] = {
+        VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+    };
+    const uint32_t partCount = sizeof(partFlags) / sizeof(partFlags[0]);
+
+    // The first library is the shared vertex input, followed by the parts of each subpass.
+    std::vector<VkPipeline> libraries(1 + g_subpassCount * partCount, VK_NULL_HANDLE);
+    try {
+        RunPipelineJobs((uint32_t)libraries.size(), threadCount, [&](uint32_t libraryIdx) {
+            if (libraryIdx == 0) {
+                libraries[0] = CreatePipeline(device, pipelineCache, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE,
+                                              VK_NULL_HANDLE, 0, 0, colorFormat,
+                                              VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT);
+                return;
+            }
+
+            const uint32_t subpassIdx = (libraryIdx - 1) / partCount;
+            const SubpassPipelineDesc& desc = descs[subpassIdx];
+            libraries[libraryIdx] = CreatePipeline(device, pipelineCache, outPipelines[subpassIdx].layout,
+                                                   desc.vertexShader, desc.fragmentShader, renderPass, subpassIdx,
+                                                   desc.attachmentCount, colorFormat, partFlags[(libraryIdx - 1) % partCount]);
+        });
+
+        // PL.5. Link the final pipelines from the libraries.
+        RunPipelineJobs(g_subpassCount, threadCount, [&](uint32_t subpassIdx) {
+            std::vector<VkPipeline> subpassLibraries = { libraries[0] };
+            subpassLibraries.insert(subpassLibraries.end(),
+                                    libraries.begin() + 1 + subpassIdx * partCount,
+                                    libraries.begin() + 1 + (subpassIdx + 1) * partCount);
+
+            outPipelines[subpassIdx].pipeline = LinkPipelineLibraries(device, pipelineCache, outPipelines[subpassIdx].layout,
+                                                                      renderPass, subpassIdx, subpassLibraries);
+        });
+    } catch (...) {
+        for (VkPipeline library : libraries) {
+            vkDestroyPipeline(device, library, NULL);
+        }
+        throw;
+    }
+
+    // PL.6. The linked pipelines do not reference the libraries, they can be destroyed.
+    for (VkPipeline library : libraries) {
+        vkDestroyPipeline(device, library, NULL);
+    }
+}
+
+static ShaderModuleHandle BuildShader(const VkDevice device, std::future<std::vector<uint32_t> >& codeLoad) {
+    // X.1. Wait for the shader loaded (or compiled) by the worker thread (ST.1).
+    std::vector<uint32_t> code = codeLoad.get();
+
+    if (code.size() == 0) {
+        throw std::runtime_error("failed to load shader!");
+    }
+
+    // X.2. Specify the vertex shader module information.
+    // Notes:
+    // * "codeSize" is in bytes.
+    // * "pCode" points to an array of SPIR-V opcodes.
+    VkShaderModuleCreateInfo info;
+    {
+        info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        info.pNext = NULL;
+        info.flags = 0;
+        info.codeSize = code.size() * sizeof(uint32_t);
+        info.pCode = reinterpret_cast<uint32_t*>(code.data());
+    }
+
+    VkShaderModule module;
+    // 9.3. Create the Vertex Shader Module.
+    if (vkCreateShaderModule(device, &info, NULL, &module) != VK_SUCCESS) {
+       throw std::runtime_error("failed to create shader module!");
+    }
+
+    return ShaderModuleHandle(device, module, vkDestroyShaderModule);
+}
+
+void PrintAttachmentTraffic(VkExtent2D extent, bool transientAttachments) {
+    // LR.4. Both render paths do the same attachment accesses, only where they happen differs.
+    // An immediate mode GPU writes the four cleared attachments, the triangles and the composed image
+    // to memory and reads the red, green and blue images back for the compose step (worst case: full screen).
+    // A tiler keeps all of it on chip and only writes out the stored attachments at the end.
+    const double imageMiB = (double)extent.width * extent.height * 4 / (1024.0 * 1024.0);
+    const uint32_t storedAttachments = transientAttachments ? 1 : 4;
+
+    printf("Bench: attachment traffic estimate per frame (MiB): immediate mode <= %.2f, tiler %.2f (%u stored attachments)\n",
+           imageMiB * (4 + 3 + 1 + 3), imageMiB * storedAttachments, storedAttachments);
+}
+
+void RecordSubpassDraws(const VkCommandBuffer cmdBuffer, const SubpassDrawInfo& draws, uint32_t subpassIdx) {
+    const AllocatedPipeline& pipe = draws.pipelines[subpassIdx];
+
+    // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe.pipeline);
+
+    // SC. Set the dynamic viewport and scissor to the current Swapchain size.
+    // Secondary Command Buffers do not inherit the dynamic state, so each subpass sets it.
+    VkViewport viewport;
+    {
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) draws.extent.width;
+        viewport.height = (float) draws.extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+    }
+
+    VkRect2D scissor;
+    {
+        scissor.offset = { 0, 0 };
+        scissor.extent = draws.extent;
+    }
+
+    vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+    // D.X. Bind descriptor set
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe.layout, 0, 1, &draws.descriptorSet, 0, NULL);
+
+    // V.7. Bind the Vertex buffers as specified by the pipeline.
+    // The compose subpass uses the vertices baked into its shader.
+    if (subpassIdx < 2) {
+        VkDeviceSize bufferOffsets[] = { 0 };
+        vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &draws.vertexBuffer, bufferOffsets);
+    }
+
+    // 17.3. Add a Draw command.
+    // Draw 3 vertices using the pipeline bound previously.
+    uint32_t vertexCount = 3;
+    uint32_t instanceCount = 1;
+
+    switch (subpassIdx) {
+        case 0:
+            // Y. Draw the red triangle
+            vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 0);
+            // Y. Draw the green triangle
+            vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 1);
+            break;
+        case 1:
+            // Y. Draw the blue triangle
+            vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 2);
+            break;
+        case 2:
+            // Y. Compose the triangle.
+            vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 0);
+            break;
+    }
+}
+
+void RecordLocalReadDraws(const VkCommandBuffer cmdBuffer, const SubpassDrawInfo& draws, uint32_t imageIdx) {
+    // LR.3.1. Images of the color attachments: present, red, green and blue.
+    // The red, green and blue images stay in the local read layout for the whole rendering,
+    // so they can be written as color attachments and read as input attachments.
+    VkImage images[g_localReadAttachmentCount];
+    VkImageView views[g_localReadAttachmentCount];
+    VkImageLayout layouts[g_localReadAttachmentCount];
+    for (uint32_t idx = 0; idx < g_localReadAttachmentCount; idx++) {
+        images[idx] = (idx == 0) ? (*draws.images)[imageIdx] : draws.attachments[idx - 1].image;
+        views[idx] = (idx == 0) ? (*draws.imageViews)[imageIdx] : draws.attachments[idx - 1].view;
+        layouts[idx] = (idx == 0) ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_RENDERING_LOCAL_READ_KHR;
+    }
+
+    // LR.3.2. Transition the images into the attachment layouts, their previous content is not needed.
+    // This replaces the initial layouts and the external dependency of the Render Pass.
+    // The earlier frames read the attachments in the fragment shader and the rendered image in a copy.
+    VkImageMemoryBarrier beginBarriers[g_localReadAttachmentCount];
+    for (uint32_t idx = 0; idx < g_localReadAttachmentCount; idx++) {
+        beginBarriers[idx].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        beginBarriers[idx].pNext = NULL;
+        beginBarriers[idx].srcAccessMask = 0;
+        beginBarriers[idx].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        beginBarriers[idx].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        beginBarriers[idx].newLayout = layouts[idx];
+        beginBarriers[idx].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        beginBarriers[idx].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        beginBarriers[idx].image = images[idx];
+        beginBarriers[idx].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         0, 0, NULL, 0, NULL, g_localReadAttachmentCount, beginBarriers);
+
+    // LR.3.3. Begin the rendering with the same load and store operations as the Render Pass.
+    VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+    VkRenderingAttachmentInfoKHR colorAttachments[g_localReadAttachmentCount];
+    for (uint32_t idx = 0; idx < g_localReadAttachmentCount; idx++) {
+        colorAttachments[idx].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        colorAttachments[idx].pNext = NULL;
+        colorAttachments[idx].imageView = views[idx];
+        colorAttachments[idx].imageLayout = layouts[idx];
+        colorAttachments[idx].resolveMode = VK_RESOLVE_MODE_NONE;
+        colorAttachments[idx].resolveImageView = VK_NULL_HANDLE;
+        colorAttachments[idx].resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachments[idx].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        // S.X. The red, green and blue images are not written out to memory if they are transient.
+        colorAttachments[idx].storeOp = ((idx > 0) && draws.transientAttachments) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachments[idx].clearValue = clearColor;
+    }
+
+    VkRenderingInfoKHR renderingInfo;
+    {
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+        renderingInfo.pNext = NULL;
+        renderingInfo.flags = 0;
+        renderingInfo.renderArea.offset = { 0, 0 };
+        renderingInfo.renderArea.extent = draws.extent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.viewMask = 0;
+        renderingInfo.colorAttachmentCount = g_localReadAttachmentCount;
+        renderingInfo.pColorAttachments = colorAttachments;
+        renderingInfo.pDepthAttachment = NULL;
+        renderingInfo.pStencilAttachment = NULL;
+    }
+
+    draws.localRead.beginRendering(cmdBuffer, &renderingInfo);
+
+    for (uint32_t stepIdx = 0; stepIdx < g_subpassCount; stepIdx++) {
+        if (stepIdx == 2) {
+            // LR.3.4. Make the red, green and blue writes visible to the input attachment reads of the compose step.
+            // Inside the rendering only a by-region dependency is allowed: every fragment reads the pixel
+            // it is shading, so a tiler resolves it on chip like the subpass dependencies.
+            VkMemoryBarrier localReadBarrier;
+            {
+                localReadBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                localReadBarrier.pNext = NULL;
+                localReadBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                localReadBarrier.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+            }
+
+            vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                 VK_DEPENDENCY_BY_REGION_BIT, 1, &localReadBarrier, 0, NULL, 0, NULL);
+
+            VkRenderingInputAttachmentIndexInfoKHR inputIndexInfo;
+            {
+                inputIndexInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INPUT_ATTACHMENT_INDEX_INFO_KHR;
+                inputIndexInfo.pNext = NULL;
+                inputIndexInfo.colorAttachmentCount = g_localReadAttachmentCount;
+                inputIndexInfo.pColorAttachmentInputIndices = g_localReadInputIndices;
+                inputIndexInfo.pDepthInputAttachmentIndex = NULL;
+                inputIndexInfo.pStencilInputAttachmentIndex = NULL;
+            }
+
+            draws.localRead.setInputAttachmentIndices(cmdBuffer, &inputIndexInfo);
+        }
+
+        // LR.3.5. Route the fragment outputs of the step to its attachments, this must match the bound pipeline.
+        VkRenderingAttachmentLocationInfoKHR locationInfo;
+        {
+            locationInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_LOCATION_INFO_KHR;
+            locationInfo.pNext = NULL;
+            locationInfo.colorAttachmentCount = g_localReadAttachmentCount;
+            locationInfo.pColorAttachmentLocations = g_localReadLocations[stepIdx];
+        }
+
+        draws.localRead.setAttachmentLocations(cmdBuffer, &locationInfo);
+
+        RecordSubpassDraws(cmdBuffer, draws, stepIdx);
+    }
+
+    draws.localRead.endRendering(cmdBuffer);
+
+    // LR.3.6. Transition the rendered image into the target layout (present or readback).
+    // The readback copy waits on the color attachment output stage.
+    VkImageMemoryBarrier endBarrier;
+    {
+        endBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        endBarrier.pNext = NULL;
+        endBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        endBarrier.dstAccessMask = 0;
+        endBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        endBarrier.newLayout = draws.targetLayout;
+        endBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        endBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        endBarrier.image = images[0];
+        endBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    }
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         0, 0, NULL, 0, NULL, 1, &endBarrier);
+}
+
+void CreateRecordWorkers(const VkDevice device, uint32_t queueFamilyIdx, uint32_t threadCount, std::vector<RecordWorker> *outWorkers) {
+    outWorkers->resize(threadCount);
+
+    VkCommandPoolCreateInfo poolInfo;
+    {
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.pNext = NULL;
+        poolInfo.flags = 0;
+        poolInfo.queueFamilyIndex = queueFamilyIdx;
+    }
+
+    for (RecordWorker& worker : *outWorkers) {
+        worker.failed = false;
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &worker.cmdPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create worker command pool!");
+        }
+    }
+}
+
+void DestroyRecordWorkers(const VkDevice device, std::vector<RecordWorker> *workers) {
+    // Destroying the pool also frees its Command Buffers.
+    for (RecordWorker& worker : *workers) {
+        vkDestroyCommandPool(device, worker.cmdPool, NULL);
+    }
+    workers->clear();
+}
+
+void RecordSecondaryCommandBuffers(const VkDevice device,
+                                   std::vector<RecordWorker> *workers,
+                                   const VkRenderPass renderPass,
+                                   const std::vector<VkFramebuffer>& framebuffers,
+                                   const SubpassDrawInfo& draws,
+                                   std::vector<VkCommandBuffer> *outCmdBuffers) {
+    // MT.2. One secondary Command Buffer for each (framebuffer, subpass) pair.
+    // Every worker writes distinct elements, so the output needs no locking.
+    outCmdBuffers->assign(framebuffers.size() * g_subpassCount, VK_NULL_HANDLE);
+
+    const uint32_t workerCount = (uint32_t)workers->size();
+    std::vector<std::thread> threads;
+    for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+        threads.push_back(std::thread(RecordWorkerMain, device, &(*workers)[workerIdx], workerIdx, workerCount,
+                                      renderPass, &framebuffers, &draws, outCmdBuffers));
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (const RecordWorker& worker : *workers) {
+        if (worker.failed) {
+            throw std::runtime_error("failed to record secondary command buffer!");
+        }
+    }
+}
+
+void RecordWorkerMain(const VkDevice device,
+                      RecordWorker *worker,
+                      uint32_t workerIdx,
+                      uint32_t workerCount,
+                      const VkRenderPass renderPass,
+                      const std::vector<VkFramebuffer> *framebuffers,
+                      const SubpassDrawInfo *draws,
+                      std::vector<VkCommandBuffer> *outCmdBuffers) {
+    // MT.3. The jobs are distributed in a round robin order.
+    std::vector<uint32_t> jobs;
+    for (uint32_t job = workerIdx; job < outCmdBuffers->size(); job += workerCount) {
+        jobs.push_back(job);
+    }
+
+    if (jobs.empty()) {
+        return;
+    }
+
+    // MT.4. Allocate the secondary Command Buffers from the pool of this thread.
+    VkCommandBufferAllocateInfo allocInfo;
+    {
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.pNext = NULL;
+        allocInfo.commandPool = worker->cmdPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = (uint32_t)jobs.size();
+    }
+
+    worker->cmdBuffers.resize(jobs.size());
+    if (vkAllocateCommandBuffers(device, &allocInfo, worker->cmdBuffers.data()) != VK_SUCCESS) {
+        worker->failed = true;
+        return;
+    }
+
+    for (size_t idx = 0; idx < jobs.size(); idx++) {
+        const uint32_t framebufferIdx = jobs[idx] / g_subpassCount;
+        const uint32_t subpassIdx = jobs[idx] % g_subpassCount;
+        const VkCommandBuffer cmdBuffer = worker->cmdBuffers[idx];
+
+        // MT.5. The inheritance info tells which Render Pass instance the commands will continue.
+        VkCommandBufferInheritanceInfo inheritanceInfo;
+        {
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.pNext = NULL;
+            inheritanceInfo.renderPass = renderPass;
+            inheritanceInfo.subpass = subpassIdx;
+            inheritanceInfo.framebuffer = (*framebuffers)[framebufferIdx];
+            inheritanceInfo.occlusionQueryEnable = VK_FALSE;
+            inheritanceInfo.queryFlags = 0;
+            inheritanceInfo.pipelineStatistics = 0;
+        }
+
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+        }
+
+        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            worker->failed = true;
+            return;
+        }
+
+        RecordSubpassDraws(cmdBuffer, *draws, subpassIdx);
+
+        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+            worker->failed = true;
+            return;
+        }
+
+        (*outCmdBuffers)[jobs[idx]] = cmdBuffer;
+    }
+}
+
+void DestroyAttachment2D(VkDevice device, MemoryArena *arena, AllocatedImage *attachment) {
+    vkDestroyImageView(device, attachment->view, NULL);
+    vkDestroyImage(device, attachment->image, NULL);
+    ArenaFree(arena, attachment->memory);
+}
+
+void PrintAttachmentMemory(VkDevice device, const AllocatedImage *attachments, uint32_t count) {
+    VkDeviceSize totalSize = 0;
+    VkDeviceSize totalCommitted = 0;
+
+    for (uint32_t idx = 0; idx < count; idx++) {
+        const AllocatedImage& attachment = attachments[idx];
+
+        // ATT.6. Only lazily allocated memory can be committed partially, other memory is always backed fully.
+        VkDeviceSize committed = attachment.memory.size;
+        if (attachment.lazilyAllocated) {
+            vkGetDeviceMemoryCommitment(device, attachment.memory.memory, &committed);
+        }
+
+        printf("Attachment %u: %s, %.1f KiB allocated, %.1f KiB committed, %.1f KiB saved\n",
+               idx + 1, attachment.lazilyAllocated ? "lazily allocated" : "device local",
+               attachment.memory.size / 1024.0, committed / 1024.0, (attachment.memory.size - committed) / 1024.0);
+
+        totalSize += attachment.memory.size;
+        totalCommitted += committed;
+    }
+
+    printf("Attachments: %.1f KiB of %.1f KiB saved\n", (totalSize - totalCommitted) / 1024.0, totalSize / 1024.0);
+}
+
+void WriteDescriptorSet(const VkDevice device,
+                        const VkDescriptorSet descriptorSet,
+                        const VkBuffer uniformBuffer,
+                        const AllocatedImage *attachments,
+                        VkImageLayout inputLayout) {
+    VkDescriptorBufferInfo bufferInfo;
+    {
+        bufferInfo.buffer = uniformBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = VK_WHOLE_SIZE;
+    }
+    VkDescriptorImageInfo imageInfo[] = {
+        { VK_NULL_HANDLE,  attachments[0].view, inputLayout },
+        { VK_NULL_HANDLE,  attachments[1].view, inputLayout },
+        { VK_NULL_HANDLE,  attachments[2].view, inputLayout },
+    };
+
+    VkWriteDescriptorSet descriptorWrite[] = {
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL, /* sType, pNext */
+            descriptorSet, 0,                             /* dstSet, dstBinding */
+            0, 1,                                         /* dstArrayElement, descriptorCount */
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,            /* descriptorType */
+            NULL, &bufferInfo, NULL,                      /* pImageInfo, pBufferInfo, pTexelBufferView */
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
+            descriptorSet, 1,
+            0, 1,
+            VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+            &imageInfo[0], NULL, NULL,
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
+            descriptorSet, 2,
+            0, 1,
+            VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+            &imageInfo[1], NULL, NULL,
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, NULL,
+            descriptorSet, 3,
+            0, 1,
+            VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+            &imageInfo[2], NULL, NULL,
+        }
+    };
+
+    vkUpdateDescriptorSets(device, 4, descriptorWrite, 0, NULL);
+}
+
+void CreateFramebuffers(const VkDevice device,
+                        const VkRenderPass renderPass,
+                        VkFormat format,
+                        VkExtent2D extent,
+                        const std::vector<VkImage>& images,
+                        const AllocatedImage *attachments,
+                        std::vector<VkImageView> *outImageViews,
+                        std::vector<VkFramebuffer> *outFramebuffers) {
+    // G.7.1. Create Image Views for the Swapchain Images.
+    outImageViews->resize(images.size());
+    {
+        VkImageViewCreateInfo createInfo;
+        {
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.pNext = NULL;
+            createInfo.flags = 0;
+            //createInfo.image = renderImage;
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = format;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
+        }
+
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            createInfo.image = images[idx];
+
+            if (vkCreateImageView(device, &createInfo, NULL, &(*outImageViews)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
+            }
+        }
+    }
+
+    // LR. Dynamic rendering uses the image views directly.
+    // The empty Framebuffers keep the one Command Buffer per image bookkeeping.
+    if (renderPass == VK_NULL_HANDLE) {
+        outFramebuffers->assign(images.size(), VK_NULL_HANDLE);
+        return;
+    }
+
+    // G.8.1. Create Frambuffer for each Swapchain Image view.
+    outFramebuffers->resize(images.size());
+    {
+        VkImageView framebufferAttachments[4] = {
+            VK_NULL_HANDLE,
+            attachments[0].view,
+            attachments[1].view,
+            attachments[2].view,
+        };
+        VkFramebufferCreateInfo framebufferInfo;
+        {
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.pNext = NULL;
+            framebufferInfo.flags = 0;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 4;
+            framebufferInfo.pAttachments = framebufferAttachments;
+            framebufferInfo.width = extent.width;
+            framebufferInfo.height = extent.height;
+            framebufferInfo.layers = 1;
+        }
+
+        for (size_t idx = 0; idx < images.size(); idx++) {
+            framebufferAttachments[0] = (*outImageViews)[idx];
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &(*outFramebuffers)[idx]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
+    }
+}
+
+void DestroyFramebuffers(const VkDevice device, std::vector<VkImageView> *imageViews, std::vector<VkFramebuffer> *framebuffers) {
+    for (size_t idx = 0; idx < framebuffers->size(); idx++) {
+        vkDestroyFramebuffer(device, (*framebuffers)[idx], NULL);
+    }
+
+    for (size_t idx = 0; idx < imageViews->size(); idx++) {
+        vkDestroyImageView(device, (*imageViews)[idx], NULL);
+    }
+
+    framebuffers->clear();
+    imageViews->clear();
+}
+
+void RecordDrawCommands(const VkDevice device,
+                        const VkCommandPool cmdPool,
+                        const VkRenderPass renderPass,
+                        const std::vector<VkFramebuffer>& framebuffers,
+                        const SubpassDrawInfo& draws,
+                        std::vector<RecordWorker> *recordWorkers,
+                        std::vector<VkCommandBuffer> *outSecondaryCmdBuffers,
+                        std::vector<VkCommandBuffer> *outCmdBuffers) {
+    std::vector<VkCommandBuffer>& cmdBuffers = *outCmdBuffers;
+
+    // G.9.1. Allocate a Command Buffer for each Framebuffer.
+    {
+        cmdBuffers.resize(framebuffers.size());
+
+        VkCommandBufferAllocateInfo allocInfo;
+        {
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.commandPool = cmdPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = cmdBuffers.size();
+        }
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    // MT. Record the draw commands of each subpass into secondary Command Buffers on the worker threads.
+    // The primary Command Buffers only execute them, so the recording scales with the number of threads.
+    if (!recordWorkers->empty()) {
+        RecordSecondaryCommandBuffers(device, recordWorkers, renderPass, framebuffers, draws, outSecondaryCmdBuffers);
+    }
+
+    // Start recording draw commands.
+    // G.10. In the current example all Command Buffers will have the same data.
+    // G.12. Each Command Buffer uses a different Framebuffer (idx).
+    for (size_t idx = 0; idx < cmdBuffers.size(); idx++) {
+        // G.XX. As a command buffer is submitted multiple times the VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT flag
+        // can't be used.
+        RecordFrameCommands(cmdBuffers[idx], 0, renderPass, framebuffers[idx], draws, *outSecondaryCmdBuffers, (uint32_t)idx);
+    }
+}
+
+void RecordFrameCommands(const VkCommandBuffer cmdBuffer,
+                         VkCommandBufferUsageFlags usageFlags,
+                         const VkRenderPass renderPass,
+                         const VkFramebuffer framebuffer,
+                         const SubpassDrawInfo& draws,
+                         const std::vector<VkCommandBuffer>& secondaryCmdBuffers,
+                         uint32_t imageIdx) {
+    // 16. Start Command Buffer
+    {
+        VkCommandBufferBeginInfo beginInfo;
+        {
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = usageFlags;
+            beginInfo.pInheritanceInfo = NULL;
+        }
+
+        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+    }
+
+    const bool useSecondary = !secondaryCmdBuffers.empty();
+    const VkSubpassContents subpassContents = useSecondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+
+    // 17. Insert draw commands into Command Buffer.
+    // LR.3. Without a Render Pass all steps are recorded into one dynamic rendering instance.
+    if (renderPass == VK_NULL_HANDLE) {
+        RecordLocalReadDraws(cmdBuffer, draws, imageIdx);
+    } else {
+        // 17.1. Add Begin RenderPass command
+        // This makes it possible to use the vmCmdDraw* calls.
+        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        VkClearValue clears[4] = {
+            clearColor, clearColor, clearColor, clearColor,
+        };
+        VkRenderPassBeginInfo renderPassInfo;
+        {
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.pNext = NULL;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = framebuffer;
+            renderPassInfo.renderArea.offset = { 0, 0 };
+            renderPassInfo.renderArea.extent = draws.extent;
+            renderPassInfo.clearValueCount = 4;
+            renderPassInfo.pClearValues = clears;
+        }
+
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, subpassContents);
+        for (uint32_t subpassIdx = 0; subpassIdx < g_subpassCount; subpassIdx++) {
+            if (subpassIdx > 0) {
+                vkCmdNextSubpass(cmdBuffer, subpassContents);
+            }
+
+            // MT.1. Either execute the secondary Command Buffer of the subpass or record its draws inline.
+            if (useSecondary) {
+                vkCmdExecuteCommands(cmdBuffer, 1, &secondaryCmdBuffers[imageIdx * g_subpassCount + subpassIdx]);
+            } else {
+                RecordSubpassDraws(cmdBuffer, draws, subpassIdx);
+            }
+        }
+
+        // 17.4. End the Render Pass.
+        vkCmdEndRenderPass(cmdBuffer);
+    }
+
+    // 18. End the Command Buffer recording.
+    if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
 }
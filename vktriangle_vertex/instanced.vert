@@ -0,0 +1,19 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 inPosition;
+// Per-instance attributes from the second vertex binding: xy is the offset, z is the scale.
+layout(location = 1) in vec3 inInstance;
+
+layout(location = 0) out vec3 fragColor;
+
+vec3 colors[3] = vec3[](
+    vec3(1.0, 0.0, 0.0),
+    vec3(0.0, 1.0, 0.0),
+    vec3(0.0, 0.0, 1.0)
+);
+
+void main() {
+    gl_Position = vec4(inPosition * inInstance.z + inInstance.xy, 0.0, 1.0);
+    fragColor = colors[gl_VertexIndex];
+}
@@ -5,6 +5,7 @@
  *
  * The example uses a single vertex input.
  * Look for the "V.X." comments to see the vertex input handling ("X" is a number).
+ * Look for the "TR.X." comments to see the batched (DEMO_TRIANGLES) draw path.
  *
  * Compile without shaderc:
  * $ g++ vktriangle_vertex.cpp -o triangle_vertex -lvulkan -std=c++11
@@ -12,16 +13,40 @@
  * Re-Compile shaders (optional):
  * $ glslangValidator -V passthrough.vert -o passthrough.vert.spv
  * $ glslangValidator -V passthrough.frag -o passthrough.frag.spv
+ * $ glslangValidator -V attributes.vert -o attributes.vert.spv
+ * $ glslangValidator -V instanced.vert -o instanced.vert.spv
+ * $ glslangValidator -V indirect_cull.comp -o indirect_cull.comp.spv
  *
  * Compile with shaderc:
  * $ g++ vktriangle_vertex.cpp -o triangle_vertex -lvulkan -lshaderc_shared -std=c++11 -DHAVE_SHADERC=1
  *
- * Run: the "passthrough.{vert,frag}*" files must be in the same dir.
+ * Run: the "passthrough.{vert,frag}*" (and for DEMO_TRIANGLES the "instanced.vert*", for the indirect draw mode
+ *   the "indirect_cull.comp*", for DEMO_VERTEX_LAYOUT the "attributes.vert*") files must be in the same dir.
  * $ ./triangle_vertex
  *
  * Env variables:
  * DEMO_USE_VALIDATION: Enables (1) or disables (0) the usage of validation layers. Default: 0
+ * DEMO_DEVICE: Physical device enumeration index or a part of its name. Default: the highest ranked device
+ *   (discrete > integrated > virtual > CPU, then the largest device local heap, then dedicated compute/transfer queues)
+ * DEMO_DEVICE_PROFILE: vkmininfo device profile (DEMO_PROFILE with DEMO_PROBE=1). The devices measured in it rank
+ *   above the unmeasured devices of the same type and are ordered by their copy bandwidth. Default: unset
  * DEMO_OUTPUT: Output PPM file name. Default: out.ppm
+ * DEMO_PPM_MMAP: Write the PPM files through mmap (1) instead of a single write call (0). Default: 0
+ * DEMO_FORCE_STAGING: Upload the vertex buffer with a staging copy (1) even if device local memory
+ *   is also host visible (ReBAR/UMA). Default: 0
+ * DEMO_BENCH: Render N frames with GPU timestamp and CPU timing before the output image, unset or 0
+ *   disables it. Default: 0
+ * DEMO_PIPELINE_CACHE: Pipeline cache file name, an empty value disables it. Default: pipeline.cache
+ * DEMO_SHADER_CACHE: Compiled SPIR-V cache directory (HAVE_SHADERC=1 only), an empty value disables it. Default: shader_cache
+ * DEMO_VERTEX_LAYOUT: Vertex buffer layout: "position" (vec2 only), "aos" (interleaved float position, color,
+ *   UV and normal), "soa" (one binding per attribute) or "packed" (half float, RGBA8 and A2B10G10R10).
+ *   The benchmark mode reports the vertex fetch bandwidth. With DEMO_TRIANGLES these layouts store every
+ *   triangle as separate vertices (DEMO_DRAW_MODE is not used). Default: position
+ * DEMO_TRIANGLES: Draw N small triangles from per-instance attributes, unset or 0 draws the single triangle.
+ *   In the DEMO_BENCH mode the count is swept in powers of 10 up to N. Default: 0
+ * DEMO_DRAW_MODE: Draw path of DEMO_TRIANGLES: "instanced" (one vkCmdDraw), "indirect" (a compute dispatch culls
+ *   the triangles outside of the render area and writes the parameters of one vkCmdDrawIndirect)
+ *   or "draws" (one vkCmdDraw per triangle). Default: instanced
  *
  * Dependencies:
  *  * C++11
@@ -34,6 +59,7 @@
  * Includes:
  *  * Validation layer enable.
  *  * PPM image output.
+ *  * Instanced and indirect draws of many triangles (GPU culled for the indirect draw).
  *
  * Excludes:
  *  * No swapchain.
@@ -59,62 +85,166 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * OFTWARE.
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <future>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
-#ifndef HAVE_SHADERC
-#define HAVE_SHADERC 0
-#endif
-
-#if HAVE_SHADERC
-#include <shaderc/shaderc.hpp>
-#endif
+#include "../common/vkdemo.h"
 
 const std::vector<const char*> g_validationLayers = {
     "VK_LAYER_KHRONOS_validation",
 };
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx);
-static uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-#if HAVE_SHADERC
-static std::vector<char> LoadGLSL(const std::string name);
-static std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc);
-#else
-static std::vector<uint32_t> LoadSPIRV(const std::string name);
-#endif
-
-static void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                                   const VkDevice device,
-                                   const VkQueue queue,
-                                   const VkCommandPool cmdPool,
-                                   const VkImage renderImage,
-                                   float renderImageWidth,
-                                   float renderImageHeight,
-                                   VkImage *outImage,
-                                   VkDeviceMemory *outMemory);
+static void PrintBenchSweepRow(uint32_t triangleCount, uint32_t triangleBytes, const BenchTimer& timer, double recordTime);
+
+// Draw paths of the DEMO_TRIANGLES mode.
+// Each of them reads the triangle offsets from the per-instance (second) vertex binding.
+enum TriangleDrawMode {
+    // A single vkCmdDraw with one instance for each triangle.
+    TRIANGLE_DRAW_INSTANCED,
+    // A single vkCmdDrawIndirect, a compute dispatch culls the instances and writes the draw parameters.
+    TRIANGLE_DRAW_INDIRECT,
+    // One vkCmdDraw for each triangle, the CPU recording cost grows with the triangle count.
+    TRIANGLE_DRAW_SEPARATE,
+};
+
+// Per-instance vertex attributes, see "instanced.vert" and "indirect_cull.comp".
+struct TriangleInstance {
+    float offset[2];
+    float scale;
+};
+
+// Buffers of the DEMO_TRIANGLES mode.
+// A "count" of zero disables the mode and the single triangle is drawn without the instance binding.
+struct TriangleBatch {
+    TriangleDrawMode mode;
+    uint32_t count;
+    VkBuffer instanceBuffer;
+    ArenaAllocation instanceMemory;
+    // Only used by the TRIANGLE_DRAW_INDIRECT mode.
+    // The cull dispatch appends the visible instances to "visibleBuffer" and counts them in "indirectBuffer".
+    VkBuffer indirectBuffer;
+    ArenaAllocation indirectMemory;
+    VkBuffer visibleBuffer;
+    ArenaAllocation visibleMemory;
+    VkDescriptorSetLayout cullSetLayout;
+    VkDescriptorPool cullDescriptorPool;
+    VkDescriptorSet cullDescriptorSet;
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullPipeline;
+};
+
+// Work group size of "indirect_cull.comp".
+static const uint32_t g_cullGroupSize = 64;
+
+static TriangleDrawMode ParseTriangleDrawMode(const char *name);
+static const char *TriangleDrawModeName(TriangleDrawMode mode);
+static void PlaceTriangleGrid(uint32_t count, std::vector<TriangleInstance> *outInstances);
+static void ExpandTriangleGrid(const std::vector<float>& triangle, uint32_t count, std::vector<float> *outPositions);
+static void CreateTriangleBatch(const VkDevice device,
+                                StagingUploader *uploader,
+                                TriangleDrawMode mode,
+                                uint32_t count,
+                                TriangleBatch *outBatch);
+static void CreateTriangleCull(const VkDevice device,
+                               const VkPipelineCache pipelineCache,
+                               std::future<std::vector<uint32_t> >& cullShaderLoad,
+                               TriangleBatch *batch);
+static void DestroyTriangleBatch(const VkDevice device, MemoryArena *arena, TriangleBatch *batch);
+static void RecordDrawCommands(const VkCommandBuffer cmdBuffer,
+                               VkCommandBufferUsageFlags usageFlags,
+                               const VkRenderPass renderPass,
+                               const VkFramebuffer framebuffer,
+                               VkExtent2D extent,
+                               const VkPipeline pipeline,
+                               const VkBuffer vertexBuffer,
+                               const VertexLayoutData& vertexLayout,
+                               const TriangleBatch& batch,
+                               uint32_t triangleCount);
 
 int main(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
+    // ST. Startup time is measured from here until everything is ready for the first frame submission.
+    const std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
     const char *envValidation = getenv("DEMO_USE_VALIDATION");
+    const char *envDevice = getenv("DEMO_DEVICE");
     const char *envOutputName = getenv("DEMO_OUTPUT");
+    const char *envPipelineCache = getenv("DEMO_PIPELINE_CACHE");
+    const char *envPpmMmap = getenv("DEMO_PPM_MMAP");
+    const char *envBench = getenv("DEMO_BENCH");
+    const char *envForceStaging = getenv("DEMO_FORCE_STAGING");
+    const char *envVertexLayout = getenv("DEMO_VERTEX_LAYOUT");
+    const char *envTriangles = getenv("DEMO_TRIANGLES");
+    const char *envDrawMode = getenv("DEMO_DRAW_MODE");
 
     bool enableValidationLayers = ((envValidation != NULL) && (strncmp("1", envValidation, 2) == 0));
+    bool ppmMmap = ((envPpmMmap != NULL) && (strncmp("1", envPpmMmap, 2) == 0));
+    uint32_t benchFrames = (envBench != NULL) ? (uint32_t)strtoul(envBench, NULL, 10) : 0;
+    bool forceStaging = ((envForceStaging != NULL) && (strncmp("1", envForceStaging, 2) == 0));
+    VertexLayout vertexLayoutMode = VERTEX_LAYOUT_POSITION;
+    if (envVertexLayout != NULL) {
+        vertexLayoutMode = ParseVertexLayout(envVertexLayout);
+    }
+    uint32_t triangleCount = (envTriangles != NULL) ? (uint32_t)strtoul(envTriangles, NULL, 10) : 0;
+    TriangleDrawMode drawMode = TRIANGLE_DRAW_INSTANCED;
+    if (envDrawMode != NULL) {
+        drawMode = ParseTriangleDrawMode(envDrawMode);
+    }
+    // TR.12. Only the instanced position layout has the indirect draw, it culls the instances on the GPU.
+    const bool gpuCull = (triangleCount > 0) && (drawMode == TRIANGLE_DRAW_INDIRECT) && (vertexLayoutMode == VERTEX_LAYOUT_POSITION);
     const char *outputFileName = "out.ppm";
 
     if (envOutputName != NULL) {
         outputFileName = envOutputName;
     }
 
+    const char *pipelineCacheFileName = "pipeline.cache";
+    if (envPipelineCache != NULL) {
+        pipelineCacheFileName = envPipelineCache;
+    }
+
     printf("Validation: %s\n", (enableValidationLayers ? "ON" : "OFF"));
     printf("Using shaderc: %s\n", (HAVE_SHADERC ? "YES" : "NO"));
-    printf("Output: %s\n", outputFileName);
+    printf("Output: %s%s\n", outputFileName, (ppmMmap ? " (mmap)" : ""));
+    printf("Pipeline cache file: %s\n", pipelineCacheFileName);
+    printf("Vertex layout: %s\n", VertexLayoutName(vertexLayoutMode));
+    if (benchFrames > 0) {
+        printf("Bench: %u frames\n", benchFrames);
+    }
+    if (triangleCount > 0) {
+        printf("Triangles: %u (%s)\n", triangleCount,
+               (vertexLayoutMode == VERTEX_LAYOUT_POSITION) ? TriangleDrawModeName(drawMode) : "vertex buffer");
+    }
+
+    // ST.1. Start loading (or compiling) the shaders on worker threads.
+    // This runs in parallel with the Instance/Device creation, the results are only
+    // waited for at the Shader Module creation.
+    // TR.2. The batched triangles are placed by the per-instance attributes.
+    // VL.2. The attribute layouts use the shader variant with the color, UV and normal inputs.
+    std::string vertName = (triangleCount > 0) ? "instanced.vert" : "passthrough.vert";
+    if (vertexLayoutMode != VERTEX_LAYOUT_POSITION) {
+        vertName = "attributes.vert";
+    }
+    std::future<std::vector<uint32_t> > vertShaderLoad = LoadShaderAsync(vertName);
+    std::future<std::vector<uint32_t> > fragShaderLoad = LoadShaderAsync("passthrough.frag");
+    std::future<std::vector<uint32_t> > cullShaderLoad;
+    if (gpuCull) {
+        cullShaderLoad = LoadShaderAsync("indirect_cull.comp");
+    }
 
     // 1. Create Vulkan Instance.
     // A Vulkan instance is the base for all other Vulkan API calls.
@@ -167,7 +297,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. Select PhysicalDevice and Queue Family Index.
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     uint32_t graphicsQueueFamilyIdx;
     {
         // 2.1 Query the number of physical devices.
@@ -183,19 +313,34 @@ int main(int argc, char **argv) {
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
         // 2.3. Select a physical device (based on some info).
-        // Currently the first physical device is selected if it supports Graphics Queue.
-        for (const VkPhysicalDevice& device : devices) {
+        // DV. The highest ranked physical device which supports Graphics Queue (and matches DEMO_DEVICE) is selected.
+        // TR.12. The cull dispatch is recorded into the draw Command Buffer, so the family must also support compute.
+        const VkQueueFlags requiredQueueFlags = VK_QUEUE_GRAPHICS_BIT | (gpuCull ? VK_QUEUE_COMPUTE_BIT : 0);
+        uint64_t bestScore = 0;
+        for (uint32_t deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+            const VkPhysicalDevice device = devices[deviceIdx];
+
             bool hasIdx;
-            graphicsQueueFamilyIdx = FindQueueFamily(device, &hasIdx);
-            if (hasIdx) {
+            uint32_t queueFamilyIdx = FindQueueFamily(device, requiredQueueFlags, 0, VK_NULL_HANDLE, &hasIdx);
+            if (!hasIdx || !MatchPhysicalDevice(device, deviceIdx, envDevice)) {
+                continue;
+            }
+
+            const uint64_t score = ScorePhysicalDevice(device);
+            if ((physicalDevice == VK_NULL_HANDLE) || (score > bestScore)) {
                 physicalDevice = device;
-                break;
+                graphicsQueueFamilyIdx = queueFamilyIdx;
+                bestScore = score;
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        printf("Device: %s (score 0x%llx)\n", properties.deviceName, (unsigned long long)bestScore);
     }
 
     // 3. Create a logical Vulkan Device.
@@ -251,6 +396,11 @@ int main(int argc, char **argv) {
         vkGetDeviceQueue(device, graphicsQueueFamilyIdx, 0, &queue);
     }
 
+    // A. Create the memory arena.
+    // The images and buffers are sub-allocated from a few large device memory blocks.
+    MemoryArena memoryArena;
+    CreateMemoryArena(physicalDevice, device, &memoryArena);
+
     // 5. Create a 256x256 2D Image to draw onto.
     // This will be the render target image.
     // Note: An Image by itself does not allocate memory on the GPU.
@@ -293,35 +443,8 @@ int main(int argc, char **argv) {
 
     // 6. Allocate and bind the memory for the render target image.
     // For each Image (or Buffer) a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory renderImageMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, renderImage, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &renderImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, renderImage, renderImageMemory, 0);
-    }
+    // The memory is sub-allocated from the memory arena and bound to the image.
+    ArenaAllocation renderImageMemory = ArenaAllocateImage(&memoryArena, renderImage, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     // 7. Create an Image View for the Render Target Image.
     // Will be used by the Framebuffer as Color Attachment.
@@ -360,6 +483,17 @@ int main(int argc, char **argv) {
         -0.5,  0.5
     };
 
+    // VL.1. Build the buffer content of the selected vertex layout.
+    // With DEMO_TRIANGLES these layouts store every triangle as separate vertices instead of instancing,
+    // so the fetched vertex data grows with the triangle count.
+    std::vector<float> layoutPositions = vertexCoordinates;
+    if ((vertexLayoutMode != VERTEX_LAYOUT_POSITION) && (triangleCount > 0)) {
+        ExpandTriangleGrid(vertexCoordinates, triangleCount, &layoutPositions);
+    }
+
+    VertexLayoutData vertexLayout;
+    BuildVertexLayout(physicalDevice, vertexLayoutMode, layoutPositions, &vertexLayout);
+
     // V.1. Create the Vulkan buffer which will hold the Vertex Input data.
     // This buffer will hold the Vertex coordinates in a vec2 like format.
     VkBuffer vertexBuffer;
@@ -369,9 +503,10 @@ int main(int argc, char **argv) {
             bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
             bufferInfo.pNext = NULL;
             bufferInfo.flags = 0;
-            bufferInfo.size = sizeof(float) * vertexCoordinates.size();
+            bufferInfo.size = vertexLayout.data.size();
             // The buffer will be used as a Vertex Input attribute.
-            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+            // The data is copied into it from a staging buffer if the memory is not host visible.
+            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
             bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             bufferInfo.queueFamilyIndexCount = 0;
             bufferInfo.pQueueFamilyIndices = NULL;
@@ -382,65 +517,28 @@ int main(int argc, char **argv) {
         }
     }
 
-    // V.2. Allocate and bind the memory for the Vertex Buffer.
-    // For each Buffer a memory should be allocated on the GPU otherwise it can't be used.
-    VkDeviceMemory vertexBufferMemory;
-    {
-        // 6.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, vertexBuffer, &memRequirements);
-
-        // 6.2 Find a memory type based on the requirements.
-        // Here a device (gpu) local memory type is requested (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT).
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice,
-                                                  memRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-        // 6.3. Based on the memory requirements specify the allocation information.
-        VkMemoryAllocateInfo allocInfo;
-        {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
-        }
-
-        // 6.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &vertexBufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        // 6.4 "Connect" the Vertex buffer with the allocated memory.
-        vkBindBufferMemory(device, vertexBuffer, vertexBufferMemory, 0);
-    }
-
-    // V.3. Upload the Vertex Buffer data.
-    {
-        // V.3.1. Map buffer memory to "data" pointer.
-        void *data;
-        if (vkMapMemory(device, vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-            throw std::runtime_error("failed to map vertex buffer!");
-        }
-
-        // V.3.2. Copy data into the "data".
-        ::memcpy(data, vertexCoordinates.data(), sizeof(float) * vertexCoordinates.size());
-
-        // V.3.3. Flush the data.
-        // This is required as a non-coherent buffer was created.
-        VkMappedMemoryRange memoryRange;
-        {
-            memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            memoryRange.pNext = NULL;
-            memoryRange.memory = vertexBufferMemory;
-            memoryRange.offset = 0;
-            memoryRange.size = VK_WHOLE_SIZE;
-        }
-        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
-
-        // V.3.4. Unmap the mapped vertex buffer.
-        // After this the "data" pointer is a non-valid pointer.
-        vkUnmapMemory(device, vertexBufferMemory);
-    }
+    // U. Create the staging uploader for the device local buffers.
+    StagingUploader stagingUploader;
+    CreateStagingUploader(device, &memoryArena, graphicsQueueFamilyIdx, forceStaging, &stagingUploader);
+
+    // V.2. Allocate device local memory for the Vertex Buffer and upload the Vertex Buffer data.
+    // The vertices are fetched by the GPU in every frame, so they should not be read over PCIe.
+    // If the device local memory is not host visible the data is copied from a staging buffer.
+    ArenaAllocation vertexBufferMemory = UploadDeviceLocalBuffer(device, &stagingUploader, vertexBuffer,
+                                                                  vertexLayout.data.data(), vertexLayout.data.size(),
+                                                                  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+    // TR.1. Create and upload the per-instance attributes (and the indirect draw buffer).
+    // The upload is part of the same batch as the Vertex Buffer.
+    TriangleBatch triangleBatch;
+    // Only the position layout is instanced.
+    CreateTriangleBatch(device, &stagingUploader, drawMode, (vertexLayout.layout == VERTEX_LAYOUT_POSITION) ? triangleCount : 0,
+                        &triangleBatch);
+
+    // V.3. Submit the batched uploads.
+    // The copies are ordered before the draws on the same queue, no wait is required here.
+    SubmitStagingUploads(device, &stagingUploader, queue);
+    printf("Buffer uploads: %u direct, %u staged\n", stagingUploader.directCount, stagingUploader.stagedCount);
 
     // 8. Create a Render Pass.
     // A Render Pass is required to use vkCmdDraw* commands.
@@ -500,13 +598,8 @@ int main(int argc, char **argv) {
     // 9. Create Vertex shader.
     VkShaderModule vertShaderModule;
     {
-        // 9.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> vertSrc = LoadGLSL("passthrough.vert");
-        std::vector<uint32_t> vertCode = CompileGLSL(shaderc_vertex_shader, vertSrc);
-        #else
-        std::vector<uint32_t> vertCode = LoadSPIRV("passthrough.vert.spv");
-        #endif
+        // 9.1. Wait for the vertex shader loaded (or compiled) by the worker thread (ST.1).
+        std::vector<uint32_t> vertCode = vertShaderLoad.get();
 
         if (vertCode.size() == 0) {
             throw std::runtime_error("failed to load vertex shader!");
@@ -534,13 +627,8 @@ int main(int argc, char **argv) {
     // 10. Create Fragment shader.
     VkShaderModule fragShaderModule;
     {
-        // 10.1. Load the GLSL shader from file and compile it with shaderc.
-        #if HAVE_SHADERC
-        std::vector<char> fragSrc = LoadGLSL("passthrough.frag");
-        std::vector<uint32_t> fragCode = CompileGLSL(shaderc_fragment_shader, fragSrc);
-        #else
-        std::vector<uint32_t> fragCode = LoadSPIRV("passthrough.frag.spv");
-        #endif
+        // 10.1. Wait for the fragment shader loaded (or compiled) by the worker thread (ST.1).
+        std::vector<uint32_t> fragCode = fragShaderLoad.get();
 
         if (fragCode.size() == 0) {
             throw std::runtime_error("failed to load fragment shader!");
@@ -581,9 +669,31 @@ int main(int argc, char **argv) {
         }
     }
 
+    // PC.1. Load the pipeline cache from disk.
+    // All pipelines are created with this cache and it is written back at exit.
+    bool pipelineCacheHit = false;
+    VkPipelineCache pipelineCache = LoadPipelineCache(physicalDevice, device, pipelineCacheFileName, &pipelineCacheHit);
+
+    // TR.12. Create the cull pipeline of the indirect draw mode.
+    if (gpuCull && (triangleBatch.count > 0)) {
+        CreateTriangleCull(device, pipelineCache, cullShaderLoad, &triangleBatch);
+    }
+
     // 12. Create the Rendering Pipeline
     VkPipeline pipeline;
     {
+        // VL.3. The packed layout stores the normal as UNORM, the shader decodes it if the constant is set.
+        const VkBool32 packedNormal = (vertexLayout.layout == VERTEX_LAYOUT_PACKED) ? VK_TRUE : VK_FALSE;
+        const VkSpecializationMapEntry specEntry = { /* constantID */ 0, /* offset */ 0, /* size */ sizeof(VkBool32) };
+
+        VkSpecializationInfo specInfo;
+        {
+            specInfo.mapEntryCount = 1;
+            specInfo.pMapEntries = &specEntry;
+            specInfo.dataSize = sizeof(packedNormal);
+            specInfo.pData = &packedNormal;
+        }
+
         VkPipelineShaderStageCreateInfo vertShaderStageInfo;
         {
             vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -592,7 +702,7 @@ int main(int argc, char **argv) {
             vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
             vertShaderStageInfo.module = vertShaderModule;
             vertShaderStageInfo.pName = "main";
-            vertShaderStageInfo.pSpecializationInfo = NULL;
+            vertShaderStageInfo.pSpecializationInfo = (vertexLayout.layout != VERTEX_LAYOUT_POSITION) ? &specInfo : NULL;
         }
 
         VkPipelineShaderStageCreateInfo fragShaderStageInfo;
@@ -629,16 +739,39 @@ int main(int argc, char **argv) {
             positionVertexAttribute.offset = 0;
         }
 
+        // TR.3. Describe the per-instance binding and attribute.
+        // The vertex positions are shared, only the instance data advances after each triangle.
+        VkVertexInputBindingDescription vertexBindings[2] = { vec2VertexBinding, vec2VertexBinding };
+        {
+            vertexBindings[1].binding = 1;
+            vertexBindings[1].stride = sizeof(TriangleInstance);
+            vertexBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        }
+
+        VkVertexInputAttributeDescription vertexAttributes[2] = { positionVertexAttribute, positionVertexAttribute };
+        {
+            vertexAttributes[1].binding = 1;
+            vertexAttributes[1].location = 1;
+            // Offset (vec2) and scale (float) of the triangle.
+            vertexAttributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+            vertexAttributes[1].offset = 0;
+        }
+
+        const uint32_t vertexInputCount = (triangleBatch.count > 0) ? 2 : 1;
+
+        // VL.4. The other layouts provide their own bindings and attributes.
+        const bool positionLayout = (vertexLayout.layout == VERTEX_LAYOUT_POSITION);
+
         // V.6. Connect the Attribute and Binding infors to the VertexInputState.
         VkPipelineVertexInputStateCreateInfo vertexInputInfo;
         {
             vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
             vertexInputInfo.pNext = NULL;
             vertexInputInfo.flags = 0;
-            vertexInputInfo.vertexBindingDescriptionCount = 1;
-            vertexInputInfo.pVertexBindingDescriptions = &vec2VertexBinding;
-            vertexInputInfo.vertexAttributeDescriptionCount = 1;
-            vertexInputInfo.pVertexAttributeDescriptions = &positionVertexAttribute;
+            vertexInputInfo.vertexBindingDescriptionCount = positionLayout ? vertexInputCount : (uint32_t)vertexLayout.bindings.size();
+            vertexInputInfo.pVertexBindingDescriptions = positionLayout ? vertexBindings : vertexLayout.bindings.data();
+            vertexInputInfo.vertexAttributeDescriptionCount = positionLayout ? vertexInputCount : (uint32_t)vertexLayout.attributes.size();
+            vertexInputInfo.pVertexAttributeDescriptions = positionLayout ? vertexAttributes : vertexLayout.attributes.data();
         }
 
         VkPipelineInputAssemblyStateCreateInfo inputAssembly;
@@ -758,9 +891,13 @@ int main(int argc, char **argv) {
             pipelineInfo.basePipelineIndex = 0;
         }
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
+        std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
+
+        double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+        printf("Pipeline creation: %.3f ms (cache %s)\n", pipelineTime, (pipelineCacheHit ? "hit" : "miss"));
     }
 
     // 13. Create Framebuffer.
@@ -820,64 +957,12 @@ int main(int argc, char **argv) {
     }
 
     // Start recording draw commands.
-
-    // 16. Start Command Buffer
-    {
-        VkCommandBufferBeginInfo beginInfo;
-        {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            beginInfo.pInheritanceInfo = NULL;
-        }
-
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
-        }
-    }
-
-    // 17. Insert draw commands into Command Buffer.
-    {
-        // 17.1. Add Begin RenderPass command
-        // This makes it possible to use the vmCmdDraw* calls.
-        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-        VkRenderPassBeginInfo renderPassInfo;
-        {
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.pNext = NULL;
-            renderPassInfo.renderPass = renderPass;
-            renderPassInfo.framebuffer = framebuffer;
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
-        }
-
-        vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
-        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-        // V.7. Bind the Vertex buffers as specified by the pipeline.
-        VkDeviceSize bufferOffsets[] = { 0 };
-        vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vertexBuffer, bufferOffsets);
-
-        // 17.3. Add a Draw command.
-        // Draw 3 vertices using the pipeline bound previously.
-        uint32_t vertexCount = 3;
-        uint32_t instanceCount = 1;
-        vkCmdDraw(cmdBuffer, vertexCount, instanceCount, 0, 0);
-
-        // 17.4. End the Render Pass.
-        vkCmdEndRenderPass(cmdBuffer);
-    }
-
-    // 18. End the Command Buffer recording.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
-    }
+    // 16-18. The commands are recorded by a helper, the benchmark sweep re-records them for each triangle count.
+    // BN. In the benchmark mode the Command Buffer is submitted multiple times.
+    const VkExtent2D renderExtent = { (uint32_t)renderImageWidth, (uint32_t)renderImageHeight };
+    RecordDrawCommands(cmdBuffer, (benchFrames > 0) ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                       renderPass, framebuffer, renderExtent, pipeline, vertexBuffer, vertexLayout, triangleBatch,
+                       std::max(triangleCount, 1u));
 
     // Recording of the draw commands into the Command Buffer is done.
     // Now the Command Buffer should be sent to the GPU.
@@ -902,6 +987,104 @@ int main(int argc, char **argv) {
         //vkResetFences(device, 1, &fence);
     }
 
+    // ST.2. Report the time to the first frame.
+    printf("Startup: %.3f ms until the first frame submission\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
+
+    // BN. Benchmark mode: render the frames without the readback and time each submission.
+    // All frames draw into the same render target, so there is only a single frame in flight.
+    // The output image is still rendered and written by the regular submission below.
+    if (benchFrames > 0) {
+        BenchTimer benchTimer;
+        CreateBenchTimer(physicalDevice, device, graphicsQueueFamilyIdx, 1, &benchTimer);
+
+        // TR.4. Sweep the triangle count in powers of 10 up to DEMO_TRIANGLES.
+        // The GPU time shows the vertex fetch and raster limit, the record time the CPU submission cost.
+        std::vector<uint32_t> sweepCounts;
+        for (uint64_t count = 1; count < triangleCount; count *= 10) {
+            sweepCounts.push_back((uint32_t)count);
+        }
+        sweepCounts.push_back(triangleCount);
+
+        // VL. Bytes of the vertex (and instance) attributes of a single triangle.
+        const uint32_t triangleBytes = 3 * vertexLayout.vertexSize + ((triangleBatch.count > 0) ? sizeof(TriangleInstance) : 0);
+
+        VkCommandBuffer benchCmdBuffers[3] = { benchTimer.beginCmdBuffers[0], cmdBuffer, benchTimer.endCmdBuffers[0] };
+
+        VkSubmitInfo submitInfo;
+        {
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = NULL;
+            submitInfo.waitSemaphoreCount = 0;
+            submitInfo.pWaitSemaphores = NULL;
+            submitInfo.pWaitDstStageMask = NULL;
+            submitInfo.commandBufferCount = 3;
+            submitInfo.pCommandBuffers = benchCmdBuffers;
+            submitInfo.signalSemaphoreCount = 0;
+            submitInfo.pSignalSemaphores = NULL;
+        }
+
+        std::chrono::steady_clock::time_point benchStart;
+        std::chrono::steady_clock::time_point benchEnd;
+        for (size_t step = 0; step < sweepCounts.size(); step++) {
+            double recordTime = 0.0;
+            if (triangleCount > 0) {
+                // The previous step is finished, the fence was waited on.
+                vkResetCommandPool(device, cmdPool, 0);
+
+                const std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
+                RecordDrawCommands(cmdBuffer, 0, renderPass, framebuffer, renderExtent, pipeline, vertexBuffer,
+                                   vertexLayout, triangleBatch, sweepCounts[step]);
+                recordTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+            }
+
+            benchTimer.gpuTimes.clear();
+            benchTimer.cpuTimes.clear();
+
+            benchStart = std::chrono::steady_clock::now();
+            for (uint32_t frame = 0; frame < benchFrames; frame++) {
+                const std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+
+                if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to submit command buffer!");
+                }
+                benchTimer.pending[0] = true;
+
+                const std::chrono::steady_clock::time_point cpuEnd = std::chrono::steady_clock::now();
+                benchTimer.cpuTimes.push_back(std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count());
+
+                if (vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to wait for fence!");
+                }
+                vkResetFences(device, 1, &fence);
+
+                CollectBenchTimestamps(device, &benchTimer, 0);
+            }
+            benchEnd = std::chrono::steady_clock::now();
+
+            if (triangleCount > 0) {
+                PrintBenchSweepRow(sweepCounts[step], triangleBytes, benchTimer, recordTime);
+            }
+        }
+
+        PrintBenchResults(physicalDevice, benchTimer, std::chrono::duration<double>(benchEnd - benchStart).count());
+        PrintVertexFetchReport(vertexLayout, 3ull * std::max(triangleCount, 1u), benchTimer);
+        DestroyBenchTimer(device, &benchTimer);
+    }
+
+    // R.1. Create the readback ring and record the capture of the rendered image.
+    // The copy is executed in the same submission after the draw commands.
+    ReadbackRing readbackRing;
+    CreateReadbackRing(physicalDevice, device, &memoryArena, graphicsQueueFamilyIdx, renderImageWidth, renderImageHeight, 1, NULL, &readbackRing);
+
+    // A.1. Report the memory arena usage after all resources are allocated.
+    PrintArenaStats(memoryArena);
+
+    VkCommandBuffer frameCmdBuffers[2] = {
+        cmdBuffer,
+        RecordReadback(device, &readbackRing, renderImage, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, fence, 0),
+    };
+
     // 20. Submit the recorded Command Buffer to the Queue.
     {
         VkSubmitInfo submitInfo;
@@ -911,8 +1094,8 @@ int main(int argc, char **argv) {
             submitInfo.waitSemaphoreCount = 0;
             submitInfo.pWaitSemaphores = NULL;
             submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
+            submitInfo.commandBufferCount = 2;
+            submitInfo.pCommandBuffers = frameCmdBuffers;
             submitInfo.signalSemaphoreCount = 0;
             submitInfo.pSignalSemaphores = NULL;
         }
@@ -935,59 +1118,20 @@ int main(int argc, char **argv) {
     // The ImageView is created for the "renderImage" thus the image is rendered into that.
 
     {
-        // Start readback process of the rendered image.
-        // 22. Copy the rendered image into a buffer which can be mapped and read.
-        // Note: this is the most basic process to the the image into a readeable memory.
-        VkImage readableImage;
-        VkDeviceMemory readableImageMemory;
-        CopyImageToLinearImage(physicalDevice, device, queue, cmdPool, renderImage, renderImageWidth, renderImageHeight, &readableImage, &readableImageMemory);
-
-        // 23. Get layout of the readable image (including row pitch).
-        VkImageSubresource subResource;
-        {
-            subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subResource.mipLevel = 0;
-            subResource.arrayLayer = 0;
-        }
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, readableImage, &subResource, &subResourceLayout);
-
-        // 24. Map image memory so we can start copying from it.
-        const uint8_t* data;
-        {
-            vkMapMemory(device, readableImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-            data += subResourceLayout.offset;
+        // 22. Get the finished capture from the readback ring.
+        // The staging buffer is persistently mapped, no copy or map is required.
+        ReadbackSlot *slot = PollReadback(device, &readbackRing);
+        if (slot == NULL) {
+            throw std::runtime_error("failed to read back the rendered image!");
         }
 
         // 25. Write out the image to a ppm file.
         {
-            std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
-            // ppm header
-            file << "P6\n" << renderImageWidth << "\n" << renderImageHeight << "\n" << 255 << "\n";
-
-            // ppm binary pixel data
-            // As the image format is R8G8B8A8 one "pixel" size is 4 bytes (uint32_t)
-            for (uint32_t y = 0; y < renderImageHeight; y++) {
-                uint32_t *row = (uint32_t*)data;
-                for (uint32_t x = 0; x < renderImageWidth; x++) {
-                    // Only copy the RGB values (3)
-                    file.write((const char*)row, 3);
-                    row++;
-                }
-
-                data += subResourceLayout.rowPitch;
-            }
-            file.close();
+            // The pixels are packed to RGB and written with a single call (or through mmap).
+            WritePPM(outputFileName, slot->data, renderImageWidth, renderImageHeight, (VkDeviceSize)renderImageWidth * 4, false, ppmMmap);
         }
 
-        // 26. UnMap the readable image memory.
-        vkUnmapMemory(device, readableImageMemory);
-
-        // XX. Free linear image's memory.
-        vkFreeMemory(device, readableImageMemory, NULL);
-
-        // XX. Destory linar image memory.
-        vkDestroyImage(device, readableImage, NULL);
+        ReleaseReadback(slot);
     }
 
     // XX. Destroy Fence.
@@ -996,6 +1140,9 @@ int main(int argc, char **argv) {
     // XX. Free Command Buffer.
     vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 
+    // R.XX. Destroy the readback ring.
+    DestroyReadbackRing(device, &readbackRing);
+
     // XX. Destroy Command Pool
     vkDestroyCommandPool(device, cmdPool, NULL);
 
@@ -1017,8 +1164,14 @@ int main(int argc, char **argv) {
     // XX. Destory Render Pass.
     vkDestroyRenderPass(device, renderPass, NULL);
 
+    // U.XX. Destroy the staging uploader, it waits for the pending uploads.
+    DestroyStagingUploader(device, &stagingUploader);
+
+    // TR.XX. Destroy the per-instance and indirect buffers and the cull pipeline.
+    DestroyTriangleBatch(device, &memoryArena, &triangleBatch);
+
     // XX. Free the Vertex Buffer's memory.
-    vkFreeMemory(device, vertexBufferMemory, NULL);
+    ArenaFree(&memoryArena, vertexBufferMemory);
 
     // XX. Destroy the Vertex Buffer.
     vkDestroyBuffer(device, vertexBuffer, NULL);
@@ -1027,11 +1180,18 @@ int main(int argc, char **argv) {
     vkDestroyImageView(device, renderImageView, NULL);
 
     // XX. Free render target image's memory.
-    vkFreeMemory(device, renderImageMemory, NULL);
+    ArenaFree(&memoryArena, renderImageMemory);
 
     // XX. Destroy render target image.
     vkDestroyImage(device, renderImage, NULL);
 
+    // PC.XX. Save and destroy the pipeline cache.
+    SavePipelineCache(physicalDevice, device, pipelineCache, pipelineCacheFileName);
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+
+    // A.XX. Free the memory arena blocks.
+    DestroyMemoryArena(&memoryArena);
+
     // XX. Destroy Device
     vkDestroyDevice(device, NULL);
 
@@ -1041,342 +1201,473 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-static uint32_t FindQueueFamily(const VkPhysicalDevice device, bool *hasIdx) {
-    if (hasIdx != nullptr) {
-        *hasIdx = false;
-    }
+void PrintBenchSweepRow(uint32_t triangleCount, uint32_t triangleBytes, const BenchTimer& timer, double recordTime) {
+    std::vector<double> gpuTimes = timer.gpuTimes;
+    std::vector<double> cpuTimes = timer.cpuTimes;
+    std::sort(gpuTimes.begin(), gpuTimes.end());
+    std::sort(cpuTimes.begin(), cpuTimes.end());
+
+    // TR.11. Print one row for each step of the sweep, the throughput is based on the median GPU time.
+    const double gpuMedian = Percentile(gpuTimes, 50.0);
+    const double frameBytes = (double)triangleBytes * triangleCount;
+    printf("Sweep: %8u triangles: GPU median %.4f ms (%.2f Mtri/s, fetch %.3f GB/s), record %.4f ms, submit median %.4f ms\n",
+           triangleCount, gpuMedian, (gpuMedian > 0.0) ? triangleCount / (gpuMedian * 1000.0) : 0.0,
+           (gpuMedian > 0.0) ? frameBytes / (gpuMedian * 1000000.0) : 0.0, recordTime, Percentile(cpuTimes, 50.0));
+}
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+TriangleDrawMode ParseTriangleDrawMode(const char *name) {
+    if (strcmp(name, "instanced") == 0) {
+        return TRIANGLE_DRAW_INSTANCED;
+    } else if (strcmp(name, "indirect") == 0) {
+        return TRIANGLE_DRAW_INDIRECT;
+    } else if (strcmp(name, "draws") == 0) {
+        return TRIANGLE_DRAW_SEPARATE;
+    }
 
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    throw std::runtime_error("unknown triangle draw mode!");
+}
 
-    uint32_t queueFamilyIdx = 0;
-    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            if (hasIdx != NULL) {
-                *hasIdx = true;
-            }
+const char *TriangleDrawModeName(TriangleDrawMode mode) {
+    switch (mode) {
+        case TRIANGLE_DRAW_INSTANCED: return "instanced";
+        case TRIANGLE_DRAW_INDIRECT: return "indirect";
+        case TRIANGLE_DRAW_SEPARATE: return "draws";
+    }
 
-            return queueFamilyIdx;
-        }
+    return "unknown";
+}
 
-        // TODO?: check if device supports the target surface
-        queueFamilyIdx++;
+void PlaceTriangleGrid(uint32_t count, std::vector<TriangleInstance> *outInstances) {
+    // TR.5. Place the triangles on a square grid over the render area.
+    // The base triangle is one unit wide, so scaling it by the cell size fills the cell.
+    uint32_t side = 1;
+    while ((uint64_t)side * side < count) {
+        side++;
     }
 
-    return UINT32_MAX;
+    const float cellSize = 2.0f / side;
+    outInstances->resize(count);
+    for (uint32_t idx = 0; idx < count; idx++) {
+        (*outInstances)[idx].offset[0] = -1.0f + cellSize * ((idx % side) + 0.5f);
+        (*outInstances)[idx].offset[1] = -1.0f + cellSize * ((idx / side) + 0.5f);
+        (*outInstances)[idx].scale = cellSize;
+    }
 }
 
-uint32_t FindMemoryType(const VkPhysicalDevice physicalDevice,
-                        uint32_t typeFilter,
-                        VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties{};
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+void ExpandTriangleGrid(const std::vector<float>& triangle, uint32_t count, std::vector<float> *outPositions) {
+    std::vector<TriangleInstance> instances;
+    PlaceTriangleGrid(count, &instances);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+    // VL. Apply the instance placement on the CPU, each triangle gets its own three vertices.
+    outPositions->clear();
+    outPositions->reserve((size_t)count * triangle.size());
+    for (uint32_t idx = 0; idx < count; idx++) {
+        for (size_t coord = 0; coord < triangle.size(); coord++) {
+            outPositions->push_back(triangle[coord] * instances[idx].scale + instances[idx].offset[coord % 2]);
         }
     }
-
-    throw std::runtime_error("failed to find suitable memory type!");
 }
 
-#if HAVE_SHADERC
+void CreateTriangleBatch(const VkDevice device,
+                         StagingUploader *uploader,
+                         TriangleDrawMode mode,
+                         uint32_t count,
+                         TriangleBatch *outBatch) {
+    outBatch->mode = mode;
+    outBatch->count = count;
+    outBatch->instanceBuffer = VK_NULL_HANDLE;
+    outBatch->indirectBuffer = VK_NULL_HANDLE;
+    outBatch->visibleBuffer = VK_NULL_HANDLE;
+    outBatch->cullSetLayout = VK_NULL_HANDLE;
+    outBatch->cullDescriptorPool = VK_NULL_HANDLE;
+    outBatch->cullPipelineLayout = VK_NULL_HANDLE;
+    outBatch->cullPipeline = VK_NULL_HANDLE;
+
+    if (count == 0) {
+        return;
+    }
 
-std::vector<char> LoadGLSL(const std::string name) {
-    std::ifstream input(name, std::ios::binary);
+    std::vector<TriangleInstance> instances;
+    PlaceTriangleGrid(count, &instances);
 
-    if (!input.is_open()) {
-        throw std::runtime_error("failed to open file:" + name);
+    // TR.6. Create the instance buffer and upload it into device local memory.
+    // The indirect draw mode reads the instances in the cull dispatch instead of the vertex input.
+    const bool indirect = (mode == TRIANGLE_DRAW_INDIRECT);
+    VkBufferCreateInfo bufferInfo;
+    {
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = NULL;
+        bufferInfo.flags = 0;
+        bufferInfo.size = sizeof(TriangleInstance) * instances.size();
+        bufferInfo.usage = (indirect ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferInfo.queueFamilyIndexCount = 0;
+        bufferInfo.pQueueFamilyIndices = NULL;
     }
 
-    return std::vector<char>(std::istreambuf_iterator<char>(input),
-                             std::istreambuf_iterator<char>());
-}
+    if (vkCreateBuffer(device, &bufferInfo, NULL, &outBatch->instanceBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance buffer!");
+    }
 
-std::vector<uint32_t> CompileGLSL(shaderc_shader_kind shaderType, const std::vector<char> &vertSrc) {
-    shaderc::Compiler compiler;
-    shaderc::CompileOptions options;
-    shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(vertSrc.data(), vertSrc.size(), shaderType, "src", options);
+    outBatch->instanceMemory = UploadDeviceLocalBuffer(device, uploader, outBatch->instanceBuffer,
+                                                       instances.data(), bufferInfo.size,
+                                                       indirect ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                                                       indirect ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 
-    return { module.begin(), module.end() };
-}
+    // TR.7. Create the indirect draw buffer and the buffer of the visible instances.
+    // They are only written by the recorded commands, so they do not need host visible memory.
+    if (indirect) {
+        bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
-#else
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &outBatch->visibleBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create visible instance buffer!");
+        }
 
-std::vector<uint32_t> LoadSPIRV(const std::string name) {
-    std::ifstream file(name, std::ios::ate | std::ios::binary);
+        outBatch->visibleMemory = ArenaAllocateBuffer(uploader->arena, outBatch->visibleBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + name);
-    }
+        bufferInfo.size = sizeof(VkDrawIndirectCommand);
+        bufferInfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-    size_t fileSize = (size_t) file.tellg();
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &outBatch->indirectBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create indirect buffer!");
+        }
 
-    if ((fileSize % sizeof(uint32_t)) != 0) {
-        throw std::runtime_error("spirv file is not divisable by 4: " + name);
+        outBatch->indirectMemory = ArenaAllocateBuffer(uploader->arena, outBatch->indirectBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     }
+}
 
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+void CreateTriangleCull(const VkDevice device,
+                        const VkPipelineCache pipelineCache,
+                        std::future<std::vector<uint32_t> >& cullShaderLoad,
+                        TriangleBatch *batch) {
+    // TR.12.1. Create the compute shader, it is loaded (or compiled) by the worker thread (ST.1).
+    // RH. The module is destroyed when the pipeline is created.
+    ShaderModuleHandle cullShader;
+    {
+        std::vector<uint32_t> cullCode = cullShaderLoad.get();
 
-    file.seekg(0);
-    file.read((char*)buffer.data(), fileSize);
+        if (cullCode.size() == 0) {
+            throw std::runtime_error("failed to load compute shader!");
+        }
 
-    file.close();
+        VkShaderModuleCreateInfo cullInfo;
+        {
+            cullInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            cullInfo.pNext = NULL;
+            cullInfo.flags = 0;
+            cullInfo.codeSize = cullCode.size() * sizeof(uint32_t);
+            cullInfo.pCode = cullCode.data();
+        }
 
-    return buffer;
-}
+        VkShaderModule module;
+        if (vkCreateShaderModule(device, &cullInfo, NULL, &module) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader module!");
+        }
+        cullShader = ShaderModuleHandle(device, module, vkDestroyShaderModule);
+    }
 
-#endif
-
-void CopyImageToLinearImage(const VkPhysicalDevice physicalDevice,
-                            const VkDevice device,
-                            const VkQueue queue,
-                            const VkCommandPool cmdPool,
-                            const VkImage inputImage,
-                            float inputImageWidth,
-                            float inputImageHeight,
-                            VkImage *outImage,
-                            VkDeviceMemory *outMemory) {
-    // TODO: do format checks and blit support check.
-
-    // A.1. Create a readable linear Image as the copy destination. (destination image)
-    VkFormat readableImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
-    VkImage readableImage;
+    // TR.12.2. Create the Descriptor Set Layout and the Compute Pipeline.
+    // Bindings: 0) all instances, 1) visible instances, 2) draw command. The triangle count is a push constant.
     {
-        VkImageCreateInfo imageInfo;
+        VkDescriptorSetLayoutBinding bindings[3];
+        for (uint32_t idx = 0; idx < 3; idx++) {
+            bindings[idx].binding = idx;
+            bindings[idx].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[idx].descriptorCount = 1;
+            bindings[idx].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[idx].pImmutableSamplers = NULL;
+        }
+
+        VkDescriptorSetLayoutCreateInfo setLayoutInfo;
         {
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.pNext = NULL;
-            imageInfo.flags = 0;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.format = readableImageFormat;
-            imageInfo.extent = { (uint32_t)inputImageWidth, (uint32_t)inputImageHeight, 1 };
-            imageInfo.mipLevels = 1;
-            imageInfo.arrayLayers = 1;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageInfo.queueFamilyIndexCount = 0;
-            imageInfo.pQueueFamilyIndices = NULL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.pNext = NULL;
+            setLayoutInfo.flags = 0;
+            setLayoutInfo.bindingCount = 3;
+            setLayoutInfo.pBindings = bindings;
         }
 
-        if (vkCreateImage(device, &imageInfo, NULL, &readableImage) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create 2D image!");
+        if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, NULL, &batch->cullSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
         }
-    }
 
-    *outImage = readableImage;
+        const VkPushConstantRange pushRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t) };
 
-    // A.2 Allocate and bind the memory for linear image
-    VkDeviceMemory readableImageMemory;
-    {
-        // A.2.1 Query the memory requirments for the image.
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, readableImage, &memRequirements);
-
-        // A.2.2 Find a memory type based on the requirements.
-        // Here a memory which is mappable is requested.
-        uint32_t memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        VkMemoryAllocateInfo allocInfo;
+        VkPipelineLayoutCreateInfo layoutInfo;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.allocationSize = memRequirements.size;
-            allocInfo.memoryTypeIndex = memoryTypeIndex;
+            layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            layoutInfo.pNext = NULL;
+            layoutInfo.flags = 0;
+            layoutInfo.setLayoutCount = 1;
+            layoutInfo.pSetLayouts = &batch->cullSetLayout;
+            layoutInfo.pushConstantRangeCount = 1;
+            layoutInfo.pPushConstantRanges = &pushRange;
         }
 
-        // A.2.3 Allocate the memory.
-        if (vkAllocateMemory(device, &allocInfo, NULL, &readableImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        if (vkCreatePipelineLayout(device, &layoutInfo, NULL, &batch->cullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
         }
 
-        // A.2.4 "Connect" the image with the allocated memory.
-        vkBindImageMemory(device, readableImage, readableImageMemory, 0);
-    }
+        VkComputePipelineCreateInfo pipelineInfo;
+        {
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.pNext = NULL;
+            pipelineInfo.flags = 0;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.pNext = NULL;
+            pipelineInfo.stage.flags = 0;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = cullShader.Get();
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.stage.pSpecializationInfo = NULL;
+            pipelineInfo.layout = batch->cullPipelineLayout;
+            pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+            pipelineInfo.basePipelineIndex = -1;
+        }
 
-    *outMemory = readableImageMemory;
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &batch->cullPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
+        }
+    }
 
-    // A.3. Create Command Buffer to record image copy operations.
-    VkCommandBuffer cmdBuffer;
+    // TR.12.3. Allocate the Descriptor Set and point it to the buffers.
     {
-        VkCommandBufferAllocateInfo allocInfo;
+        VkDescriptorPoolSize poolSize;
         {
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.pNext = NULL;
-            allocInfo.commandPool = cmdPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSize.descriptorCount = 3;
         }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+        VkDescriptorPoolCreateInfo poolInfo;
+        {
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.pNext = NULL;
+            poolInfo.flags = 0;
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
         }
-    }
 
-    // Start recording image copy commands.
+        if (vkCreateDescriptorPool(device, &poolInfo, NULL, &batch->cullDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
 
-    // A.4. Start Command Buffer.
-    {
-        VkCommandBufferBeginInfo beginInfo;
+        VkDescriptorSetAllocateInfo allocInfo;
         {
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.pNext = NULL;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            beginInfo.pInheritanceInfo = NULL;
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.pNext = NULL;
+            allocInfo.descriptorPool = batch->cullDescriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &batch->cullSetLayout;
         }
 
-        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
+        if (vkAllocateDescriptorSets(device, &allocInfo, &batch->cullDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
         }
-    }
 
-    // A.4. Transition destination image to transfer destination layout.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    }
+        const VkDescriptorBufferInfo bufferInfos[3] = {
+            { batch->instanceBuffer, 0, VK_WHOLE_SIZE },
+            { batch->visibleBuffer, 0, VK_WHOLE_SIZE },
+            { batch->indirectBuffer, 0, VK_WHOLE_SIZE },
+        };
 
-    // A.5. Transition source image to transfer source layout
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
+        VkWriteDescriptorSet descriptorWrite;
         {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = inputImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.pNext = NULL;
+            descriptorWrite.dstSet = batch->cullDescriptorSet;
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorCount = 3;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.pImageInfo = NULL;
+            descriptorWrite.pBufferInfo = bufferInfos;
+            descriptorWrite.pTexelBufferView = NULL;
+        }
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, NULL);
     }
+}
 
-    // A.6. Add image copy command.
-    {
-        // Note: requires us to manually flip components
-        VkImageCopy imageCopyRegion;
-        {
-            imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.srcSubresource.mipLevel = 0;
-            imageCopyRegion.srcSubresource.baseArrayLayer = 0;
-            imageCopyRegion.srcSubresource.layerCount = 1;
-            imageCopyRegion.srcOffset = { 0, 0, 0 };
-            imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageCopyRegion.dstSubresource.mipLevel = 0;
-            imageCopyRegion.dstSubresource.baseArrayLayer = 0;
-            imageCopyRegion.dstSubresource.layerCount = 1;
-            imageCopyRegion.dstOffset = { 0, 0, 0 };
-            imageCopyRegion.extent.width = inputImageWidth;
-            imageCopyRegion.extent.height = inputImageHeight;
-            imageCopyRegion.extent.depth = 1;
-        }
-
-        // Issue the copy command
-        vkCmdCopyImage(cmdBuffer,
-                       inputImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       readableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &imageCopyRegion);
+void DestroyTriangleBatch(const VkDevice device, MemoryArena *arena, TriangleBatch *batch) {
+    vkDestroyPipeline(device, batch->cullPipeline, NULL);
+    vkDestroyPipelineLayout(device, batch->cullPipelineLayout, NULL);
+    vkDestroyDescriptorPool(device, batch->cullDescriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(device, batch->cullSetLayout, NULL);
+
+    if (batch->indirectBuffer != VK_NULL_HANDLE) {
+        ArenaFree(arena, batch->indirectMemory);
+        vkDestroyBuffer(device, batch->indirectBuffer, NULL);
     }
 
-    // A.7. Transition destination image to general layout, which is the required layout for mapping the image memory later on.
-    {
-        VkImageMemoryBarrier imageMemoryBarrier;
-        {
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.pNext = NULL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.srcQueueFamilyIndex = 0;
-            imageMemoryBarrier.dstQueueFamilyIndex = 0;
-            imageMemoryBarrier.image = readableImage;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        }
-
-        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
+    if (batch->visibleBuffer != VK_NULL_HANDLE) {
+        ArenaFree(arena, batch->visibleMemory);
+        vkDestroyBuffer(device, batch->visibleBuffer, NULL);
     }
 
-    // A.8. End the Command Buffer.
-    {
-        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+    if (batch->instanceBuffer != VK_NULL_HANDLE) {
+        ArenaFree(arena, batch->instanceMemory);
+        vkDestroyBuffer(device, batch->instanceBuffer, NULL);
     }
+}
 
-    // A.9. Create a Fence.
-    VkFence fence;
+void RecordDrawCommands(const VkCommandBuffer cmdBuffer,
+                        VkCommandBufferUsageFlags usageFlags,
+                        const VkRenderPass renderPass,
+                        const VkFramebuffer framebuffer,
+                        VkExtent2D extent,
+                        const VkPipeline pipeline,
+                        const VkBuffer vertexBuffer,
+                        const VertexLayoutData& vertexLayout,
+                        const TriangleBatch& batch,
+                        uint32_t triangleCount) {
+    // 16. Start Command Buffer
     {
-        VkFenceCreateInfo fenceInfo;
+        VkCommandBufferBeginInfo beginInfo;
         {
-            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-            fenceInfo.pNext = 0;
-            fenceInfo.flags = 0;
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.pNext = NULL;
+            beginInfo.flags = usageFlags;
+            beginInfo.pInheritanceInfo = NULL;
         }
 
-        if (vkCreateFence(device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create synchronization object!");
+        if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
         }
+    }
 
-        //vkResetFences(device, 1, &fence);
+    // TR.8. Fill the indirect draw parameters on the GPU timeline.
+    // The instance count is reset and the cull dispatch counts (and compacts) the visible instances.
+    // All of it must be outside of the Render Pass and visible to the indirect command read.
+    if ((batch.count > 0) && (batch.mode == TRIANGLE_DRAW_INDIRECT)) {
+        // TR.8.1. A previous submission of the same buffers may still draw from them.
+        vkCmdPipelineBarrier(cmdBuffer,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0, NULL,
+                             0, NULL,
+                             0, NULL);
+
+        VkDrawIndirectCommand drawCommand = { 3, 0, 0, 0 };
+        vkCmdUpdateBuffer(cmdBuffer, batch.indirectBuffer, 0, sizeof(drawCommand), &drawCommand);
+
+        VkBufferMemoryBarrier resetBarrier;
+        {
+            resetBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            resetBarrier.pNext = NULL;
+            resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            resetBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            resetBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            resetBarrier.buffer = batch.indirectBuffer;
+            resetBarrier.offset = 0;
+            resetBarrier.size = sizeof(drawCommand);
+        }
+
+        vkCmdPipelineBarrier(cmdBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0, NULL,
+                             1, &resetBarrier,
+                             0, NULL);
+
+        // TR.8.2. One invocation for each triangle of this step.
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, batch.cullPipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, batch.cullPipelineLayout,
+                                0, 1, &batch.cullDescriptorSet, 0, NULL);
+        vkCmdPushConstants(cmdBuffer, batch.cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(triangleCount), &triangleCount);
+        vkCmdDispatch(cmdBuffer, (triangleCount + g_cullGroupSize - 1) / g_cullGroupSize, 1, 1);
+
+        // TR.8.3. The draw reads the counts and the compacted instances written by the dispatch.
+        VkBufferMemoryBarrier cullBarriers[2];
+        for (uint32_t idx = 0; idx < 2; idx++) {
+            cullBarriers[idx].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            cullBarriers[idx].pNext = NULL;
+            cullBarriers[idx].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            cullBarriers[idx].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            cullBarriers[idx].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            cullBarriers[idx].offset = 0;
+            cullBarriers[idx].size = VK_WHOLE_SIZE;
+        }
+        cullBarriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        cullBarriers[0].buffer = batch.indirectBuffer;
+        cullBarriers[1].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        cullBarriers[1].buffer = batch.visibleBuffer;
+
+        vkCmdPipelineBarrier(cmdBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             0,
+                             0, NULL,
+                             2, cullBarriers,
+                             0, NULL);
     }
 
-    // A.10. Submit the recorded Command Buffer to the Queue.
+    // 17. Insert draw commands into Command Buffer.
     {
-        VkSubmitInfo submitInfo;
+        // 17.1. Add Begin RenderPass command
+        // This makes it possible to use the vmCmdDraw* calls.
+        VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        VkRenderPassBeginInfo renderPassInfo;
         {
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &cmdBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.pNext = NULL;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = framebuffer;
+            renderPassInfo.renderArea.offset = { 0, 0 };
+            renderPassInfo.renderArea.extent = extent;
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
         }
 
-        // A fence is provided to have a CPU side sync point.
-        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit command buffer!");
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // 17.2. Bind the Graphics pipeline inside the Current Render Pass.
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        // V.7. Bind the Vertex buffers as specified by the pipeline.
+        // VL.5. The SoA layout binds the same buffer once for each attribute stream.
+        std::vector<VkBuffer> vertexBuffers(vertexLayout.bindingOffsets.size(), vertexBuffer);
+        vkCmdBindVertexBuffers(cmdBuffer, 0, (uint32_t)vertexBuffers.size(), vertexBuffers.data(),
+                               vertexLayout.bindingOffsets.data());
+
+        // TR.9. The batched triangles also bind the per-instance buffer.
+        // The indirect draw only reads the instances which passed the cull dispatch.
+        if (batch.count > 0) {
+            const VkDeviceSize instanceOffset = 0;
+            const VkBuffer instanceBuffer = (batch.mode == TRIANGLE_DRAW_INDIRECT) ? batch.visibleBuffer : batch.instanceBuffer;
+            vkCmdBindVertexBuffers(cmdBuffer, 1, 1, &instanceBuffer, &instanceOffset);
         }
+
+        // 17.3. Add a Draw command.
+        // Draw 3 vertices using the pipeline bound previously.
+        uint32_t vertexCount = 3;
+        if (batch.count == 0) {
+            // VL. Without instancing the vertex buffer holds every triangle (a single one by default).
+            vkCmdDraw(cmdBuffer, vertexCount * triangleCount, 1, 0, 0);
+        } else if (batch.mode == TRIANGLE_DRAW_INSTANCED) {
+            // TR.10. Each instance is one triangle.
+            vkCmdDraw(cmdBuffer, vertexCount, triangleCount, 0, 0);
+        } else if (batch.mode == TRIANGLE_DRAW_INDIRECT) {
+            // TR.10. The vertex and instance counts are read from the buffer filled by the cull dispatch.
+            vkCmdDrawIndirect(cmdBuffer, batch.indirectBuffer, 0, 1, sizeof(VkDrawIndirectCommand));
+        } else {
+            // TR.10. The first instance selects the per-instance attributes of the triangle.
+            for (uint32_t idx = 0; idx < triangleCount; idx++) {
+                vkCmdDraw(cmdBuffer, vertexCount, 1, 0, idx);
+            }
+        }
+
+        // 17.4. End the Render Pass.
+        vkCmdEndRenderPass(cmdBuffer);
     }
 
-    // A.11. Wait the submitted Command Buffer to finish.
+    // 18. End the Command Buffer recording.
     {
-        // -1 means to wait for ever to finish.
-        if (vkWaitForFences(device, 1, &fence, VK_TRUE, -1) != VK_SUCCESS) {
-            throw std::runtime_error("failed to wait for fence!");
+        if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
         }
     }
-
-    // XX. Destroy Fence.
-    vkDestroyFence(device, fence, NULL);
-
-    // XX. Free Command Buffer.
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }